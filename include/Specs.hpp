@@ -41,6 +41,13 @@
 #define GPU_FRAMERATE           30
 #define GPU_DEFAULT_SCALING     2
 
+// Frames usadas para as estatísticas de tempo de frame
+#define FRAME_HISTORY           128
+// Dorme até faltar esse tempo para a próxima frame, depois faz spin
+#define FRAME_SPIN_MARGIN_MS    2
+// Máximo de updates para compensar frames atrasadas
+#define FRAME_MAX_CATCHUP       3
+
 #define GPU_MEM_SIZE            (GPU_COMMAND_MEM_SIZE+\
                                  GPU_PALETTE_MEM_SIZE+\
                                  GPU_VIDEO_MEM_SIZE)
@@ -71,6 +78,18 @@
 
 #define AUDIO_OPERATOR_AMOUNT   4
 
+// Buffer circular entre a thread de síntese e a placa de áudio,
+// em blocos de AUDIO_SAMPLE_AMOUNT samples
+#define AUDIO_RING_MIN_DEPTH    2
+#define AUDIO_RING_MAX_DEPTH    16
+#define AUDIO_RING_DEFAULT_DEPTH 4
+#define AUDIO_RING_SIZE         (AUDIO_RING_MAX_DEPTH*AUDIO_SAMPLE_AMOUNT)
+// Callbacks sem underrun antes de diminuir a latência (~5s)
+#define AUDIO_RING_SHRINK_AFTER 430
+
+// Threads extras para sintetizar os canais em paralelo (0 = sequencial)
+#define AUDIO_MIX_WORKERS       0
+
 #define AUDIO_MEM_SIZE          (AUDIO_CHANNEL_MEM_SIZE+\
                                  AUDIO_SAMPLE_MEM_SIZE)
 
@@ -114,6 +133,74 @@
 #define CONTROLLER_LENGTH_BITS  20
 #define CONTROLLER_MEM_SIZE     (CONTROLLER_AMOUNT*CONTROLLER_LENGTH_BITS/8)
 
+/*
+ * Assets
+ */
+
+// Bytes de spritesheets decodificadas mantidas em cache sem nenhum
+// processo usando, para acelerar a próxima execução do mesmo app
+#define IMAGE_CACHE_IDLE_SIZE   (2*1024*1024)
+// Locks que serializam o acesso às versões nativas (.nsh) das folhas,
+// escolhidos pelo caminho
+#define IMAGE_SHEET_LOCKS       16
+
+// Threads que carregam assets em segundo plano
+#define ASSET_LOADER_WORKERS    2
+// Resultados de escritas em segundo plano guardados para save_status();
+// só os dos últimos pedidos terminados
+#define FILE_WRITER_RESULTS     256
+
+/*
+ * Profiler
+ */
+
+// Processos com tempos separados nas estatísticas e no overlay
+#define PROFILER_PROCESSES      16
+// Eventos guardados num trace; depois disso o trace para de crescer
+#define PROFILER_TRACE_EVENTS   (1<<18)
+
+// Instruções Lua entre duas olhadas no relógio do sampler
+#define SAMPLER_INSTRUCTIONS    1000
+// Microssegundos entre duas amostras de pilha
+#define SAMPLER_INTERVAL        1000
+// Frames guardadas por amostra, a partir da função atual
+#define SAMPLER_MAX_DEPTH       64
+
+/*
+ * VMs dos apps
+ */
+
+// Limite padrão de memória de um app com vm própria
+#define VM_MEMORY_LIMIT         (64*1024*1024)
+// Microssegundos de coleta incremental por frame, por vm
+#define VM_GC_BUDGET            1000
+// Kilobytes por passo do coletor
+#define VM_GC_STEP              8
+// Crescimento do heap (%) desde o último ciclo que começa outro
+#define VM_GC_GROWTH            150
+// Níveis de tabelas aninhadas copiados entre vms
+#define VM_COPY_DEPTH           32
+
+/*
+ * Escalonador de processos
+ */
+
+// Threads que rodam o update() dos apps com vm própria
+#define SCHEDULER_WORKERS       2
+// Milissegundos entre duas tentativas de um worker travar o console
+#define SCHEDULER_LOCK_WAIT     1
+// Milissegundos que o reboot espera os workers largarem as vms; quem
+// não larga (um laço compilado pelo JIT) tem a vm abandonada
+#define SCHEDULER_CANCEL_WAIT   500
+// Microssegundos de update por frame de um processo antes de ele ceder
+// (env.slice muda)
+#define SCHEDULER_SLICE         4000
+// Instruções Lua entre duas olhadas no prazo da fatia
+#define SCHEDULER_SLICE_INSTRUCTIONS 1000
+// Mensagens esperando na caixa de um processo (potência de 2); com a
+// caixa cheia, as novas se perdem. Cabe a saída de um ls numa frame
+#define MAILBOX_CAPACITY        1024
+
 /*
  * General
  */
@@ -2,12 +2,15 @@
 #define AUDIO_H
 
 #include <array>
+#include <atomic>
+#include <thread>
 
 #include <SDL.h>
 
 #include <Specs.hpp>
 
 #include <kernel/Channel.hpp>
+#include <kernel/WorkerPool.hpp>
 #include <kernel/Memory.hpp>
 #include <kernel/Device.hpp>
 
@@ -23,17 +26,70 @@ class Audio: public Device {
 
     // ID da placa de áudio
     SDL_AudioDeviceID device;
+
+    // Buffer circular de samples já sintetizados, a thread de síntese
+    // escreve e a callback da placa de áudio lê, sem locks
+    int16_t *ring;
+    atomic<uint64_t> ring_read, ring_write;
+
+    // Thread que sintetiza à frente da placa de áudio
+    thread renderer;
+    atomic<bool> rendering;
+
+    // Callbacks seguidas sem underrun (para o modo de latência dinâmica)
+    unsigned int stable_callbacks;
+
+    // Ticks gastos na callback da placa de áudio (total e a mais longa)
+    // e sintetizando, desde o último take_counters()
+    atomic<uint64_t> callback_ticks, callback_max_ticks, synthesis_ticks;
+
+    // Workers para mixar os canais em paralelo, cada um
+    // escreve em seu próprio buffer parcial
+    unique_ptr<WorkerPool> workers;
+    int16_t *partials;
+    unsigned int partial_sample_count;
 public:
-    Audio(Memory&);
+#pragma pack(push, 1)
+    typedef struct StatisticsLayout {
+        // Quantas vezes a placa de áudio ficou sem samples
+        uint32_t underruns;
+        // Samples (estéreo) prontos no buffer circular
+        uint16_t buffered;
+        // Blocos sintetizados à frente (escrita para configurar)
+        uint8_t depth;
+        // Aumenta a latência após underruns e diminui quando estável
+        uint8_t dynamic;
+    } StatisticsLayout;
+#pragma pack(pop)
+
+    StatisticsLayout *statistics;
+
+    Audio(Memory&, const size_t = AUDIO_MIX_WORKERS);
     ~Audio();
 
     void startup();
     void shutdown();
 
-    // Preenche buffer com samples e chama o tick de áudio para
-    // mudar parâmetros, se necessário (usando as funções calc_*)
+    // Mapeia os registradores de estatísticas em memória
+    void map_statistics(Memory&);
+
+    // Copia samples do buffer circular para a placa de áudio
     void fill(int16_t*, int);
+
+    // Microssegundos na callback (total e a mais longa) e sintetizando
+    // desde a última chamada
+    void take_counters(uint32_t&, uint32_t&, uint32_t&);
 private:
+    // Sintetiza à frente enquanto o buffer circular não estiver cheio
+    void render_loop();
+
+    // Preenche buffer com samples e chama o tick de áudio para
+    // mudar parâmetros, se necessário (usando as funções calc_*)
+    void synthesize(int16_t*, int);
+
+    // Quantos blocos devem estar prontos no buffer circular
+    unsigned int lookahead();
+
     // Inicializa placa de áudio
     SDL_AudioDeviceID initialize();
 
@@ -44,6 +100,8 @@ private:
 
     // Prepara samples mixados
     void mix(int16_t*, unsigned int);
+    // Sintetiza um canal no seu buffer parcial (roda nos workers)
+    void mix_channel(const size_t);
 
     // Checa timestamps dos comandos nas filas
     // de cada canal e os executa se >= ao tempo atual
@@ -2,14 +2,21 @@
 #define GPU_H
 
 #include <cstdint>
+#include <atomic>
+#include <bitset>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include <SDL.h>
 
 #include <gif_lib.h>
 
 #include <kernel/Device.hpp>
+#include <kernel/FontAtlas.hpp>
 #include <kernel/Memory.hpp>
 #include <kernel/VideoEncoder.hpp>
+#include <kernel/Options.hpp>
 #include <Specs.hpp>
 
 // OpenGL
@@ -25,6 +32,19 @@
 #define SPRITESHEET_H       1024
 #define SPRITESHEET_LENGTH  SPRITESHEET_W*SPRITESHEET_H*BYTES_PER_PIXEL
 
+// Tamanho do sprite usado pelo spr()
+#define GPU_SPRITE_W        16
+#define GPU_SPRITE_H        16
+
+// Células dos mapas: 16 bits little-endian com o índice do tile na
+// spritesheet (em ordem de linhas), os flips e a paleta
+#define TILE_INDEX_MASK     0x03FF
+#define TILE_FLIP_X         0x0400
+#define TILE_FLIP_Y         0x0800
+#define TILE_PALETTE_SHIFT  12
+#define TILE_PALETTE_MASK   0x07
+#define TILE_CELL_SIZE      2
+
 #define OUT_OF_BOUNDS(x,y)              ((x)<target_clip_start_x || (y)<target_clip_start_y ||\
                                          (x)>=target_clip_end_x || (y)>=target_clip_end_y) 
 
@@ -36,6 +56,18 @@
 #define COLMAP1(c)          palette_memory[512+((c)&0x7F)]
 #define COLMAP2(c)          palette_memory[640+((c)&0x7F)]
 
+// Primitivas com os pixels escritos contados para o profiler
+enum GPUPrimitive {
+    GPU_PRIMITIVE_LINE,
+    GPU_PRIMITIVE_CIRCLE,
+    GPU_PRIMITIVE_FILL,
+    GPU_PRIMITIVE_SPRITE,
+    GPU_PRIMITIVE_TILEMAP,
+    GPU_PRIMITIVE_TEXT,
+    GPU_PRIMITIVE_CLEAR,
+    GPU_PRIMITIVE_AMOUNT
+};
+
 class GPU: public Device {
     // Pointeiros para memória
     uint8_t *video_memory;
@@ -54,6 +86,32 @@ class GPU: public Device {
     // Quantas frames foram renderizadas
     size_t cycle;
 
+    // Glifos da fonte e o texto sendo desenhado, já convertido em glifos
+    FontAtlas font;
+    vector<uint8_t> text_run;
+
+    // Tiles da spritesheet atual que só têm a cor 0, conferidos no
+    // máximo uma vez por frame (o número da frame, mais um, fica em
+    // `tiles_checked`)
+    const uint8_t *tiles_source;
+    int16_t tiles_source_w, tiles_w, tiles_h;
+    vector<size_t> tiles_checked;
+    vector<bool> tiles_empty;
+
+    // Meia largura de cada linha do último canto arredondado, a partir
+    // do centro (igual à circle_fill)
+    vector<int16_t> corner_spans;
+    int16_t corner_radius;
+
+    // Área da memória de vídeo desenhada desde o último take_damage()
+    int16_t damage_x1, damage_y1, damage_x2, damage_y2;
+
+    // Pixels escritos por primitiva e ticks gastos em upload() (que
+    // roda na thread do presenter no modo pipeline) desde o último
+    // take_counters()
+    uint32_t pixels[GPU_PRIMITIVE_AMOUNT];
+    atomic<uint64_t> upload_ticks;
+
     // Encoder para salvar h264
     VideoEncoder *h264;
     // Arquivo para salvar gifs
@@ -73,6 +131,31 @@ class GPU: public Device {
     // Shader para expandir as cores
     GLuint shader;
 
+    // Linhas da memória de vídeo e paleta alteradas desde o último
+    // upload; frames sem alterações não são enviadas nem mostradas
+    bitset<GPU_VIDEO_HEIGHT> dirty_rows;
+    bool palette_dirty;
+    // Mostra a próxima frame mesmo sem alterações (janela redimensionada etc)
+    bool needs_present;
+    // Frame enviada por draw() esperando o show()
+    bool uploaded;
+
+    // Modo pipeline: uma thread é dona do renderer e faz upload/present
+    // enquanto a thread principal já roda a próxima frame
+    bool pipelined;
+    thread presenter;
+    bool presenting;
+    // Cópias das frames terminadas (vídeo + paleta) e o que mudou nelas
+    struct Frame {
+        uint8_t *data;
+        bitset<GPU_VIDEO_HEIGHT> rows;
+        bool palette;
+    } frames[2];
+    // Frame esperando o present e frame sendo lida pelo presenter (-1 = nenhuma)
+    int pending_frame, reading_frame;
+    mutex frame_lock;
+    condition_variable frame_ready;
+
     // Cursores do mouse
     map<uint32_t, SDL_Cursor*> cursors;
     map<uint32_t, SDL_Surface*> cursor_surfaces;
@@ -81,13 +164,33 @@ protected:
 
     SDL_Window* window;
 public:
-    GPU(Memory&, const bool);
+    GPU(Memory&, const Options&);
     ~GPU();
 
     void startup();
 
-    // Desenha no framebuffer
-    void draw();
+    // Envia a frame para o framebuffer. Retorna se há uma frame para o
+    // show() mostrar; uma frame sem mudanças não tem, e no modo pipeline
+    // quem mostra é a thread do renderer
+    bool draw();
+    // Mostra a frame enviada. Com vsync, bloqueia até ele: o kernel chama
+    // fora do lock do console, para os workers rodarem enquanto isso
+    void show();
+
+    // Força o present da próxima frame
+    void invalidate();
+    // Esquece os tiles vazios conferidos (reboot): a contagem de frames
+    // recomeça e uma spritesheet nova pode cair no mesmo endereço
+    void clear_tiles();
+    // Retângulo que envolve tudo desenhado na tela desde a última
+    // chamada (vazio se nada mudou)
+    SDL_Rect take_damage();
+    // Devolve um dano tirado com take_damage()
+    void restore_damage(const SDL_Rect&);
+
+    // Pixels por primitiva e microssegundos de upload desde a última
+    // chamada
+    void take_counters(uint32_t*, uint32_t&);
 
     // Atualiza tamanho da janela
     void resize();
@@ -109,11 +212,44 @@ public:
     void tri_fill(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
     void quad_fill(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
     void circle_fill(int16_t, int16_t, int16_t, uint8_t);
+    // Retângulos com cantos arredondados, numa passada por linha. Com uma
+    // paleta (0 a 7) a cor passa por ela como os pixels de um sprite; com
+    // uma negativa é usada como no rect_fill
+    void rounded_rect_fill(int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t, int16_t);
+    void rounded_rect(int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t, int16_t);
 
     void sprite(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
+    // Como o sprite, mas de qualquer área indexada (origem, w e h)
+    void blit(const uint8_t*, int16_t, int16_t,
+              int16_t, int16_t, int16_t, int16_t, int16_t, int16_t,
+              uint8_t);
+    // Estica um sprite em 9 partes: origem (x, y, w, h), cortes nas
+    // colunas (sl1, sl2) e linhas (sl3, sl4) do sprite e o retângulo
+    // da tela. Os meios são repetidos; com sl3 = sl4 = h vira 3-slice
+    void slice(int16_t, int16_t, int16_t, int16_t,
+               int16_t, int16_t, int16_t, int16_t,
+               int16_t, int16_t, int16_t, int16_t,
+               uint8_t);
+    // Mapa de tiles da spritesheet atual: células, tamanho do mapa,
+    // tamanho do tile, scroll e o retângulo da tela onde desenhar
+    void tilemap(const uint8_t*, int16_t, int16_t,
+                 int16_t, int16_t,
+                 int16_t, int16_t,
+                 int16_t, int16_t, int16_t, int16_t);
+
+    // Texto UTF-8 com a fonte padrão da spritesheet atual
+    void print(const char*, size_t, int16_t, int16_t, uint8_t);
 
     void clip(int16_t, int16_t, int16_t, int16_t);
 
+    // Desenha numa superfície fora da tela em vez da memória de vídeo.
+    // O clip passa a ser a superfície inteira
+    void set_target(uint8_t*, int16_t, int16_t);
+    void reset_target();
+    bool drawing_to(const uint8_t*) const;
+    // Troca uma cor por outra no que for desenhado, como o swap_colors()
+    void map_color(uint8_t, uint8_t);
+
     void set_system_cursor(uint8_t);
     void set_cursor(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
 
@@ -121,8 +257,27 @@ public:
     bool start_capturing(const string&);
     bool stop_capturing();
 private:
-    void copy_scan_line(uint8_t *, uint8_t *, size_t, uint8_t) const;
-    void scan_line(int16_t, int16_t, int16_t, uint8_t) const;
+    // Cria renderer, textura e shader na thread atual
+    void create_renderer(const bool);
+    void destroy_renderer();
+    // Envia as linhas alteradas de vídeo e a paleta para a textura
+    void upload(const uint8_t*, const uint8_t*, const bitset<GPU_VIDEO_HEIGHT>&, const bool);
+    // Marca uma área da memória de vídeo como alterada, dentro do clip
+    void mark_damage(int16_t, int16_t, int16_t, int16_t);
+    void add_damage(int16_t, int16_t, int16_t, int16_t);
+    void present(const SDL_Rect&);
+    // Thread do modo pipeline
+    void present_loop(const bool);
+    void submit_frame();
+
+    void copy_scan_line(uint8_t *, const uint8_t *, size_t, uint8_t) const;
+    // Como a copy_scan_line, mas lendo a origem de trás para frente
+    void copy_scan_line_flipped(uint8_t *, const uint8_t *, size_t, uint8_t) const;
+    bool empty_tile(const size_t, const int16_t);
+    // Prepara corner_spans e retorna o recuo da linha nas laterais
+    void make_corner(int16_t);
+    int16_t corner_inset(int16_t, int16_t) const;
+    void scan_line(int16_t, int16_t, int16_t, uint8_t);
     void fix_rect_bounds(int16_t&, int16_t&, int16_t&, int16_t&, int16_t, int16_t) const;
     void fix_line_bounds(int16_t&, int16_t&, int16_t&, int16_t&) const;
     uint8_t find_point_region(const int16_t, const int16_t) const;
@@ -0,0 +1,83 @@
+#ifndef NIBBLE_ASSET_LOADER_H
+#define NIBBLE_ASSET_LOADER_H
+
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <kernel/Memory.hpp>
+#include <kernel/filesystem.hpp>
+#include <kernel/mmap/Image.hpp>
+
+using namespace std;
+
+/*
+ * Carrega arquivos em threads de fundo.
+ *
+ * As threads só leem e decodificam para buffers próprios. Spritesheets
+ * entram no cache de imagens (mmap::cache_image) e a memória do console,
+ * que não é thread-safe, só é tocada em `collect`, chamado pelo kernel
+ * entre frames.
+ */
+class AssetLoader {
+public:
+    enum State {
+        LOAD_PENDING = 0,
+        LOAD_DONE,
+        LOAD_FAILED
+    };
+private:
+    struct Request {
+        size_t id;
+        string path;
+        bool is_image;
+        State state;
+        // Worker terminou; imagens só ficam prontas depois do `collect`
+        bool decoded;
+
+        mmap::DecodedImage image;
+        string data;
+    };
+
+    vector<thread> workers;
+
+    mutex lock;
+    // Acorda os workers quando há pedidos
+    condition_variable wake;
+    // Acorda quem espera um pedido terminar
+    condition_variable finished;
+
+    list<shared_ptr<Request>> queue;
+    // Decodificados, esperando `collect`
+    list<shared_ptr<Request>> completed;
+    map<size_t, shared_ptr<Request>> requests;
+
+    size_t next_id;
+    bool running;
+public:
+    AssetLoader(const size_t);
+    ~AssetLoader();
+
+    // Começa a carregar um arquivo; imagens (.png/.nsh) são decodificadas
+    size_t load(const string&);
+    State status(const size_t);
+    // Espera um pedido terminar, já colocando o resultado na memória
+    void wait(Memory&, const size_t);
+    // Descarta o pedido, pegando o conteúdo do arquivo carregado (vazio
+    // para imagens). Falso se o pedido não terminou ou não existe.
+    bool take(const size_t, string&);
+
+    // Coloca o que terminou na memória do console. Só na thread do kernel.
+    void collect(Memory&);
+    // Descarta todos os pedidos (reboot)
+    void clear();
+private:
+    void work();
+};
+
+#endif /* NIBBLE_ASSET_LOADER_H */
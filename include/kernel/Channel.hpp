@@ -5,6 +5,7 @@
 #include <kernel/Memory.hpp>
 #include <kernel/Wave.hpp>
 #include <queue>
+#include <mutex>
 #include <map>
 using namespace std;
 
@@ -33,6 +34,8 @@ public:
     } Command;
 
     queue<Command> commands;
+    // Comandos são enfileirados pelo kernel e executados pela thread de síntese
+    mutex commands_lock;
 
 #pragma pack(push, 1)
     typedef struct DelayLayout {
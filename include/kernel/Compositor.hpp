@@ -0,0 +1,75 @@
+#ifndef NIBBLE_COMPOSITOR_H
+#define NIBBLE_COMPOSITOR_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <SDL.h>
+
+using namespace std;
+
+// Retângulos de dano guardados por passada; mais que isso são juntados
+#define COMPOSITOR_MAX_RECTS    8
+
+/*
+ * Decide quais processos precisam rodar o draw() em cada passada.
+ *
+ * Cada processo com draw() tem uma janela. A GPU informa a área que cada
+ * draw() realmente pintou, e essas áreas ficam como dano até o fim da
+ * passada: as janelas desenhadas depois (por cima) que cruzam o dano são
+ * redesenhadas. O resto só roda o draw() se estiver animando (o padrão),
+ * se pediu para ser redesenhado ou se uma área sob ela foi exposta (uma
+ * janela fechou ou mudou de lugar, ou algo pintou fora de um draw()).
+ *
+ * A memória de vídeo não é apagada entre as frames, então quem não
+ * desenha continua na tela como estava.
+ */
+class Compositor {
+    typedef struct Window {
+        SDL_Rect rect;
+        // Roda o draw() em toda passada
+        bool animating;
+        // Pediu para ser redesenhada na próxima passada
+        bool damaged;
+    } Window;
+
+    map<int32_t, Window> windows;
+
+    // Dano da passada atual
+    vector<SDL_Rect> damage;
+    // Áreas expostas que valem para todas as janelas da próxima passada
+    vector<SDL_Rect> exposed;
+
+    // A janela entre begin() e end() perdeu o que tinha na tela e deve
+    // ser pintada inteira, não só o que mudou nela
+    bool repaint = false;
+public:
+    // Começa uma passada pelos processos. Recebe o que foi pintado
+    // desde a última janela
+    void begin_frame(const SDL_Rect&);
+
+    // Janela do processo e o que foi pintado antes dela; retorna se o
+    // draw() deve rodar
+    bool begin(const int32_t, const SDL_Rect&, const SDL_Rect&);
+    // O que o draw() pintou
+    void end(const int32_t, const SDL_Rect&);
+    // Se o draw() em andamento deve pintar a janela inteira (ela foi
+    // exposta, mudou de lugar ou pediu redraw), e não só o que animou
+    bool repainting() const;
+
+    void redraw(const int32_t);
+    void animate(const int32_t, const bool);
+    // O processo parou; a área da janela fica exposta
+    void remove(const int32_t);
+    // Algo que estava por cima de todas as janelas saiu
+    void expose(const SDL_Rect&);
+    void clear();
+private:
+    Window& window(const int32_t);
+    // Adiciona um retângulo, juntando com outro se não houver espaço
+    static void add(vector<SDL_Rect>&, const SDL_Rect&);
+    static bool hits(const vector<SDL_Rect>&, const SDL_Rect&);
+};
+
+#endif /* NIBBLE_COMPOSITOR_H */
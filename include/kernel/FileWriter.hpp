@@ -0,0 +1,82 @@
+#ifndef NIBBLE_FILE_WRITER_H
+#define NIBBLE_FILE_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <kernel/filesystem.hpp>
+
+#include <Specs.hpp>
+
+using namespace std;
+
+/*
+ * Escreve arquivos numa thread de fundo (write-behind).
+ *
+ * Cada pedido escreve num arquivo temporário, que vai para o storage e
+ * só então substitui o original, então um crash nunca deixa um arquivo
+ * pela metade. Pedidos para um arquivo que ainda não começou a ser
+ * escrito são juntados: só o último é escrito.
+ */
+class FileWriter {
+public:
+    // Escreve o conteúdo no caminho dado (o temporário) e o manda para o
+    // storage antes de retornar
+    typedef function<bool(Path&)> Job;
+
+    enum State {
+        WRITE_PENDING = 0,
+        WRITE_DONE,
+        WRITE_FAILED
+    };
+private:
+    struct Request {
+        string path;
+        Job job;
+        // Pedidos juntados nesse
+        vector<size_t> ids;
+    };
+
+    thread writer;
+
+    mutex lock;
+    condition_variable wake;
+    condition_variable idle;
+
+    list<Request> queue;
+    map<size_t, State> states;
+    // Pedidos na ordem em que terminaram: só os FILE_WRITER_RESULTS
+    // últimos ficam em `states` até alguém perguntar
+    deque<size_t> finished;
+
+    size_t next_id;
+    bool writing;
+    bool running;
+public:
+    FileWriter();
+    // Termina de escrever o que está na fila
+    ~FileWriter();
+
+    // Retorna o pedido para status(), ou 0 sem `tracked` (quem não vai
+    // perguntar)
+    size_t write(const string&, Job, const bool tracked = true);
+    size_t write(const string&, string, const bool tracked = true);
+
+    // Estados finais são informados uma vez e esquecidos. Um pedido
+    // esquecido (ou 0) conta como falho
+    State status(const size_t);
+
+    // Espera a fila esvaziar
+    void flush();
+private:
+    void work();
+};
+
+#endif /* NIBBLE_FILE_WRITER_H */
@@ -0,0 +1,80 @@
+#ifndef NIBBLE_FONT_ATLAS_H
+#define NIBBLE_FONT_ATLAS_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Fonte padrão: glifos 8x8 numa grade de 10 colunas no começo da spritesheet
+#define FONT_CHAR_W         8
+#define FONT_CHAR_H         8
+#define FONT_COLUMNS        10
+#define FONT_GLYPH_AMOUNT   111
+#define FONT_ROWS           ((FONT_GLYPH_AMOUNT+FONT_COLUMNS-1)/FONT_COLUMNS)
+#define FONT_NO_GLYPH       0xFF
+
+// Quantas spritesheets diferentes guardam glifos ao mesmo tempo
+#define FONT_ATLAS_SHEETS   8
+
+/*
+ * Glifos da fonte padrão pré-processados a partir da spritesheet.
+ *
+ * Cada spritesheet usada para texto ganha uma cópia da área da fonte,
+ * com uma máscara de 1 bit por pixel (cor diferente de 0) para cada
+ * linha dos glifos. A cópia é conferida com a spritesheet uma vez por
+ * frame, então escrever nela por qualquer caminho atualiza os glifos.
+ *
+ * O texto é UTF-8; bytes que não formam uma sequência válida são lidos
+ * como Latin-1. Cada codepoint ocupa uma célula da fonte.
+ */
+class FontAtlas {
+public:
+    typedef struct Glyph {
+        // Cores da spritesheet, linha por linha
+        uint8_t pixels[FONT_CHAR_W*FONT_CHAR_H];
+        // Bit x ligado quando o pixel x da linha não é a cor 0
+        uint8_t mask[FONT_CHAR_H];
+        // Nenhum pixel com cor diferente de 0
+        bool empty;
+    } Glyph;
+
+    typedef struct Sheet {
+        const uint8_t *source;
+        int16_t w, h;
+        // Frame em que a cópia foi conferida pela última vez
+        size_t checked;
+        // Área da fonte como estava na spritesheet
+        uint8_t region[FONT_COLUMNS*FONT_CHAR_W*FONT_ROWS*FONT_CHAR_H];
+        Glyph glyphs[FONT_GLYPH_AMOUNT];
+        // Cores que aparecem nos glifos
+        vector<uint8_t> colors;
+    } Sheet;
+private:
+    vector<unique_ptr<Sheet>> sheets;
+public:
+    // Glifos da spritesheet, refeitos se ela mudou desde a última frame
+    const Sheet& get(const uint8_t*, const int16_t, const int16_t, const size_t);
+    // Esquece todas as spritesheets
+    void clear();
+
+    // Índice do glifo de um codepoint, ou FONT_NO_GLYPH
+    static uint8_t glyph_of(const uint32_t);
+    // Lê o codepoint em str[pos] e avança pos
+    static uint32_t decode(const char*, const size_t, size_t&);
+
+    // Quantas células o texto ocupa
+    static size_t length(const char*, const size_t);
+    // Quantos bytes do começo do texto cabem em tantas células
+    static size_t fit(const char*, const size_t, const size_t);
+    // Quebra o texto em linhas de até tantas células, preferindo
+    // quebrar depois de espaços; '\n' sempre quebra. Retorna os
+    // bytes em que cada linha começa
+    static void wrap(const char*, const size_t, const size_t, vector<size_t>&);
+private:
+    void build(Sheet&);
+    bool changed(const Sheet&) const;
+};
+
+#endif /* NIBBLE_FONT_ATLAS_H */
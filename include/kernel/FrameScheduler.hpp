@@ -0,0 +1,72 @@
+#ifndef NIBBLE_FRAME_SCHEDULER_H
+#define NIBBLE_FRAME_SCHEDULER_H
+
+#include <cstdint>
+
+#include <kernel/Memory.hpp>
+
+#include <Specs.hpp>
+
+using namespace std;
+
+/*
+ * Controla o ritmo das frames com o contador de alta resolução do SDL.
+ *
+ * O tempo real é acumulado e consumido em passos fixos, assim update(dt)
+ * sempre recebe o mesmo dt. Sem vsync, espera a próxima frame dormindo
+ * e depois fazendo spin nos últimos milissegundos; com vsync, o
+ * SDL_RenderPresent é quem segura o ritmo.
+ */
+class FrameScheduler {
+    // Ticks do contador por segundo e por passo
+    uint64_t frequency;
+    uint64_t step;
+
+    // Início da frame atual e tempo ainda não consumido em passos
+    uint64_t frame_start;
+    uint64_t accumulator;
+
+    bool vsync;
+
+    // Últimos tempos de frame, em microssegundos
+    uint32_t history[FRAME_HISTORY];
+    size_t history_position, history_length;
+    uint64_t history_sum;
+public:
+#pragma pack(push, 1)
+    typedef struct StatisticsLayout {
+        // Tempos de frame em microssegundos
+        uint32_t min;
+        uint32_t avg;
+        uint32_t p99;
+        uint32_t max;
+        // Frames desde o boot
+        uint32_t frames;
+        // Updates descartados por estarmos atrasados
+        uint32_t dropped;
+    } StatisticsLayout;
+#pragma pack(pop)
+
+    StatisticsLayout *statistics;
+
+    FrameScheduler(Memory&, const unsigned int, const bool);
+
+    // Recomeça a contagem (depois de um reset, por exemplo)
+    void reset();
+
+    // Começa uma frame: mede o tempo desde a anterior e
+    // retorna quantos passos fixos devem ser rodados
+    unsigned int begin_frame();
+
+    // Duração de um passo em segundos
+    float delta() const;
+
+    // Espera até a hora da próxima frame. Com vsync, uma frame mostrada
+    // já esperou; as que não mostraram nada dormem até o prazo
+    void wait(const bool presented);
+private:
+    uint64_t now() const;
+    void record(const uint64_t);
+};
+
+#endif /* NIBBLE_FRAME_SCHEDULER_H */
@@ -9,11 +9,22 @@
 #include <mutex>
 #include <atomic>
 #include <list>
+#include <map>
 
 #include <kernel/filesystem.hpp>
+#include <kernel/AssetLoader.hpp>
+#include <kernel/Compositor.hpp>
+#include <kernel/FileWriter.hpp>
+#include <kernel/FrameScheduler.hpp>
+#include <kernel/MessageBus.hpp>
+#include <kernel/Options.hpp>
 #include <kernel/Process.hpp>
+#include <kernel/ProcessScheduler.hpp>
+#include <kernel/Profiler.hpp>
+#include <kernel/Sampler.hpp>
 #include <kernel/Memory.hpp>
 #include <kernel/Types.hpp>
+#include <kernel/WidgetTree.hpp>
 
 #include <devices/GPU.hpp>
 #include <devices/Audio.hpp>
@@ -47,7 +58,55 @@ private:
 
     /* Início da memória livre */
     size_t process_memory_start;
+
+    /* Ritmo das frames */
+    unique_ptr<FrameScheduler> scheduler;
+
+    /* Carregamento de assets em segundo plano */
+    unique_ptr<AssetLoader> loader;
+
+    /* Escrita de arquivos em segundo plano */
+    unique_ptr<FileWriter> writer;
+
+    /* O hook do sampler está instalado? */
+    bool sampling;
+
+    /* Apps com vm Lua própria, por pid */
+    map<int32_t, unique_ptr<Process>> vms;
+    /* Vms de processos que pararam, fechadas entre as frames */
+    vector<pair<int32_t, unique_ptr<Process>>> stopped_vms;
+    /* Caixas de mensagens e tópicos de todos os processos */
+    unique_ptr<MessageBus> bus;
+    /* Estado do kernel que está chamando uma vm (para as chamadas de
+       sistema voltarem para ele) */
+    lua_State *vm_caller;
+
+    /* Apps fora de apps/system rodam em vms próprias */
+    bool isolate_apps;
+
+    /* Updates das vms dos apps em outras threads */
+    unique_ptr<ProcessScheduler> process_scheduler;
+
+    /* Travado pela thread principal durante a frame; os workers só
+       tocam no console (e na vm do kernel) com ele */
+    recursive_timed_mutex console;
+
+    /* Widgets coletados nos workers, destruídos na thread principal */
+    mutex widget_garbage_lock;
+    vector<int32_t> widget_garbage;
 public:
+    /* Widgets do nibui */
+    unique_ptr<WidgetTree> widgets;
+
+    /* Quais processos redesenham a cada passada */
+    unique_ptr<Compositor> compositor;
+
+    /* Tempos e contadores de cada frame */
+    unique_ptr<Profiler> profiler;
+
+    /* Pilhas Lua amostradas por processo */
+    unique_ptr<Sampler> sampler;
+
     /* Dispositivos */
 
     // GPU
@@ -62,7 +121,7 @@ public:
     unique_ptr<MidiController> midi_controller;
 #endif
 public:
-    Kernel(const bool);
+    Kernel(const Options&);
     ~Kernel();
 
     // Controles de power e botões de hardware
@@ -82,9 +141,73 @@ public:
     size_t api_read(char*, const size_t, const size_t);
 
     void api_use_spritesheet(const size_t, const int, const int);
+    void api_tilemap(const size_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t);
     tuple<size_t, int, int> api_load_spritesheet(string);
-    void api_save_spritesheet(const size_t, const int, const int, const string);
+    size_t api_save_spritesheet(const size_t, const int, const int, const string);
     void api_unload_spritesheet(const size_t);
+    size_t api_own_spritesheet(const size_t);
+
+    size_t api_new_surface(const int, const int);
+    void api_free_surface(const size_t);
+    void api_draw_to(const size_t, const int, const int);
+    void api_draw_surface(const size_t, const int, const int,
+                          int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
+
+    tuple<size_t, size_t> api_load_binary(string);
+    void api_unload_binary(const size_t);
+
+    size_t api_load_async(const string);
+    int api_load_status(const size_t);
+    void api_load_wait(const size_t);
+    bool api_load_result(const size_t, string&);
+
+    size_t api_save_file(const string, string, const bool);
+    int api_save_status(const size_t);
+
+    size_t api_profiler_statistics();
+    size_t api_trace_stop(const string);
+    int api_sample(const int32_t, const string, const double, const string);
+
+    bool api_isolate_apps();
+
+    // Trava o console para um worker; falso se o update dele foi
+    // cancelado enquanto esperava
+    bool api_enter();
+    void api_leave();
+
+    // Vms dos apps: funções da API C do Lua, que retornam -1 com a
+    // mensagem de erro no topo da pilha
+    int api_vm_new(lua_State*);
+    int api_vm_call(lua_State*);
+    int api_vm_free(lua_State*);
+    int api_vm_stats(lua_State*);
+    int api_vm_syscall(lua_State*);
+    int api_vm_update(lua_State*);
+    int api_vm_busy(lua_State*);
+    int api_vm_priority(lua_State*);
+    int api_vm_receive(lua_State*);
+
+    // Destrói um widget; num worker, só no fim da frame
+    void api_widget_destroy(const int32_t);
+
+    // Mensagens entre processos, na vm do kernel
+    int api_bus_open(lua_State*);
+    int api_bus_close(lua_State*);
+    int api_bus_send(lua_State*);
+    int api_bus_receive(lua_State*);
+    int api_bus_subscribe(lua_State*);
+    int api_bus_unsubscribe(lua_State*);
+    int api_bus_publish(lua_State*);
+    int api_bus_subscribers(lua_State*);
+
+    // Fatias de tempo do update, na vm do kernel e nas dos apps
+    int api_slice_begin(lua_State*);
+    int api_slice_end(lua_State*);
+private:
+    // Salva as sessões do sampler que terminaram e liga ou desliga o hook
+    void update_sampler();
+    // Coleta de lixo das vms e fecha as que pararam
+    void update_vms();
 };
 
 extern "C" {
@@ -93,46 +216,155 @@ extern "C" {
         size_t len;
     } LuaString;
 
+    API typedef struct FileEntry {
+        const char* name;
+        size_t name_length;
+        uint64_t size;
+        int64_t mtime;
+        uint8_t type;
+    } FileEntry;
+
+    // Entradas e nomes num único bloco, liberado com um free
+    API typedef struct FileListing {
+        size_t count;
+        int more;
+        FileEntry* entries;
+    } FileListing;
+
     // Energia
     API void kernel_api_shutdown();
 
+    // O kernel foi compilado em modo debug?
+    API int kernel_api_debug();
+
+    // Apps rodam em vms próprias (-i)?
+    API int kernel_api_isolate_apps();
+
+    // Relógio monotônico em microssegundos, para medir intervalos
+    API double kernel_api_time();
+
+    // Console travado, para o update de um app num worker; 0 se o
+    // processo parou enquanto esperava
+    API int kernel_api_enter();
+    API void kernel_api_leave();
+
     // Memória
     API size_t kernel_api_read(char*, const size_t, const size_t);
     API size_t kernel_api_write(const size_t, const size_t, const char*);
 
     // Spritesheets
     API void kernel_api_load_spritesheet(const char*, size_t*, int*, int*);
-    API void kernel_api_save_spritesheet(const size_t, const int, const int, const char*);
+    API size_t kernel_api_save_spritesheet(const size_t, const int, const int, const char*);
     API void kernel_api_use_spritesheet(const size_t, const int, const int);
     API void kernel_api_unload_spritesheet(const size_t);
+    API size_t kernel_api_own_spritesheet(const size_t);
+
+    // Superfícies: áreas indexadas fora da tela, que podem ser alvo
+    // do desenho e coladas na tela depois
+    API size_t kernel_api_new_surface(const int, const int);
+    API void kernel_api_free_surface(const size_t);
+
+    // Binários
+    API void kernel_api_load_binary(const char*, size_t*, size_t*);
+    API void kernel_api_unload_binary(const size_t);
+
+    // Carregamento assíncrono
+    API size_t kernel_api_load_async(const char*);
+    API int kernel_api_load_status(const size_t);
+    API void kernel_api_load_wait(const size_t);
+    API LuaString* kernel_api_load_result(const size_t);
+
+    // Escrita em segundo plano
+    API size_t kernel_api_save_file(const char*, const char*, const size_t, const int);
+    API int kernel_api_save_status(const size_t);
 
     // Arquivos
     API LuaString* api_list_files(const char*, size_t*, int*);
+    API FileListing* api_list_entries(const char*, const size_t, const size_t);
     API int api_create_directory(const char*);
     API int api_touch_file(const char*);
     API int api_create_file(const char*);
+    API int api_file_info(const char*, int64_t*, size_t*);
 
     // Desenho
-    API void gpu_api_line(int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_rect(int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_tri(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_quad(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_circle(int16_t, int16_t, int16_t, uint8_t);
-
-    API void gpu_api_rect_fill(int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_tri_fill(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_quad_fill(int16_t, int16_t,
-                           int16_t, int16_t,
-                           int16_t, int16_t,
-                           int16_t, int16_t,
-                           uint8_t);
-    API void gpu_api_circle_fill(int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_sprite(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-    API void gpu_api_clip(int16_t, int16_t, int16_t, int16_t);
-    API void gpu_api_clear(uint8_t);
+    // Coordenadas e cores chegam do Lua como estão: o arredondamento,
+    // a saturação e o módulo de paleta/cor são feitos aqui
+    API void gpu_api_line(double, double, double, double, double);
+    API void gpu_api_rect(double, double, double, double, double);
+    API void gpu_api_tri(double, double, double, double, double, double, double);
+    API void gpu_api_quad(double, double, double, double, double, double, double, double, double);
+    API void gpu_api_circle(double, double, double, double);
+
+    API void gpu_api_rect_fill(double, double, double, double, double);
+    API void gpu_api_tri_fill(double, double, double, double, double, double, double);
+    API void gpu_api_quad_fill(double, double,
+                           double, double,
+                           double, double,
+                           double, double,
+                           double);
+    API void gpu_api_circle_fill(double, double, double, double);
+    API void gpu_api_rounded_rect_fill(double, double, double, double, double, double, double);
+    API void gpu_api_rounded_rect(double, double, double, double, double, double, double);
+    API void gpu_api_sprite(double, double, double, double, double, double, double);
+    API void gpu_api_spr(double, double, double, double, double);
+    API void gpu_api_slice(double, double, double, double,
+                           double, double, double, double,
+                           double, double, double, double,
+                           double);
+    API void gpu_api_print(const char*, const size_t, double, double, double);
+    API void gpu_api_clip(double, double, double, double);
+    // Superfície de largura 0 volta a desenhar na tela
+    API void gpu_api_draw_to(const size_t, const int, const int);
+    API void gpu_api_draw_surface(const size_t, const int, const int,
+                                  double, double, double, double, double, double,
+                                  double);
+    API void gpu_api_clear(double);
+    API void gpu_api_tilemap(const size_t,
+                             double, double,
+                             double, double,
+                             double, double,
+                             double, double, double, double);
+
+    // Texto (UTF-8, larguras em pixels)
+    API size_t gpu_api_measure(const char*, const size_t);
+    API size_t gpu_api_fit(const char*, const size_t, double);
+    API size_t gpu_api_wrap(const char*, const size_t, double, size_t*, const size_t);
     API int gpu_start_capturing(const char*);
     API int gpu_stop_capturing();
 
+    // Compositor (janelas pelo pid do processo)
+    API void compositor_api_frame();
+    API int compositor_api_begin(const int32_t, double, double, double, double);
+    API void compositor_api_end(const int32_t);
+    API void compositor_api_redraw(const int32_t);
+    API void compositor_api_animate(const int32_t, const int);
+    API void compositor_api_remove(const int32_t);
+
+    // Profiler
+    API size_t profiler_api_statistics();
+    API int profiler_api_enabled();
+    API void profiler_api_begin(const int32_t, const int);
+    API void profiler_api_end();
+    API void profiler_api_name(const int32_t, const char*);
+    API void profiler_api_overlay(const int);
+    API void profiler_api_trace_start();
+    // Salva o trace em segundo plano; retorna o pedido para o
+    // kernel_api_save_status ou -1 se não havia trace
+    API size_t profiler_api_trace_stop(const char*);
+    // Amostra as pilhas Lua de um processo por alguns segundos e salva
+    // no formato "folded" do flamegraph. 0 se começou, 1 se ele já está
+    // sendo amostrado e 2 se ele roda num worker, onde o hook não amostra
+    API int profiler_api_sample(const int32_t, const char*, const double, const char*);
+
+    // Widgets do nibui (ids de WidgetTree)
+    API int32_t ui_api_create();
+    API void ui_api_destroy(const int32_t);
+    API void ui_api_set_props(const int32_t, const WidgetProps*);
+    API void ui_api_set_content(const int32_t, const char*, const size_t);
+    API void ui_api_set_children(const int32_t, const int32_t*, const size_t);
+    API int32_t ui_api_render(const int32_t, const int32_t, const int,
+                              double, double, double, double);
+
     // Cursor
     API void gpu_api_set_cursor(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
 
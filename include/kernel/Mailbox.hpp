@@ -0,0 +1,58 @@
+#ifndef NIBBLE_MAILBOX_H
+#define NIBBLE_MAILBOX_H
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <Specs.hpp>
+
+using namespace std;
+
+/*
+ * Caixa de mensagens de um processo.
+ *
+ * Uma fila circular de tamanho fixo sem locks (a fila limitada do
+ * Vyukov): qualquer thread põe e qualquer thread tira, em O(1). Cada
+ * célula tem um número de sequência que diz se ela está livre para a
+ * próxima escrita ou pronta para a próxima leitura.
+ *
+ * As mensagens atravessam como bytes, e não como tabelas Lua, então
+ * quem envia e quem recebe podem estar em vms e threads diferentes sem
+ * dividir estado.
+ */
+class Mailbox {
+    typedef struct Cell {
+        atomic<size_t> sequence;
+        string message;
+    } Cell;
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // Separados para escritores e leitores não brigarem pela mesma linha
+    // de cache
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+public:
+    // Capacidade arredondada para uma potência de 2
+    Mailbox(const size_t capacity = MAILBOX_CAPACITY);
+
+    // Falso se a caixa está cheia
+    bool push(string&&);
+    // Falso se a caixa está vazia
+    bool pop(string&);
+
+    // Serializa o valor no índice da pilha. Só dados atravessam, como em
+    // Process::call_across; falso se o valor não atravessa
+    static bool encode(lua_State*, int, string&);
+    // Põe o valor serializado no topo da pilha
+    static void decode(lua_State*, const string&);
+};
+
+#endif /* NIBBLE_MAILBOX_H */
@@ -8,6 +8,8 @@
 #include <tuple>
 #include <map>
 
+#include <kernel/filesystem.hpp>
+
 using namespace std;
 
 class Memory {
@@ -16,6 +18,10 @@ public:
     enum AccessMode {
         ACCESS_WRITE, ACCESS_READ, ACCESS_AFTER_READ
     };
+
+    // Chamado com o modo e o intervalo [início, fim) acessado,
+    // relativo ao começo da área
+    typedef function<void(AccessMode, size_t, size_t)> Trigger;
 private:
     // Representa um bloco contínuo de memória, alocado por
     // allocate ou vazio
@@ -23,18 +29,24 @@ private:
         size_t pos;
         size_t size;
 
-        Area(size_t, size_t, function<void(AccessMode)> = nullptr);
+        Area(size_t, size_t, Trigger = nullptr);
 
         bool operator < (Area&);
 
-        function <void(AccessMode)> trigger;
+        Trigger trigger;
     };
 
     // Áreas de memória
     map<uint8_t*, Area> free_areas;
     map<uint8_t*, Area> used_areas;
 
+    // Trechos com páginas de arquivos mapeadas (ponteiro -> tamanho)
+    map<uint8_t*, size_t> mapped_files;
+
     bool log_memory_allocation;
+
+    // Chamadas de triggers() desde o último take_trigger_calls()
+    size_t trigger_calls;
 protected:
     friend class Kernel;
     friend class Process;
@@ -51,8 +63,10 @@ public:
 
     // Retorna um ponteiro para uma região não usada
     // de memória por n bytes
-    uint8_t* allocate(const size_t, const string, function<void(AccessMode)> = nullptr);
-    tuple<uint8_t*, size_t> allocate_with_position(const size_t, const string, function<void(AccessMode)> = nullptr);
+    uint8_t* allocate(const size_t, const string, Trigger = nullptr);
+    tuple<uint8_t*, size_t> allocate_with_position(const size_t, const string, Trigger = nullptr);
+    // Como allocate, mas a posição+offset é múltipla do alinhamento
+    tuple<uint8_t*, size_t> allocate_aligned(const size_t, const string, const size_t, const size_t = 0, Trigger = nullptr);
     // Permite que esse ponteiro seja retornado novamente
     void deallocate(uint8_t*);
     void deallocate(const size_t);
@@ -69,9 +83,23 @@ public:
 
     // Verifica e roda os triggers para as áreas dadas
     void triggers(const size_t, const size_t, const AccessMode);
+    // Para o profiler
+    size_t take_trigger_calls();
 
     // Habilita/Desabilita log de alocação
     void set_log(bool);
+
+    // Mapeia as páginas de um arquivo (copy-on-write) a partir de um
+    // ponteiro alinhado a página, começando num offset também alinhado.
+    // Falha onde não existe mmap.
+    bool map_file(uint8_t*, Path&, const size_t, const size_t = 0);
+
+    // Tamanho da página do sistema
+    static size_t page_size();
+private:
+    void log_allocation(const string&, const size_t, const size_t);
+    // Devolve páginas mapeadas dentro de uma área para memória anônima
+    void unmap_files(const Area&);
 };
 
 #endif /* MEMORY_H */
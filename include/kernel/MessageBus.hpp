@@ -0,0 +1,57 @@
+#ifndef NIBBLE_MESSAGE_BUS_H
+#define NIBBLE_MESSAGE_BUS_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <kernel/Mailbox.hpp>
+
+using namespace std;
+
+/*
+ * Mensagens entre processos.
+ *
+ * Cada processo tem uma caixa (Mailbox) de tamanho fixo, do começo ao fim
+ * dele, esteja o app na vm do kernel, numa vm própria ou num worker. As
+ * mensagens vão serializadas, então quem recebe ganha uma cópia e não
+ * divide tabelas com quem enviou.
+ *
+ * Tópicos entregam uma mensagem a todos os processos que assinaram: ela
+ * é serializada uma vez só e copiada para cada caixa.
+ *
+ * Os mapas só mudam com o console travado (na thread principal ou num
+ * worker dentro de Kernel::api_enter); as caixas em si não precisam de
+ * lock.
+ */
+class MessageBus {
+    map<int32_t, unique_ptr<Mailbox>> mailboxes;
+    // Assinantes de cada tópico
+    map<string, set<int32_t>> topics;
+public:
+    // Cria a caixa do processo (ou retorna a que já existe)
+    Mailbox* open(const int32_t);
+    // Joga fora a caixa e tira o processo dos tópicos
+    void close(const int32_t);
+    // Só tira o processo dos tópicos; a caixa fica para quem ainda lê
+    // dela (uma vm parada num worker)
+    void leave(const int32_t);
+    void clear();
+
+    // nullptr se o processo não tem caixa
+    Mailbox* find(const int32_t);
+
+    // Falso se o processo não existe ou a caixa está cheia
+    bool send(const int32_t, string&&);
+
+    void subscribe(const int32_t, const string&);
+    void unsubscribe(const int32_t, const string&);
+    // Para quantos processos a mensagem foi
+    size_t publish(const string&, const string&);
+    vector<int32_t> subscribers(const string&) const;
+};
+
+#endif /* NIBBLE_MESSAGE_BUS_H */
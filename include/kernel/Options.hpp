@@ -0,0 +1,24 @@
+#ifndef NIBBLE_OPTIONS_H
+#define NIBBLE_OPTIONS_H
+
+#include <cstddef>
+
+#include <Specs.hpp>
+
+// Opções de inicialização, vindas da linha de comando
+struct Options {
+    // Começa em tela cheia (-f)
+    bool fullscreen = false;
+    // Usa o vsync para o ritmo das frames (-v)
+    bool vsync = false;
+    // Envia as frames para a GPU em outra thread (-p)
+    bool pipelined = false;
+    // Roda os apps fora de apps/system em vms Lua próprias (-i)
+    bool isolate_apps = false;
+    // Threads extras para mixar o áudio (-w n)
+    size_t audio_workers = AUDIO_MIX_WORKERS;
+    // Threads que rodam os updates dos apps com vm própria (-t n)
+    size_t process_workers = SCHEDULER_WORKERS;
+};
+
+#endif /* NIBBLE_OPTIONS_H */
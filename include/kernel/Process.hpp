@@ -7,6 +7,7 @@ extern "C" {
 #include <lualib.h>
 }
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -20,8 +21,39 @@ using namespace std;
 class Process {
     // RAM e estado da vm Lua
     lua_State *st;
+
+    // Alocador do LuaJIT (a arena dessa vm) e quanto ela usa; acima de
+    // `limit` as alocações falham (0 = sem limite). O uso é lido pela
+    // thread principal enquanto um worker roda a vm
+    lua_Alloc alloc;
+    void *alloc_data;
+    atomic<size_t> used, peak;
+    size_t limit;
+
+    // Microssegundos por frame para a coleta incremental feita pelo
+    // kernel (0 = só o coletor automático)
+    uint32_t gc_budget;
+    atomic<uint32_t> gc_time;
+    // Memória viva no fim do último ciclo completo
+    size_t gc_live;
+    bool gc_running;
+
+    // Hook do sampler, chamado pelo hook da vm (nullptr sem amostragem)
+    lua_Hook sampler;
+    int sampler_instructions;
+
+    // Fatia de tempo do update em andamento: a corrotina cede quando o
+    // prazo (em ticks) passa, no primeiro ponto seguro
+    lua_State *slice_thread;
+    uint64_t slice_deadline;
+    bool preempted;
+
+    // Pedido de parada do update que um worker roda (nullptr fora de
+    // worker). Posto pelo próprio worker: o hook não muda de outra thread
+    const atomic<bool> *stop;
 protected:
     friend class Kernel;
+    friend class ProcessScheduler;
 
     bool initialized;
     bool ok;
@@ -35,7 +67,7 @@ public:
     Path executable;
     const static string lua_entry_point;
 
-    Process(Memory&, Path&);
+    Process(Memory&, Path&, const size_t limit = 0, const uint32_t gc_budget = 0);
     ~Process();
 
     // Roda o processo
@@ -43,8 +75,50 @@ public:
     void update(float);
     void audio_tick();
     void menu();
+
+    // Chama o hook a cada tantas instruções; sem hook, tira o atual
+    void sample(lua_Hook, const int);
+
+    // Começa uma fatia de `us` microssegundos (0 = SCHEDULER_SLICE) para
+    // a corrotina: passado o prazo, ela cede como se chamasse
+    // coroutine.yield(). Só cede fora do código do kernel e sem funções
+    // C na pilha (fora pcall), onde o LuaJIT não consegue voltar.
+    // Retorna a fatia
+    uint32_t begin_slice(lua_State*, const uint32_t);
+    // Fim da fatia; retorna se a corrotina foi interrompida
+    bool end_slice();
+
+    // O hook interrompe o código Lua com "process stopped" quando `flag`
+    // fica true (nullptr para de olhar). Só da thread que roda a vm
+    void watch_stop(const atomic<bool>*);
+
+    // Registra uma função C como global, com o pid e um ponteiro como
+    // upvalues. Chamadas entre vms usam a API C do Lua: uma chamada FFI
+    // não pode voltar para o Lua
+    void expose(const char*, lua_CFunction, const int32_t, void *data = nullptr);
+    // Chama a global `shutdown`, antes da vm de um app ser fechada
+    void shutdown();
+
+    // Passos do coletor até fechar o ciclo ou acabar o orçamento
+    void collect_garbage();
+
+    size_t memory_used() const;
+    size_t memory_peak() const;
+    size_t memory_limit() const;
+    uint32_t garbage_time() const;
+
+    // Chama a global `function` de `to` com `count` valores da pilha de
+    // `from` a partir de `first` e copia os resultados de volta. Só
+    // dados atravessam (tabelas são copiadas; funções e userdata viram
+    // nil). Retorna quantos resultados, ou -1 com o erro em `from`
+    static int call_across(lua_State*, lua_State*, const char*, const int, const int);
 private:
-    int call_with_traceback(lua_State*, int, int);
+    void update_hook();
+    static void hook(lua_State*, lua_Debug*);
+    static bool can_yield(lua_State*);
+
+    static int call_with_traceback(lua_State*, int, int);
+    static void* allocate(void*, void*, size_t, size_t);
 };
 
 #endif /* PROCESS_H */
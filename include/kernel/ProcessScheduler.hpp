@@ -0,0 +1,115 @@
+#ifndef NIBBLE_PROCESS_SCHEDULER_H
+#define NIBBLE_PROCESS_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <kernel/Process.hpp>
+
+using namespace std;
+
+/*
+ * Roda o update() dos apps com vm própria em threads de fundo.
+ *
+ * A vm do kernel e as vms dos apps são independentes, então N threads
+ * podem rodar os M apps enquanto a thread principal cuida do resto. Cada
+ * processo tem no máximo um update na fila ou rodando: se a frame chega
+ * antes de ele terminar, o tempo só acumula para o próximo. A fila sai
+ * por prioridade (maior primeiro) e, dentro da mesma prioridade, por
+ * ordem de chegada.
+ *
+ * O console (memória, GPU, vm do kernel) não é thread-safe: um worker só
+ * toca nele com o lock do kernel, que a thread principal segura durante
+ * a frame. Ver Kernel::api_enter.
+ */
+class ProcessScheduler {
+    typedef struct Job {
+        int32_t pid = 0;
+        Process *process = nullptr;
+        int priority = 0;
+        // Segundos acumulados para o próximo update
+        float dt = 0;
+        bool queued = false;
+        bool running = false;
+        // Worker que roda o update
+        size_t worker = 0;
+        // O processo parou; o update em andamento deve desistir. Lido
+        // sem o lock pelo hook do worker
+        atomic<bool> cancelled { false };
+        // Ordem de chegada na fila
+        uint64_t order = 0;
+        // Ticks rodando nos workers
+        uint64_t ticks = 0;
+        // Erro do último update, até o kernel pegar
+        string error;
+    } Job;
+
+    vector<thread> workers;
+    // Workers que saíram do laço (e podem ser esperados no join)
+    vector<bool> exited;
+    // Workers presos num update abandonado: já foram substituídos e saem
+    // se um dia voltarem
+    vector<bool> retired;
+
+    mutex lock;
+    // Acorda os workers quando há updates na fila
+    condition_variable wake;
+    // Acorda quem espera um update terminar
+    condition_variable finished;
+
+    // O worker segura o job dele: um job tirado do mapa (reboot) continua
+    // valendo até o update terminar
+    map<int32_t, shared_ptr<Job>> jobs;
+
+    uint64_t order;
+    uint64_t frequency;
+    size_t amount;
+    bool running;
+public:
+    ProcessScheduler(const size_t);
+    ~ProcessScheduler();
+
+    // Quantos workers; sem nenhum, todos os updates ficam na thread
+    // principal
+    size_t size() const;
+
+    void add(const int32_t, Process*, const int);
+    // O processo parou: o update em andamento desiste na próxima vez que
+    // tentar travar o console
+    void cancel(const int32_t);
+    // Tira um processo que não está rodando
+    void remove(const int32_t);
+    // Cancela tudo e espera os workers largarem as vms (reboot), por até
+    // SCHEDULER_CANCEL_WAIT ms. Retorna os pids que ainda rodam (presos
+    // num trace compilado, onde o hook não chega): as vms deles não
+    // podem ser fechadas, e cada worker preso ganha um substituto
+    vector<int32_t> clear();
+
+    // Pede um update. 1 se entrou na fila, 0 se o anterior ainda não
+    // terminou (o dt acumula) e -1 com o erro se o anterior falhou
+    int update(const int32_t, const float, string&);
+    bool busy(const int32_t);
+    bool has(const int32_t);
+    void set_priority(const int32_t, const int);
+    // Microssegundos rodando nos workers
+    uint64_t cpu_time(const int32_t);
+
+    // A thread atual é um worker rodando um update?
+    static bool on_worker();
+    // O update que o worker atual roda foi cancelado?
+    static bool cancelled();
+private:
+    void spawn();
+    void work(const size_t);
+    // O próximo update da fila, ou nullptr
+    shared_ptr<Job> next();
+};
+
+#endif /* NIBBLE_PROCESS_SCHEDULER_H */
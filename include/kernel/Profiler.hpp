@@ -0,0 +1,177 @@
+#ifndef NIBBLE_PROFILER_H
+#define NIBBLE_PROFILER_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+
+#include <devices/GPU.hpp>
+#include <devices/Audio.hpp>
+#include <kernel/Memory.hpp>
+
+#include <Specs.hpp>
+
+using namespace std;
+
+// Pixels do overlay para o tempo de uma frame (a barra vai até o dobro)
+#define PROFILER_OVERLAY_BUDGET 64
+#define PROFILER_OVERLAY_ROW    3
+
+// Grupos de funções chamadas pelo Lua via FFI
+enum ProfilerApi {
+    PROFILER_API_KERNEL,
+    PROFILER_API_GPU,
+    PROFILER_API_AUDIO,
+    PROFILER_API_UI,
+    PROFILER_API_COMPOSITOR,
+    PROFILER_API_AMOUNT
+};
+
+// Partes de um processo medidas separadamente
+enum ProfilerSection {
+    PROFILER_INIT,
+    PROFILER_UPDATE,
+    PROFILER_DRAW,
+    PROFILER_AUDIO_TICK,
+    // Coleta de lixo da vm própria do processo
+    PROFILER_GC,
+    PROFILER_SECTION_AMOUNT
+};
+
+/*
+ * Mede para onde vai o tempo de cada frame.
+ *
+ * Os números da última frame completa ficam num registrador na memória
+ * do console. Os contadores baratos (chamadas FFI, pixels, triggers,
+ * upload e áudio) são sempre acumulados; os tempos de cada processo só
+ * são medidos com o profiler ligado, pelo registrador, pelo overlay ou
+ * durante um trace.
+ *
+ * O overlay desenha barras por cima da tela, com a frame inteira como
+ * escala. O trace guarda os eventos em memória e gera um JSON no formato
+ * do Chrome (chrome://tracing ou Perfetto) quando termina.
+ */
+class Profiler {
+public:
+#pragma pack(push, 1)
+    typedef struct CountersLayout {
+        // Chamadas FFI por grupo
+        uint32_t calls[PROFILER_API_AMOUNT];
+        // Pixels escritos por tipo de primitiva
+        uint32_t pixels[GPU_PRIMITIVE_AMOUNT];
+        // Chamadas de Memory::triggers (read/write do Lua)
+        uint32_t triggers;
+        // Microssegundos enviando a frame para a textura
+        uint32_t upload;
+        // Microssegundos na callback da placa de áudio (total e a mais
+        // longa) e sintetizando na thread de áudio
+        uint32_t audio_callback;
+        uint32_t audio_callback_max;
+        uint32_t audio_synthesis;
+        uint32_t audio_underruns;
+    } CountersLayout;
+
+    typedef struct ProcessLayout {
+        int32_t pid;
+        // Microssegundos por seção
+        uint32_t time[PROFILER_SECTION_AMOUNT];
+    } ProcessLayout;
+
+    typedef struct StatisticsLayout {
+        // Escritos para ligar as medidas por processo e o overlay
+        uint8_t enabled;
+        uint8_t overlay;
+        // Um trace está sendo gravado
+        uint8_t tracing;
+        // Entradas usadas em `processes`
+        uint8_t process_count;
+        // Microssegundos do começo da frame até antes da espera
+        uint32_t frame;
+        CountersLayout counters;
+        ProcessLayout processes[PROFILER_PROCESSES];
+    } StatisticsLayout;
+#pragma pack(pop)
+
+    StatisticsLayout *statistics;
+private:
+    typedef struct TraceEvent {
+        // PROFILER_SECTION_AMOUNT é a frame inteira
+        uint8_t section;
+        int32_t pid;
+        uint64_t start, duration;
+    } TraceEvent;
+
+    typedef struct TraceSample {
+        uint64_t time;
+        CountersLayout counters;
+    } TraceSample;
+
+    uint64_t frequency;
+    uint64_t frame_start;
+
+    // Frame atual; vai para o registrador no end_frame()
+    CountersLayout counters;
+    ProcessLayout processes[PROFILER_PROCESSES];
+    size_t process_count;
+
+    // Seção aberta por begin()
+    bool in_section;
+    int32_t section_pid;
+    ProfilerSection section;
+    uint64_t section_start;
+
+    uint32_t last_underruns;
+
+    // Onde o overlay foi desenhado na última frame
+    bool overlay_shown;
+    SDL_Rect overlay_rect;
+
+    bool tracing;
+    uint64_t trace_start;
+    vector<TraceEvent> events;
+    vector<TraceSample> samples;
+    // Nomes dos processos para o trace
+    map<int32_t, string> names;
+public:
+    Profiler(Memory&);
+
+    // Para o trace e zera tudo (reboot)
+    void reset();
+
+    void begin_frame();
+    // Junta os contadores dos dispositivos e publica a frame
+    void end_frame(Memory&, GPU&, Audio&);
+
+    inline void count(const ProfilerApi api) {
+        counters.calls[api]++;
+    }
+
+    // Os tempos por processo estão sendo medidos?
+    bool enabled() const;
+
+    // Mede uma seção de um processo (sem aninhar)
+    void begin(const int32_t, const ProfilerSection);
+    void end();
+    // Processo da seção aberta, se houver uma
+    bool current(int32_t&) const;
+    void name(const int32_t, const string&);
+
+    void toggle_overlay();
+    // Desenha o overlay com a última frame completa. Retorna a área que
+    // ele deixou de cobrir, que precisa ser redesenhada
+    SDL_Rect draw_overlay(GPU&);
+
+    void start_trace();
+    // Gera o JSON do trace; falso se nenhum estava sendo gravado
+    bool stop_trace(string&);
+private:
+    uint64_t now() const;
+    uint32_t to_us(const uint64_t) const;
+    ProcessLayout* process(const int32_t);
+    void bar(GPU&, int16_t&, const int16_t, const uint32_t, const uint8_t) const;
+};
+
+#endif /* NIBBLE_PROFILER_H */
@@ -0,0 +1,66 @@
+#ifndef NIBBLE_SAMPLER_H
+#define NIBBLE_SAMPLER_H
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+
+#include <Specs.hpp>
+
+using namespace std;
+
+/*
+ * Amostra as pilhas Lua de processos escolhidos por alguns segundos.
+ *
+ * O LuaJIT 2.0 não tem o jit.profile, então o kernel instala um hook de
+ * contagem que chama sample() a cada SAMPLER_INSTRUCTIONS instruções.
+ * Uma pilha só é guardada quando já se passou SAMPLER_INTERVAL desde a
+ * última, então cada amostra vale o mesmo tempo mesmo com funções que
+ * gastam muito por instrução (chamadas para o C, por exemplo).
+ *
+ * As amostras de cada sessão viram pilhas no formato "folded" do
+ * flamegraph.pl/speedscope: uma linha por pilha, com as funções
+ * separadas por ';' da raiz até a folha e a quantidade no fim.
+ */
+class Sampler {
+    typedef struct Session {
+        int32_t pid;
+        // Raiz das pilhas (o app)
+        string name;
+        // Onde salvar as pilhas
+        string path;
+        uint64_t end;
+        uint64_t last_sample;
+        map<string, size_t> stacks;
+    } Session;
+
+    uint64_t frequency;
+    vector<Session> sessions;
+public:
+    Sampler();
+
+    // Amostra o processo por alguns segundos; falso se ele já está
+    // sendo amostrado
+    bool start(const int32_t, const string&, const double, const string&);
+    void clear();
+
+    // Alguma sessão precisa do hook?
+    bool active() const;
+
+    // Chamado pelo hook com o processo que está rodando
+    void sample(lua_State*, const int32_t);
+
+    // Tira as sessões que terminaram, como (caminho, pilhas)
+    vector<pair<string, string>> collect();
+private:
+    static string frame(lua_Debug&);
+};
+
+#endif /* NIBBLE_SAMPLER_H */
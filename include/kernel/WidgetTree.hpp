@@ -0,0 +1,111 @@
+#ifndef NIBBLE_WIDGET_TREE_H
+#define NIBBLE_WIDGET_TREE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <devices/GPU.hpp>
+
+using namespace std;
+
+#define WIDGET_NONE             -1
+// Pares de cores trocadas durante o texto
+#define WIDGET_CMAP_AMOUNT      8
+// Parâmetros de sprite, 3-slice ou 9-slice do fundo
+#define WIDGET_SLICE_AMOUNT     8
+
+extern "C" {
+    // Propriedades de um widget já calculadas pelo Lua
+    typedef struct WidgetProps {
+        double x, y, w, h;
+        double radius, z, border_size;
+        double shadow_color, border_color, background;
+        double palette, text_palette;
+        double padding_top, padding_left, padding_bottom, padding_right;
+        double clip_to;
+        // Fundo com sprite: 2 (spr), 4 (pspr), 6 (3-slice) ou 8 (9-slice)
+        // valores; 0 para fundo de uma cor só
+        double slices[WIDGET_SLICE_AMOUNT];
+        uint8_t slice_count;
+        // 0 esquerda/topo, 1 centro/meio, 2 direita/baixo, 3 nenhum
+        uint8_t text_align, vertical_align;
+        // O Lua desenha esse widget (tem um `draw` próprio)
+        uint8_t custom;
+        uint8_t cmap_count;
+        uint8_t cmap[WIDGET_CMAP_AMOUNT*2];
+    } WidgetProps;
+}
+
+/*
+ * Árvore de widgets do nibui, desenhada em modo retido.
+ *
+ * Os nós ficam num vetor único e se ligam por índices. O Lua só envia
+ * propriedades quando elas mudam, o que marca o nó para ser redesenhado
+ * e os ancestrais como danificados; render() pula as subárvores que não
+ * mudaram. Widgets com `draw` próprio são devolvidos para o Lua, que os
+ * desenha e continua o render depois deles.
+ */
+class WidgetTree {
+public:
+    typedef struct Box {
+        double x, y, w, h;
+    } Box;
+private:
+    typedef struct Node {
+        WidgetProps props;
+
+        int32_t parent;
+        int32_t first_child, next_sibling;
+
+        // Precisa ser redesenhado
+        bool dirty;
+        // Algum descendente precisa ser redesenhado
+        bool damaged;
+        // Algum descendente é desenhado pelo Lua
+        bool has_custom;
+        bool alive;
+    } Node;
+
+    vector<Node> nodes;
+    // Textos ficam fora dos nós para manter o vetor compacto
+    vector<string> contents;
+    vector<int32_t> free_nodes;
+
+    // Ligações ou widgets com `draw` próprio mudaram
+    bool structure_changed;
+public:
+    WidgetTree();
+
+    int32_t create();
+    void destroy(const int32_t);
+    // Esquece todos os nós (reboot)
+    void clear();
+
+    void set_props(const int32_t, const WidgetProps&);
+    void set_content(const int32_t, const string&);
+    void set_children(const int32_t, const int32_t*, const size_t);
+
+    // Desenha `root` e seus descendentes até encontrar um widget com
+    // `draw` próprio, que é retornado (ou WIDGET_NONE no fim). Para
+    // continuar, chame de novo passando esse widget em `resume`.
+    // A raiz segue o `dirty` do Lua, como no Widget.draw(); a janela do
+    // processo limita o clip, como o clip() do Lua
+    int32_t render(GPU&, const int32_t, const int32_t, const bool, const Box&);
+    // Marca a subárvore inteira para o próximo render (a janela foi
+    // exposta e o que não mudou também sumiu da tela)
+    void invalidate(const int32_t);
+private:
+    bool valid(const int32_t) const;
+    void unlink(const int32_t);
+    void mark_dirty(const int32_t);
+    void update_custom();
+    // Próximo nó em pré-ordem depois da subárvore, sem sair de `root`
+    int32_t after(int32_t, const int32_t) const;
+
+    Box clip_box(const int32_t) const;
+    void clip(GPU&, const Box&, double, double, double, double) const;
+    void draw(GPU&, const int32_t, const Box&);
+};
+
+#endif /* NIBBLE_WIDGET_TREE_H */
@@ -0,0 +1,52 @@
+#ifndef NIBBLE_WORKER_POOL_H
+#define NIBBLE_WORKER_POOL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Conjunto fixo de threads para paralelismo fork-join.
+ *
+ * Cada `run` distribui `jobs` tarefas entre os workers e a thread que
+ * chamou, e só retorna quando todas terminam. Não aloca memória depois
+ * de construído e espera com spin, para ser usado em tempo real (áudio).
+ */
+class WorkerPool {
+public:
+    typedef void (*Job)(void*, size_t);
+private:
+    vector<thread> workers;
+
+    // Incrementado a cada `run` para acordar os workers
+    atomic<uint64_t> generation;
+    // Próxima tarefa a ser pega
+    atomic<size_t> next_job;
+    // Workers que já terminaram a geração atual
+    atomic<size_t> finished;
+
+    size_t job_count;
+    Job job;
+    void *context;
+
+    atomic<bool> running;
+public:
+    WorkerPool(const size_t);
+    ~WorkerPool();
+
+    // Quantas threads além da que chama `run`
+    size_t size() const;
+
+    // Roda job(context, i) para i em [0, jobs) e espera terminar
+    void run(const size_t, Job, void*);
+private:
+    void work();
+    // Pega e executa tarefas até acabarem
+    void drain();
+    // Espera ocupada, cedendo a CPU aos poucos
+    static void backoff(unsigned int&);
+};
+
+#endif /* NIBBLE_WORKER_POOL_H */
@@ -13,6 +13,8 @@
 #endif
 
 #include <iostream>
+#include <cstdint>
+#include <string>
 #include <fcntl.h>			// Low level file creation
 #include <sys/types.h>		// For Linux/Windows
 #include <sys/stat.h>		// For Linux/Windows
@@ -59,6 +61,18 @@ private:
 	//set_ios_path();
 };
 
+// Entry of a directory listing. Names live in a single buffer shared by
+// every entry of the listing, at [name_offset, name_offset+name_length).
+struct DirectoryEntry {
+	enum Type : uint8_t { ENTRY_FILE = 0, ENTRY_DIRECTORY, ENTRY_OTHER };
+
+	size_t name_offset;
+	size_t name_length;
+	Type type;
+	uint64_t size;
+	int64_t mtime;
+};
+
 class fs {
 	static const int buffer_size = 4096; // 4 K of memory
 public:
@@ -74,8 +88,26 @@ public:
 	static bool create_directory (Path&);
 	static bool is_dir (Path);
 	static size_t get_file_size (Path);
+	static time_t get_modification_time (Path);
 	static char* get_file_data (Path);
+	static bool read_file_data (Path, char*, size_t, size_t = 0);
+	// Atomic: writes a temporary file and swaps it in place. Safe on files
+	// that are mapped into console memory (Memory::map_file)
 	static bool set_file_data(Path, const char*, size_t);
+	// Writes the whole buffer (retrying partial writes) and flushes it
+	// to the storage. Truncates the file first, so never use it on a file
+	// that may be mapped: the pages past the new end would SIGBUS
+	static bool write_file_data (Path, const char*, size_t);
+	static bool sync_file (Path);
+	// Atomically replaces the second file with the first one
+	static bool replace_file (Path, Path);
+	// A temporary name next to the file, unique to this call, for writing
+	// before replace_file (several threads may save the same file)
+	static Path temp_path (Path);
 	static vector <Path> list_directory (Path, bool&);
+	// Lists up to `limit` entries after skipping `offset` ones ("." and ".."
+	// are never listed), with type, size and mtime. `more` tells if there
+	// are entries after the last one.
+	static bool list_entries (Path, size_t, size_t, vector <DirectoryEntry>&, string&, bool&);
 };
 #endif /* BAZINGA_FILESYSTEM_H */
@@ -1,12 +1,68 @@
 #ifndef MMAP_IMAGE_H
 #define MMAP_IMAGE_H
 
+#include <cstdint>
+#include <ctime>
+#include <functional>
 #include <tuple>
+#include <vector>
+
+// Formato nativo de spritesheets: cabeçalho, paleta opcional e, a partir
+// de SHEET_DATA_OFFSET, os índices em 8 bits ou 4 bits (dois por byte,
+// primeiro pixel nos bits baixos). A versão gerada de um PNG é sempre em
+// 8 bits; 4 bits só nas .nsh salvas diretamente
+#define SHEET_EXTENSION     "nsh"
+#define SHEET_VERSION       1
+#define SHEET_PALETTE_SIZE  (256*4)
+// Alinhado a página, para os índices em 8 bits poderem ser mapeados
+#define SHEET_DATA_OFFSET   4096
 
 namespace mmap {
+#pragma pack(push, 1)
+    struct SheetHeader {
+        char magic[4];
+        uint8_t version;
+        uint8_t bits;
+        uint8_t has_palette;
+        uint8_t reserved;
+        uint16_t width;
+        uint16_t height;
+        // Tamanho e data do PNG de onde a sheet foi gerada (0 se nenhum)
+        uint64_t source_size;
+        int64_t source_mtime;
+    };
+#pragma pack(pop)
+
+    // Imagem decodificada fora da memória do console
+    struct DecodedImage {
+        vector<uint8_t> pixels;
+        // SHEET_PALETTE_SIZE bytes, ou vazia se a imagem não tem paleta
+        vector<uint8_t> palette;
+        int16_t w, h;
+        // Tamanho e data do arquivo antes de decodificar
+        size_t size;
+        time_t mtime;
+    };
+
+    // Imagens são compartilhadas entre quem carregar o mesmo arquivo
     tuple<size_t, int16_t, int16_t> read_image(Memory&, Path&);
+    // PNG, ou formato nativo se a extensão for SHEET_EXTENSION
     void write_image(Memory&, size_t, int16_t, int16_t, Path&);
+    // Copia a imagem e retorna quem a escreve depois, em qualquer caminho
+    // e em outra thread (para o FileWriter)
+    function<bool(Path&)> image_writer(Memory&, size_t, int16_t, int16_t, Path&);
+    // Devolve uma imagem carregada por read_image
+    void release_image(Memory&, size_t);
+    // Garante uma cópia exclusiva antes de escrever, retornando a nova posição
+    size_t own_image(Memory&, size_t);
+
+    // Decodifica sem tocar na memória do console: pode rodar em outra thread
+    bool decode_image_file(Path&, DecodedImage&);
+    // Coloca no cache, sem referências, uma imagem de decode_image_file
+    void cache_image(Memory&, Path&, DecodedImage&);
 
+    // Esquece todas as imagens; a memória delas é liberada pelo kernel
+    void reset_images();
     void cleanup_palettes();
 }
 
@@ -369,7 +369,7 @@ end
 local edit_app = Edit:new({})
 
 -- UI
-local ui = edit_app:nom():use('cursor')
+local ui = edit_app:nom():use('cursor'):use('damage')
 
 function init()
   show_next_notification()
@@ -2,6 +2,34 @@ local Cursor = {}
 
 local Line = require 'Line'
 
+-- `position` é o byte do conteúdo onde o cursor está; `user_position` é a
+-- coluna (em codepoints) que o usuário escolheu, mantida ao trocar de linha
+
+-- Anda `char_count` codepoints a partir do byte `position`
+local function step(content, position, char_count)
+  while char_count > 0 and position <= #content do
+    position += 1
+
+    while position <= #content and content:byte(position) >= 0x80 and content:byte(position) < 0xC0 do
+      position += 1
+    end
+
+    char_count -= 1
+  end
+
+  while char_count < 0 and position > 1 do
+    position -= 1
+
+    while position > 1 and content:byte(position) >= 0x80 and content:byte(position) < 0xC0 do
+      position -= 1
+    end
+
+    char_count += 1
+  end
+
+  return position
+end
+
 function Cursor:new(line, position)
   return new(Cursor, {
                line = line,
@@ -10,13 +38,21 @@ function Cursor:new(line, position)
   })
 end
 
-function Cursor:move_by_chars(char_count)
-  local position = self.user_position
+function Cursor:column()
+  return measure(self.line.content:sub(1, self.position-1))/8+1
+end
 
-  self.position = math.min(math.max(position+char_count, 1), self.line:length()+1)
+function Cursor:move_to_column(column)
+  self.position = fit_text(self.line.content, (column-1)*8)+1
+  self.user_position = self:column()
+end
 
-  if char_count ~= 0 and position ~= self.position then
-    self.user_position = self.position
+function Cursor:move_by_chars(char_count)
+  if char_count == 0 then
+    self.position = fit_text(self.line.content, (self.user_position-1)*8)+1
+  else
+    self.position = step(self.line.content, math.min(self.position, self.line:length()+1), char_count)
+    self.user_position = self:column()
   end
 end
 
@@ -44,10 +80,9 @@ end
 
 function Cursor:look_at(char_count)
   if self.line then
-    local x1, x2 = self.position+char_count, self.position
-    local s, e = math.max(0, math.min(x1, x2)), math.min(math.max(x1, x2), self.line:length())
+    local other = step(self.line.content, self.position, char_count)
 
-    return self.line.content:sub(s, e)
+    return self.line.content:sub(math.min(self.position, other), math.max(self.position, other)-1)
   else
     return ""
   end
@@ -60,7 +95,8 @@ function Cursor:insert_chars(str)
     self.line.content = content:sub(1, self.position-1)..str..content:sub(self.position, -1)
     self.line:highlight()
 
-    self:move_by_chars(#str)
+    self.position += #str
+    self.user_position = self:column()
   end
 end
 
@@ -69,8 +105,11 @@ function Cursor:remove_chars(char_count)
 
   if char_count < 0 then
     if self.position > 1  then
-      self.line.content = content:sub(1, self.position+char_count-1)..content:sub(self.position, -1)
-      self:move_by_chars(char_count)
+      local start = step(content, self.position, char_count)
+
+      self.line.content = content:sub(1, start-1)..content:sub(self.position, -1)
+      self.position = start
+      self.user_position = self:column()
     else
       self:merge_lines(-1)
     end
@@ -78,7 +117,7 @@ function Cursor:remove_chars(char_count)
 
   if char_count > 0 then
     if self.position > 0 then
-      self.line.content = content:sub(1, self.position-1)..content:sub(self.position+char_count, -1)
+      self.line.content = content:sub(1, self.position-1)..content:sub(step(content, self.position, char_count), -1)
     else
       self.merge_lines(1)
     end
@@ -90,7 +129,6 @@ end
 function Cursor:merge_lines(line_count)
   if line_count < 0 and self.line.prev then
     self.position = self.line.prev:length()+1
-    self.user_position = self.position
 
     if self.line.next then
         self.line.next.prev = self.line.prev
@@ -100,6 +138,7 @@ function Cursor:merge_lines(line_count)
     self.line.prev.content = self.line.prev.content..self.line.content
 
     self.line = self.line.prev
+    self.user_position = self:column()
   else
     if self.line.next then
       self.line.content = self.line.content .. self.line.next.content
@@ -147,11 +186,11 @@ function Cursor:to_left(x)
 end
 
 function Cursor:screen_position()
-  return self.line.offset_x + self.position * 8
+  return self.line.offset_x + self:column() * 8
 end
 
 function Cursor:draw(x, y)
-  fill_rect(self.line.offset_x+x+(self.position-1)*8, self.line.offset_y+y, 1, 8, 15)
+  fill_rect(self.line.offset_x+x+(self:column()-1)*8, self.line.offset_y+y, 1, 8, 15)
 end
 
 return Cursor
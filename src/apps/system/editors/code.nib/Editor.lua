@@ -89,9 +89,7 @@ function Editor:move_to_mouse(x, y)
     if y >= line_y and y < line_y+line:height() then
       self.cursor.line = line
 
-      -- TODO: only works with monospace 8px font
-      self.cursor.position = math.min(math.floor(x/8+0.5)+1, self.cursor.line:length()+1)
-      self.cursor.user_position = self.cursor.position
+      self.cursor:move_to_column(math.floor(x/8+0.5)+1)
     end
 
     line_y += line:height()
@@ -194,7 +194,7 @@ function Line:draw(x, y)
     swap_colors(15, keywords[span.name] or 15)
     swap_colors(7, math.max((keywords[span.name] or 15) - 8, 1))
 
-    print(str, self.offset_x+x+(span.i_start-1)*8, self.offset_y+y)
+    print(str, self.offset_x+x+measure(self.content:sub(1, span.i_start-1)), self.offset_y+y)
   end
 
   swap_colors(15, 15)
@@ -9,16 +9,7 @@ local AUTOPRESS_TIME = 0.01
 local AUTOPRESS_WAIT = 0.25
 
 local function write_file(file, text)
-    local f = io.open(file, "w")
-
-    if f then
-        f:write(text)
-        f:close()
-
-        return true
-    end
-
-    return nil
+    return save_file(file, text)
 end
 
 local function autopress(button, action)
@@ -95,9 +86,8 @@ return {
         -- TODO: use NOM's event system
         local input = read_keys()
 
-        for i=1,#input do
-            local char = input:sub(i, i)
-
+        -- Um codepoint por vez, para o cursor nunca ficar no meio de um caractere
+        for char in input:gmatch("[%z\1-\127\194-\244][\128-\191]*") do
             if char == "\08" then
                 if self.editor:look_at(-2) == "  " then
                     self.editor:remove_chars(-2)
@@ -8,7 +8,7 @@ local input = ''
 local prompt_color = 11
 
 function init()
-    send_message(env.tty, { subscribe = env.pid, name = 'lua.nib' })
+    subscribe(tty_input())
 
     write_line(_VERSION, 6)
     write(prompt, prompt_color)
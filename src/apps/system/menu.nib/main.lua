@@ -76,7 +76,7 @@ function init()
     mask_color(0)
 
     menu = Menu:new({ time = get_time() })
-    nom = menu:nom():use('cursor')
+    nom = menu:nom():use('cursor'):use('damage')
 
     -- Pausa todas as apps que eestão rodando
     for _, pid in ipairs(env.running) do
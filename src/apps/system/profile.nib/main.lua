@@ -0,0 +1,65 @@
+require 'tty'
+
+-- Amostra as funções Lua de um app:
+--   profile <app> <segundos> [arquivo]
+-- Começa o app se ele não estiver rodando. As pilhas são salvas no
+-- formato "folded" (flamegraph.pl, speedscope, inferno)
+
+local paths = {
+  "apps/system/editors/",
+  "apps/system/",
+  "apps/",
+}
+
+-- O caminho do app: o de uma cópia rodando ou o primeiro que existe
+local function resolve(name)
+  local running = {}
+
+  for _, process in ipairs(list_processes()) do
+    running[process.app] = true
+  end
+
+  for _, path in ipairs(paths) do
+    if running[path..name] then
+      return path..name
+    end
+  end
+
+  for _, path in ipairs(paths) do
+    if list_entries(path..name) then
+      return path..name
+    end
+  end
+
+  return nil
+end
+
+function init()
+  local app = env.params[2]
+  local seconds = tonumber(env.params[3] or '')
+
+  if not app or not seconds then
+    write_line('usage: profile <app> <seconds> [file]')
+    stop_app(0)
+    return
+  end
+
+  local name = app:gsub('%.nib$', '')..'.nib'
+  local file = env.params[4] or name:gsub('%.nib$', '')..'.folded'
+
+  local app_path = resolve(name)
+
+  if not app_path then
+    write_line(name..' not found', 6)
+  else
+    local pid, reason = profile(app_path, seconds, file)
+
+    if pid then
+      write_line('profiling '..app_path..' for '..seconds..'s into '..file)
+    else
+      write_line(app_path..' '..reason, 6)
+    end
+  end
+
+  stop_app(0)
+end
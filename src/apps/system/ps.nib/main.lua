@@ -0,0 +1,23 @@
+require 'tty'
+
+-- Lista os processos com o tempo de CPU de cada um:
+--   ps
+-- Apps com o update num worker aparecem com um '*' na prioridade
+
+function init()
+  write_line('  pid      cpu   pri  app', 8)
+
+  for _, process in ipairs(list_processes()) do
+    local stats = process_stats(process.pid)
+
+    if stats then
+      local cpu = string.format('%7.2fs', stats.cpu/1000000)
+      local priority = tostring(stats.priority)..(stats.threaded and '*' or '')
+
+      write(string.format('%5d %s %5s  ', process.pid, cpu, priority))
+      write_line((process.app:gsub('^apps/', '')), process.running and 7 or 5)
+    end
+  end
+
+  stop_app(0)
+end
@@ -1,9 +1,10 @@
 -- Nibble Shell
 -- by @felipeoltavares
 
+require 'tty'
+
 local tty
 
-local name = 'shell.nib'
 local prompt = "~"
 local prompt_color = 9
 
@@ -28,10 +29,15 @@ end
 function init()
     tty = env.tty
 
-    -- Avisa que quer receber mensagens com entrada do usuário
-    send_message(tty, { subscribe = env.pid, name = name })
+    -- Recebe as linhas digitadas no terminal
+    subscribe(tty_input())
 
     execute("help")
+
+    -- Os editores são os próximos apps mais prováveis
+    for _, editor in ipairs({ 'code', 'sprite', 'map', 'music' }) do
+        prefetch_app(sh.path[1]..editor..'.nib')
+    end
 end
 
 function update(dt)
@@ -91,7 +97,7 @@ function execute(cmd)
             })
 
             if child then
-                send_message(tty, { unsubscribe=env.pid })
+                unsubscribe(tty_input())
                 send_message(tty, { disable = true })
 
                 found = true
@@ -135,9 +141,9 @@ function receive_messages()
         if message.app_started then
         end
 
+        -- O app que parou já saiu do tópico
         if message.app_stopped then
-            send_message(tty, { unsubscribe = message.app_stopped })
-            send_message(tty, { subscribe = env.pid, name = name })
+            subscribe(tty_input())
             send_message(tty, { enable = true })
             print_prompt()
         end
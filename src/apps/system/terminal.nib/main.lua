@@ -6,7 +6,13 @@ local user_input = ""
 
 local text = Textarea:new(8, 8, 400-16, 200)
 
+-- Linhas digitadas vão para quem assina esse tópico (o tty_input() do
+-- framework tty)
+local INPUT = 'tty:'..env.pid
+
+-- Pids que assinam, e o nome do app de cada um
 local listeners = {}
+local names = {}
 
 local t = 0
 
@@ -50,8 +56,8 @@ end
 function listeners_line()
     local line = ''
 
-    for pid, name in pairs(listeners) do
-        line = line..('\12 '..name)
+    for _, pid in ipairs(listeners) do
+        line = line..('\12 '..(names[pid] or tostring(pid)))
     end
 
     if line ~= '' then
@@ -83,6 +89,7 @@ function update(dt)
     t += dt
 
     receive_messages()
+    update_listeners()
 
     if not disabled and has_listeners() then
         local input = read_keys()
@@ -153,11 +160,23 @@ function update(dt)
 end
 
 function has_listeners()
-    for _, _ in pairs(listeners) do
-        return true
-    end
+    return #listeners > 0
+end
+
+function update_listeners()
+    listeners = subscribers(INPUT)
+
+    for _, pid in ipairs(listeners) do
+        if not names[pid] then
+            names = {}
+
+            for _, process in ipairs(list_processes()) do
+                names[process.pid] = process.app:match('[^/]+$')
+            end
 
-    return false
+            break
+        end
+    end
 end
 
 function lineiter(s)
@@ -198,9 +217,7 @@ function add_text(str, bg, fg, swap)
 end
 
 function send_to_listeners(text)
-    for listener, _ in pairs(listeners) do
-        send_message(listener, {input=text})
-    end
+    publish(INPUT, {input=text})
 end
 
 function receive_messages()
@@ -214,14 +231,6 @@ function receive_messages()
                 add_text(message.print, message.background)
             end
 
-            if message.subscribe and type(message.subscribe) == "number" then
-                listeners[message.subscribe] = message.name
-            end
-
-            if message.unsubscribe and type(message.unsubscribe) == "number" then
-                listeners[message.unsubscribe] = nil
-            end
-
             if message.disable then
                 disabled = true
             end
@@ -0,0 +1,29 @@
+require 'tty'
+
+-- Profiler do kernel:
+--   trace start          começa a gravar um trace
+--   trace stop <arquivo> salva o trace (JSON do Chrome/Perfetto)
+--   trace overlay        liga/desliga as barras por cima da tela (ctrl+p)
+
+function init()
+  local cmd = env.params[2]
+
+  if cmd == 'start' then
+    start_trace()
+    write_line('tracing, "trace stop <file>" to save')
+  elseif cmd == 'stop' then
+    local file = env.params[3] or 'trace.json'
+
+    if stop_trace(file) then
+      write_line('writing trace to '..file)
+    else
+      write_line('not tracing', 6)
+    end
+  elseif cmd == 'overlay' then
+    profiler_overlay(not profiler_stats().overlay)
+  else
+    write_line('usage: trace start|stop <file>|overlay')
+  end
+
+  stop_app(0)
+end
@@ -0,0 +1,131 @@
+/*
+ * Compara a mixagem sequencial dos canais com a mixagem
+ * paralela (WorkerPool) para vários tamanhos de bloco.
+ *
+ * Uso: audio_mix_benchmark [workers]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include <kernel/Channel.hpp>
+#include <kernel/WorkerPool.hpp>
+#include <kernel/Memory.hpp>
+
+#include <Specs.hpp>
+
+using namespace std;
+
+// Segundos de áudio sintetizados para cada medida
+#define BENCHMARK_SECONDS       2
+// Notas tocando em cada canal
+#define BENCHMARK_VOICES        8
+
+struct Bench {
+    unique_ptr<Channel> channels[AUDIO_CHANNEL_AMOUNT];
+    int16_t partials[AUDIO_CHANNEL_AMOUNT*AUDIO_SAMPLE_AMOUNT*2];
+    unsigned int sample_count;
+};
+
+static void setup_channel(Channel &channel) {
+    auto &synth = channel.memory.synthesizer;
+
+    memset(&channel.memory, 0, sizeof(Channel::MemoryLayout));
+
+    for (size_t op=0;op<AUDIO_OPERATOR_AMOUNT;op++) {
+        synth.frequencies[op] = 255*(op+1);
+        synth.envelopes[op].sustained = 255;
+        synth.envelopes[op].level = 255;
+        synth.envelopes[op].sustain = 255;
+        synth.envelopes[op].release = 255;
+        synth.wave_types[op] = FMSynthesizer::SINE;
+
+        // Cada operador modula o próximo e vai para a saída
+        if (op+1 < AUDIO_OPERATOR_AMOUNT) {
+            synth.amplitudes[FM_MATRIX(op, op+1)] = 128;
+        }
+        synth.amplitudes[FM_MATRIX(op, AUDIO_OPERATOR_AMOUNT)] = 16;
+    }
+
+    channel.memory.delay.delay = 8;
+    channel.memory.delay.feedback = 64;
+
+    for (uint8_t n=0;n<BENCHMARK_VOICES;n++) {
+        channel.press(48+n*3, 127);
+    }
+}
+
+static double measure(Bench &bench, WorkerPool *workers, unsigned int block) {
+    int16_t samples[AUDIO_SAMPLE_AMOUNT*2];
+    const auto blocks = BENCHMARK_SECONDS*AUDIO_SAMPLE_RATE/block;
+
+    const auto start = chrono::steady_clock::now();
+
+    for (unsigned int b=0;b<blocks;b++) {
+        memset(samples, 0, sizeof(samples));
+
+        if (!workers) {
+            for (auto &channel: bench.channels) {
+                channel->fill(samples, block*2);
+            }
+        } else {
+            bench.sample_count = block;
+
+            workers->run(AUDIO_CHANNEL_AMOUNT, [] (void *ctx, size_t c) {
+                auto &bench = *(Bench*)ctx;
+                auto partial = bench.partials+c*AUDIO_SAMPLE_AMOUNT*2;
+
+                memset(partial, 0, bench.sample_count*AUDIO_SAMPLE_LENGTH*2);
+                bench.channels[c]->fill(partial, bench.sample_count*2);
+            }, &bench);
+
+            for (unsigned int s=0;s<block*2;s++) {
+                int out = samples[s];
+
+                for (unsigned int c=0;c<AUDIO_CHANNEL_AMOUNT;c++) {
+                    out += bench.partials[c*AUDIO_SAMPLE_AMOUNT*2+s];
+                }
+
+                samples[s] = max(min(out, INT16_MAX), INT16_MIN);
+            }
+        }
+    }
+
+    const auto end = chrono::steady_clock::now();
+
+    return chrono::duration<double, milli>(end-start).count();
+}
+
+int main(int argc, char **argv) {
+    size_t worker_amount = argc > 1 ? atoi(argv[1]) : max(thread::hardware_concurrency(), 1u)-1;
+
+    Memory memory;
+    Bench bench;
+
+    for (auto &channel: bench.channels) {
+        channel = make_unique<Channel>(memory);
+        setup_channel(*channel);
+    }
+
+    WorkerPool workers(worker_amount);
+
+    cout << AUDIO_CHANNEL_AMOUNT << " channels, " << BENCHMARK_VOICES << " voices each, ";
+    cout << worker_amount << "+1 threads, " << BENCHMARK_SECONDS << "s of audio" << endl;
+    cout << setw(8) << "block" << setw(16) << "sequential ms" << setw(16) << "parallel ms" << setw(10) << "speedup" << endl;
+
+    for (unsigned int block=32;block<=AUDIO_SAMPLE_AMOUNT;block*=2) {
+        auto sequential = measure(bench, nullptr, block);
+        auto parallel = measure(bench, &workers, block);
+
+        cout << setw(8) << block;
+        cout << setw(16) << fixed << setprecision(2) << sequential;
+        cout << setw(16) << parallel;
+        cout << setw(9) << sequential/parallel << "x" << endl;
+    }
+
+    return 0;
+}
@@ -3,10 +3,15 @@
 #include <climits>
 #include <cstring>
 #include <cmath>
+#include <chrono>
 #include <iostream>
 using namespace std;
 
-Audio::Audio(Memory &memory): next_tick(0) {
+Audio::Audio(Memory &memory, const size_t worker_amount):
+    next_tick(0), ring_read(0), ring_write(0),
+    rendering(false), stable_callbacks(0),
+    callback_ticks(0), callback_max_ticks(0), synthesis_ticks(0),
+    partials(nullptr), partial_sample_count(0), statistics(nullptr) {
     // Cria canais
     for (size_t ch=0;ch<AUDIO_CHANNEL_AMOUNT;ch++) {
         channels[ch] = make_unique<Channel>(memory);
@@ -18,11 +23,35 @@ Audio::Audio(Memory &memory): next_tick(0) {
     // Calcula velocidade da sincronização
     calc_tick_period(AUDIO_UPDATE_RATE);
 
+    ring = new int16_t[AUDIO_RING_SIZE*2];
+    memset(ring, 0, AUDIO_RING_SIZE*2*sizeof(int16_t));
+
+    if (worker_amount > 0) {
+        workers = make_unique<WorkerPool>(worker_amount);
+        partials = new int16_t[AUDIO_CHANNEL_AMOUNT*AUDIO_SAMPLE_AMOUNT*2];
+
+        cout << "Mixing audio with " << worker_amount+1 << " threads" << endl;
+    }
+
     device = initialize();
 }
 
 Audio::~Audio() {
+    shutdown();
+
     SDL_CloseAudioDevice(device);
+
+    delete[] ring;
+    delete[] partials;
+}
+
+void Audio::map_statistics(Memory &memory) {
+    statistics = (StatisticsLayout*)memory.allocate(sizeof(StatisticsLayout), "Audio Statistics");
+
+    statistics->underruns = 0;
+    statistics->buffered = 0;
+    statistics->depth = AUDIO_RING_DEFAULT_DEPTH;
+    statistics->dynamic = 1;
 }
 
 SDL_AudioDeviceID Audio::initialize() {
@@ -38,7 +67,19 @@ SDL_AudioDeviceID Audio::initialize() {
     spec_in.samples  = AUDIO_SAMPLE_AMOUNT;
 
     spec_in.callback = [] (void *udata, Uint8 *stream, int len) {
-        ((Audio*)udata)->fill((int16_t*)stream, len/AUDIO_SAMPLE_LENGTH/2);
+        auto audio = (Audio*)udata;
+        const auto start = SDL_GetPerformanceCounter();
+
+        audio->fill((int16_t*)stream, len/AUDIO_SAMPLE_LENGTH/2);
+
+        const auto ticks = SDL_GetPerformanceCounter()-start;
+
+        audio->callback_ticks += ticks;
+
+        // Só essa thread aumenta o máximo
+        if (ticks > audio->callback_max_ticks.load(memory_order_relaxed)) {
+            audio->callback_max_ticks.store(ticks, memory_order_relaxed);
+        }
     };
 
     spec_in.userdata = (void*)this;
@@ -67,16 +108,106 @@ SDL_AudioDeviceID Audio::initialize() {
 }
 
 void Audio::startup() {
+    if (!rendering) {
+        rendering = true;
+        renderer = thread(&Audio::render_loop, this);
+    }
+
     SDL_PauseAudioDevice(device, 0);
 }
 
 void Audio::shutdown() {
     SDL_PauseAudioDevice(device, 1);
+
+    if (rendering) {
+        rendering = false;
+        renderer.join();
+    }
+}
+
+unsigned int Audio::lookahead() {
+    if (!statistics) {
+        return AUDIO_RING_DEFAULT_DEPTH;
+    }
+
+    return max<unsigned int>(min<unsigned int>(statistics->depth, AUDIO_RING_MAX_DEPTH),
+                             AUDIO_RING_MIN_DEPTH);
+}
+
+void Audio::render_loop() {
+    while (rendering) {
+        const auto write = ring_write.load(memory_order_relaxed);
+        const auto read = ring_read.load(memory_order_acquire);
+
+        // Buffer cheio o suficiente, espera a placa de áudio consumir
+        if (write-read >= lookahead()*AUDIO_SAMPLE_AMOUNT) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        const auto start = SDL_GetPerformanceCounter();
+
+        // AUDIO_RING_SIZE é múltiplo de AUDIO_SAMPLE_AMOUNT, então
+        // um bloco nunca dá a volta no buffer
+        synthesize(ring+(write%AUDIO_RING_SIZE)*2, AUDIO_SAMPLE_AMOUNT);
+
+        synthesis_ticks += SDL_GetPerformanceCounter()-start;
+
+        ring_write.store(write+AUDIO_SAMPLE_AMOUNT, memory_order_release);
+    }
 }
 
 // Each sample should be 4 bytes:
 // [ L: 2 ] [ R: 2 ]
-void Audio::fill(int16_t *samples, int missing_sample_count) {
+void Audio::fill(int16_t *samples, int sample_count) {
+    const auto read = ring_read.load(memory_order_relaxed);
+    const auto write = ring_write.load(memory_order_acquire);
+    const auto available = min<uint64_t>(write-read, sample_count);
+
+    // Copia em até duas partes, caso dê a volta no buffer
+    const auto start = read%AUDIO_RING_SIZE;
+    const auto first = min<uint64_t>(available, AUDIO_RING_SIZE-start);
+
+    memcpy(samples, ring+start*2, first*AUDIO_SAMPLE_LENGTH*2);
+    memcpy(samples+first*2, ring, (available-first)*AUDIO_SAMPLE_LENGTH*2);
+
+    ring_read.store(read+available, memory_order_release);
+
+    if (!statistics) {
+        memset(samples+available*2, 0, (sample_count-available)*AUDIO_SAMPLE_LENGTH*2);
+        return;
+    }
+
+    if (available < uint64_t(sample_count)) {
+        // Underrun: completa com silêncio
+        memset(samples+available*2, 0, (sample_count-available)*AUDIO_SAMPLE_LENGTH*2);
+
+        statistics->underruns++;
+        stable_callbacks = 0;
+
+        if (statistics->dynamic && statistics->depth < AUDIO_RING_MAX_DEPTH) {
+            statistics->depth = lookahead()+1;
+        }
+    } else if (statistics->dynamic && ++stable_callbacks >= AUDIO_RING_SHRINK_AFTER) {
+        stable_callbacks = 0;
+
+        if (statistics->depth > AUDIO_RING_MIN_DEPTH) {
+            statistics->depth = lookahead()-1;
+        }
+    }
+
+    statistics->buffered = write-read-available;
+}
+
+void Audio::take_counters(uint32_t &callback_us, uint32_t &callback_max_us, uint32_t &synthesis_us) {
+    const auto frequency = SDL_GetPerformanceFrequency();
+
+    callback_us = callback_ticks.exchange(0)*1000000/frequency;
+    callback_max_us = callback_max_ticks.exchange(0)*1000000/frequency;
+    synthesis_us = synthesis_ticks.exchange(0)*1000000/frequency;
+}
+
+void Audio::synthesize(int16_t *samples, int missing_sample_count) {
     unsigned int initial_t = *t;
 
     memset(samples, 0, missing_sample_count*AUDIO_SAMPLE_LENGTH*2);
@@ -107,12 +238,48 @@ void Audio::fill(int16_t *samples, int missing_sample_count) {
 }
 
 void Audio::mix(int16_t* samples, unsigned int sample_count) {
-    // Preenche samples de cada canal
-    for (unsigned int c=0;c<AUDIO_CHANNEL_AMOUNT;c++) {
-        channels[c]->fill(samples, sample_count*2);
+    if (!workers) {
+        // Preenche samples de cada canal
+        for (unsigned int c=0;c<AUDIO_CHANNEL_AMOUNT;c++) {
+            channels[c]->fill(samples, sample_count*2);
+        }
+
+        return;
+    }
+
+    // Fork-join: cada canal em um buffer parcial
+    partial_sample_count = sample_count;
+
+    workers->run(AUDIO_CHANNEL_AMOUNT, [] (void *audio, size_t c) {
+        ((Audio*)audio)->mix_channel(c);
+    }, this);
+
+    // Soma os buffers parciais no buffer de saída
+    for (unsigned int s=0;s<sample_count*2;s++) {
+        int out = samples[s];
+
+        for (unsigned int c=0;c<AUDIO_CHANNEL_AMOUNT;c++) {
+            out += partials[c*AUDIO_SAMPLE_AMOUNT*2+s];
+        }
+
+        if (out < INT16_MIN) {
+            out = INT16_MIN;
+        } else if (out > INT16_MAX) {
+            out = INT16_MAX;
+        }
+
+        samples[s] = out;
     }
 }
 
+void Audio::mix_channel(const size_t c) {
+    auto partial = partials+c*AUDIO_SAMPLE_AMOUNT*2;
+
+    memset(partial, 0, partial_sample_count*AUDIO_SAMPLE_LENGTH*2);
+
+    channels[c]->fill(partial, partial_sample_count*2);
+}
+
 void Audio::calc_tick_period(const double frequency) {
     // Período em segundos
     const double period = 1/frequency;
@@ -95,12 +95,21 @@ void main() {
 }
 )";
 
-GPU::GPU(Memory& memory, const bool fullscreen_startup):
+GPU::GPU(Memory& memory, const Options &options):
+    source(nullptr), source_w(0), source_h(0),
     target_clip_start_x(0), target_clip_start_y(0),
     target_clip_end_x(GPU_VIDEO_WIDTH), target_clip_end_y(GPU_VIDEO_HEIGHT),
-    is_fullscreen(fullscreen_startup),
-    cycle(0), h264(nullptr), gif(nullptr),
-    colormap(nullptr), screen_scale(GPU_DEFAULT_SCALING), screen_offset_x(0), screen_offset_y(0) {
+    is_fullscreen(options.fullscreen),
+    cycle(0), tiles_source(nullptr), tiles_source_w(0), tiles_w(0), tiles_h(0),
+    corner_radius(-1),
+    damage_x1(INT16_MAX), damage_y1(INT16_MAX), damage_x2(INT16_MIN), damage_y2(INT16_MIN),
+    pixels(), upload_ticks(0),
+    h264(nullptr), gif(nullptr),
+    colormap(nullptr), screen_scale(GPU_DEFAULT_SCALING), screen_offset_x(0), screen_offset_y(0),
+    renderer(nullptr), framebuffer(nullptr), shader(0),
+    palette_dirty(true), needs_present(true), uploaded(false),
+    pipelined(options.pipelined), presenting(false),
+    pending_frame(-1), reading_frame(-1) {
 
     window = SDL_CreateWindow("nibble",
                               SDL_WINDOWPOS_CENTERED,
@@ -111,11 +120,25 @@ GPU::GPU(Memory& memory, const bool fullscreen_startup):
 
     SDL_SetHint(SDL_HINT_RENDER_DRIVER, "opengl");
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    //renderer = SDL_CreateSoftwareRenderer(SDL_GetWindowSurface(window));
+    // Escritas do Lua (put_pixel, swap_colors etc) também marcam o que mudou
+    palette_memory = memory.allocate(GPU_PALETTE_MEM_SIZE, "GPU Palettes",
+                                     [this] (Memory::AccessMode mode, size_t, size_t) {
+        if (mode == Memory::ACCESS_WRITE) {
+            palette_dirty = true;
+        }
+    });
+    video_memory = memory.allocate(GPU_VIDEO_MEM_SIZE, "GPU Video Memory",
+                                   [this] (Memory::AccessMode mode, size_t start, size_t end) {
+        if (mode == Memory::ACCESS_WRITE) {
+            for (size_t y=start/GPU_VIDEO_WIDTH;y<=(end-1)/GPU_VIDEO_WIDTH;y++) {
+                dirty_rows.set(y);
+            }
 
-    palette_memory = memory.allocate(GPU_PALETTE_MEM_SIZE, "GPU Palettes");
-    video_memory = memory.allocate(GPU_VIDEO_MEM_SIZE, "GPU Video Memory");
+            add_damage(0, start/GPU_VIDEO_WIDTH, GPU_VIDEO_WIDTH-1, (end-1)/GPU_VIDEO_WIDTH);
+        }
+    });
+
+    frames[0].data = frames[1].data = nullptr;
 
     // Não mostra o cursor
     SDL_ShowCursor(SDL_DISABLE);
@@ -128,22 +151,49 @@ GPU::GPU(Memory& memory, const bool fullscreen_startup):
     SDL_FreeSurface(icon_surface);
     delete pixels;
 
+    framebuffer_src = SDL_Rect {0, 0, GPU_VIDEO_WIDTH/4, GPU_VIDEO_HEIGHT};
+    framebuffer_dst = SDL_Rect {0, 0,
+                                int(GPU_VIDEO_WIDTH*screen_scale),
+                                int(GPU_VIDEO_HEIGHT*screen_scale)};
+
+    if (pipelined) {
+        // O contexto OpenGL pertence à thread que cria o renderer,
+        // então tudo que usa o renderer fica no presenter
+        for (auto &frame: frames) {
+            frame.data = new uint8_t[GPU_VIDEO_MEM_SIZE+GPU_PALETTE_MEM_SIZE];
+        }
+
+        presenting = true;
+        presenter = thread(&GPU::present_loop, this, options.vsync);
+    } else {
+        create_renderer(options.vsync);
+    }
+}
+
+void GPU::create_renderer(const bool vsync) {
+    // Com vsync, o SDL_RenderPresent segura o ritmo das frames
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync? SDL_RENDERER_PRESENTVSYNC : 0));
+    //renderer = SDL_CreateSoftwareRenderer(SDL_GetWindowSurface(window));
+
     // Linhas extras para a paleta
     framebuffer = SDL_CreateTexture(renderer,
                                     SDL_PIXELFORMAT_RGBA8888,
                                     SDL_TEXTUREACCESS_STREAMING,
                                     GPU_VIDEO_WIDTH/4, GPU_VIDEO_HEIGHT+16);
 
-    framebuffer_src = SDL_Rect {0, 0, GPU_VIDEO_WIDTH/4, GPU_VIDEO_HEIGHT};
-    framebuffer_dst = SDL_Rect {0, 0,
-                                int(GPU_VIDEO_WIDTH*screen_scale),
-                                int(GPU_VIDEO_HEIGHT*screen_scale)};
-
     check_opengl();
 
     shader = compile_program(default_vertex_shader, expand_colors_shader);
 }
 
+void GPU::destroy_renderer() {
+    SDL_DestroyTexture(framebuffer);
+    SDL_DestroyRenderer(renderer);
+
+    framebuffer = nullptr;
+    renderer = nullptr;
+}
+
 void GPU::check_opengl() {
     // Inicializa extensões OpenGL
     // Referência: https://github.com/AugustoRuiz/sdl2glsl/blob/master/src/main.cpp
@@ -181,8 +231,22 @@ GPU::~GPU() {
 
     free_cursors();
 
-    SDL_DestroyTexture(framebuffer);
-    SDL_DestroyRenderer(renderer);
+    if (pipelined) {
+        {
+            lock_guard<mutex> lock(frame_lock);
+            presenting = false;
+        }
+
+        frame_ready.notify_one();
+        presenter.join();
+
+        for (auto &frame: frames) {
+            delete[] frame.data;
+        }
+    } else {
+        destroy_renderer();
+    }
+
     SDL_DestroyWindow(window);
 }
 
@@ -226,6 +290,9 @@ void GPU::startup() {
         video_memory[i] = (i/20 + i/400/4)%0x10;
     }
 
+    dirty_rows.set();
+    palette_dirty = true;
+
     // Aspect-ratio correto
     resize();
 
@@ -238,6 +305,8 @@ void GPU::startup() {
 }
 
 void GPU::paint_boot_animation() {
+    dirty_rows.set();
+
     for (size_t i=0;i<GPU_VIDEO_MEM_SIZE/4;i++) {
         if (rand()%3 == 0) {
             video_memory[i*4+0] = 0;
@@ -248,22 +317,12 @@ void GPU::paint_boot_animation() {
     }
 }
 
-void GPU::draw() {
+bool GPU::draw() {
     if (cycle <= BOOT_CYCLES) {
         paint_boot_animation();
     }
     cycle++;
 
-    // Atualiza a memória de vídeo
-    void *data;
-    int pitch;
-    SDL_LockTexture(framebuffer, NULL, &data, &pitch);
-
-    // Tela
-    memcpy(data, video_memory, GPU_VIDEO_MEM_SIZE);
-    // Paleta
-    memcpy(((uint8_t*)data)+GPU_VIDEO_MEM_SIZE, palette_memory, GPU_PALETTE_MEM_SIZE);
-
     // Grava a frame
     if (h264) {
         uint8_t data[GPU_VIDEO_MEM_SIZE*3];
@@ -279,23 +338,215 @@ void GPU::draw() {
         capture_frame();
     }
 
-    // Upload para a GPU
-    SDL_UnlockTexture(framebuffer);
+    // Nada mudou: não envia nem mostra a frame
+    if (!dirty_rows.any() && !palette_dirty && !needs_present) {
+        return false;
+    }
+
+    if (pipelined) {
+        submit_frame();
+    } else {
+        upload(video_memory, palette_memory, dirty_rows, palette_dirty);
+        uploaded = true;
+    }
+
+    dirty_rows.reset();
+    palette_dirty = false;
+    needs_present = false;
+
+    return !pipelined;
+}
+
+void GPU::show() {
+    if (uploaded) {
+        uploaded = false;
+        present(framebuffer_dst);
+    }
+}
+
+void GPU::invalidate() {
+    needs_present = true;
+}
+
+void GPU::mark_damage(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    // Desenhos fora da memória de vídeo não vão para a tela
+    if (target != video_memory) {
+        return;
+    }
+
+    x1 = max(x1, target_clip_start_x);
+    y1 = max(y1, target_clip_start_y);
+    x2 = min<int16_t>(x2, target_clip_end_x-1);
+    y2 = min<int16_t>(y2, target_clip_end_y-1);
+
+    if (x1 > x2 || y1 > y2) {
+        return;
+    }
+
+    add_damage(x1, y1, x2, y2);
+
+    for (;y1<=y2;y1++) {
+        dirty_rows.set(y1);
+    }
+}
+
+void GPU::add_damage(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    damage_x1 = min(damage_x1, x1);
+    damage_y1 = min(damage_y1, y1);
+    damage_x2 = max(damage_x2, x2);
+    damage_y2 = max(damage_y2, y2);
+}
+
+SDL_Rect GPU::take_damage() {
+    SDL_Rect damage = { 0, 0, 0, 0 };
+
+    if (damage_x1 <= damage_x2) {
+        damage = { damage_x1, damage_y1, damage_x2-damage_x1+1, damage_y2-damage_y1+1 };
+    }
+
+    damage_x1 = damage_y1 = INT16_MAX;
+    damage_x2 = damage_y2 = INT16_MIN;
+
+    return damage;
+}
+
+void GPU::restore_damage(const SDL_Rect &damage) {
+    if (!SDL_RectEmpty(&damage)) {
+        add_damage(damage.x, damage.y, damage.x+damage.w-1, damage.y+damage.h-1);
+    }
+}
+
+void GPU::take_counters(uint32_t *out, uint32_t &upload_us) {
+    memcpy(out, pixels, sizeof(pixels));
+    memset(pixels, 0, sizeof(pixels));
+
+    upload_us = upload_ticks.exchange(0)*1000000/SDL_GetPerformanceFrequency();
+}
+
+void GPU::upload(const uint8_t *video, const uint8_t *palette,
+                 const bitset<GPU_VIDEO_HEIGHT> &rows, const bool palette_changed) {
+    const int pitch = GPU_VIDEO_WIDTH*BYTES_PER_PIXEL;
+    const auto start = SDL_GetPerformanceCounter();
+
+    // Envia cada sequência contínua de linhas alteradas de uma vez
+    for (int y=0;y<GPU_VIDEO_HEIGHT;) {
+        if (!rows[y]) {
+            y++;
+            continue;
+        }
+
+        int end = y;
+
+        while (end < GPU_VIDEO_HEIGHT && rows[end]) {
+            end++;
+        }
+
+        SDL_Rect span {0, y, GPU_VIDEO_WIDTH/4, end-y};
+        SDL_UpdateTexture(framebuffer, &span, video+y*pitch, pitch);
+
+        y = end;
+    }
+
+    // Paleta, nas linhas extras depois da tela
+    if (palette_changed) {
+        const int palette_rows = (GPU_PALETTE_MEM_SIZE+pitch-1)/pitch;
+        uint8_t data[palette_rows*pitch];
+
+        memcpy(data, palette, GPU_PALETTE_MEM_SIZE);
+
+        SDL_Rect span {0, GPU_VIDEO_HEIGHT, GPU_VIDEO_WIDTH/4, palette_rows};
+        SDL_UpdateTexture(framebuffer, &span, data, pitch);
+    }
+
+    upload_ticks += SDL_GetPerformanceCounter()-start;
+}
 
+void GPU::present(const SDL_Rect &dst) {
     // Só limpa a tela se tivermos barras horizontais ou verticais
-    if (screen_offset_x != 0 || screen_offset_y != 0) {
+    if (dst.x != 0 || dst.y != 0) {
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
     }
 
     // Desenha o framebuffer na tela
     glUseProgram(shader);
-    SDL_RenderCopy(renderer, framebuffer, &framebuffer_src, &framebuffer_dst);
+    SDL_RenderCopy(renderer, framebuffer, &framebuffer_src, &dst);
 
     // Mostra o resultado na janela
     SDL_RenderPresent(renderer);
 }
 
+void GPU::submit_frame() {
+    int index;
+    bitset<GPU_VIDEO_HEIGHT> rows = dirty_rows;
+    bool palette = palette_dirty;
+
+    {
+        lock_guard<mutex> lock(frame_lock);
+
+        // Uma frame ainda não mostrada é substituída pela nova,
+        // mas o que mudou nela ainda precisa ser enviado
+        if (pending_frame >= 0) {
+            rows |= frames[pending_frame].rows;
+            palette = palette || frames[pending_frame].palette;
+
+            pending_frame = -1;
+        }
+
+        // Usa o buffer que o presenter não está lendo
+        index = reading_frame == 0 ? 1 : 0;
+    }
+
+    auto &frame = frames[index];
+
+    memcpy(frame.data, video_memory, GPU_VIDEO_MEM_SIZE);
+    memcpy(frame.data+GPU_VIDEO_MEM_SIZE, palette_memory, GPU_PALETTE_MEM_SIZE);
+
+    frame.rows = rows;
+    frame.palette = palette;
+
+    {
+        lock_guard<mutex> lock(frame_lock);
+        pending_frame = index;
+    }
+
+    frame_ready.notify_one();
+}
+
+void GPU::present_loop(const bool vsync) {
+    create_renderer(vsync);
+
+    unique_lock<mutex> lock(frame_lock);
+
+    while (presenting) {
+        frame_ready.wait(lock, [this] { return pending_frame >= 0 || !presenting; });
+
+        if (!presenting) {
+            break;
+        }
+
+        reading_frame = pending_frame;
+        pending_frame = -1;
+
+        // `resize` muda o destino na thread principal
+        const auto dst = framebuffer_dst;
+        const auto &frame = frames[reading_frame];
+
+        lock.unlock();
+
+        upload(frame.data, frame.data+GPU_VIDEO_MEM_SIZE, frame.rows, frame.palette);
+        present(dst);
+
+        lock.lock();
+
+        reading_frame = -1;
+    }
+
+    lock.unlock();
+
+    destroy_renderer();
+}
+
 void GPU::fullscreen(const bool fullscreen) {
     SDL_SetWindowFullscreen(window, fullscreen? SDL_WINDOW_FULLSCREEN_DESKTOP : 0);
 
@@ -326,9 +577,15 @@ void GPU::resize() {
         screen_offset_x = 0;
     }
 
-    framebuffer_dst = SDL_Rect {int(screen_offset_x), int(screen_offset_y),
-                               int(GPU_VIDEO_WIDTH*screen_scale),
-                               int(GPU_VIDEO_HEIGHT*screen_scale)};
+    {
+        lock_guard<mutex> lock(frame_lock);
+
+        framebuffer_dst = SDL_Rect {int(screen_offset_x), int(screen_offset_y),
+                                   int(GPU_VIDEO_WIDTH*screen_scale),
+                                   int(GPU_VIDEO_HEIGHT*screen_scale)};
+    }
+
+    needs_present = true;
 
     free_cursors();
 }
@@ -556,6 +813,9 @@ void GPU::line(int16_t x1, int16_t y1,
     // Algorítmo Cohen-Sutherland de clipping
     fix_line_bounds(x1, y1, x2, y2);
 
+    mark_damage(min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
+    pixels[GPU_PRIMITIVE_LINE] += max(abs(x1-x2), abs(y1-y2))+1;
+
     // Bresenham para inteiros
     const int16_t dx = abs(x1-x2);
     const int16_t dy = -abs(y1-y2);
@@ -641,6 +901,8 @@ void GPU::circle(int16_t dx, int16_t dy, int16_t r, uint8_t color) {
     int16_t d = 1-abs(r);
     int16_t x = abs(r), y = 0;
 
+    mark_damage(dx-x, dy-x, dx+x, dy+x);
+
     while(x >= y) {
         // Desenha o pixel anterior, replicado em 8
         if (!OUT_OF_BOUNDS(dx+x, dy+y)) {
@@ -679,6 +941,9 @@ void GPU::circle(int16_t dx, int16_t dy, int16_t r, uint8_t color) {
 
         y++;
     }
+
+    // Oito pixels por passo
+    pixels[GPU_PRIMITIVE_CIRCLE] += y*8;
 }
 
 void GPU::rect_fill(int16_t x, int16_t y,
@@ -855,7 +1120,7 @@ void GPU::quad_fill(int16_t x1, int16_t y1,
     }
 }
 
-void GPU::scan_line(int16_t x1, int16_t x2, int16_t y, uint8_t color) const {
+void GPU::scan_line(int16_t x1, int16_t x2, int16_t y, uint8_t color) {
     if (TRANSPARENT(color))
         return;
 
@@ -865,6 +1130,9 @@ void GPU::scan_line(int16_t x1, int16_t x2, int16_t y, uint8_t color) const {
             x2 = min(x2, (int16_t)(target_clip_end_x-1));
 
             memset(target+x1+y*target_w, color, x2-x1+1);
+
+            mark_damage(x1, y, x2, y);
+            pixels[GPU_PRIMITIVE_FILL] += x2-x1+1;
         }
     }
 }
@@ -894,7 +1162,144 @@ void GPU::circle_fill(int16_t dx, int16_t dy, int16_t r, uint8_t color) {
     }
 }
 
-void GPU::copy_scan_line(uint8_t *dst, uint8_t *src, size_t bytes, uint8_t pal) const {
+void GPU::make_corner(int16_t r) {
+    if (r == corner_radius) {
+        return;
+    }
+
+    corner_radius = r;
+    corner_spans.assign(r+1, 0);
+
+    // Mesmo midpoint da circle_fill: a linha y tem meia largura x e a
+    // linha x tem meia largura y
+    int16_t d = 1-r;
+    int16_t x = r, y = 0;
+
+    while (x >= y) {
+        corner_spans[y] = max(corner_spans[y], x);
+        corner_spans[x] = max(corner_spans[x], y);
+
+        if (d <= 0) {
+            d += ((y+1)<<1)+1;
+        } else {
+            d += ((y+1)<<1)-((x-1)<<1)+1;
+
+            x--;
+        }
+
+        y++;
+    }
+}
+
+// Quantos pixels a linha `row` de um retângulo de altura `h` começa
+// depois da borda esquerda (e termina antes da direita); -1 fora dele
+int16_t GPU::corner_inset(int16_t row, int16_t h) const {
+    if (row < 0 || row >= h) {
+        return -1;
+    }
+
+    const auto r = corner_radius;
+
+    if (row < r) {
+        return r-corner_spans[r-row];
+    }
+
+    if (row > h-r-1) {
+        return r-corner_spans[row-(h-r-1)];
+    }
+
+    return 0;
+}
+
+void GPU::rounded_rect_fill(int16_t x, int16_t y,
+                            int16_t w, int16_t h,
+                            int16_t r, uint8_t color, int16_t pal) {
+    if (pal >= 0)
+        color = COLMAP1(color+((pal&0x0F)<<4));
+
+    if (TRANSPARENT(color))
+        return;
+
+    if (w < 0) {
+        x += w;
+        w = -w;
+    }
+
+    if (h < 0) {
+        y += h;
+        h = -h;
+    }
+
+    if (w == 0 || h == 0) {
+        return;
+    }
+
+    // Os cantos não passam do meio do retângulo
+    make_corner(max<int16_t>(min<int16_t>(r, (min(w, h)-1)/2), 0));
+
+    const auto first = max<int16_t>(0, target_clip_start_y-y);
+    const auto last = min<int16_t>(h, target_clip_end_y-y);
+
+    for (int16_t row=first;row<last;row++) {
+        const auto inset = corner_inset(row, h);
+
+        scan_line(x+inset, x+w-1-inset, y+row, color);
+    }
+}
+
+void GPU::rounded_rect(int16_t x, int16_t y,
+                       int16_t w, int16_t h,
+                       int16_t r, uint8_t color, int16_t pal) {
+    if (pal >= 0)
+        color = COLMAP1(color+((pal&0x0F)<<4));
+
+    if (TRANSPARENT(color))
+        return;
+
+    if (w < 0) {
+        x += w;
+        w = -w;
+    }
+
+    if (h < 0) {
+        y += h;
+        h = -h;
+    }
+
+    if (w == 0 || h == 0) {
+        return;
+    }
+
+    make_corner(max<int16_t>(min<int16_t>(r, (min(w, h)-1)/2), 0));
+
+    const auto first = max<int16_t>(0, target_clip_start_y-y);
+    const auto last = min<int16_t>(h, target_clip_end_y-y);
+
+    for (int16_t row=first;row<last;row++) {
+        const auto inset = corner_inset(row, h);
+        const auto above = corner_inset(row-1, h);
+        const auto below = corner_inset(row+1, h);
+
+        // Primeira e última linhas são inteiras
+        if (above < 0 || below < 0) {
+            scan_line(x+inset, x+w-1-inset, y+row, color);
+            continue;
+        }
+
+        // O interior é o que tem vizinhos dentro do retângulo nos
+        // quatro lados; o resto da linha é contorno
+        const auto interior = max<int16_t>(inset+1, max(above, below));
+
+        if (interior > w-1-interior) {
+            scan_line(x+inset, x+w-1-inset, y+row, color);
+        } else {
+            scan_line(x+inset, x+interior-1, y+row, color);
+            scan_line(x+w-interior, x+w-1-inset, y+row, color);
+        }
+    }
+}
+
+void GPU::copy_scan_line(uint8_t *dst, const uint8_t *src, size_t bytes, uint8_t pal) const {
     const auto end_src = src+bytes;
 
     while (src < end_src) {
@@ -910,13 +1315,35 @@ void GPU::copy_scan_line(uint8_t *dst, uint8_t *src, size_t bytes, uint8_t pal)
     }
 }
 
+void GPU::copy_scan_line_flipped(uint8_t *dst, const uint8_t *src, size_t bytes, uint8_t pal) const {
+    const auto end_dst = dst+bytes;
+
+    while (dst < end_dst) {
+        auto c = COLMAP1(((*src--) + (pal<<4)));
+
+        if (!TRANSPARENT(c)) {
+            *dst = c;
+        }
+
+        dst++;
+    }
+}
+
 void GPU::sprite(int16_t sx, int16_t sy,
                  int16_t dx, int16_t dy,
                  int16_t w, int16_t h,
                  uint8_t pal) {
+    blit(source, source_w, source_h, sx, sy, dx, dy, w, h, pal);
+}
+
+void GPU::blit(const uint8_t *from, int16_t from_w, int16_t from_h,
+               int16_t sx, int16_t sy,
+               int16_t dx, int16_t dy,
+               int16_t w, int16_t h,
+               uint8_t pal) {
     pal = pal&0x0F;
 
-    if (dy >= target_clip_end_y || dx >= target_clip_end_x) {
+    if (!from || dy >= target_clip_end_y || dx >= target_clip_end_x) {
         return;
     }
 
@@ -940,25 +1367,351 @@ void GPU::sprite(int16_t sx, int16_t sy,
         w = target_clip_end_x-dx;
     }
 
+    // Partes fora da origem não são desenhadas
     if (sx < 0) {
         w = max(w+sx, 0);
+        dx -= sx;
         sx = 0;
     }
 
     if (sy < 0) {
         h = max(h+sy, 0);
-        dy = 0;
+        dy -= sy;
+        sy = 0;
     }
 
-    auto src = source+sy*source_w+sx;
+    w = min<int16_t>(w, from_w-sx);
+    h = min<int16_t>(h, from_h-sy);
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    auto src = from+sy*from_w+sx;
     auto ptr = target+dy*target_w+dx;
     const auto ptr_f = ptr+target_w*h;
 
-    for(;ptr < ptr_f;ptr+=target_w,src+=source_w) {
+    mark_damage(dx, dy, dx+w-1, dy+h-1);
+    pixels[GPU_PRIMITIVE_SPRITE] += w*h;
+
+    for(;ptr < ptr_f;ptr+=target_w,src+=from_w) {
         copy_scan_line(ptr, src, w, pal);
     }
 }
 
+void GPU::slice(int16_t sx, int16_t sy,
+                int16_t sw, int16_t sh,
+                int16_t sl1, int16_t sl2,
+                int16_t sl3, int16_t sl4,
+                int16_t dx, int16_t dy,
+                int16_t w, int16_t h,
+                uint8_t pal) {
+    pal = pal&0x0F;
+
+    // Só partes inteiras da spritesheet
+    if (sw <= 0 || sh <= 0 || w <= 0 || h <= 0 ||
+        sx < 0 || sy < 0 || sx+sw > source_w || sy+sh > source_h) {
+        return;
+    }
+
+    sl1 = max<int16_t>(min(sl1, sw), 0);
+    sl2 = max(min(sl2, sw), sl1);
+    sl3 = max<int16_t>(min(sl3, sh), 0);
+    sl4 = max(min(sl4, sh), sl3);
+
+    // Parte da tela dentro do clip, relativa a (dx, dy)
+    const int16_t first_col = max(0, target_clip_start_x-dx);
+    const int16_t end_col = min<int>(w, target_clip_end_x-dx);
+    const int16_t first_row = max(0, target_clip_start_y-dy);
+    const int16_t end_row = min<int>(h, target_clip_end_y-dy);
+
+    if (first_col >= end_col || first_row >= end_row) {
+        return;
+    }
+
+    const int16_t step_w = sl2-sl1, step_h = sl4-sl3;
+
+    // Onde começam a direita e a base na tela. Elas são desenhadas por
+    // cima das outras partes quando não cabe tudo
+    const int16_t right = w-(sw-sl2);
+    const int16_t bottom = h-(sh-sl4);
+
+    // Primeira repetição do meio que aparece no clip
+    int16_t middle = sl1;
+
+    if (step_w > 0 && first_col > sl1) {
+        middle += (first_col-sl1)/step_w*step_w;
+    }
+
+    mark_damage(dx+first_col, dy+first_row, dx+end_col-1, dy+end_row-1);
+    pixels[GPU_PRIMITIVE_SPRITE] += (end_col-first_col)*(end_row-first_row);
+
+    for (int16_t row=first_row;row<end_row;row++) {
+        int16_t src_row;
+
+        if (row >= bottom) {
+            src_row = sl4+row-bottom;
+        } else if (row < sl3) {
+            src_row = row;
+        } else if (step_h > 0) {
+            src_row = sl3+(row-sl3)%step_h;
+        } else {
+            continue;
+        }
+
+        const auto src = source+(sy+src_row)*source_w+sx;
+        const auto dst = target+(dy+row)*target_w+dx;
+
+        // Copia as colunas [from, to) da tela a partir da coluna
+        // `src_col` do sprite
+        const auto blit = [&] (int16_t from, int16_t to, int16_t src_col) {
+            const auto start = max(from, first_col);
+            const auto end = min(to, end_col);
+
+            if (start < end) {
+                copy_scan_line(dst+start, src+src_col+(start-from), end-start, pal);
+            }
+        };
+
+        blit(0, min(sl1, right), 0);
+
+        if (step_w > 0) {
+            for (int16_t col=middle;col<min(right, end_col);col+=step_w) {
+                blit(col, min<int16_t>(col+step_w, right), sl1);
+            }
+        }
+
+        blit(max<int16_t>(right, 0), w, sl2+max<int16_t>(-right, 0));
+    }
+}
+
+void GPU::clear_tiles() {
+    tiles_source = nullptr;
+    tiles_checked.clear();
+    tiles_empty.clear();
+}
+
+bool GPU::empty_tile(const size_t tile, const int16_t columns) {
+    const auto stamp = cycle+1;
+
+    if (tiles_checked[tile] == stamp) {
+        return tiles_empty[tile];
+    }
+
+    auto ptr = source+(tile/columns)*tiles_h*source_w+(tile%columns)*tiles_w;
+    bool empty = true;
+
+    for (int16_t y=0;y<tiles_h && empty;y++,ptr+=source_w) {
+        for (int16_t x=0;x<tiles_w;x++) {
+            if (ptr[x] != 0) {
+                empty = false;
+                break;
+            }
+        }
+    }
+
+    tiles_checked[tile] = stamp;
+    tiles_empty[tile] = empty;
+
+    return empty;
+}
+
+void GPU::tilemap(const uint8_t *map, int16_t map_w, int16_t map_h,
+                  int16_t tile_w, int16_t tile_h,
+                  int16_t scroll_x, int16_t scroll_y,
+                  int16_t x, int16_t y, int16_t w, int16_t h) {
+    if (!source || map_w <= 0 || map_h <= 0 || tile_w <= 0 || tile_h <= 0) {
+        return;
+    }
+
+    const int16_t columns = source_w/tile_w;
+    const size_t tiles = columns*(source_h/tile_h);
+
+    if (tiles == 0) {
+        return;
+    }
+
+    // Retângulo de destino dentro do clip
+    const int start_x = max(x, target_clip_start_x);
+    const int start_y = max(y, target_clip_start_y);
+    const int end_x = min(x+w, (int)target_clip_end_x);
+    const int end_y = min(y+h, (int)target_clip_end_y);
+
+    if (start_x >= end_x || start_y >= end_y) {
+        return;
+    }
+
+    // Outra spritesheet ou outro tamanho de tile
+    if (tiles_source != source || tiles_source_w != source_w ||
+        tiles_w != tile_w || tiles_h != tile_h || tiles_checked.size() != tiles) {
+        tiles_source = source;
+        tiles_source_w = source_w;
+        tiles_w = tile_w;
+        tiles_h = tile_h;
+        tiles_checked.assign(tiles, 0);
+        tiles_empty.assign(tiles, false);
+    }
+
+    // Tiles vazios só podem ser pulados quando a cor 0 é transparente
+    bool skip_empty[TILE_PALETTE_MASK+1];
+
+    for (uint8_t pal=0;pal<=TILE_PALETTE_MASK;pal++) {
+        skip_empty[pal] = TRANSPARENT(COLMAP1(pal<<4));
+    }
+
+    const int map_px_w = map_w*tile_w;
+    const int map_px_h = map_h*tile_h;
+
+    mark_damage(start_x, start_y, end_x-1, end_y-1);
+    pixels[GPU_PRIMITIVE_TILEMAP] += (end_x-start_x)*(end_y-start_y);
+
+    // Linha a linha da tela, um trecho de scan line por tile
+    for (int dy=start_y;dy<end_y;dy++) {
+        const int py = dy-y+scroll_y;
+
+        if (py < 0 || py >= map_px_h) {
+            continue;
+        }
+
+        const auto row = map+(py/tile_h)*map_w*TILE_CELL_SIZE;
+        const int in_y = py%tile_h;
+        const auto line = target+dy*target_w;
+
+        int dx = start_x;
+        int px = dx-x+scroll_x;
+
+        // Parte à esquerda do mapa
+        if (px < 0) {
+            dx -= px;
+            px = 0;
+        }
+
+        for (;dx<end_x && px<map_px_w;) {
+            const int in_x = px%tile_w;
+            const int span = min(tile_w-in_x, end_x-dx);
+
+            const auto cell_ptr = row+(px/tile_w)*TILE_CELL_SIZE;
+            const uint16_t cell = cell_ptr[0]|(cell_ptr[1]<<8);
+            const size_t tile = cell&TILE_INDEX_MASK;
+            const uint8_t pal = (cell>>TILE_PALETTE_SHIFT)&TILE_PALETTE_MASK;
+
+            if (tile < tiles && !(skip_empty[pal] && empty_tile(tile, columns))) {
+                const int sy = (tile/columns)*tile_h+((cell&TILE_FLIP_Y) ? tile_h-1-in_y : in_y);
+                const auto src = source+sy*source_w+(tile%columns)*tile_w;
+
+                if (cell&TILE_FLIP_X) {
+                    copy_scan_line_flipped(line+dx, src+tile_w-1-in_x, span, pal);
+                } else {
+                    copy_scan_line(line+dx, src+in_x, span, pal);
+                }
+            }
+
+            dx += span;
+            px += span;
+        }
+    }
+}
+
+void GPU::print(const char *str, size_t len,
+                int16_t x, int16_t y,
+                uint8_t pal) {
+    pal = pal&0x0F;
+
+    if (!source || x >= target_clip_end_x ||
+        y >= target_clip_end_y || y+FONT_CHAR_H <= target_clip_start_y) {
+        return;
+    }
+
+    const auto &sheet = font.get(source, source_w, source_h, cycle);
+
+    // Só as cores que aparecem na fonte passam pela paleta
+    uint8_t colors[256];
+    bool visible[256];
+
+    visible[0] = false;
+
+    for (const auto c: sheet.colors) {
+        colors[c] = COLMAP1(c+(pal<<4));
+        visible[c] = !TRANSPARENT(colors[c]);
+    }
+
+    // Com a cor 0 transparente, só os pixels da máscara são desenhados
+    const bool solid = visible[0];
+
+    // Glifos até a borda do clip
+    const size_t cells = (target_clip_end_x-x+FONT_CHAR_W-1)/FONT_CHAR_W;
+    size_t pos = 0;
+
+    text_run.clear();
+
+    while (pos < len && text_run.size() < cells) {
+        text_run.push_back(FontAtlas::glyph_of(FontAtlas::decode(str, len, pos)));
+    }
+
+    const int16_t first_row = max<int16_t>(target_clip_start_y-y, 0);
+    const int16_t last_row = min<int16_t>(target_clip_end_y-y, FONT_CHAR_H);
+
+    mark_damage(x, y+first_row, x+(int16_t)(text_run.size()*FONT_CHAR_W)-1, y+last_row-1);
+    pixels[GPU_PRIMITIVE_TEXT] += text_run.size()*FONT_CHAR_W*max(last_row-first_row, 0);
+
+    // Uma linha de pixels por vez, atravessando todos os glifos
+    for (int16_t row=first_row;row<last_row;row++) {
+        const auto line = target+(y+row)*target_w;
+
+        for (size_t i=0;i<text_run.size();i++) {
+            const int16_t gx = x+i*FONT_CHAR_W;
+
+            if (text_run[i] == FONT_NO_GLYPH || gx+FONT_CHAR_W <= target_clip_start_x) {
+                continue;
+            }
+
+            const auto &glyph = sheet.glyphs[text_run[i]];
+
+            if (glyph.empty && !solid) {
+                continue;
+            }
+
+            const auto pixels = glyph.pixels+row*FONT_CHAR_W;
+            const uint8_t mask = solid ? 0xFF : glyph.mask[row];
+
+            // Inteiro dentro do clip?
+            const bool inside = gx >= target_clip_start_x && gx+FONT_CHAR_W <= target_clip_end_x;
+
+            for (int16_t px=0;mask>>px;px++) {
+                const auto c = pixels[px];
+
+                if (!(mask&(1<<px)) || !visible[c]) {
+                    continue;
+                }
+
+                if (inside || (gx+px >= target_clip_start_x && gx+px < target_clip_end_x)) {
+                    line[gx+px] = colors[c];
+                }
+            }
+        }
+    }
+}
+
+void GPU::set_target(uint8_t *surface, int16_t w, int16_t h) {
+    target = surface;
+    target_w = w;
+    target_h = h;
+
+    // O clip anterior era de outra área
+    target_clip_start_x = 0;
+    target_clip_start_y = 0;
+    target_clip_end_x = w;
+    target_clip_end_y = h;
+}
+
+void GPU::reset_target() {
+    set_target(video_memory, GPU_VIDEO_WIDTH, GPU_VIDEO_HEIGHT);
+}
+
+bool GPU::drawing_to(const uint8_t *surface) const {
+    return target == surface;
+}
+
 void GPU::clip(int16_t x, int16_t y,
                int16_t w, int16_t h) {
     if (x >= target_w || y >= target_h) {
@@ -986,6 +1739,10 @@ void GPU::clip(int16_t x, int16_t y,
     target_clip_end_y = dy;
 }
 
+void GPU::map_color(uint8_t from, uint8_t to) {
+    COLMAP1(from) = to;
+}
+
 void GPU::clear(uint8_t color) {
     if (TRANSPARENT(color))
         return;
@@ -997,6 +1754,10 @@ void GPU::clear(uint8_t color) {
 
         // Seta tudo com um só memset
         memset(ptr, COLMAP1(color), len);
+
+        mark_damage(target_clip_start_x, target_clip_start_y,
+                    target_clip_end_x-1, target_clip_end_y-1);
+        pixels[GPU_PRIMITIVE_CLEAR] += len;
     } else {
         const auto w = target_clip_end_x-target_clip_start_x;
         const auto h = target_clip_end_y-target_clip_start_y;
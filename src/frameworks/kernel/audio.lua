@@ -2,6 +2,7 @@ local hw = require('frameworks.kernel.hw')
 local audio = {}
 
 local audio_addr = 96768
+local stats_addr = 98714
 
 local ch = 0
 
@@ -84,6 +85,29 @@ local function noteoff(n)
   hw.enqueue_command(t, ch, 2, n, 0)
 end
 
+-- Latência do áudio: blocos sintetizados à frente e se
+-- devem aumentar/diminuir automaticamente
+local function latency(depth, dynamic)
+  if depth then
+    hw.write(stats_addr+6, string.char(depth))
+  end
+
+  if dynamic ~= nil then
+    hw.write(stats_addr+7, string.char(dynamic and 1 or 0))
+  end
+end
+
+local function stats()
+  local data = hw.read(stats_addr, 8)
+
+  return {
+    underruns = data:byte(1)+data:byte(2)*256+data:byte(3)*65536+data:byte(4)*16777216,
+    buffered = data:byte(5)+data:byte(6)*256,
+    depth = data:byte(7),
+    dynamic = data:byte(8) == 1,
+  }
+end
+
 audio.encode = encode
 audio.channel = channel
 audio.envelope = envelope
@@ -92,5 +116,7 @@ audio.reverb = reverb
 audio.route = route
 audio.noteon = noteon
 audio.noteoff = noteoff
+audio.latency = latency
+audio.stats = stats
 
 return audio
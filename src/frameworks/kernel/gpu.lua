@@ -1,6 +1,12 @@
 local hw = require('frameworks.kernel.hw')
 local gpu = {}
 
+local FRAME_STATS = 98722
+
+local function u32(data, i)
+    return data:byte(i)+data:byte(i+1)*256+data:byte(i+2)*65536+data:byte(i+3)*16777216
+end
+
 function gpu.swap_colors(a, b)
     if b == nil then
         b = a
@@ -74,5 +80,19 @@ function gpu.put_sheet_pixel(sheet_location, sheet_w, sheet_h, x, y, color)
     return hw.write(y*sheet_w+x+sheet_location, string.char(color%128))
 end
 
+-- Tempos de frame em microssegundos
+function gpu.frame_stats()
+    local data = hw.read(FRAME_STATS, 24)
+
+    return {
+        min = u32(data, 1),
+        avg = u32(data, 5),
+        p99 = u32(data, 9),
+        max = u32(data, 13),
+        frames = u32(data, 17),
+        dropped = u32(data, 21),
+    }
+end
+
 return gpu
 
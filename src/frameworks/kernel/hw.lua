@@ -12,37 +12,144 @@ typedef struct LuaString {
 } LuaString;
 
 void kernel_api_shutdown();
+int kernel_api_debug();
+int kernel_api_isolate_apps();
+double kernel_api_time();
+int kernel_api_enter();
+void kernel_api_leave();
 
 size_t kernel_api_read(char*, const size_t, const size_t);
 size_t kernel_api_write(const size_t, const size_t, const char*);
 
 void kernel_api_load_spritesheet(const char*, size_t*, int*, int*);
-void kernel_api_save_spritesheet(const size_t, const int, const int, const char*);
+size_t kernel_api_save_spritesheet(const size_t, const int, const int, const char*);
 void kernel_api_use_spritesheet(const size_t, const int, const int);
 void kernel_api_unload_spritesheet(const size_t);
-
-void gpu_api_clear(uint8_t);
-void gpu_api_clip(int16_t, int16_t, int16_t, int16_t);
-
-void gpu_api_sprite(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-
-void gpu_api_rect_fill(int16_t, int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_tri_fill(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_circle_fill(int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_quad_fill(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-
-void gpu_api_line(int16_t, int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_rect(int16_t, int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_tri(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_circle(int16_t, int16_t, int16_t, uint8_t);
-void gpu_api_quad(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
+size_t kernel_api_own_spritesheet(const size_t);
+void kernel_api_load_binary(const char*, size_t*, size_t*);
+void kernel_api_unload_binary(const size_t);
+
+size_t kernel_api_new_surface(const int, const int);
+void kernel_api_free_surface(const size_t);
+
+size_t kernel_api_load_async(const char*);
+int kernel_api_load_status(const size_t);
+void kernel_api_load_wait(const size_t);
+LuaString* kernel_api_load_result(const size_t);
+
+size_t kernel_api_save_file(const char*, const char*, const size_t, const int);
+int kernel_api_save_status(const size_t);
+
+void gpu_api_clear(double);
+void gpu_api_clip(double, double, double, double);
+void gpu_api_draw_to(const size_t, const int, const int);
+void gpu_api_draw_surface(const size_t, const int, const int, double, double, double, double, double, double, double);
+void gpu_api_tilemap(const size_t, double, double, double, double, double, double, double, double, double, double);
+
+void gpu_api_sprite(double, double, double, double, double, double, double);
+void gpu_api_spr(double, double, double, double, double);
+void gpu_api_slice(double, double, double, double, double, double, double, double, double, double, double, double, double);
+void gpu_api_print(const char*, const size_t, double, double, double);
+
+size_t gpu_api_measure(const char*, const size_t);
+size_t gpu_api_fit(const char*, const size_t, double);
+size_t gpu_api_wrap(const char*, const size_t, double, size_t*, const size_t);
+
+void gpu_api_rect_fill(double, double, double, double, double);
+void gpu_api_tri_fill(double, double, double, double, double, double, double);
+void gpu_api_circle_fill(double, double, double, double);
+void gpu_api_rounded_rect_fill(double, double, double, double, double, double, double);
+void gpu_api_rounded_rect(double, double, double, double, double, double, double);
+void gpu_api_quad_fill(double, double, double, double, double, double, double, double, double);
+
+void gpu_api_line(double, double, double, double, double);
+void gpu_api_rect(double, double, double, double, double);
+void gpu_api_tri(double, double, double, double, double, double, double);
+void gpu_api_circle(double, double, double, double);
+void gpu_api_quad(double, double, double, double, double, double, double, double, double);
 
 void gpu_api_set_cursor(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, uint8_t);
 
+void compositor_api_frame();
+int compositor_api_begin(const int32_t, double, double, double, double);
+void compositor_api_end(const int32_t);
+void compositor_api_redraw(const int32_t);
+void compositor_api_animate(const int32_t, const int);
+void compositor_api_remove(const int32_t);
+
+typedef struct __attribute__((packed)) ProfilerStatistics {
+    uint8_t enabled;
+    uint8_t overlay;
+    uint8_t tracing;
+    uint8_t process_count;
+    uint32_t frame;
+    uint32_t calls[5];
+    uint32_t pixels[7];
+    uint32_t triggers;
+    uint32_t upload;
+    uint32_t audio_callback;
+    uint32_t audio_callback_max;
+    uint32_t audio_synthesis;
+    uint32_t audio_underruns;
+    struct __attribute__((packed)) {
+        int32_t pid;
+        uint32_t time[5];
+    } processes[16];
+} ProfilerStatistics;
+
+size_t profiler_api_statistics();
+int profiler_api_enabled();
+void profiler_api_begin(const int32_t, const int);
+void profiler_api_end();
+void profiler_api_name(const int32_t, const char*);
+void profiler_api_overlay(const int);
+void profiler_api_trace_start();
+size_t profiler_api_trace_stop(const char*);
+int profiler_api_sample(const int32_t, const char*, const double, const char*);
+
+typedef struct WidgetProps {
+    double x, y, w, h;
+    double radius, z, border_size;
+    double shadow_color, border_color, background;
+    double palette, text_palette;
+    double padding_top, padding_left, padding_bottom, padding_right;
+    double clip_to;
+    double slices[8];
+    uint8_t slice_count;
+    uint8_t text_align, vertical_align;
+    uint8_t custom;
+    uint8_t cmap_count;
+    uint8_t cmap[16];
+} WidgetProps;
+
+int32_t ui_api_create();
+void ui_api_destroy(const int32_t);
+void ui_api_set_props(const int32_t, const WidgetProps*);
+void ui_api_set_content(const int32_t, const char*, const size_t);
+void ui_api_set_children(const int32_t, const int32_t*, const size_t);
+int32_t ui_api_render(const int32_t, const int32_t, const int, double, double, double, double);
+
 LuaString* api_list_files(const char*, size_t*, int*);
+
+typedef struct FileEntry {
+    const char* name;
+    size_t name_length;
+    uint64_t size;
+    int64_t mtime;
+    uint8_t type;
+} FileEntry;
+
+typedef struct FileListing {
+    size_t count;
+    int more;
+    FileEntry* entries;
+} FileListing;
+
+FileListing* api_list_entries(const char*, const size_t, const size_t);
 int api_create_directory(const char*);
 int api_touch_file(const char*);
 int api_create_file(const char*);
+int api_file_info(const char*, int64_t*, size_t*);
 
 int gpu_start_capturing(const char*);
 int gpu_stop_capturing();
@@ -79,210 +186,470 @@ function hw.unload_spritesheet(ptr)
     ffi.C.kernel_api_unload_spritesheet(ptr)
 end
 
+-- Spritesheets carregadas são compartilhadas; antes de escrever numa
+-- delas, pegue uma cópia exclusiva (pode mudar de posição)
+function hw.own_spritesheet(ptr)
+    return tonumber(ffi.C.kernel_api_own_spritesheet(ptr))
+end
+
+-- Salva em segundo plano; retorna o pedido para hw.save_status
 function hw.save_spritesheet(ptr, w, h, sheet)
-    ffi.C.kernel_api_save_spritesheet(ptr, w, h, sheet)
+    return tonumber(ffi.C.kernel_api_save_spritesheet(ptr, w, h, sheet))
+end
+
+-- Escrita em segundo plano: o arquivo é trocado de uma vez só quando
+-- estiver completo, e salvar de novo antes disso substitui o pedido
+
+local SAVE_STATES = { [0] = 'pending', 'done', 'failed' }
+
+-- Com `untracked`, ninguém vai perguntar pelo resultado: não há pedido
+-- (retorna 0)
+function hw.save_file(file, data, untracked)
+    return tonumber(ffi.C.kernel_api_save_file(file, data, #data, untracked and 0 or 1))
+end
+
+-- 'done' e 'failed' são informados uma vez só
+function hw.save_status(id)
+    return SAVE_STATES[ffi.C.kernel_api_save_status(id)]
 end
 
 function hw.use_spritesheet(ptr, w, h)
     ffi.C.kernel_api_use_spritesheet(ptr, w, h)
 end
 
+function hw.load_binary(file)
+    local ptr, length = ffi.new('size_t[1]'), ffi.new('size_t[1]')
+
+    ffi.C.kernel_api_load_binary(file, ptr, length)
+
+    if ptr[0] == ffi.cast('size_t', -1) then
+        return nil
+    end
+
+    return tonumber(ptr[0]), tonumber(length[0])
+end
+
+function hw.unload_binary(ptr)
+    ffi.C.kernel_api_unload_binary(ptr)
+end
+
+-- Superfícies ficam na memória do console, uma cor por byte, começando
+-- transparentes (cor 0)
+function hw.new_surface(w, h)
+    local ptr = ffi.C.kernel_api_new_surface(w, h)
+
+    if ptr == ffi.cast('size_t', -1) then
+        return nil
+    end
+
+    return tonumber(ptr)
+end
+
+function hw.free_surface(ptr)
+    ffi.C.kernel_api_free_surface(ptr)
+end
+
+-- Carregamento em segundo plano. Spritesheets (.png/.nsh) vão para o
+-- cache de imagens, e o próximo load_spritesheet delas é imediato.
+
+local LOAD_STATES = { [0] = 'pending', 'done', 'failed' }
+
+function hw.load_async(file)
+    return tonumber(ffi.C.kernel_api_load_async(file))
+end
+
+function hw.load_status(id)
+    return LOAD_STATES[ffi.C.kernel_api_load_status(id)]
+end
+
+function hw.load_wait(id)
+    ffi.C.kernel_api_load_wait(id)
+
+    return hw.load_status(id)
+end
+
+-- Descarta o pedido, retornando o conteúdo se já tiver terminado
+function hw.load_result(id)
+    local result = ffi.C.kernel_api_load_result(id)
+
+    if result == nil then
+        return nil
+    end
+
+    local data = ffi.string(result.ptr, result.len)
+
+    ffi.C.free(result.ptr)
+    ffi.C.free(result)
+
+    return data
+end
+
 -- GPU
 
+-- Arredondamento, clipping e módulo de paleta e cor são feitos no C++;
+-- os wrappers só preenchem os valores padrão
+
 local DEFAULT_COLOR = 0x00
 local DEFAULT_PAL   = 0x00
-local PAL_NUM       = 0x08
-local SPR_W         = 0x10
-local SPR_H         = 0x10
+local DEFAULT_CH_W  = 8
 
 function hw.spr(x, y, sprx, spry, pal)
-    assert(x, "spr() needs a x value")
-    assert(y, "spr() needs a y value")
-    assert(sprx, "spr() needs a sprx value")
-    assert(spry, "spr() needs a spry value")
-
-    -- Paleta padrão
-    pal = pal or DEFAULT_PAL 
-    -- Garante que todos são inteiros e a paleta é entre 0-7
-    x, y = math.floor(x), math.floor(y)
-    sprx, spry = math.floor(sprx), math.floor(spry)
-    pal = math.floor(pal)%PAL_NUM
-    -- Sprites para pixels
-    sprx, spry = sprx*SPR_W, spry*SPR_H
-
-    -- Envia para a GPU
-    ffi.C.gpu_api_sprite(sprx, spry, x, y, SPR_W, SPR_H, pal)
+    ffi.C.gpu_api_spr(x, y, sprx, spry, pal or DEFAULT_PAL)
 end
 
 function hw.pspr(x, y, sx, sy, w, h, pal)
-    assert(x, "pspr() needs a x value")
-    assert(y, "pspr() needs a y value")
-    assert(sx, "pspr() needs a sx value")
-    assert(sy, "pspr() needs a sy value")
-    assert(w, "pspr() needs a w value")
-    assert(h, "pspr() needs a h value")
+    ffi.C.gpu_api_sprite(sx, sy, x, y, w, h, pal or DEFAULT_PAL)
+end
 
-    pal = pal or DEFAULT_PAL
-    x, y = math.floor(x), math.floor(y)
-    sx, sy = math.floor(sx), math.floor(sy)
-    pal = math.floor(pal)%PAL_NUM
+-- Sprite esticado em 9 partes: cortes nas colunas sl1 e sl2 e nas
+-- linhas sl3 e sl4 do sprite; os meios se repetem até encher w x h
+function hw.slice9(x, y, w, h, sx, sy, sw, sh, sl1, sl2, sl3, sl4, pal)
+    ffi.C.gpu_api_slice(sx, sy, sw, sh, sl1, sl2, sl3, sl4, x, y, w, h, pal or DEFAULT_PAL)
+end
 
-    ffi.C.gpu_api_sprite(sx, sy, x, y, w, h, pal)
+-- Só na horizontal, com a altura do sprite
+function hw.slice3(x, y, w, h, sx, sy, sw, sh, sl1, sl2, pal)
+    ffi.C.gpu_api_slice(sx, sy, sw, sh, sl1, sl2, sh, sh, x, y, w, h, pal or DEFAULT_PAL)
 end
 
 function hw.clip(x, y, w, h)
     ffi.C.gpu_api_clip(x, y, w, h)
 end
 
+-- Sem superfície, volta a desenhar na tela. Trocar o alvo reinicia o clip
+function hw.draw_to(ptr, w, h)
+    if ptr then
+        ffi.C.gpu_api_draw_to(ptr, w, h)
+    else
+        ffi.C.gpu_api_draw_to(0, 0, 0)
+    end
+end
+
+-- Cola uma parte da superfície, como um sprite
+function hw.draw_surface(ptr, surface_w, surface_h, x, y, sx, sy, w, h, pal)
+    ffi.C.gpu_api_draw_surface(ptr, surface_w, surface_h, sx or 0, sy or 0,
+                               x, y, w or surface_w, h or surface_h,
+                               pal or DEFAULT_PAL)
+end
+
 function hw.set_cursor(x, y, w, h, hx, hy, pal)
     ffi.C.gpu_api_set_cursor(x, y, w or 16, h or 16, hx or 0, hy or 0, pal or 0)
 end
 
 function hw.line(x1, y1, x2, y2, color)
-    assert(x1, "line() needs a x1 value")
-    assert(y1, "line() needs a y1 value")
-    assert(x2, "line() needs a x2 value")
-    assert(y2, "line() needs a y2 value")
+    ffi.C.gpu_api_line(x1, y1, x2, y2, color or DEFAULT_COLOR)
+end
 
-    color = color or DEFAULT_COLOR
+function hw.rect_fill(x, y, w, h, color)
+    ffi.C.gpu_api_rect_fill(x, y, w, h, color or DEFAULT_COLOR)
+end
 
-    ffi.C.gpu_api_line(x1, y1, x2, y2, color)
+function hw.circle_fill(x, y, r, color)
+    ffi.C.gpu_api_circle_fill(x, y, r, color or DEFAULT_COLOR)
 end
 
-function hw.rect_fill(x, y, w, h, color)
-    assert(x, "rectf() needs a x value")
-    assert(y, "rectf() needs a y value")
-    assert(w, "rectf() needs a w value")
-    assert(h, "rectf() needs a h value")
+-- Com `pal` a cor passa pela paleta, como nos sprites; sem ela é usada
+-- como no rect_fill
+function hw.rounded_rect_fill(x, y, w, h, r, color, pal)
+    ffi.C.gpu_api_rounded_rect_fill(x, y, w, h, r, color or DEFAULT_COLOR, pal or -1)
+end
 
-    color = color or DEFAULT_COLOR
+function hw.rounded_rect(x, y, w, h, r, color, pal)
+    ffi.C.gpu_api_rounded_rect(x, y, w, h, r, color or DEFAULT_COLOR, pal or -1)
+end
 
-    ffi.C.gpu_api_rect_fill(x, y, w, h, color)
+function hw.quad_fill(x1, y1, x2, y2, x3, y3, x4, y4, color)
+    ffi.C.gpu_api_quad_fill(x1, y1, x2, y2, x3, y3, x4, y4, color or DEFAULT_COLOR)
 end
 
-function hw.circle_fill(x, y, r, color)
-    assert(x, "circf() needs a x value")
-    assert(y, "circf() needs a y value")
-    assert(r, "circf() needs a r value")
+function hw.tri_fill(x1, y1, x2, y2, x3, y3, color)
+    ffi.C.gpu_api_tri_fill(x1, y1, x2, y2, x3, y3, color or DEFAULT_COLOR)
+end
 
-    color = color or DEFAULT_COLOR
+function hw.rect(x, y, w, h, color)
+    ffi.C.gpu_api_rect(x, y, w, h, color or DEFAULT_COLOR)
+end
 
-    ffi.C.gpu_api_circle_fill(x, y, r, color)
+function hw.circle(x, y, r, color)
+    ffi.C.gpu_api_circle(x, y, r, color or DEFAULT_COLOR)
 end
 
-function hw.quad_fill(x1, y1, x2, y2, x3, y3, x4, y4, color)
-    assert(x1, "quadf() needs a x1 value")
-    assert(y1, "quadf() needs a y1 value")
-    assert(x2, "quadf() needs a x2 value")
-    assert(y2, "quadf() needs a y2 value")
-    assert(x3, "quadf() needs a x3 value")
-    assert(y3, "quadf() needs a y3 value")
-    assert(x4, "quadf() needs a x4 value")
-    assert(y4, "quadf() needs a y4 value")
+function hw.quad(x1, y1, x2, y2, x3, y3, x4, y4, color)
+    ffi.C.gpu_api_quad(x1, y1, x2, y2, x3, y3, x4, y4, color or DEFAULT_COLOR)
+end
 
-    color = color or DEFAULT_COLOR
+function hw.tri(x1, y1, x2, y2, x3, y3, color)
+    ffi.C.gpu_api_tri(x1, y1, x2, y2, x3, y3, color or DEFAULT_COLOR)
+end
 
-    ffi.C.gpu_api_quad_fill(x1, y1, x2, y2, x3, y3, x4, y4, color)
+function hw.clr(color)
+    ffi.C.gpu_api_clear(color or DEFAULT_COLOR)
 end
 
-function hw.tri_fill(x1, y1, x2, y2, x3, y3, color)
-    assert(x1, "quadf() needs a x1 value")
-    assert(y1, "quadf() needs a y1 value")
-    assert(x2, "quadf() needs a x2 value")
-    assert(y2, "quadf() needs a y2 value")
-    assert(x3, "quadf() needs a x3 value")
-    assert(y3, "quadf() needs a y3 value")
+-- Mapas: células de 16 bits little-endian na memória do console, com
+-- o índice do tile (bits 0-9), flip x (10), flip y (11) e paleta (12-14)
+
+local TILE_FLIP_X = 0x0400
+local TILE_FLIP_Y = 0x0800
+
+function hw.map_cell(tile, pal, flip_x, flip_y)
+    local cell = bit.band(tile, 0x03FF)+bit.lshift(bit.band(pal or DEFAULT_PAL, 0x07), 12)
 
-    color = color or DEFAULT_COLOR
+    if flip_x then cell = cell+TILE_FLIP_X end
+    if flip_y then cell = cell+TILE_FLIP_Y end
 
-    ffi.C.gpu_api_tri_fill(x1, y1, x2, y2, x3, y3, color)
+    return cell
 end
 
-function hw.rect(x, y, w, h, color)
-    assert(x, "rectf() needs a x value")
-    assert(y, "rectf() needs a y value")
-    assert(w, "rectf() needs a w value")
-    assert(h, "rectf() needs a h value")
+-- Desenha o mapa inteiro numa chamada só; por padrão com tiles 16x16,
+-- sem scroll e na tela toda
+function hw.tilemap(ptr, map_w, map_h, tile_w, tile_h, scroll_x, scroll_y, x, y, w, h)
+    ffi.C.gpu_api_tilemap(ptr, map_w, map_h,
+                          tile_w or 16, tile_h or 16,
+                          scroll_x or 0, scroll_y or 0,
+                          x or 0, y or 0, w or 400, h or 240)
+end
 
-    color = color or DEFAULT_COLOR
+-- Texto em UTF-8; cada codepoint ocupa uma célula da fonte padrão
 
-    ffi.C.gpu_api_rect(x, y, w, h, color)
+function hw.print(str, dstx, dsty, pal)
+    ffi.C.gpu_api_print(str, #str, dstx, dsty, pal or DEFAULT_PAL)
 end
 
-function hw.circle(x, y, r, color)
-    assert(x, "circf() needs a x value")
-    assert(y, "circf() needs a y value")
-    assert(r, "circf() needs a r value")
+-- Largura em pixels
+function hw.measure(str)
+    return tonumber(ffi.C.gpu_api_measure(str, #str))
+end
+
+-- Quantos bytes do começo de `str` cabem em `width` pixels
+function hw.fit(str, width)
+    return tonumber(ffi.C.gpu_api_fit(str, #str, width))
+end
 
-    color = color or DEFAULT_COLOR
+-- Quebra `str` em linhas de até `width` pixels, de preferência nos espaços
+function hw.wrap(str, width)
+    local starts = ffi.new('size_t[?]', #str+1)
+    local count = tonumber(ffi.C.gpu_api_wrap(str, #str, width, starts, #str+1))
+    local lines = {}
+
+    for i=0,count-1 do
+        local from = tonumber(starts[i])+1
+        local to = i+1 < count and tonumber(starts[i+1]) or #str
+
+        lines[i+1] = (str:sub(from, to):gsub('\n$', ''))
+    end
 
-    ffi.C.gpu_api_circle(x, y, r, color)
+    return lines
 end
 
-function hw.quad(x1, y1, x2, y2, x3, y3, x4, y4, color)
-    assert(x1, "quadf() needs a x1 value")
-    assert(y1, "quadf() needs a y1 value")
-    assert(x2, "quadf() needs a x2 value")
-    assert(y2, "quadf() needs a y2 value")
-    assert(x3, "quadf() needs a x3 value")
-    assert(y3, "quadf() needs a y3 value")
-    assert(x4, "quadf() needs a x4 value")
-    assert(y4, "quadf() needs a y4 value")
+-- Compositor: cada processo com draw() é uma janela, pelo pid
 
-    color = color or DEFAULT_COLOR
+function hw.compose_frame()
+    ffi.C.compositor_api_frame()
+end
 
-    ffi.C.gpu_api_quad(x1, y1, x2, y2, x3, y3, x4, y4, color)
+-- Retorna se o draw() do processo precisa rodar nessa passada
+function hw.window_begin(pid, x, y, w, h)
+    return ffi.C.compositor_api_begin(pid, x, y, w, h) ~= 0
 end
 
-function hw.tri(x1, y1, x2, y2, x3, y3, color)
-    assert(x1, "quadf() needs a x1 value")
-    assert(y1, "quadf() needs a y1 value")
-    assert(x2, "quadf() needs a x2 value")
-    assert(y2, "quadf() needs a y2 value")
-    assert(x3, "quadf() needs a x3 value")
-    assert(y3, "quadf() needs a y3 value")
+function hw.window_end(pid)
+    ffi.C.compositor_api_end(pid)
+end
+
+function hw.window_redraw(pid)
+    ffi.C.compositor_api_redraw(pid)
+end
 
-    color = color or DEFAULT_COLOR
+function hw.window_animate(pid, animating)
+    ffi.C.compositor_api_animate(pid, animating and 1 or 0)
+end
 
-    ffi.C.gpu_api_tri(x1, y1, x2, y2, x3, y3, color)
+function hw.window_remove(pid)
+    ffi.C.compositor_api_remove(pid)
 end
 
-function hw.clr(color)
-    color = color or DEFAULT_COLOR
+-- Profiler
 
-    color = math.floor(color)%128
+local PROFILER_SECTIONS = { init = 0, update = 1, draw = 2, audio_tick = 3, gc = 4 }
+local PROFILER_APIS = { 'kernel', 'gpu', 'audio', 'ui', 'compositor' }
+local PROFILER_PRIMITIVES = { 'line', 'circle', 'fill', 'sprite', 'tilemap', 'text', 'clear' }
 
-    ffi.C.gpu_api_clear(color)
+-- Os tempos por processo só são medidos com o profiler ligado
+function hw.profiling()
+    return ffi.C.profiler_api_enabled() ~= 0
 end
 
-local DEFAULT_FT_W = 10
-local DEFAULT_FT_H = 10
-local DEFAULT_CH_W = 8
-local DEFAULT_CH_H = 8
-local DEFAULT_FT_CHARS = "1234567890ABCDEFGHIJKLMNOPQRSTUVWXYZ.,!?abcdefghijklmnopqrstuvwxyz()[]<>{}\"\"'-_=\\/|&~*%@$#:;+"..string.char(1)..string.char(2)..string.char(3)..string.char(4)..string.char(5)..string.char(6)..string.char(7)..string.char(8)..string.char(9)..string.char(10)..string.char(11)..string.char(12)..string.char(13)..string.char(14)..string.char(15)..string.char(16)..string.char(17).." "
+function hw.profile_begin(pid, section)
+    ffi.C.profiler_api_begin(pid, PROFILER_SECTIONS[section])
+end
 
-function hw.print(str, dstx, dsty, pal)
-    assert(str, "print() needs a str value")
-    assert(dstx, "print() needs a x value")
-    assert(dsty, "print() needs a y value")
+function hw.profile_end()
+    ffi.C.profiler_api_end()
+end
 
-    for i=1,#str do
-        local ch = str:sub(i, i)
-        local index, _ = DEFAULT_FT_CHARS:find(ch, 1, true)
+-- Nome do processo no trace
+function hw.profile_name(pid, name)
+    ffi.C.profiler_api_name(pid, name)
+end
+
+function hw.profiler_overlay(show)
+    ffi.C.profiler_api_overlay(show and 1 or 0)
+end
+
+function hw.trace_start()
+    ffi.C.profiler_api_trace_start()
+end
 
-        if index ~= nil then
-            local px = math.floor((index-1)%DEFAULT_FT_W)*DEFAULT_CH_W
-            local py = math.floor((index-1)/DEFAULT_FT_W)*DEFAULT_CH_H
+-- Retorna o pedido para hw.save_status, ou nil sem trace gravando
+function hw.trace_stop(file)
+    local id = ffi.C.profiler_api_trace_stop(file)
 
-            hw.pspr(dstx, dsty, px, py, DEFAULT_CH_W, DEFAULT_CH_H, pal)
+    if id == ffi.cast('size_t', -1) then
+        return nil
+    end
+
+    return tonumber(id)
+end
+
+local SAMPLE_ERRORS = {
+    'already being sampled',
+    'runs on a worker thread and cannot be sampled',
+}
+
+-- Amostra as pilhas do processo e salva em `file` depois de
+-- `seconds`; falso e o motivo se não pode amostrar
+function hw.sample(pid, name, seconds, file)
+    local status = ffi.C.profiler_api_sample(pid, name, seconds, file)
+
+    if status ~= 0 then
+        return false, SAMPLE_ERRORS[status]
+    end
+
+    return true
+end
+
+-- Última frame completa; tempos em microssegundos
+function hw.profiler_stats()
+    local data = hw.read(tonumber(ffi.C.profiler_api_statistics()), ffi.sizeof('ProfilerStatistics'))
+    local s = ffi.cast('const ProfilerStatistics*', data)
+
+    local stats = {
+        enabled = s.enabled ~= 0,
+        overlay = s.overlay ~= 0,
+        tracing = s.tracing ~= 0,
+        frame = s.frame,
+        calls = {},
+        pixels = {},
+        triggers = s.triggers,
+        upload = s.upload,
+        audio_callback = s.audio_callback,
+        audio_callback_max = s.audio_callback_max,
+        audio_synthesis = s.audio_synthesis,
+        audio_underruns = s.audio_underruns,
+        processes = {},
+    }
+
+    for i, name in ipairs(PROFILER_APIS) do
+        stats.calls[name] = s.calls[i-1]
+    end
+
+    for i, name in ipairs(PROFILER_PRIMITIVES) do
+        stats.pixels[name] = s.pixels[i-1]
+    end
+
+    for i=0,s.process_count-1 do
+        local p = s.processes[i]
+        local entry = { pid = p.pid }
+
+        for name, section in pairs(PROFILER_SECTIONS) do
+            entry[name] = p.time[section]
         end
 
-        dstx = dstx+DEFAULT_CH_W
+        table.insert(stats.processes, entry)
     end
+
+    return stats
 end
 
-function hw.measure(str)
-    return #str*DEFAULT_CH_W
+-- Widgets do nibui, desenhados pelo C++
+
+-- Retorna o id e um handle que destrói o nó quando for coletado
+function hw.widget_node()
+    local id = ffi.C.ui_api_create()
+    local handle = ffi.gc(ffi.new('int32_t[1]', id), function(h)
+        ffi.C.ui_api_destroy(h[0])
+    end)
+
+    return id, handle
+end
+
+-- Struct para preencher antes de hw.widget_update
+function hw.widget_props()
+    return ffi.new('WidgetProps')
+end
+
+function hw.widget_update(id, props)
+    ffi.C.ui_api_set_props(id, props)
+end
+
+function hw.widget_content(id, str)
+    ffi.C.ui_api_set_content(id, str, #str)
+end
+
+function hw.widget_children(id, ids)
+    ffi.C.ui_api_set_children(id, ffi.new('int32_t[?]', #ids, ids), #ids)
+end
+
+-- Retorna o próximo widget com `draw` próprio, ou -1
+function hw.widget_render(root, resume, dirty, x, y, w, h)
+    return ffi.C.ui_api_render(root, resume, dirty and 1 or 0, x, y, w, h)
+end
+
+-- No kernel compilado em modo debug, os argumentos obrigatórios são
+-- conferidos antes de ir para o C++, com as mensagens de sempre
+
+local REQUIRED = {
+    spr = { 'spr', 'x', 'y', 'sprx', 'spry' },
+    pspr = { 'pspr', 'x', 'y', 'sx', 'sy', 'w', 'h' },
+    clip = { 'clip', 'x', 'y', 'w', 'h' },
+    line = { 'line', 'x1', 'y1', 'x2', 'y2' },
+    rect_fill = { 'rectf', 'x', 'y', 'w', 'h' },
+    circle_fill = { 'circf', 'x', 'y', 'r' },
+    rounded_rect_fill = { 'fill_rrect', 'x', 'y', 'w', 'h', 'r' },
+    rounded_rect = { 'rrect', 'x', 'y', 'w', 'h', 'r' },
+    slice9 = { 'nine_slice', 'x', 'y', 'w', 'h', 'sx', 'sy', 'sw', 'sh', 'sl1', 'sl2', 'sl3', 'sl4' },
+    slice3 = { 'three_slice', 'x', 'y', 'w', 'h', 'sx', 'sy', 'sw', 'sh', 'sl1', 'sl2' },
+    quad_fill = { 'quadf', 'x1', 'y1', 'x2', 'y2', 'x3', 'y3', 'x4', 'y4' },
+    tri_fill = { 'trif', 'x1', 'y1', 'x2', 'y2', 'x3', 'y3' },
+    rect = { 'rect', 'x', 'y', 'w', 'h' },
+    circle = { 'circ', 'x', 'y', 'r' },
+    quad = { 'quad', 'x1', 'y1', 'x2', 'y2', 'x3', 'y3', 'x4', 'y4' },
+    tri = { 'tri', 'x1', 'y1', 'x2', 'y2', 'x3', 'y3' },
+    tilemap = { 'draw_map', 'ptr', 'map_w', 'map_h' },
+    print = { 'print', 'str', 'x', 'y' },
+    measure = { 'measure', 'str' },
+    fit = { 'fit_text', 'str', 'width' },
+    wrap = { 'wrap_text', 'str', 'width' },
+}
+
+if ffi.C.kernel_api_debug() ~= 0 then
+    for name, required in pairs(REQUIRED) do
+        local fn = hw[name]
+
+        hw[name] = function(...)
+            for i=2,#required do
+                local value = select(i-1, ...)
+                local expected = required[i] == 'str' and 'string' or 'number'
+
+                if type(value) ~= expected then
+                    error(required[1].."() needs a "..required[i].." value", 2)
+                end
+            end
+
+            return fn(...)
+        end
+    end
 end
 
 -- Funções customizadas
@@ -347,6 +714,38 @@ function hw.list(path)
     end
 end
 
+local ENTRY_TYPES = { [0] = 'file', 'directory', 'other' }
+
+-- Lista entradas (sem "." e "..") com tipo, tamanho e data de modificação.
+-- Com `limit`, lista de `offset` em diante e diz se ainda há mais.
+function hw.list_entries(path, offset, limit)
+    local listing = ffi.C.api_list_entries(path, offset or 0,
+                                           limit or ffi.cast('size_t', -1))
+
+    if listing == nil then
+        return nil
+    end
+
+    local entries = {}
+
+    for i=0,tonumber(listing.count)-1 do
+        local entry = listing.entries[i]
+
+        entries[i+1] = {
+            name = ffi.string(entry.name, entry.name_length),
+            type = ENTRY_TYPES[entry.type],
+            size = tonumber(entry.size),
+            mtime = tonumber(entry.mtime),
+        }
+    end
+
+    local more = listing.more ~= 0
+
+    ffi.C.free(listing)
+
+    return entries, more
+end
+
 function hw.create_directory(path)
     return ffi.C.api_create_directory(path) == 1
 end
@@ -359,6 +758,18 @@ function hw.create_file(path)
     return ffi.C.api_create_file(path) == 1
 end
 
+-- Data de modificação e tamanho, ou nil se o arquivo não existe
+function hw.file_info(path)
+    local c_mtime = ffi.new('int64_t[1]')
+    local c_size = ffi.new('size_t[1]')
+
+    if ffi.C.api_file_info(path, c_mtime, c_size) == 0 then
+        return nil
+    end
+
+    return tonumber(c_mtime[0]), tonumber(c_size[0])
+end
+
 function hw.start_capturing(path)
     return ffi.C.gpu_start_capturing(path) == 1
 end
@@ -375,5 +786,24 @@ function hw.shutdown()
     ffi.C.kernel_api_shutdown()
 end
 
+-- Apps fora de apps/system rodam em vms próprias?
+function hw.isolate_apps()
+    return ffi.C.kernel_api_isolate_apps() ~= 0
+end
+
+-- Microssegundos, para medir intervalos
+function hw.time()
+    return ffi.C.kernel_api_time()
+end
+
+-- Trava o console para um update num worker; false se o processo parou
+function hw.enter()
+    return ffi.C.kernel_api_enter() ~= 0
+end
+
+function hw.leave()
+    ffi.C.kernel_api_leave()
+end
+
 return hw
 
@@ -0,0 +1,229 @@
+-- Carregamento de código dos processos (Lua, Moonscript e Fennel)
+
+local hw = require('frameworks.kernel.hw')
+
+-- Moonscript
+package.loaded.moonscript = require("frameworks.kernel.moonscript")
+
+local moon_parse = require("moonscript.parse")
+local moon_compile = require("moonscript.compile")
+
+-- Fennel
+local fennel = require("frameworks.kernel.fennel")
+
+local loader = {}
+
+-- Chunks carregados por cada app (pela tabela da API dele), para o JIT
+-- poder ser desligado no app inteiro. As funções seguram a tabela pelo
+-- ambiente, então uma tabela fraca não solta nada: nib_api.free limpa
+loader.chunks = {}
+
+local function remember(fn, env)
+    local chunks = loader.chunks[env] or {}
+
+    table.insert(chunks, fn)
+    loader.chunks[env] = chunks
+end
+
+--
+-- Cache de bytecode: chunks compilados ficam em BYTECODE_CACHE e só são
+-- recompilados quando o fonte ou o compilador mudam. A primeira linha
+-- diz de qual versão do fonte o bytecode veio e quantos bytes ele tem:
+-- o LuaJIT não confere o bytecode, e um arquivo cortado derrubaria o
+-- console
+--
+
+local BYTECODE_CACHE = 'cache/bytecode/'
+
+local compilers = {
+    moon = 'frameworks/kernel/moonscript.lua',
+    fnl = 'frameworks/kernel/fennel.lua',
+}
+
+local compiler_versions = {}
+
+local function compiler_version(kind)
+    if not compiler_versions[kind] then
+        -- O formato do bytecode muda com o LuaJIT
+        local compiler = compilers[kind]
+
+        compiler_versions[kind] = jit.version..'/'..kind..'/'..
+                                  (compiler and hw.file_info(compiler) or 0)
+    end
+
+    return compiler_versions[kind]
+end
+
+-- Carrega `path`, usando `compile` (fonte -> lua) só se não houver
+-- bytecode válido no cache
+function loader.loadcached(path, kind, compile)
+    local mtime, size = hw.file_info(path)
+
+    if not mtime then
+        return nil, "No such file or directory"
+    end
+
+    local key = compiler_version(kind)..'\t'..mtime..'\t'..size..'\t'
+    local cache_path = BYTECODE_CACHE..path:gsub('[/\\:]', '_')
+
+    local cache_file = io.open(cache_path, "rb")
+
+    if cache_file then
+        local cached = cache_file:read("*all")
+        cache_file:close()
+
+        local header = cached:find('\n', 1, true)
+        local length = header and cached:sub(1, #key) == key and
+                       tonumber(cached:sub(#key+1, header-1))
+
+        if length and length == #cached-header then
+            local fn = loadstring(cached:sub(header+1), '@'..path)
+
+            if fn then
+                return fn
+            end
+        end
+    end
+
+    local source_file = io.open(path, "rb")
+
+    if not source_file then
+        return nil, "No such file or directory"
+    end
+
+    local source = source_file:read("*all")
+    source_file:close()
+
+    local ok, lua_script, err = pcall(compile, source)
+
+    if not ok then
+        return nil, lua_script
+    elseif not lua_script then
+        return nil, err
+    end
+
+    local fn, err = loadstring(lua_script, '@'..path)
+
+    if not fn then
+        return nil, err
+    end
+
+    hw.create_directory('cache')
+    hw.create_directory(BYTECODE_CACHE)
+
+    -- Pelo FileWriter: o arquivo só é trocado depois de completo
+    local bytecode = string.dump(fn)
+
+    hw.save_file(cache_path, key..#bytecode..'\n'..bytecode, true)
+
+    return fn
+end
+
+function loader.loadlua(path)
+    return loader.loadcached(path, 'lua', function(source)
+        return source
+    end)
+end
+
+function loader.loadmoon(path)
+    return loader.loadcached(path, 'moon', function(source)
+        local tree, err = moon_parse.string(source)
+
+        if not tree then
+            return nil, err
+        end
+
+        return moon_compile.tree(tree)
+    end)
+end
+
+function loader.loadfennel(path)
+    return loader.loadcached(path, 'fnl', fennel.compileString)
+end
+
+function loader.file_exists(path)
+    local file = io.open(path, "r")
+
+    if file then
+        file:close()
+
+        return true
+    end
+
+    return false
+end
+
+function loader.exec(path, env, args)
+    local fn, msg, ok
+
+    if loader.file_exists(path..".moon") then
+        fn, msg = loader.loadmoon(path..".moon")
+    elseif loader.file_exists(path..".fnl") then
+        fn, msg = loader.loadfennel(path..".fnl")
+    elseif loader.file_exists(path..".lua") then
+        fn, msg = loader.loadlua(path..".lua")
+    end
+
+    if not fn then
+       return fn, msg
+    end
+
+    return loader.exec_fn(fn, env, args)
+end
+
+function loader.sandbox_fn(fn, env)
+    if not fn then
+        return
+    end
+
+    setfenv(fn, env)
+end
+
+function loader.exec_fn(fn, env, args)
+    setfenv(fn, env)
+    remember(fn, env)
+
+    return pcall(fn, args)
+end
+
+-- require dos processos: procura no app e depois nos frameworks
+function loader.require(entrypoint, module, proc)
+    local paths = {
+        entrypoint..'/'..module:gsub("%.", "/"),
+        'frameworks/'..module:gsub("%.", "/"),
+        'frameworks/'..module:gsub("%.", "/").."/main",
+    }
+
+    local extensions = { ".lua", ".moon", ".fnl" }
+
+    local errors = {}
+
+    for _, path in ipairs(paths) do
+        for _, extension in ipairs(extensions) do
+            local fn, err
+
+            if extension == ".lua" then
+                fn, err = loader.loadlua(path..extension)
+            elseif extension == ".moon" then
+                fn, err = loader.loadmoon(path..extension)
+            elseif extension == ".fnl" then
+                fn, err = loader.loadfennel(path..extension)
+            end
+
+            if not fn then
+                table.insert(errors, 'require "'..path..'"): '..tostring(err))
+            else
+                loader.sandbox_fn(fn, proc.pub)
+                remember(fn, proc.pub)
+                return fn()
+            end
+        end
+    end
+
+    print('could not load', module, 'tried:')
+    for _, err in ipairs(errors) do
+        print(err)
+    end
+end
+
+return loader
@@ -3,39 +3,45 @@
 -- Para acessar as funções do kernel cpp
 local hw = require('frameworks.kernel.hw')
 
--- Utilitários
-local audio = require('frameworks.kernel.audio')
-local input = require('frameworks.kernel.input')
-local lang = require('frameworks.kernel.lang')
-local gpu = require('frameworks.kernel.gpu')
-local pprint = require('frameworks.kernel.pprint')
-
--- Moonscript
-package.loaded.moonscript = require("frameworks.kernel.moonscript")
-
-local moon_parse = require("moonscript.parse")
-local moon_compile = require("moonscript.compile")
-
--- Fennel
-local fennel = require("frameworks.kernel.fennel")
+local loader = require('frameworks.kernel.loader')
+local nib_api = require('frameworks.kernel.nib_api')
+local timeslice = require('frameworks.kernel.timeslice')
 
 local processes = {}
 local pid_counter = 0
 local executing_process = nil
 
+-- Processos com vm própria, por pid
+local vms = {}
+local isolate_apps = false
+
 local global_time = 0
 
+-- Funções do kernel usadas pela API dos processos (definidas no fim)
+local host
+
+-- Mede o tempo de cada processo nessa frame
+local profiling = false
+
+-- Microssegundos de updates por frame: depois disso, updates que
+-- cederam e têm prioridade menor só continuam na próxima
+local FRAME_BUDGET = 10000
+
 --
 -- Pontos de entrada a partir do cpp
 --
 
 function init()
+    isolate_apps = hw.isolate_apps()
+
     processes[0] = make_process('apps/system/init.nib', {})
 end
 
 function update(dt)
     global_time += dt
 
+    profiling = hw.profiling()
+
     exec_processes(dt)
 
     audio_tick()
@@ -91,13 +97,18 @@ function get_running_process(entrypoint)
     return nil
 end
 
-function nib_open_asset(entrypoint, asset, kind)
-    local path = entrypoint..'/'..asset:gsub("%.", "/")..'.'..kind:gsub("%.", "")
+-- A spritesheet do processo pode estar compartilhada com outros
+-- processos; copia antes da primeira escrita
+function own_spritesheet(process)
+    local sheet = process.priv.spritesheet
+    local ptr = hw.own_spritesheet(sheet.ptr)
 
-    print('loading', asset, '('..kind..')')
-    print('at', path)
+    if ptr ~= sheet.ptr then
+        sheet.ptr = ptr
+        hw.use_spritesheet(sheet.ptr, sheet.w, sheet.h)
+    end
 
-    return io.open(path, "r+")
+    return sheet
 end
 
 -- Cria um processo, composto de um conjunto de infromações acessíveis apenas ao
@@ -130,9 +141,19 @@ function make_process(entrypoint, env, group)
             h = sheet_h
         },
         external_spritesheets = {},
+        external_binaries = {},
+        surfaces = {},
+        loads = {},
         width = w, height = h,
         x = x, y = y,
-        message_queue = {},
+        -- Microssegundos nas chamadas da thread principal
+        cpu = 0,
+        -- Ordem dos updates (maior primeiro), aqui e nos workers
+        priority = env.priority or 0,
+        -- Update em andamento e segundos que ele ainda não viu
+        slice = timeslice.new(),
+        -- O update cedeu e continua na próxima frame
+        suspended = false,
         pid = pid_counter,
         parent = executing_process,
         entrypoint = entrypoint,
@@ -142,6 +163,9 @@ function make_process(entrypoint, env, group)
 
     table.insert(proc.priv.group, pid_counter)
 
+    -- A caixa de mensagens existe antes do código do app rodar
+    bus_open(pid_counter)
+
     if executing_process then
         table.insert(executing_process.priv.children, proc)
     end
@@ -155,17 +179,25 @@ function make_process(entrypoint, env, group)
     local parent_process = executing_process
     executing_process = proc
 
-    proc.pub = nib_api(entrypoint, proc, env)
-    proc.pub.env = env
-    proc.pub.env.pid = proc.priv.pid
+    hw.profile_name(pid_counter, entrypoint)
+
+    if env.isolated or (isolate_apps and not is_privileged(entrypoint)) then
+        proc.priv.ok, err = make_vm(proc, env)
+    else
+        proc.pub = nib_api.new(host, entrypoint, proc, env)
+        proc.pub.env = env
+        proc.pub.env.pid = proc.priv.pid
+
+        proc.priv.ok, err = loader.exec(entrypoint..'/main', proc.pub)
+    end
 
-    proc.priv.ok, err = exec(entrypoint..'/main', proc.pub)
     proc.priv.running = true
 
     executing_process = parent_process
 
     if not proc.priv.ok then
         if err == nil then
+            bus_close(proc.priv.pid)
             return nil
         else
             -- true = erro de sintaxe
@@ -174,199 +206,286 @@ function make_process(entrypoint, env, group)
     end
 
     -- Põe as funções que vamos chamar em sandboxes
-    sandbox_fn(proc.pub.init, proc.pub)
-    sandbox_fn(proc.pub.draw, proc.pub)
-    sandbox_fn(proc.pub.update, proc.pub)
+    if not proc.priv.vm then
+        loader.sandbox_fn(proc.pub.init, proc.pub)
+        loader.sandbox_fn(proc.pub.draw, proc.pub)
+        loader.sandbox_fn(proc.pub.update, proc.pub)
+    end
 
     return proc
 end
 
-function exec_processes(dt)
-    for p, proc in pairs(processes) do
-        if proc.priv.running then
-            exec_process(proc, dt)
+-- Roda o app numa vm Lua própria, com memória, limite e coleta de lixo
+-- separados. No kernel o processo só tem funções que chamam as do app
+-- (env.memory_limit em bytes e env.gc_budget em microssegundos por
+-- frame mudam os padrões). O update() roda num worker, a não ser com
+-- env.threaded = false
+function make_vm(proc, env)
+    local pid = proc.priv.pid
+    local call = vm_call
+
+    proc.priv.vm = true
+    proc.pub = { env = env }
+    env.pid = pid
+
+    vms[pid] = proc
+
+    local ok, callbacks, threaded = vm_new(pid, proc.priv.entrypoint, {
+        pid = pid,
+        env = env,
+        x = proc.priv.x, y = proc.priv.y,
+        width = proc.priv.width, height = proc.priv.height,
+        spritesheet = proc.priv.spritesheet,
+    }, env.memory_limit, env.gc_budget,
+    env.threaded ~= false and proc.priv.priority or nil)
+
+    proc.priv.threaded = threaded
+
+    if not ok then
+        -- Sem erro, o app não existe e o processo não vai ficar na lista
+        if callbacks == nil then
+            close_vm(proc)
         end
+
+        return false, callbacks
     end
-end
 
-function exec_process(process, dt)
-    if not process.priv.ok then
-        return
+    for _, name in ipairs(callbacks) do
+        -- Um processo parado ainda pode ter o draw() chamado nessa passada
+        proc.pub[name] = function(...)
+            if vms[pid] then
+                return call(pid, name, ...)
+            end
+        end
     end
 
-    executing_process = process
+    return true
+end
 
-    -- Usa a spritesheet do processo
-    local sheet = process.priv.spritesheet
-    hw.use_spritesheet(sheet.ptr, sheet.w, sheet.h)
+function close_vm(process)
+    if process.priv.vm then
+        vm_free(process.priv.pid)
+        vms[process.priv.pid] = nil
+    end
+end
 
-    if not process.priv.initialized then
-        if process.pub.init then
-            xpcall(process.pub.init, function (err)
-                process.priv.ok = false
-                handle_process_error(err)
-            end)
-        end
+local function syscall_return(parent, ok, ...)
+    executing_process = parent
 
-        process.priv.initialized = true
+    if not ok then
+        error(..., 0)
     end
 
-    if process.pub.update then
-        xpcall(process.pub.update, function (err)
-            process.priv.ok = false
-            handle_process_error(err)
-        end, dt)
+    return ...
+end
+
+-- Chamadas de sistema dos apps com vm própria: as funções de `host`
+-- rodam como se o app estivesse executando aqui
+function vm_syscall(pid, name, ...)
+    local proc = vms[pid]
+    local fn = host[name]
+
+    if not proc or not fn or name == 'current' then
+        error('invalid system call '..tostring(name), 0)
     end
 
-    if process.pub.draw then
-        hw.clip(process.priv.x, process.priv.y,
-                process.priv.width, process.priv.height)
+    local parent = executing_process
+    executing_process = proc
 
-        xpcall(process.pub.draw, function (err)
-            process.priv.ok = false
-            handle_process_error(err)
-        end)
+    return syscall_return(parent, pcall(fn, ...))
+end
+
+local function by_priority(a, b)
+    if a.priv.priority ~= b.priv.priority then
+        return a.priv.priority > b.priv.priority
     end
+
+    return a.priv.pid < b.priv.pid
 end
 
-function exec_audio_tick(process)
-    if not process.priv.ok then
-        return
+-- Primeiro os updates, por prioridade, cada um numa fatia de tempo;
+-- depois os draws, na ordem das janelas
+function exec_processes(dt)
+    hw.compose_frame()
+
+    local order = {}
+
+    for _, proc in pairs(processes) do
+        if proc.priv.running then
+            proc.priv.slice.dt += dt
+            table.insert(order, proc)
+        end
+    end
+
+    table.sort(order, by_priority)
+
+    local start = hw.time()
+
+    for _, proc in ipairs(order) do
+        -- Um update anterior pode ter parado o processo
+        if processes[proc.priv.pid] == proc and proc.priv.running and
+           not (proc.priv.suspended and hw.time()-start >= FRAME_BUDGET) then
+            exec_update(proc)
+        end
     end
 
+    for p, proc in pairs(processes) do
+        if proc.priv.running then
+            exec_draw(proc)
+        end
+    end
+end
+
+function use_process(process)
     executing_process = process
 
     -- Usa a spritesheet do processo
     local sheet = process.priv.spritesheet
     hw.use_spritesheet(sheet.ptr, sheet.w, sheet.h)
+end
 
-    if process.priv.initialized then
-        if process.pub.audio_tick then
-            xpcall(process.pub.audio_tick, function (err)
-                process.priv.ok = false
-                handle_process_error(err)
-            end)
-        end
+function exec_update(process)
+    if not process.priv.ok then
+        return
     end
-end
 
-function loadmoon(path)
-    local moon_file = io.open(path, "rb")
+    use_process(process)
 
-    if moon_file then
-        local moon_script = moon_file:read("*all")
-        moon_file:close()
+    if not process.priv.initialized then
+        if process.pub.init then
+            call_process(process, 'init', process.pub.init)
+        end
 
-        local lua_script = moon_compile.tree(moon_parse.string(moon_script))
+        process.priv.initialized = true
+    end
 
-        return loadstring(lua_script, "@"..path)
-    else
-        return nil, "No such file or directory"
+    -- O update dos apps nos workers é pedido junto com o draw
+    if process.priv.threaded or not process.pub.update then
+        return
     end
-end
 
-function loadfennel(path)
-    local fennel_file = io.open(path, "rb")
+    local slice = process.priv.slice
+    local status
 
-    if fennel_file then
-        local fennel_script = fennel_file:read("*all")
-        fennel_file:close()
+    nib_api.resume_drawing(process)
 
-        local ok, lua_script = pcall(fennel.compileString, fennel_script)
+    if process.priv.vm then
+        -- A vm do app tem a própria corrotina e a própria fatia
+        status = call_process(process, 'update', process.pub.update, slice.dt)
+        slice.dt = 0
+    else
+        status = call_process(process, 'update', timeslice.resume, slice, process.pub, 0, true)
+    end
 
-        if ok then
-            return loadstring(lua_script, '@'..path)
-        else
-            return ok, lua_script
-        end
+    process.priv.suspended = status ~= nil
+    -- Interrompido no meio, o estado do app não está pronto para o draw
+    process.priv.preempted = status == 'preempted'
+
+    if status then
+        nib_api.suspend_drawing(process)
     else
-        return nil, "No such file or directory"
+        nib_api.stop_drawing_to(process)
     end
 end
 
-function file_exists(path)
-    local file = io.open(path, "r")
+function exec_draw(process)
+    if not process.priv.ok or not process.priv.initialized then
+        return
+    end
 
-    if file then
-        file:close()
+    use_process(process)
 
-        return true
+    if process.priv.threaded then
+        exec_threaded(process)
+    elseif process.pub.draw then
+        draw_process(process, process.priv.preempted)
     end
-
-    return false
 end
 
-function exec(path, env, args)
-    local fn, msg, ok
+-- O update roda num worker: desenha o que o último update deixou e pede
+-- o próximo. Enquanto o worker não termina, a janela fica como está
+function exec_threaded(process)
+    local pid = process.priv.pid
 
-    if file_exists(path..".moon") then
-        fn, msg = loadmoon(path..".moon")
-    elseif file_exists(path..".fnl") then
-        fn, msg = loadfennel(path..".fnl")
-    elseif file_exists(path..".lua") then
-        fn, msg = loadfile(path..".lua")
+    if process.pub.draw then
+        draw_process(process, vm_busy(pid))
     end
 
-    if not fn then
-       return fn, msg
-    end
+    if process.pub.update then
+        local queued, err = vm_update(pid, process.priv.slice.dt)
 
-    return exec_fn(fn, env, args)
-end
+        process.priv.slice.dt = 0
 
-function sandbox_fn(fn, env)
-    if not fn then
-        return
+        if queued == nil then
+            process.priv.ok = false
+            handle_process_error(err)
+        elseif queued then
+            -- O que esse update desenhar só aparece no próximo draw()
+            hw.window_redraw(pid)
+        end
     end
-
-    setfenv(fn, env)
 end
 
-function exec_fn(fn, env, args)
-    setfenv(fn, env)
+function draw_process(process, busy)
+    local pid = process.priv.pid
 
-    return pcall(fn, args)
+    -- Só redesenha se estiver animando ou se algo mudou na janela
+    if hw.window_begin(pid, process.priv.x, process.priv.y,
+                       process.priv.width, process.priv.height) then
+        if busy then
+            hw.window_redraw(pid)
+        else
+            hw.clip(process.priv.x, process.priv.y,
+                    process.priv.width, process.priv.height)
+
+            call_process(process, 'draw', process.pub.draw)
+
+            nib_api.stop_drawing_to(process)
+        end
+    end
+
+    hw.window_end(pid)
 end
 
---
--- Funções customizadas para processos sandboxed
---
+local function call_done(process, start, ok, ...)
+    if profiling then
+        hw.profile_end()
+    end
 
-function nib_require(entrypoint, module, proc)
-    local paths = {
-        entrypoint..'/'..module:gsub("%.", "/"),
-        'frameworks/'..module:gsub("%.", "/"),
-        'frameworks/'..module:gsub("%.", "/").."/main",
-    }
+    process.priv.cpu += hw.time()-start
 
-    local extensions = { ".lua", ".moon", ".fnl" }
+    if ok then
+        return ...
+    end
+end
 
-    local errors = {}
+-- Roda uma função do processo, medindo com o profiler ligado. Retorna o
+-- que ela retornar, ou nada se der erro
+function call_process(process, section, fn, ...)
+    local start = hw.time()
 
-    for _, path in ipairs(paths) do
-        for _, extension in ipairs(extensions) do
-            local fn, err
+    if profiling then
+        hw.profile_begin(process.priv.pid, section)
+    end
 
-            if extension == ".lua" then
-                fn, err = loadfile(path..extension)
-            elseif extension == ".moon" then
-                fn, err = loadmoon(path..extension)
-            elseif extension == ".fnl" then
-                fn, err = loadfennel(path..extension)
-            end
+    return call_done(process, start, xpcall(fn, function (err)
+        process.priv.ok = false
+        handle_process_error(err)
+    end, ...))
+end
 
-            if not fn then
-                table.insert(errors, 'require "'..path..'"): '..tostring(err))
-            else
-                sandbox_fn(fn, proc.pub)
-                return fn()
-            end
-        end
+function exec_audio_tick(process)
+    if not process.priv.ok then
+        return
     end
 
-    print('could not load', module, 'tried:')
-    for _, err in ipairs(errors) do
-        print(err)
+    use_process(process)
+
+    -- Como o draw, espera um update interrompido continuar
+    if process.priv.initialized and not process.priv.preempted then
+        if process.pub.audio_tick and not (process.priv.threaded and vm_busy(process.priv.pid)) then
+            call_process(process, 'audio_tick', process.pub.audio_tick)
+        end
     end
 end
 
@@ -409,7 +528,7 @@ function stop_app(pid, disable_grouping)
         if proc and proc.priv.parent then
             local parent = proc.priv.parent
 
-            table.insert(parent.priv.message_queue, 1, { app_stopped = executing_process.priv.pid })
+            bus_send(parent.priv.pid, { app_stopped = executing_process.priv.pid })
 
             if parent.priv.waiting == proc.priv.pid then
                 resume_app(parent.priv.pid)
@@ -422,6 +541,9 @@ function stop_app(pid, disable_grouping)
             send_stopped(process)
 
             if process then
+                close_vm(process)
+                bus_close(process.priv.pid)
+                hw.window_remove(pid)
                 processes[pid] = nil
             end
         else
@@ -435,10 +557,11 @@ function stop_app(pid, disable_grouping)
                 if process then
                     hw.unload_spritesheet(process.priv.spritesheet.ptr)
 
-                    for _, sheet in ipairs(process.priv.external_spritesheets) do
-                        hw.unload_spritesheet(sheet.ptr)
-                    end
+                    nib_api.free(process)
+                    close_vm(process)
+                    bus_close(pid)
 
+                    hw.window_remove(pid)
                     processes[pid] = nil
                 end
             end
@@ -462,254 +585,138 @@ function resume_app(pid)
     if process then
         process.priv.running = true
         hw.write(768, process.priv.screen)
+        hw.window_redraw(pid)
     end
 end
 
-function nib_api(entrypoint, proc, env)
-    local api = {
-        _G = {},
-        -- Processos podem usar require limitado,
-        require = function(module)
-            return nib_require(entrypoint, module, proc)
-        end,
-        -- Permite escrever para stdout
-        terminal_print = print,
-        terminal_pretty = pprint,
-        -- Energia
-        shutdown = hw.shutdown,
-        -- Syscalls
-        start_app = function(app, env, grouped)
-            return start_app(app, env, grouped)
-        end,
-        stop_app = function(pid, disable_grouping)
-            return stop_app(pid, disable_grouping)
-        end,
-        pause_app = function (pid, wait_pid)
-            local process = processes[pid]
+-- O que a API dos processos pede ao kernel
+host = {
+    current = function()
+        return executing_process
+    end,
+    start_app = function(app, env, grouped)
+        return start_app(app, env, grouped)
+    end,
+    stop_app = function(pid, disable_grouping)
+        return stop_app(pid, disable_grouping)
+    end,
+    pause_app = function (pid, wait_pid)
+        local process = processes[pid]
 
-            if process then
-                process.priv.screen = hw.read(768, 400*240)
-                process.priv.running = false
+        if process then
+            process.priv.screen = hw.read(768, 400*240)
+            process.priv.running = false
 
-                -- This process can wake us up
-                process.priv.waiting = wait_pid
-            end
-        end,
-        resume_app = function (pid)
-            resume_app(pid)
-        end,
-        send_message = function(pid, message)
-            if processes[pid] and message then
-                table.insert(processes[pid].priv.message_queue, 1, message)
-            end
-        end,
-        receive_message = function()
-            return table.remove(executing_process.priv.message_queue)
-        end,
-        -- Ferramentas para a linguagem
-        instanceof = lang.instanceof,
-        new = lang.new,
-        copy = lang.copy,
-        inherit = function(c, x) return lang.new(c, x or {}) end,
-        concat = lang.concat,
-        zip = lang.zip,
-        debug = error,
-        load = load,
-        pcall = function(fn)
-            setfenv(fn, executing_process.pub)
-
-            return pcall(fn)
-        end,
-        assert = assert,
-        _VERSION = _VERSION,
-        -- Funções matemática
-        math = math,
-        string = string,
-        -- Funções gerais
-        bit = require 'bit',
-        time = os.time,
-        date = os.date,
-        clock = function() return global_time end,
-        ipairs = ipairs, next = next, type = type,
-        setmetatable = setmetatable, pairs = pairs, rawget = rawget,
-        tonumber = tonumber, tostring = tostring,
-        join = table.concat,
-        push = table.insert,
-        pop = table.remove,
-        remove = table.remove,
-        insert = table.insert,
-        shift = function(tbl) return table.remove(tbl, 1) end,
-        sort = table.sort,
-        unwrap = unpack,
-        from_ascii = string.char,
-        -- GPU
-        clear = hw.clr,
-        sprite = hw.spr,
-        custom_sprite = hw.pspr,
-        fill_rect = hw.rect_fill,
-        fill_circ = hw.circle_fill,
-        fill_tri = hw.tri_fill,
-        fill_quad = hw.quad_fill,
-        line = hw.line,
-        rect = hw.rect,
-        circ = hw.circle,
-        tri = hw.tri,
-        quad = hw.quad,
-        clip = function (x, y, w, h)
-            x = math.max(x, proc.priv.x)
-            y = math.max(y, proc.priv.y)
-            w = math.min(w, proc.priv.x+proc.priv.width-x)
-            h = math.min(h, proc.priv.y+proc.priv.height-y)
-
-            hw.clip(x, y, w, h)
-        end,
-        print = hw.print,
-        measure = hw.measure,
-        mouse_cursor = hw.set_cursor,
-        start_recording = hw.start_capturing,
-        stop_recording = hw.stop_capturing,
-        get_pixel = gpu.get_pixel,
-        put_pixel = gpu.put_pixel,
-        get_sheet_pixel = function(x, y)
-            local sheet = executing_process.priv.spritesheet
-            return gpu.get_sheet_pixel(sheet.ptr, sheet.w, sheet.h, x, y)
-        end,
-        get_sheet_full = function(sheet, w, h)
-            if sheet and w and h then
-                return gpu.get_sheet_full(sheet, w, h)
-            else
-                local sheet = executing_process.priv.spritesheet
-                return gpu.get_sheet_full(sheet.ptr, sheet.w, sheet.h)
-            end
-        end,
-        put_sheet_pixel = function(x, y, color)
-            local sheet = executing_process.priv.spritesheet
-            return gpu.put_sheet_pixel(sheet.ptr, sheet.w, sheet.h, x, y, color)
-        end,
-        put_sheet_full = function(data, sheet, w, h)
-            if sheet and w and h then
-                return gpu.put_sheet_full(sheet, w, h, data)
-            else
-                local sheet = executing_process.priv.spritesheet
-                return gpu.put_sheet_full(sheet.ptr, sheet.w, sheet.h, data)
-            end
-        end,
-        get_sheet_size = function()
-            local sheet = executing_process.priv.spritesheet
-
-            return sheet.w, sheet.h
-        end,
-        save_sheet = function(file, sheet, w, h)
-            if sheet and w and h then
-                hw.save_spritesheet(sheet, w, h, file)
-            else
-                local sheet = executing_process.priv.spritesheet
-                hw.save_spritesheet(sheet.ptr, sheet.w, sheet.h, file)
-            end
-        end,
-        load_sheet = function(file)
-            local ptr, w, h = hw.load_spritesheet(file)
+            -- This process can wake us up
+            process.priv.waiting = wait_pid
+        end
+    end,
+    resume_app = function (pid)
+        resume_app(pid)
+    end,
+    -- As mensagens vão copiadas pelo barramento do kernel; false se o
+    -- processo não existe ou a caixa dele está cheia
+    send_message = function(pid, message)
+        if type(pid) == 'number' and message ~= nil then
+            return bus_send(pid, message)
+        end
 
-            table.insert(executing_process.priv.external_spritesheets, {
-                             ptr = ptr, w = w, h = h,
-            })
+        return false
+    end,
+    receive_message = function()
+        return bus_receive(executing_process.priv.pid)
+    end,
+    subscribe = function(topic)
+        bus_subscribe(executing_process.priv.pid, tostring(topic))
+    end,
+    unsubscribe = function(topic)
+        bus_unsubscribe(executing_process.priv.pid, tostring(topic))
+    end,
+    publish = function(topic, message)
+        if message == nil then
+            return 0
+        end
 
-            return ptr, w, h
-        end,
-        open_asset = function(asset, kind)
-            return nib_open_asset(entrypoint, asset, kind)
-        end,
-        -- Color manipulation
-        copy_palette = gpu.copy_palette,
-        mask_color = gpu.mask_color,
-        swap_colors = gpu.swap_colors,
-        swap_screen_colors = gpu.swap_screen_colors,
-        rgba_color = hw.rgba_color,
-        -- Memory access
-        read16 = hw.read16,
-        read8 = hw.read8,
-        read = hw.read,
-        write = hw.write,
-        -- Input
-        UP = input.UP,
-        DOWN = input.DOWN,
-        LEFT = input.LEFT,
-        RIGHT = input.RIGHT,
-        RED = input.RED,
-        BLUE = input.BLUE,
-        BLACK = input.BLACK,
-        WHITE = input.WHITE,
-        MOUSE_LEFT = input.MOUSE_LEFT,
-        MOUSE_RIGHT = input.MOUSE_RIGHT,
-        SHIFT = input.SHIFT,
-        CTRL = input.CTRL,
-        ALT = input.ALT,
-        GUI = input.GUI,
-        button_down = input.button_down,
-        button_up = input.button_up,
-        button_press = input.button_press,
-        button_release = input.button_release,
-        mouse_button_down = input.mouse_button_down,
-        mouse_button_up = input.mouse_button_up,
-        mouse_button_press = input.mouse_button_press,
-        mouse_button_release = input.mouse_button_release,
-        mouse_position = input.mouse_position,
-        mouse_scroll = input.mouse_scroll,
-        read_keys = input.read_keys,
-        read_key_events = input.read_key_events,
-        read_midi = input.read_midi,
-        -- Audio
-        encode = audio.encode,
-        channel = audio.channel,
-        envelope = audio.envelope,
-        freqs = audio.freqs,
-        reverb = audio.reverb,
-        route = audio.route,
-        noteon = audio.noteon,
-        noteoff = audio.noteoff,
-        OP1 = audio.OP1,
-        OP2 = audio.OP2,
-        OP3 = audio.OP3,
-        OP4 = audio.OP4,
-        OUT = audio.OUT,
-        CH1 = audio.CH1,
-        CH2 = audio.CH2,
-        CH3 = audio.CH3,
-        CH4 = audio.CH4,
-        CH5 = audio.CH5,
-        CH6 = audio.CH6,
-        CH7 = audio.CH7,
-        CH8 = audio.CH8,
-        utf8 = require "frameworks.kernel.utf8",
-    }
+        return bus_publish(tostring(topic), message)
+    end,
+    subscribers = function(topic)
+        return bus_subscribers(tostring(topic))
+    end,
+    yield_frame = function()
+        return timeslice.yield(executing_process.priv.slice)
+    end,
+    clock = function()
+        return global_time
+    end,
+    own_spritesheet = function()
+        return own_spritesheet(executing_process)
+    end,
+    -- Tempo de CPU (microssegundos) e prioridade de um processo, e
+    -- memória e coleta se ele tem vm própria
+    process_stats = function(pid)
+        local process = processes[pid or executing_process.priv.pid]
+
+        if not process then
+            return nil
+        end
+
+        local stats = vm_stats(process.priv.pid) or {}
 
-    -- Expõe o sistema de arquivos para processos
-    -- privilegiados
-    --if is_privileged(entrypoint) then
-        api.io = io
-        api.os = os
+        stats.cpu = (stats.cpu or 0)+process.priv.cpu
+        stats.priority = process.priv.priority
+        stats.threaded = process.priv.threaded or false
 
-        api.list_directory = hw.list
-        api.create_directory = hw.create_directory
-        api.touch_file = hw.touch_file
-        api.create_file = hw.create_file
+        return stats
+    end,
+    -- Maior prioridade roda antes nos workers; só muda alguma coisa para
+    -- apps com o update num worker
+    set_priority = function(pid, priority)
+        local process = processes[pid]
 
-        api.loadstring = function(str)
-            local chunk = loadstring(str)
-            setfenv(chunk, executing_process.pub)
+        if process and type(priority) == 'number' then
+            process.priv.priority = math.floor(priority)
 
-            return chunk
+            if process.priv.threaded then
+                vm_priority(pid, process.priv.priority)
+            end
+        end
+    end,
+    list_processes = function()
+        local list = {}
+
+        for pid, process in pairs(processes) do
+            table.insert(list, {
+                pid = pid,
+                app = process.priv.entrypoint,
+                running = process.priv.running or false,
+            })
         end
 
-        -- print("privileged:", entrypoint)
-    --end
+        table.sort(list, function(a, b) return a.pid < b.pid end)
 
-    -- API bonitinha para Fennel
-    for k, v in pairs(api) do
-        if k:match("_") then
-            api["__fnl_global__"..k:gsub("_", "_2d")] = v
+        return list
+    end,
+    -- Amostra o app (começa ele se não estiver rodando); retorna
+    -- o pid, ou nil e o motivo. Uma cópia começada aqui que não pode
+    -- ser amostrada é parada
+    profile = function(app, seconds, file)
+        local process = get_running_process(app)
+        local pid = process and process.priv.pid or start_app(app)
+
+        if not pid then
+            return nil, 'could not be started'
         end
-    end
 
-    return api
-end
+        local ok, reason = hw.sample(pid, app, seconds, file)
+
+        if ok then
+            return pid
+        end
+
+        if not process then
+            stop_app(pid)
+        end
+
+        return nil, reason
+    end,
+}
@@ -0,0 +1,476 @@
+-- API dos processos: o ambiente em que o código de um app roda.
+--
+-- O que depende da tabela de processos do kernel vem de `host`. Na vm
+-- do kernel, `host` mexe direto nos processos; num app com vm própria,
+-- cada função de `host` é uma chamada de sistema para o kernel.
+
+local hw = require('frameworks.kernel.hw')
+
+local audio = require('frameworks.kernel.audio')
+local input = require('frameworks.kernel.input')
+local lang = require('frameworks.kernel.lang')
+local gpu = require('frameworks.kernel.gpu')
+local pprint = require('frameworks.kernel.pprint')
+local loader = require('frameworks.kernel.loader')
+
+local nib_api = {}
+
+local function open_asset(entrypoint, asset, kind)
+    local path = entrypoint..'/'..asset:gsub("%.", "/")..'.'..kind:gsub("%.", "")
+
+    print('loading', asset, '('..kind..')')
+    print('at', path)
+
+    return io.open(path, "r+")
+end
+
+-- Um processo que parou no meio de um draw_to faria os próximos
+-- desenharem na superfície dele
+function nib_api.stop_drawing_to(process)
+    process.priv.clipped = false
+
+    if process.priv.drawing_to then
+        process.priv.drawing_to = nil
+        hw.draw_to(nil)
+    end
+end
+
+-- Um update que cede no meio de um draw_to volta à tela até o resto da
+-- frame terminar; o alvo e o clip dele ficam guardados para o resume
+function nib_api.suspend_drawing(process)
+    local priv = process.priv
+
+    priv.suspended_drawing = {
+        surface = priv.drawing_to,
+        clip = priv.clipped and { unpack(priv.clip) } or nil,
+    }
+
+    nib_api.stop_drawing_to(process)
+end
+
+-- Antes de continuar o update que cedeu
+function nib_api.resume_drawing(process)
+    local priv = process.priv
+    local saved = priv.suspended_drawing
+
+    if not saved then
+        return
+    end
+
+    priv.suspended_drawing = nil
+
+    local surface = saved.surface
+
+    if surface then
+        -- O draw pode ter liberado a superfície nesse meio tempo
+        if not priv.surfaces[surface] then
+            return
+        end
+
+        priv.drawing_to = surface
+        hw.draw_to(surface.ptr, surface.w, surface.h)
+    end
+
+    if saved.clip then
+        priv.clip = saved.clip
+        priv.clipped = true
+        hw.clip(unpack(saved.clip))
+    end
+end
+
+-- Libera o que o processo carregou ou criou (menos a spritesheet
+-- dele, que é do kernel)
+function nib_api.free(proc)
+    for _, sheet in ipairs(proc.priv.external_spritesheets) do
+        hw.unload_spritesheet(sheet.ptr)
+    end
+
+    for _, ptr in ipairs(proc.priv.external_binaries) do
+        hw.unload_binary(ptr)
+    end
+
+    for surface in pairs(proc.priv.surfaces) do
+        hw.free_surface(surface.ptr)
+    end
+
+    for id in pairs(proc.priv.loads) do
+        hw.load_result(id)
+    end
+
+    loader.chunks[proc.pub] = nil
+end
+
+function nib_api.new(host, entrypoint, proc, env)
+    local api = {
+        _G = {},
+        -- Processos podem usar require limitado,
+        require = function(module)
+            return loader.require(entrypoint, module, proc)
+        end,
+        -- Permite escrever para stdout
+        terminal_print = print,
+        terminal_pretty = pprint,
+        -- Energia
+        shutdown = hw.shutdown,
+        -- Syscalls
+        start_app = host.start_app,
+        stop_app = host.stop_app,
+        pause_app = host.pause_app,
+        resume_app = host.resume_app,
+        send_message = host.send_message,
+        receive_message = host.receive_message,
+        -- Tópicos: publish() entrega uma cópia da mensagem para cada
+        -- processo que assinou
+        subscribe = host.subscribe,
+        unsubscribe = host.unsubscribe,
+        publish = host.publish,
+        subscribers = host.subscribers,
+        -- Cede o resto da frame no meio do update(), que continua
+        -- daqui na próxima; retorna os segundos que passaram
+        yield_frame = host.yield_frame,
+        -- Compositor: com animate(false), o draw() só roda quando
+        -- redraw() é chamado ou outra janela passa por cima
+        animate = function(animating)
+            hw.window_animate(proc.priv.pid, animating)
+        end,
+        redraw = function()
+            hw.window_redraw(proc.priv.pid)
+        end,
+        -- Ferramentas para a linguagem
+        instanceof = lang.instanceof,
+        new = lang.new,
+        copy = lang.copy,
+        inherit = function(c, x) return lang.new(c, x or {}) end,
+        concat = lang.concat,
+        zip = lang.zip,
+        debug = error,
+        load = load,
+        pcall = function(fn)
+            setfenv(fn, host.current().pub)
+
+            return pcall(fn)
+        end,
+        assert = assert,
+        _VERSION = _VERSION,
+        -- Funções matemática
+        math = math,
+        string = string,
+        -- Funções gerais
+        bit = require 'bit',
+        time = os.time,
+        date = os.date,
+        clock = host.clock,
+        ipairs = ipairs, next = next, type = type,
+        setmetatable = setmetatable, pairs = pairs, rawget = rawget,
+        tonumber = tonumber, tostring = tostring,
+        join = table.concat,
+        push = table.insert,
+        pop = table.remove,
+        remove = table.remove,
+        insert = table.insert,
+        shift = function(tbl) return table.remove(tbl, 1) end,
+        sort = table.sort,
+        unwrap = unpack,
+        from_ascii = string.char,
+        -- GPU
+        clear = hw.clr,
+        sprite = hw.spr,
+        custom_sprite = hw.pspr,
+        nine_slice = hw.slice9,
+        three_slice = hw.slice3,
+        fill_rect = hw.rect_fill,
+        fill_circ = hw.circle_fill,
+        fill_rrect = hw.rounded_rect_fill,
+        fill_tri = hw.tri_fill,
+        fill_quad = hw.quad_fill,
+        line = hw.line,
+        rect = hw.rect,
+        circ = hw.circle,
+        rrect = hw.rounded_rect,
+        tri = hw.tri,
+        quad = hw.quad,
+        clip = function (x, y, w, h)
+            -- Numa superfície, o clip não depende da janela
+            if not proc.priv.drawing_to then
+                x = math.max(x, proc.priv.x)
+                y = math.max(y, proc.priv.y)
+                w = math.min(w, proc.priv.x+proc.priv.width-x)
+                h = math.min(h, proc.priv.y+proc.priv.height-y)
+            end
+
+            -- Guardado para um update que cede (suspend_drawing)
+            local clip = proc.priv.clip or {}
+            clip[1], clip[2], clip[3], clip[4] = x, y, w, h
+
+            proc.priv.clip = clip
+            proc.priv.clipped = true
+
+            hw.clip(x, y, w, h)
+        end,
+        new_surface = function (w, h)
+            local ptr = hw.new_surface(w, h)
+
+            if not ptr then
+                return nil
+            end
+
+            local surface = { ptr = ptr, w = w, h = h }
+
+            proc.priv.surfaces[surface] = true
+
+            return surface
+        end,
+        free_surface = function (surface)
+            if not proc.priv.surfaces[surface] then
+                return
+            end
+
+            if proc.priv.drawing_to == surface then
+                proc.priv.drawing_to = nil
+                proc.priv.clipped = false
+                hw.draw_to(nil)
+            end
+
+            proc.priv.surfaces[surface] = nil
+            hw.free_surface(surface.ptr)
+        end,
+        draw_to = function (surface)
+            -- Trocar o alvo reinicia o clip
+            proc.priv.clipped = false
+
+            if surface and proc.priv.surfaces[surface] then
+                proc.priv.drawing_to = surface
+                hw.draw_to(surface.ptr, surface.w, surface.h)
+            else
+                proc.priv.drawing_to = nil
+                hw.draw_to(nil)
+                hw.clip(proc.priv.x, proc.priv.y,
+                        proc.priv.width, proc.priv.height)
+            end
+        end,
+        draw_surface = function (surface, x, y, pal, sx, sy, w, h)
+            if proc.priv.surfaces[surface] then
+                hw.draw_surface(surface.ptr, surface.w, surface.h,
+                                x, y, sx, sy, w, h, pal)
+            end
+        end,
+        draw_map = hw.tilemap,
+        map_cell = hw.map_cell,
+        print = hw.print,
+        measure = hw.measure,
+        fit_text = hw.fit,
+        wrap_text = hw.wrap,
+        widget_node = hw.widget_node,
+        widget_props = hw.widget_props,
+        widget_update = hw.widget_update,
+        widget_content = hw.widget_content,
+        widget_children = hw.widget_children,
+        widget_render = function (root, resume, dirty)
+            return hw.widget_render(root, resume, dirty,
+                                    proc.priv.x, proc.priv.y,
+                                    proc.priv.width, proc.priv.height)
+        end,
+        mouse_cursor = hw.set_cursor,
+        start_recording = hw.start_capturing,
+        stop_recording = hw.stop_capturing,
+        get_pixel = gpu.get_pixel,
+        put_pixel = gpu.put_pixel,
+        frame_stats = gpu.frame_stats,
+        profiler_stats = hw.profiler_stats,
+        profiler_overlay = hw.profiler_overlay,
+        start_trace = hw.trace_start,
+        stop_trace = hw.trace_stop,
+        -- Amostra o app (começa ele se não estiver rodando); retorna
+        -- o pid ou nil
+        profile = host.profile,
+        process_stats = host.process_stats,
+        set_priority = host.set_priority,
+        list_processes = host.list_processes,
+        get_sheet_pixel = function(x, y)
+            local sheet = host.current().priv.spritesheet
+            return gpu.get_sheet_pixel(sheet.ptr, sheet.w, sheet.h, x, y)
+        end,
+        get_sheet_full = function(sheet, w, h)
+            if sheet and w and h then
+                return gpu.get_sheet_full(sheet, w, h)
+            else
+                local sheet = host.current().priv.spritesheet
+                return gpu.get_sheet_full(sheet.ptr, sheet.w, sheet.h)
+            end
+        end,
+        put_sheet_pixel = function(x, y, color)
+            local sheet = host.own_spritesheet()
+            return gpu.put_sheet_pixel(sheet.ptr, sheet.w, sheet.h, x, y, color)
+        end,
+        put_sheet_full = function(data, sheet, w, h)
+            if sheet and w and h then
+                return gpu.put_sheet_full(sheet, w, h, data)
+            else
+                local sheet = host.own_spritesheet()
+                return gpu.put_sheet_full(sheet.ptr, sheet.w, sheet.h, data)
+            end
+        end,
+        get_sheet_size = function()
+            local sheet = host.current().priv.spritesheet
+
+            return sheet.w, sheet.h
+        end,
+        save_sheet = function(file, sheet, w, h)
+            if sheet and w and h then
+                return hw.save_spritesheet(sheet, w, h, file)
+            else
+                local sheet = host.current().priv.spritesheet
+                return hw.save_spritesheet(sheet.ptr, sheet.w, sheet.h, file)
+            end
+        end,
+        save_file = hw.save_file,
+        save_status = hw.save_status,
+        load_sheet = function(file)
+            local ptr, w, h = hw.load_spritesheet(file)
+
+            -- Quem carrega uma sheet explicitamente pode escrever nela
+            ptr = hw.own_spritesheet(ptr)
+
+            table.insert(host.current().priv.external_spritesheets, {
+                             ptr = ptr, w = w, h = h,
+            })
+
+            return ptr, w, h
+        end,
+        load_binary = function(file)
+            local ptr, length = hw.load_binary(file)
+
+            if ptr then
+                table.insert(host.current().priv.external_binaries, ptr)
+            end
+
+            return ptr, length
+        end,
+        load_async = function(file)
+            local id = hw.load_async(file)
+
+            host.current().priv.loads[id] = true
+
+            return id
+        end,
+        load_status = hw.load_status,
+        load_wait = hw.load_wait,
+        load_result = function(id)
+            if hw.load_status(id) == 'pending' then
+                return nil
+            end
+
+            host.current().priv.loads[id] = nil
+
+            return hw.load_result(id)
+        end,
+        -- Começa a carregar os assets de um app antes de abri-lo
+        prefetch_app = function(app)
+            local id = hw.load_async(app..'/assets/sheet.png')
+
+            host.current().priv.loads[id] = true
+
+            return id
+        end,
+        open_asset = function(asset, kind)
+            return open_asset(entrypoint, asset, kind)
+        end,
+        -- Color manipulation
+        copy_palette = gpu.copy_palette,
+        mask_color = gpu.mask_color,
+        swap_colors = gpu.swap_colors,
+        swap_screen_colors = gpu.swap_screen_colors,
+        rgba_color = hw.rgba_color,
+        -- Memory access
+        read16 = hw.read16,
+        read8 = hw.read8,
+        read = hw.read,
+        write = hw.write,
+        -- Input
+        UP = input.UP,
+        DOWN = input.DOWN,
+        LEFT = input.LEFT,
+        RIGHT = input.RIGHT,
+        RED = input.RED,
+        BLUE = input.BLUE,
+        BLACK = input.BLACK,
+        WHITE = input.WHITE,
+        MOUSE_LEFT = input.MOUSE_LEFT,
+        MOUSE_RIGHT = input.MOUSE_RIGHT,
+        SHIFT = input.SHIFT,
+        CTRL = input.CTRL,
+        ALT = input.ALT,
+        GUI = input.GUI,
+        button_down = input.button_down,
+        button_up = input.button_up,
+        button_press = input.button_press,
+        button_release = input.button_release,
+        mouse_button_down = input.mouse_button_down,
+        mouse_button_up = input.mouse_button_up,
+        mouse_button_press = input.mouse_button_press,
+        mouse_button_release = input.mouse_button_release,
+        mouse_position = input.mouse_position,
+        mouse_scroll = input.mouse_scroll,
+        read_keys = input.read_keys,
+        read_key_events = input.read_key_events,
+        read_midi = input.read_midi,
+        -- Audio
+        encode = audio.encode,
+        channel = audio.channel,
+        envelope = audio.envelope,
+        freqs = audio.freqs,
+        reverb = audio.reverb,
+        route = audio.route,
+        noteon = audio.noteon,
+        noteoff = audio.noteoff,
+        audio_latency = audio.latency,
+        audio_stats = audio.stats,
+        OP1 = audio.OP1,
+        OP2 = audio.OP2,
+        OP3 = audio.OP3,
+        OP4 = audio.OP4,
+        OUT = audio.OUT,
+        CH1 = audio.CH1,
+        CH2 = audio.CH2,
+        CH3 = audio.CH3,
+        CH4 = audio.CH4,
+        CH5 = audio.CH5,
+        CH6 = audio.CH6,
+        CH7 = audio.CH7,
+        CH8 = audio.CH8,
+        utf8 = require "frameworks.kernel.utf8",
+    }
+
+    -- Expõe o sistema de arquivos para processos
+    -- privilegiados
+    --if is_privileged(entrypoint) then
+        api.io = io
+        api.os = os
+
+        api.list_directory = hw.list
+        api.list_entries = hw.list_entries
+        api.create_directory = hw.create_directory
+        api.touch_file = hw.touch_file
+        api.create_file = hw.create_file
+
+        api.loadstring = function(str)
+            local chunk = loadstring(str)
+            setfenv(chunk, host.current().pub)
+
+            return chunk
+        end
+
+        -- print("privileged:", entrypoint)
+    --end
+
+    -- API bonitinha para Fennel
+    for k, v in pairs(api) do
+        if k:match("_") then
+            api["__fnl_global__"..k:gsub("_", "_2d")] = v
+        end
+    end
+
+    return api
+end
+
+return nib_api
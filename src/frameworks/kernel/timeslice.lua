@@ -0,0 +1,96 @@
+-- Fatias de tempo do update() dos processos
+--
+-- O update roda numa corrotina. Quando passa da fatia (slice_begin, do
+-- kernel cpp) ou quando o app chama yield_frame(), a corrotina cede e
+-- continua de onde parou na próxima frame, sem travar o console. Usado
+-- pelo kernel para os apps na vm dele e pelo runtime das vms próprias
+
+local hw = require('frameworks.kernel.hw')
+
+local loader = require('frameworks.kernel.loader')
+
+local timeslice = {}
+
+-- Quantas fatias um update pode passar do prazo sem ceder antes de o
+-- app sair do JIT
+local OVERRUN = 2
+
+function timeslice.new()
+    return {
+        -- Corrotina do update em andamento, ou nil
+        thread = nil,
+        -- Segundos que ainda não chegaram a um update
+        dt = 0,
+        -- A corrotina foi interrompida pelo prazo (e não cedeu por
+        -- conta própria)
+        preempted = false,
+        interpreted = false,
+    }
+end
+
+-- Roda o update (ou continua o anterior) do app com a API `pub`; a
+-- fatia é pub.env.slice microssegundos ou a padrão do kernel. Sem
+-- `sliced`, a corrotina só cede com yield_frame(). Retorna nil se o
+-- update terminou, 'preempted' ou 'yielded'
+function timeslice.resume(state, pub, dt, sliced)
+    state.dt += dt
+
+    if not state.thread then
+        state.thread = coroutine.create(pub.update)
+    end
+
+    local thread = state.thread
+
+    -- Quem foi interrompido não vê o resume; o tempo fica para o próximo
+    -- update
+    local delivered = state.dt
+
+    if not state.preempted then
+        state.dt = 0
+    end
+
+    local start = hw.time()
+    local slice = sliced and slice_begin(thread, pub.env.slice)
+
+    local ok, err = coroutine.resume(thread, delivered)
+
+    state.preempted = sliced and slice_end() or false
+
+    if not ok then
+        state.thread = nil
+        state.preempted = false
+
+        error(debug.traceback(thread, err), 0)
+    end
+
+    -- Traces compilados não chamam o hook: um app que passa muito do
+    -- prazo sai do JIT e o hook passa a pegar os laços dele
+    if slice and not state.interpreted and hw.time()-start > slice*OVERRUN then
+        state.interpreted = true
+
+        for _, chunk in ipairs(loader.chunks[pub] or {}) do
+            jit.off(chunk, true)
+            jit.flush(chunk, true)
+        end
+    end
+
+    if coroutine.status(thread) == 'dead' then
+        state.thread = nil
+
+        return nil
+    end
+
+    return state.preempted and 'preempted' or 'yielded'
+end
+
+-- yield_frame(): cede o resto da frame e retorna os segundos até o
+-- update continuar. Fora do update não faz nada
+function timeslice.yield(state)
+    if state and state.thread and coroutine.running() == state.thread then
+        return coroutine.yield()
+    end
+
+    return 0
+end
+
+return timeslice
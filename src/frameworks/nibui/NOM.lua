@@ -147,6 +147,10 @@ function NOM:new(desc)
         event_queue = {},
         focused_widget = nil,
         mouse_focused_widget = nil,
+        -- Widgets que precisam enviar as propriedades para o WidgetTree
+        pending = setmetatable({}, { __mode = 'k' }),
+        -- Id do nó -> widget
+        nodes = setmetatable({}, { __mode = 'v' }),
     }
 
     instanceof(instance, NOM)
@@ -162,9 +166,22 @@ end
 function NOM:use(feature)
     self.features[feature] = true
 
+    -- O processo só redesenha quando algum widget muda
+    if feature == 'damage' then
+        animate(false)
+    end
+
     return self
 end
 
+function NOM:flush()
+    for widget in pairs(self.pending) do
+        self.pending[widget] = nil
+
+        widget:sync()
+    end
+end
+
 function NOM:draw()
     self.root:draw()
     clip(env.x, env.y, env.width, env.height)
@@ -213,6 +230,10 @@ function NOM:update(dt)
             self.mouse_focused_widget:mouse_scroll(x, y)
         end
     end
+
+    if self.features.damage and next(self.pending) then
+        redraw()
+    end
 end
 
 function NOM:find(selector, node)
@@ -39,6 +39,9 @@ local function update_widget(widget, new_widget, time, easing)
     end
   end
 
+  -- Hashes are no longer refreshed every frame
+  widget:update_hash()
+
   -- Only update if something has changed
   if widget.hash ~= new_widget.hash then
     -- Update the current widget props with the new widget props
@@ -72,6 +75,8 @@ local function update_widget(widget, new_widget, time, easing)
   end
 
   widget.children[#children+1] = nil
+
+  widget:sync_children()
 end
 
 function NeactComponent:new()
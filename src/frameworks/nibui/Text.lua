@@ -74,11 +74,12 @@ end
 
 function Text:draw()
     local off_x = 0
+    local txt_size = measure(self.text)
 
     if self.align == 1 then
-        off_x = -(#self.text*8)/2
+        off_x = -txt_size/2
     elseif self.align == 2 then
-        off_x = -#self.text*8
+        off_x = -txt_size
     end
 
     for from, to in pairs(self.colormap) do
@@ -88,8 +89,6 @@ function Text:draw()
     -- Configura bold/não bold
     --swap_colors(7, self.bold)
 
-    local txt_size = measure(self.text)
-
     -- Desenha
     fill_rect(self.x+off_x, self.y-1, txt_size, 10, self.background_color)
     print(self.text, self.x+off_x, self.y, self.palette)
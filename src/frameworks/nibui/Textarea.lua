@@ -7,7 +7,6 @@ local Textarea = {}
 
 local DEFAULT_W = 400
 local DEFAULT_H = 240
-local CHAR_W = 8
 local CHAR_H = 8
 
 function Textarea:new(x, y, w, h)
@@ -120,18 +119,20 @@ end
 function Textarea:advance_cursor(text)
     local by = text.text
     local texts = {}
+    local available = self.x+self.w-self.cursor_x
 
     self.cursor += #by
 
     self.cursor_x += measure(by)
     
     if self.cursor_x > self.x+self.w and self.wrap then
-        local overflow = math.ceil((self.cursor_x-(self.x+self.w))/CHAR_W)
+        -- Bytes que cabem no resto da linha
+        local fits = fit_text(by, available)
 
         self.cursor_x = self.x
         self.cursor_y += self.line_height
 
-        local before, after = text:sub(0, #by-overflow), text:sub(#by-overflow+1, #by)
+        local before, after = text:sub(0, fits), text:sub(fits+1, #by)
 
         after.x = self.cursor_x
         after.y = self.cursor_y
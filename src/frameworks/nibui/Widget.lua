@@ -12,6 +12,16 @@ local iparent = {
 
 setmetatable(iparent, iparent)
 
+-- Códigos de alinhamento do WidgetTree; qualquer outro valor usa 0
+local TEXT_ALIGN = { left = 0, center = 1, right = 2 }
+local VERTICAL_ALIGN = { top = 0, middle = 1, bottom = 2 }
+
+local MAX_SLICES = 8
+local MAX_CMAP = 8
+
+-- Preenchida a cada sync e copiada pelo C++
+local scratch_props
+
 function Widget:new(config, document, parent)
     local defaults = {
         -- Colors
@@ -52,8 +62,12 @@ function Widget:new(config, document, parent)
         -- Hash of all properties
         hash = 0,
         neact_generated_by = config.neact_generated_by,
+        -- Nó no WidgetTree e o que já foi enviado para ele
+        native = { content = nil, children = {} },
     }
 
+    instance.native.id, instance.native.handle = widget_node()
+
     for k, _ in zip(config, defaults) do
         if config[k] then
             if type(config[k]) == 'number' then
@@ -80,6 +94,9 @@ function Widget:new(config, document, parent)
 
     setmetatable(instance, Widget)
 
+    document.nodes[instance.native.id] = instance
+    document.pending[instance] = true
+
     if config.ref then
         config.ref(instance)
     end
@@ -142,9 +159,7 @@ function Widget:update_hash(print_out)
             hash = bit.bxor(bit.lshift(hash, 5), hash) + math.floor(value*255)
         elseif type(value) == "string" then
             for i=1,#value do
-                local c = value:sub(i, i)
-
-                hash = bit.bxor(bit.lshift(hash, 5), hash) + c:byte()
+                hash = bit.bxor(bit.lshift(hash, 5), hash) + value:byte(i)
             end
         elseif type(value) == "table" then
             -- Do not handle nested tables
@@ -175,8 +190,6 @@ function Widget:update(dt)
         end
     end
 
-    self:update_hash()
-
     -- Atualiza filhos
     for _, child in ipairs(self.children) do
         child:update(dt)
@@ -233,165 +246,118 @@ function Widget:clip_box(b)
 end
 
 function Widget:draw_3slice(x, y, w, h, sx, sy, sw, sh, sl1, sl2)
-    -- Right side
-
-    w = math.ceil(w)
-
-    clip(x, y, w, h)
-
-    custom_sprite(x, y, sx, sy, sl1, sh, self.palette)
+    three_slice(x, y, math.ceil(w), h, sx, sy, sw, sh, sl1, sl2, self.palette)
+end
 
-    -- Middle
+function Widget:draw_9slice(x, y, w, h, sx, sy, sw, sh, sl1, sl2, sl3, sl4)
+    nine_slice(x, y, math.ceil(w), math.ceil(h), sx, sy, sw, sh, sl1, sl2, sl3, sl4, self.palette)
+end
 
-    local step = sl2-sl1
+-- Loop
 
-    -- Setup a clip rect for the middle
-    clip(x+sl1, y, w-(sw-step), h)
+-- Envia as propriedades atuais para o WidgetTree
+function Widget:sync()
+    local native = rawget(self, 'native')
 
-    -- Draw the middle
-    for dx=0,w,step do
-        custom_sprite(x+sl1+dx, y, sx+sl1, sy, step, sh, self.palette)
+    if not scratch_props then
+        scratch_props = widget_props()
     end
 
-    -- Restore clipping
-    clip(x, y, w, h)
+    local p = scratch_props
 
-    -- Left side
+    p.x, p.y, p.w, p.h = self.x, self.y, self.w, self.h
+    p.radius, p.z, p.border_size = self.radius, self.z, self.border_size
+    p.shadow_color, p.border_color = self.shadow_color, self.border_color
+    p.palette, p.text_palette = self.palette, self.text_palette
+    p.padding_top, p.padding_left = self.padding_top, self.padding_left
+    p.padding_bottom, p.padding_right = self.padding_bottom, self.padding_right
+    p.clip_to = self.clip_to
 
-    custom_sprite(x+w-sw+sl2, y, sx+sl2, sy, sw-sl2, sh, self.palette)
-end
+    local background = self.background
 
-function Widget:draw_9slice(x, y, w, h, sx, sy, sw, sh, sl1, sl2, sl3, sl4)
-    -- Top
-    self:draw_3slice(x, y, w, sl3, sx, sy, sw, sl3, sl1, sl2)
+    if type(background) == 'table' then
+        local count = math.min(#background, MAX_SLICES)
 
-    h = math.ceil(h)
+        for i=1,count do
+            p.slices[i-1] = background[i]
+        end
 
-    -- Middle
-    local step_h = sl4-sl3
-    local dy = sl3
+        p.background = 0
+        p.slice_count = count
+    else
+        p.background = background
+        p.slice_count = 0
+    end
 
-    for dy=sl3,h-(sh-sl4),step_h do
-        --local height = math.max(math.min(step_h, h-(sh-sl4)-sl3), 0)
-        local height = math.min(step_h, h-(sh-sl4)-dy)
+    p.text_align = TEXT_ALIGN[self.text_align] or 3
+    p.vertical_align = VERTICAL_ALIGN[self.vertical_align] or 3
+    p.custom = rawget(self, 'draw') and 1 or 0
 
-        self:draw_3slice(x, y+dy, w, height, sx, sy+sl3, sw, step_h, sl1, sl2)
-    end
+    local cmap = self.cmap
+    local count = math.min(#cmap, MAX_CMAP)
 
-    -- Bottom
-    self:draw_3slice(x, y+h-sh+sl4, w, sh-sl4, sx, sy+sl4, sw, sh-sl4, sl1, sl2)
+    for i=1,count do
+        p.cmap[i*2-2] = math.floor(cmap[i][1])
+        p.cmap[i*2-1] = math.floor(cmap[i][2])
+    end
 
-    clip(self.x, self.y, self.w, self.h)
-end
+    p.cmap_count = count
 
--- Loop
+    widget_update(native.id, p)
 
-function Widget:draw()
-    if self.dirty then
-        self.dirty = false
-
-        local x, y = self.x, self.y
-        local w, h = self.w, self.h
-        local r = math.floor(self.radius)
-        local content = self.content
-        local shadow_color = math.floor(self.shadow_color)
-        local border_color = math.floor(self.border_color)
-        local border_size = math.floor(self.border_size)
-        local z = math.floor(self.z)
-
-        clip(unwrap(self:clip_box()))
-
-        if z ~= 0 then
-          fill_rect(x+r, y+z, w-r*2, h, shadow_color)
-          fill_rect(x, y+r+z, w, h-r*2, shadow_color)
-
-          if r ~= 0 then
-            fill_circ(x+r, y+r+z, r, shadow_color)
-            fill_circ(x+w-r-1, y+r+z, r, shadow_color)
-            fill_circ(x+r, y+h-r+z-1, r, shadow_color)
-            fill_circ(x+w-r-1, y+h-r+z-1, r, shadow_color)
-          end
-        end
+    local content = self.content
 
-        fill_rect(x+r, y, w-r*2, h, border_color)
-        fill_rect(x, y+r, w, h-r*2, border_color)
+    if content ~= native.content then
+        widget_content(native.id, content)
+        native.content = content
+    end
 
-        if r ~= 0 then
-            fill_circ(x+r, y+r, r, border_color)
-            fill_circ(x+w-r-1, y+r, r, border_color)
-            fill_circ(x+r, y+h-r-1, r, border_color)
-            fill_circ(x+w-r-1, y+h-r-1, r, border_color)
-        end
+    self:sync_children()
+end
 
-        if type(self.background) ~= 'table' then
-            local background = math.floor(self.background)
+function Widget:sync_children()
+    local native = rawget(self, 'native')
+    local synced = native.children
+    local changed = #synced ~= #self.children
 
-            do
-                local w = w-border_size*2
-                local h = h-border_size*2
-                local x = x+border_size
-                local y = y+border_size
-                local r = math.max(r-border_size, 0)
+    for i, child in ipairs(self.children) do
+        local id = rawget(child, 'native').id
 
-                fill_rect(x+r, y, w-r*2, h, background)
-                fill_rect(x, y+r, w, h-r*2, background)
+        if synced[i] ~= id then
+            synced[i] = id
+            changed = true
+        end
+    end
 
-                if r ~= 0 then
-                    fill_circ(x+r, y+r, r, background)
-                    fill_circ(x+w-r-1, y+r, r, background)
-                    fill_circ(x+r, y+h-r-1, r, background)
-                    fill_circ(x+w-r-1, y+h-r-1, r, background)
-                end
-            end
-        else
-            if #self.background == 2 then
-                local sprite_x, sprite_y = self.background[1], self.background[2]
-
-                sprite(x, y, sprite_x, sprite_y, self.palette)
-            elseif #self.background == 4 then
-                local sprite_x, sprite_y, sprite_w, sprite_h = unwrap(self.background)
-
-                custom_sprite(x, y, sprite_x, sprite_y, sprite_w, sprite_h, self.palette)
-            elseif #self.background == 6 then
-                self:draw_3slice(x, y, w, h, unwrap(self.background))
-            elseif #self.background == 8 then
-                self:draw_9slice(x, y, w, h, unwrap(self.background))
-            end
+    if changed then
+        for i=#self.children+1,#synced do
+            synced[i] = nil
         end
 
+        widget_children(native.id, synced)
+    end
+end
 
-        local tx, ty = 0, 0
+-- O WidgetTree desenha a subárvore e devolve os widgets com `draw`
+-- próprio, um por vez, para serem desenhados aqui
+function Widget:draw()
+    local document = self.document
+    local node = rawget(self, 'native').id
 
-        if self.text_align == 'left' then
-            tx = x+self.padding_left
-        elseif self.text_align == 'center' then
-            tx = x+w/2-measure(content)/2
-        elseif self.text_align == 'right' then
-            tx = x+w-measure(content)-self.padding_right
-        end
+    document:flush()
 
-        if self.vertical_align == 'top' then
-            ty = 0
-        elseif self.vertical_align == 'middle' then
-            ty = y+h/2-4
-        elseif self.vertical_align == 'bottom' then
-            ty = h-8
-        end
+    local custom = widget_render(node, -1, self.dirty)
 
-        -- TODO: use decorated text
-        for i, v in ipairs(self.cmap) do
-            swap_colors(math.floor(v[1]), math.floor(v[2]))
-        end
+    self.dirty = false
 
-        print(content, tx, ty+self.padding_top-self.padding_bottom, self.text_palette)
+    while custom >= 0 do
+        local widget = document.nodes[custom]
 
-        for i, v in ipairs(self.cmap) do
-            swap_colors(math.floor(v[1]), math.floor(v[1]))
+        if widget then
+            widget:draw()
         end
-    end
 
-    for _, child in ipairs(self.children) do
-        child:draw()
+        custom = widget_render(node, custom, false)
     end
 end
 
@@ -590,6 +556,7 @@ end
 
 function Widget:set_dirty()
     self.dirty = true
+    self.document.pending[self] = true
 
     for _, child in ipairs(self.children) do
         child:set_dirty()
@@ -31,7 +31,7 @@ return function(name)
     }
 
     for _, path in ipairs(search_paths) do
-      if #list_directory(path) > 0 then
+      if list_entries(path, 0, 0) then
         local file = io.open(path.."/main.lua", "r")
         local sheet = io.open(path.."/assets/sheet.png", "r")
         local broken_path = break_name(path)
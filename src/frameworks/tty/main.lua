@@ -4,6 +4,13 @@ if env.shell then
   })
 end
 
+-- Tópico em que o terminal publica as linhas digitadas, como
+-- { input = linha }: quem quer a entrada assina com
+-- subscribe(tty_input())
+function tty_input(tty)
+  return 'tty:'..tostring(tty or env.tty)
+end
+
 function write(str, bg)
   send_message(env.tty, {
     print = tostring(str),
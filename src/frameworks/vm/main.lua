@@ -0,0 +1,228 @@
+-- Runtime de um app com vm Lua própria
+--
+-- O kernel cria essa vm com vm_new(), que chama boot(), e depois roda
+-- as funções do app com call(). A API é a mesma dos apps na vm do
+-- kernel; só o que mexe na tabela de processos vira uma chamada de
+-- sistema (syscall, registrada pelo kernel), com os dados copiados.
+-- Mensagens chegam pela caixa da vm (receive, também do kernel)
+--
+-- Com prioridade, o update() roda num worker do ProcessScheduler pela
+-- global update(), enquanto a thread principal segue com a frame. Na
+-- thread principal, o update() roda numa fatia de tempo (ver timeslice)
+
+local hw = require('frameworks.kernel.hw')
+
+-- Se o update está rodando num worker
+local on_worker = false
+
+-- Desenhos feitos pelo update num worker, refeitos no próximo draw(),
+-- na vez do processo entre as janelas
+local commands = {}
+
+local drawing = {}
+
+for _, name in ipairs({ 'clr', 'spr', 'pspr', 'slice9', 'slice3', 'clip',
+                        'draw_to', 'draw_surface', 'set_cursor', 'line',
+                        'rect_fill', 'circle_fill', 'rounded_rect_fill',
+                        'rounded_rect', 'quad_fill', 'tri_fill', 'rect',
+                        'circle', 'quad', 'tri', 'tilemap', 'print',
+                        'use_spritesheet', 'window_animate',
+                        'window_redraw' }) do
+    drawing[name] = true
+end
+
+-- Não tocam no console
+local pure = {
+    time = true, enter = true, leave = true,
+    map_cell = true, rgba_color = true, widget_props = true,
+}
+
+local function leave(ok, ...)
+    hw.leave()
+
+    if not ok then
+        error(..., 0)
+    end
+
+    return ...
+end
+
+-- O resto do hw só roda num worker com o console travado. Os módulos
+-- usam as funções pela tabela hw, então isso vem antes de carregá-los
+for name, fn in pairs(hw) do
+    if type(fn) == 'function' and not pure[name] then
+        if drawing[name] then
+            hw[name] = function(...)
+                if on_worker then
+                    commands[#commands+1] = { fn, select('#', ...), ... }
+                else
+                    return fn(...)
+                end
+            end
+        else
+            hw[name] = function(...)
+                if on_worker then
+                    if not hw.enter() then
+                        error('process stopped', 0)
+                    end
+
+                    return leave(pcall(fn, ...))
+                end
+
+                return fn(...)
+            end
+        end
+    end
+end
+
+local loader = require('frameworks.kernel.loader')
+local nib_api = require('frameworks.kernel.nib_api')
+local timeslice = require('frameworks.kernel.timeslice')
+
+local proc = nil
+
+-- Update em andamento
+local slice = timeslice.new()
+
+local host = {
+    current = function()
+        return proc
+    end,
+    -- A spritesheet é do kernel; guarda a cópia que ele devolve
+    own_spritesheet = function()
+        proc.priv.spritesheet = syscall('own_spritesheet')
+
+        return proc.priv.spritesheet
+    end,
+}
+
+for _, name in ipairs({ 'start_app', 'stop_app', 'pause_app', 'resume_app',
+                        'send_message', 'clock', 'profile',
+                        'process_stats', 'set_priority',
+                        'list_processes', 'subscribe', 'unsubscribe',
+                        'publish', 'subscribers' }) do
+    host[name] = function(...)
+        return syscall(name, ...)
+    end
+end
+
+-- Sem passar pelo kernel: a caixa não tem lock
+host.receive_message = function()
+    return receive()
+end
+
+host.yield_frame = function()
+    return timeslice.yield(slice)
+end
+
+-- Retorna as funções que o kernel deve chamar, ou nil e o erro
+function boot(entrypoint, info)
+    proc = {
+        priv = {
+            pid = info.pid,
+            entrypoint = entrypoint,
+            spritesheet = info.spritesheet,
+            external_spritesheets = {},
+            external_binaries = {},
+            surfaces = {},
+            loads = {},
+            width = info.width, height = info.height,
+            x = info.x, y = info.y,
+        },
+    }
+
+    proc.pub = nib_api.new(host, entrypoint, proc, info.env)
+    proc.pub.env = info.env
+
+    local ok, err = loader.exec(entrypoint..'/main', proc.pub)
+
+    if not ok then
+        return nil, err
+    end
+
+    local callbacks = {}
+
+    for _, name in ipairs({ 'init', 'update', 'draw', 'audio_tick' }) do
+        if type(proc.pub[name]) == 'function' then
+            loader.sandbox_fn(proc.pub[name], proc.pub)
+            table.insert(callbacks, name)
+        elseif name == 'draw' and info.threaded then
+            -- Os desenhos do update precisam de um draw() para aparecer
+            table.insert(callbacks, name)
+        end
+    end
+
+    return true, callbacks
+end
+
+local function finish(...)
+    nib_api.stop_drawing_to(proc)
+
+    return ...
+end
+
+-- Um update que cedeu continua, no próximo resume, desenhando onde
+-- estava
+local function finish_update(status)
+    if status then
+        nib_api.suspend_drawing(proc)
+    else
+        nib_api.stop_drawing_to(proc)
+    end
+
+    return status
+end
+
+local function replay()
+    local list = commands
+    commands = {}
+
+    for _, command in ipairs(list) do
+        command[1](unpack(command, 3, command[2]+2))
+    end
+end
+
+-- O update retorna nil se terminou, ou como timeslice.resume se cedeu
+function call(name, ...)
+    if name == 'draw' then
+        replay()
+    elseif name == 'update' then
+        nib_api.resume_drawing(proc)
+
+        return finish_update(timeslice.resume(slice, proc.pub, (...), true))
+    end
+
+    local fn = proc.pub[name]
+
+    if fn then
+        return finish(fn(...))
+    end
+
+    return finish()
+end
+
+local function worker_done(ok, ...)
+    on_worker = false
+
+    if not ok then
+        error(..., 0)
+    end
+end
+
+-- Chamada pelo worker, fora da thread principal. Aqui não há fatia: um
+-- update longo só ocupa o worker, e o update só cede com yield_frame()
+function update(dt)
+    on_worker = true
+
+    worker_done(xpcall(function()
+        nib_api.resume_drawing(proc)
+        finish_update(timeslice.resume(slice, proc.pub, dt, false))
+    end, debug.traceback))
+end
+
+-- Antes de a vm ser fechada
+function shutdown()
+    if proc then
+        nib_api.free(proc)
+    end
+end
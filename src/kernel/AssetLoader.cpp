@@ -0,0 +1,177 @@
+#include <kernel/AssetLoader.hpp>
+
+AssetLoader::AssetLoader(const size_t worker_amount):
+    next_id(1), running(true) {
+    for (size_t w=0;w<worker_amount;w++) {
+        workers.emplace_back(&AssetLoader::work, this);
+    }
+}
+
+AssetLoader::~AssetLoader() {
+    {
+        lock_guard<mutex> guard(lock);
+        running = false;
+    }
+
+    wake.notify_all();
+
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+size_t AssetLoader::load(const string &path) {
+    auto request = make_shared<Request>();
+
+    auto extension = Path(path).get_extension();
+
+    request->path = path;
+    request->is_image = extension == "png" || extension == SHEET_EXTENSION;
+    request->state = LOAD_PENDING;
+    request->decoded = false;
+
+    {
+        lock_guard<mutex> guard(lock);
+
+        request->id = next_id++;
+        requests[request->id] = request;
+        queue.push_back(request);
+    }
+
+    wake.notify_one();
+
+    return request->id;
+}
+
+AssetLoader::State AssetLoader::status(const size_t id) {
+    lock_guard<mutex> guard(lock);
+
+    auto request = requests.find(id);
+
+    if (request == requests.end()) {
+        return LOAD_FAILED;
+    }
+
+    return request->second->state;
+}
+
+void AssetLoader::wait(Memory &memory, const size_t id) {
+    {
+        unique_lock<mutex> guard(lock);
+
+        finished.wait(guard, [this, id] {
+            auto request = requests.find(id);
+
+            return request == requests.end() || request->second->decoded;
+        });
+    }
+
+    collect(memory);
+}
+
+bool AssetLoader::take(const size_t id, string &data) {
+    lock_guard<mutex> guard(lock);
+
+    auto request = requests.find(id);
+
+    if (request == requests.end()) {
+        return false;
+    }
+
+    const auto done = request->second->state != LOAD_PENDING;
+
+    if (done) {
+        data = move(request->second->data);
+    }
+
+    requests.erase(request);
+
+    return done;
+}
+
+void AssetLoader::collect(Memory &memory) {
+    list<shared_ptr<Request>> ready;
+
+    {
+        lock_guard<mutex> guard(lock);
+        ready.swap(completed);
+    }
+
+    for (auto &request: ready) {
+        auto path = Path(request->path);
+
+        mmap::cache_image(memory, path, request->image);
+
+        // Libera os pixels, já copiados para a memória do console
+        request->image = mmap::DecodedImage();
+
+        lock_guard<mutex> guard(lock);
+        request->state = LOAD_DONE;
+    }
+}
+
+void AssetLoader::clear() {
+    lock_guard<mutex> guard(lock);
+
+    queue.clear();
+    completed.clear();
+    requests.clear();
+}
+
+void AssetLoader::work() {
+    while (true) {
+        shared_ptr<Request> request;
+
+        {
+            unique_lock<mutex> guard(lock);
+
+            wake.wait(guard, [this] {
+                return !running || !queue.empty();
+            });
+
+            if (!running) {
+                return;
+            }
+
+            request = queue.front();
+            queue.pop_front();
+        }
+
+        auto path = Path(request->path);
+        bool ok;
+
+        if (request->is_image) {
+            ok = mmap::decode_image_file(path, request->image);
+        } else {
+            auto data = fs::get_file_data(path);
+
+            ok = data != nullptr;
+
+            if (ok) {
+                request->data.assign(data, fs::get_file_size(path));
+                delete[] data;
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+
+            // Descartado enquanto carregava
+            if (requests.count(request->id) == 0) {
+                continue;
+            }
+
+            request->decoded = true;
+
+            if (!ok) {
+                request->state = LOAD_FAILED;
+            } else if (request->is_image) {
+                completed.push_back(request);
+            } else {
+                request->state = LOAD_DONE;
+            }
+        }
+
+        finished.notify_all();
+    }
+}
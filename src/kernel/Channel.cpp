@@ -98,6 +98,8 @@ void Channel::enqueue_command(uint64_t timestamp,
                               uint8_t command,
                               uint8_t note,
                               uint8_t velocity) {
+    lock_guard<mutex> lock(commands_lock);
+
     commands.push(Command {
         timestamp,
         (Cmd)command,
@@ -107,6 +109,8 @@ void Channel::enqueue_command(uint64_t timestamp,
 }
 
 void Channel::execute_commands(const uint64_t t) {
+    lock_guard<mutex> lock(commands_lock);
+
     while (!commands.empty() && commands.front().timestamp <= t) {
         const auto command = commands.front();
 
@@ -0,0 +1,131 @@
+#include <kernel/Compositor.hpp>
+
+void Compositor::begin_frame(const SDL_Rect &outside) {
+    damage.swap(exposed);
+    exposed.clear();
+
+    add(damage, outside);
+    add(exposed, outside);
+}
+
+bool Compositor::begin(const int32_t pid, const SDL_Rect &rect, const SDL_Rect &outside) {
+    // Pintado fora de um draw(), num update() por exemplo: pode ter
+    // passado por cima de janelas que já foram desenhadas
+    add(damage, outside);
+    add(exposed, outside);
+
+    auto &w = window(pid);
+
+    if (!SDL_RectEquals(&w.rect, &rect)) {
+        add(damage, w.rect);
+        add(exposed, w.rect);
+
+        w.rect = rect;
+        w.damaged = true;
+    }
+
+    repaint = w.damaged || hits(damage, w.rect);
+
+    w.damaged = false;
+
+    return w.animating || repaint;
+}
+
+void Compositor::end(const int32_t, const SDL_Rect &drawn) {
+    add(damage, drawn);
+
+    repaint = false;
+}
+
+bool Compositor::repainting() const {
+    return repaint;
+}
+
+void Compositor::redraw(const int32_t pid) {
+    window(pid).damaged = true;
+}
+
+void Compositor::animate(const int32_t pid, const bool animating) {
+    auto &w = window(pid);
+
+    // Volta a animar a partir da próxima passada
+    w.damaged = w.damaged || animating;
+    w.animating = animating;
+}
+
+void Compositor::remove(const int32_t pid) {
+    const auto it = windows.find(pid);
+
+    if (it != windows.end()) {
+        add(exposed, it->second.rect);
+        windows.erase(it);
+    }
+}
+
+void Compositor::expose(const SDL_Rect &rect) {
+    add(exposed, rect);
+}
+
+void Compositor::clear() {
+    repaint = false;
+    windows.clear();
+    damage.clear();
+    exposed.clear();
+}
+
+Compositor::Window& Compositor::window(const int32_t pid) {
+    auto it = windows.find(pid);
+
+    if (it == windows.end()) {
+        // Janela nova: anima até o processo dizer o contrário
+        it = windows.emplace(pid, Window { { 0, 0, 0, 0 }, true, true }).first;
+    }
+
+    return it->second;
+}
+
+void Compositor::add(vector<SDL_Rect> &rects, const SDL_Rect &rect) {
+    if (SDL_RectEmpty(&rect)) {
+        return;
+    }
+
+    for (auto &r: rects) {
+        if (SDL_HasIntersection(&r, &rect)) {
+            SDL_UnionRect(&r, &rect, &r);
+            return;
+        }
+    }
+
+    if (rects.size() < COMPOSITOR_MAX_RECTS) {
+        rects.push_back(rect);
+        return;
+    }
+
+    // Junta com o que cresce menos
+    SDL_Rect *best = nullptr;
+    int best_growth = 0;
+
+    for (auto &r: rects) {
+        SDL_Rect merged;
+        SDL_UnionRect(&r, &rect, &merged);
+
+        const int growth = merged.w*merged.h-r.w*r.h;
+
+        if (!best || growth < best_growth) {
+            best = &r;
+            best_growth = growth;
+        }
+    }
+
+    SDL_UnionRect(best, &rect, best);
+}
+
+bool Compositor::hits(const vector<SDL_Rect> &rects, const SDL_Rect &rect) {
+    for (const auto &r: rects) {
+        if (SDL_HasIntersection(&r, &rect)) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <memory>
+
+#include <kernel/FileWriter.hpp>
+
+FileWriter::FileWriter():
+    next_id(1), writing(false), running(true) {
+    writer = thread(&FileWriter::work, this);
+}
+
+FileWriter::~FileWriter() {
+    flush();
+
+    {
+        lock_guard<mutex> guard(lock);
+        running = false;
+    }
+
+    wake.notify_all();
+    writer.join();
+}
+
+size_t FileWriter::write(const string &path, Job job, const bool tracked) {
+    size_t id = 0;
+
+    {
+        lock_guard<mutex> guard(lock);
+
+        if (tracked) {
+            id = next_id++;
+            states[id] = WRITE_PENDING;
+        }
+
+        auto pending = find_if(queue.begin(), queue.end(), [&path] (const Request &request) {
+            return request.path == path;
+        });
+
+        // Ainda não começou: só o conteúdo mais novo importa
+        if (pending != queue.end()) {
+            pending->job = job;
+
+            if (tracked) {
+                pending->ids.push_back(id);
+            }
+
+            return id;
+        }
+
+        queue.push_back(Request { path, job, {} });
+
+        if (tracked) {
+            queue.back().ids.push_back(id);
+        }
+    }
+
+    wake.notify_one();
+
+    return id;
+}
+
+size_t FileWriter::write(const string &path, string data, const bool tracked) {
+    auto shared_data = make_shared<string>(move(data));
+
+    // write_file_data já manda para o storage
+    return write(path, [shared_data] (Path &target) {
+        return fs::write_file_data(target, shared_data->data(), shared_data->size());
+    }, tracked);
+}
+
+FileWriter::State FileWriter::status(const size_t id) {
+    lock_guard<mutex> guard(lock);
+
+    auto state = states.find(id);
+
+    if (state == states.end()) {
+        return WRITE_FAILED;
+    }
+
+    auto current = state->second;
+
+    if (current != WRITE_PENDING) {
+        states.erase(state);
+    }
+
+    return current;
+}
+
+void FileWriter::flush() {
+    unique_lock<mutex> guard(lock);
+
+    idle.wait(guard, [this] {
+        return queue.empty() && !writing;
+    });
+}
+
+void FileWriter::work() {
+    while (true) {
+        Request request;
+
+        {
+            unique_lock<mutex> guard(lock);
+
+            wake.wait(guard, [this] {
+                return !running || !queue.empty();
+            });
+
+            if (queue.empty()) {
+                return;
+            }
+
+            request = move(queue.front());
+            queue.pop_front();
+            writing = true;
+        }
+
+        auto path = Path(request.path);
+        auto temp = fs::temp_path(path);
+
+        bool ok = request.job(temp) && fs::replace_file(temp, path);
+
+        if (!ok) {
+            fs::delete_file(temp);
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+
+            for (auto id: request.ids) {
+                auto state = states.find(id);
+
+                if (state == states.end()) {
+                    continue;
+                }
+
+                state->second = ok ? WRITE_DONE : WRITE_FAILED;
+                finished.push_back(id);
+            }
+
+            // Quem nunca pergunta não faz o mapa crescer para sempre
+            while (finished.size() > FILE_WRITER_RESULTS) {
+                states.erase(finished.front());
+                finished.pop_front();
+            }
+
+            writing = false;
+        }
+
+        idle.notify_all();
+    }
+}
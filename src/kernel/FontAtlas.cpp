@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <kernel/FontAtlas.hpp>
+
+// Ordem dos glifos na fonte padrão, a mesma de antes no hw.lua. As aspas
+// aparecem duas vezes e, como no `find` do Lua, vale a primeira
+static const char font_chars[] = "1234567890ABCDEFGHIJKLMNOPQRSTUVWXYZ.,!?"
+                                 "abcdefghijklmnopqrstuvwxyz()[]<>{}\"\"'-_=\\/|&~*%@$#:;+"
+                                 "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0A\x0B\x0C\x0D\x0E\x0F\x10\x11"
+                                 " ";
+
+// Letras acentuadas do Latin-1 (U+00C0 a U+00FF) usam a letra sem acento
+static const char latin1_letters[] = "AAAAAAACEEEEIIIIDNOOOOOxOUUUUY\0s"
+                                     "aaaaaaaceeeeiiiidnooooo\0ouuuuy\0y";
+
+// Codepoint -> índice do glifo, até U+00FF
+static const array<uint8_t, 256> glyph_table = [] {
+    array<uint8_t, 256> table;
+    table.fill(FONT_NO_GLYPH);
+
+    for (size_t i=sizeof(font_chars)-1;i>0;i--) {
+        table[(uint8_t)font_chars[i-1]] = i-1;
+    }
+
+    for (size_t i=0;i<sizeof(latin1_letters)-1;i++) {
+        if (latin1_letters[i] != '\0') {
+            table[0xC0+i] = table[(uint8_t)latin1_letters[i]];
+        }
+    }
+
+    // Espaço sem quebra
+    table[0xA0] = table[' '];
+
+    return table;
+}();
+
+const FontAtlas::Sheet& FontAtlas::get(const uint8_t *source, const int16_t w, const int16_t h, const size_t frame) {
+    for (auto &sheet: sheets) {
+        if (sheet->source == source && sheet->w == w && sheet->h == h) {
+            if (sheet->checked != frame) {
+                if (changed(*sheet)) {
+                    build(*sheet);
+                }
+
+                sheet->checked = frame;
+            }
+
+            return *sheet;
+        }
+    }
+
+    Sheet *sheet;
+
+    if (sheets.size() < FONT_ATLAS_SHEETS) {
+        sheets.push_back(make_unique<Sheet>());
+        sheet = sheets.back().get();
+    } else {
+        // Reaproveita a que está há mais tempo sem uso
+        sheet = min_element(sheets.begin(), sheets.end(), [] (const unique_ptr<Sheet> &a, const unique_ptr<Sheet> &b) {
+            return a->checked < b->checked;
+        })->get();
+    }
+
+    sheet->source = source;
+    sheet->w = w;
+    sheet->h = h;
+    sheet->checked = frame;
+
+    build(*sheet);
+
+    return *sheet;
+}
+
+void FontAtlas::clear() {
+    sheets.clear();
+}
+
+bool FontAtlas::changed(const Sheet &sheet) const {
+    const size_t region_w = FONT_COLUMNS*FONT_CHAR_W;
+    const size_t region_h = FONT_ROWS*FONT_CHAR_H;
+    const size_t row_w = min<size_t>(max<int16_t>(sheet.w, 0), region_w);
+    const size_t rows = min<size_t>(max<int16_t>(sheet.h, 0), region_h);
+
+    for (size_t y=0;y<rows;y++) {
+        if (memcmp(sheet.region+y*region_w, sheet.source+y*sheet.w, row_w) != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FontAtlas::build(Sheet &sheet) {
+    const size_t region_w = FONT_COLUMNS*FONT_CHAR_W;
+    const size_t region_h = FONT_ROWS*FONT_CHAR_H;
+    const size_t row_w = min<size_t>(max<int16_t>(sheet.w, 0), region_w);
+    const size_t rows = min<size_t>(max<int16_t>(sheet.h, 0), region_h);
+
+    // Partes da fonte fora da spritesheet ficam vazias
+    memset(sheet.region, 0, sizeof(sheet.region));
+
+    for (size_t y=0;y<rows;y++) {
+        memcpy(sheet.region+y*region_w, sheet.source+y*sheet.w, row_w);
+    }
+
+    bool used[256] = { false };
+
+    for (size_t g=0;g<FONT_GLYPH_AMOUNT;g++) {
+        auto &glyph = sheet.glyphs[g];
+        const auto origin = sheet.region+(g/FONT_COLUMNS)*FONT_CHAR_H*region_w+(g%FONT_COLUMNS)*FONT_CHAR_W;
+
+        glyph.empty = true;
+
+        for (size_t y=0;y<FONT_CHAR_H;y++) {
+            auto row = glyph.pixels+y*FONT_CHAR_W;
+
+            memcpy(row, origin+y*region_w, FONT_CHAR_W);
+
+            glyph.mask[y] = 0;
+
+            for (size_t x=0;x<FONT_CHAR_W;x++) {
+                used[row[x]] = true;
+
+                if (row[x] != 0) {
+                    glyph.mask[y] |= 1<<x;
+                }
+            }
+
+            glyph.empty = glyph.empty && glyph.mask[y] == 0;
+        }
+    }
+
+    sheet.colors.clear();
+
+    for (size_t c=0;c<256;c++) {
+        if (used[c]) {
+            sheet.colors.push_back(c);
+        }
+    }
+}
+
+uint8_t FontAtlas::glyph_of(const uint32_t codepoint) {
+    return codepoint < glyph_table.size() ? glyph_table[codepoint] : FONT_NO_GLYPH;
+}
+
+uint32_t FontAtlas::decode(const char *str, const size_t len, size_t &pos) {
+    const uint8_t lead = str[pos++];
+
+    if (lead < 0x80) {
+        return lead;
+    }
+
+    size_t extra;
+    uint32_t codepoint, minimum;
+
+    if ((lead&0xE0) == 0xC0) {
+        extra = 1, codepoint = lead&0x1F, minimum = 0x80;
+    } else if ((lead&0xF0) == 0xE0) {
+        extra = 2, codepoint = lead&0x0F, minimum = 0x800;
+    } else if ((lead&0xF8) == 0xF0) {
+        extra = 3, codepoint = lead&0x07, minimum = 0x10000;
+    } else {
+        return lead;
+    }
+
+    if (pos+extra > len) {
+        return lead;
+    }
+
+    for (size_t i=0;i<extra;i++) {
+        const uint8_t next = str[pos+i];
+
+        if ((next&0xC0) != 0x80) {
+            return lead;
+        }
+
+        codepoint = (codepoint<<6)|(next&0x3F);
+    }
+
+    // Sequências longas demais, surrogates e valores fora do Unicode
+    if (codepoint < minimum || codepoint > 0x10FFFF ||
+        (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+        return lead;
+    }
+
+    pos += extra;
+
+    return codepoint;
+}
+
+size_t FontAtlas::length(const char *str, const size_t len) {
+    size_t pos = 0, count = 0;
+
+    while (pos < len) {
+        decode(str, len, pos);
+        count++;
+    }
+
+    return count;
+}
+
+size_t FontAtlas::fit(const char *str, const size_t len, const size_t cells) {
+    size_t pos = 0;
+
+    for (size_t count=0;count<cells && pos<len;count++) {
+        decode(str, len, pos);
+    }
+
+    return pos;
+}
+
+void FontAtlas::wrap(const char *str, const size_t len, const size_t cells, vector<size_t> &lines) {
+    lines.clear();
+    lines.push_back(0);
+
+    size_t pos = 0, count = 0;
+
+    // Onde a linha recomeçaria depois do último espaço, e quantas
+    // células ficam antes disso
+    bool has_space = false;
+    size_t space = 0, space_count = 0;
+
+    while (pos < len) {
+        const auto start = pos;
+        const auto codepoint = decode(str, len, pos);
+
+        if (codepoint == '\n') {
+            lines.push_back(pos);
+            count = 0;
+            has_space = false;
+            continue;
+        }
+
+        // Sem largura, só quebra nos '\n'
+        if (cells == 0 || count < cells) {
+            count++;
+        } else if (codepoint == ' ') {
+            // Espaços no fim da linha podem passar da largura
+            has_space = true;
+            space = pos;
+            space_count = count;
+            continue;
+        } else {
+            if (has_space) {
+                lines.push_back(space);
+                count -= space_count;
+            } else {
+                lines.push_back(start);
+                count = 0;
+            }
+
+            has_space = false;
+            count++;
+        }
+
+        if (codepoint == ' ') {
+            has_space = true;
+            space = pos;
+            space_count = count;
+        }
+    }
+}
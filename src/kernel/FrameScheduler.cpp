@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstring>
+
+#include <SDL.h>
+
+#include <kernel/FrameScheduler.hpp>
+
+FrameScheduler::FrameScheduler(Memory &memory, const unsigned int framerate, const bool vsync):
+    vsync(vsync) {
+    frequency = SDL_GetPerformanceFrequency();
+    step = frequency/framerate;
+
+    statistics = (StatisticsLayout*)memory.allocate(sizeof(StatisticsLayout), "Frame Statistics");
+
+    reset();
+}
+
+void FrameScheduler::reset() {
+    frame_start = now();
+    // Primeira frame roda um update imediatamente
+    accumulator = step;
+
+    history_position = 0;
+    history_length = 0;
+    history_sum = 0;
+
+    memset(statistics, 0, sizeof(StatisticsLayout));
+}
+
+uint64_t FrameScheduler::now() const {
+    return SDL_GetPerformanceCounter();
+}
+
+float FrameScheduler::delta() const {
+    return float(step)/float(frequency);
+}
+
+unsigned int FrameScheduler::begin_frame() {
+    const auto current = now();
+    const auto elapsed = current-frame_start;
+
+    if (statistics->frames > 0) {
+        record(elapsed);
+        accumulator += elapsed;
+    }
+
+    frame_start = current;
+    statistics->frames++;
+
+    auto steps = accumulator/step;
+    accumulator -= steps*step;
+
+    // Muito atrasados: descarta o resto em vez de acumular para sempre
+    if (steps > FRAME_MAX_CATCHUP) {
+        statistics->dropped += steps-FRAME_MAX_CATCHUP;
+        steps = FRAME_MAX_CATCHUP;
+    }
+
+    return steps;
+}
+
+void FrameScheduler::wait(const bool presented) {
+    if (vsync && presented) {
+        return;
+    }
+
+    // A próxima frame começa quando o acumulador completar um passo
+    const auto deadline = frame_start+(step-accumulator);
+    const auto margin = frequency*FRAME_SPIN_MARGIN_MS/1000;
+
+    auto current = now();
+
+    // Dorme a parte grossa, com precisão de milissegundos
+    if (current+margin < deadline) {
+        SDL_Delay(Uint32((deadline-margin-current)*1000/frequency));
+    }
+
+    // Spin até o prazo
+    while (now() < deadline);
+}
+
+void FrameScheduler::record(const uint64_t elapsed) {
+    const uint32_t us = min<uint64_t>(elapsed*1000000/frequency, UINT32_MAX);
+
+    if (history_length == FRAME_HISTORY) {
+        history_sum -= history[history_position];
+    } else {
+        history_length++;
+    }
+
+    history[history_position] = us;
+    history_sum += us;
+    history_position = (history_position+1)%FRAME_HISTORY;
+
+    uint32_t sorted[FRAME_HISTORY];
+    memcpy(sorted, history, history_length*sizeof(uint32_t));
+
+    const auto p99 = (history_length*99)/100;
+    nth_element(sorted, sorted+p99, sorted+history_length);
+
+    statistics->min = *min_element(history, history+history_length);
+    statistics->max = *max_element(history, history+history_length);
+    statistics->avg = history_sum/history_length;
+    statistics->p99 = sorted[p99];
+}
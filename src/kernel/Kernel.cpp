@@ -1,4 +1,6 @@
 #include <iostream>
+#include <cstdlib>
+#include <cmath>
 #include <algorithm>
 #include <stdexcept>
 #include <thread>
@@ -9,7 +11,30 @@
 
 using namespace std;
 
-Kernel::Kernel(const bool fullscreen_startup): open_menu_next_frame(false), power(true) {
+// Chamadas entre a vm do kernel e as vms dos apps (mais abaixo)
+static int vm_new(lua_State*);
+static int vm_call(lua_State*);
+static int vm_free(lua_State*);
+static int vm_stats(lua_State*);
+static int vm_syscall(lua_State*);
+static int vm_update(lua_State*);
+static int vm_busy(lua_State*);
+static int vm_priority(lua_State*);
+static int vm_receive(lua_State*);
+static int bus_open(lua_State*);
+static int bus_close(lua_State*);
+static int bus_send(lua_State*);
+static int bus_receive(lua_State*);
+static int bus_subscribe(lua_State*);
+static int bus_unsubscribe(lua_State*);
+static int bus_publish(lua_State*);
+static int bus_subscribers(lua_State*);
+static int slice_begin(lua_State*);
+static int slice_end(lua_State*);
+
+Kernel::Kernel(const Options &options):
+    open_menu_next_frame(false), power(true), sampling(false),
+    vm_caller(nullptr), isolate_apps(options.isolate_apps) {
 #ifdef SDL_VIDEO_OPENGL
     if (SDL_Init(SDL_INIT_EVERYTHING | SDL_VIDEO_OPENGL) != 0) {
         cout << "SDL_Init: " << SDL_GetError() << endl;
@@ -25,8 +50,8 @@ Kernel::Kernel(const bool fullscreen_startup): open_menu_next_frame(false), powe
     cout << endl << "=============== Memory Map ===============" << endl;
 
     // Cria dispositivos
-    gpu = make_unique<GPU>(memory, fullscreen_startup);
-    audio = make_unique<Audio>(memory);
+    gpu = make_unique<GPU>(memory, options);
+    audio = make_unique<Audio>(memory, options.audio_workers);
     controller = make_unique<Controller>(memory);
     keyboard = make_unique<Keyboard>(memory);
     mouse = make_unique<Mouse>(memory);
@@ -35,6 +60,21 @@ Kernel::Kernel(const bool fullscreen_startup): open_menu_next_frame(false), powe
     midi_controller = make_unique<MidiController>(memory);
 #endif
 
+    // Registradores adicionados depois dos dispositivos para
+    // não mudar os endereços já usados pelos apps
+    audio->map_statistics(memory);
+    // Com pipeline, o present não bloqueia a thread principal
+    scheduler = make_unique<FrameScheduler>(memory, GPU_FRAMERATE, options.vsync && !options.pipelined);
+    profiler = make_unique<Profiler>(memory);
+    sampler = make_unique<Sampler>();
+
+    loader = make_unique<AssetLoader>(ASSET_LOADER_WORKERS);
+    process_scheduler = make_unique<ProcessScheduler>(options.process_workers);
+    bus = make_unique<MessageBus>();
+    writer = make_unique<FileWriter>();
+    widgets = make_unique<WidgetTree>();
+    compositor = make_unique<Compositor>();
+
     cout << "==========================================" << endl << endl;
 
     memory.set_log(false);
@@ -65,6 +105,11 @@ void Kernel::startup() {
 #endif
     audio->startup();
 
+    scheduler->reset();
+    profiler->reset();
+    sampler->clear();
+    sampling = false;
+
     auto entrypoint = Path("./frameworks/kernel/");
 
     process = make_unique<Process>(memory, entrypoint);
@@ -73,6 +118,24 @@ void Kernel::startup() {
         cout << "Could not start LuaJIT" << endl;
         exit(1);
     }
+
+    process->expose("vm_new", vm_new, 0);
+    process->expose("vm_call", vm_call, 0);
+    process->expose("vm_free", vm_free, 0);
+    process->expose("vm_stats", vm_stats, 0);
+    process->expose("vm_update", vm_update, 0);
+    process->expose("vm_busy", vm_busy, 0);
+    process->expose("vm_priority", vm_priority, 0);
+    process->expose("bus_open", bus_open, 0);
+    process->expose("bus_close", bus_close, 0);
+    process->expose("bus_send", bus_send, 0);
+    process->expose("bus_receive", bus_receive, 0);
+    process->expose("bus_subscribe", bus_subscribe, 0);
+    process->expose("bus_unsubscribe", bus_unsubscribe, 0);
+    process->expose("bus_publish", bus_publish, 0);
+    process->expose("bus_subscribers", bus_subscribers, 0);
+    process->expose("slice_begin", slice_begin, 0, process.get());
+    process->expose("slice_end", slice_end, 0, process.get());
 }
 
 void Kernel::menu() {
@@ -80,6 +143,27 @@ void Kernel::menu() {
 }
 
 void Kernel::shutdown() {
+    // Nenhum worker pode continuar rodando um app (nem esperando o
+    // console) depois daqui. Quem não para a tempo está num laço
+    // compilado, que nunca volta ao console: a vm dele é abandonada em
+    // vez de fechada embaixo do worker
+    for (const auto pid: process_scheduler->clear()) {
+        cout << "process " << pid << " did not stop, abandoning its vm and replacing its worker" << endl;
+
+        const auto it = vms.find(pid);
+
+        if (it != vms.end()) {
+            it->second.release();
+            vms.erase(it);
+        }
+
+        for (auto &stopped: stopped_vms) {
+            if (stopped.first == pid) {
+                stopped.second.release();
+            }
+        }
+    }
+
     /* Shutdown dos periféricos */
 
     gpu->shutdown();
@@ -91,18 +175,44 @@ void Kernel::shutdown() {
     midi_controller->shutdown();
 #endif
 
+    // Termina de salvar o que os processos pediram
+    writer->flush();
+
+    // Fecha o Lua antes de limpar o resto, para os finalizers ainda
+    // encontrarem o que liberam
+    vms.clear();
+    stopped_vms.clear();
+    bus->clear();
+    vm_caller = nullptr;
+    process.reset();
+
     // Limpa a memória dos processos
+    loader->clear();
+    // As folhas em cache (e as compartilhadas) ficam na memória dos
+    // processos, que é liberada logo abaixo: o cache não pode sobreviver
+    // ao reboot apontando para áreas livres
+    mmap::reset_images();
+    gpu->font.clear();
+    gpu->clear_tiles();
+    widgets->clear();
+    compositor->clear();
+
+    {
+        lock_guard<mutex> guard(widget_garbage_lock);
+        widget_garbage.clear();
+    }
     memory.deallocate_after(process_memory_start);
 }
 
 void Kernel::loop() {
-    float last_time = 0;
-
     while (power) {
-        float current_time = SDL_GetTicks();
-        float delta = (current_time - last_time)/1000;
-        //float fps = 1.f / delta;
-        last_time = current_time;
+        // Os workers só tocam no console fora da frame, enquanto ela espera
+        unique_lock<recursive_timed_mutex> frame(console);
+
+        // Quantos updates de passo fixo rodar nessa frame
+        auto steps = scheduler->begin_frame();
+
+        profiler->begin_frame();
 
         SDL_Event event;
 
@@ -129,6 +239,11 @@ void Kernel::loop() {
                         case SDL_WINDOWEVENT_SIZE_CHANGED: {
                             gpu->resize();
                         } break;
+                        // Janela precisa ser redesenhada mesmo sem mudanças
+                        case SDL_WINDOWEVENT_EXPOSED:
+                        case SDL_WINDOWEVENT_RESTORED: {
+                            gpu->invalidate();
+                        } break;
                         // Solta botões ao perder foco
                         case SDL_WINDOWEVENT_FOCUS_LOST: {
                             controller->all_released();
@@ -158,6 +273,10 @@ void Kernel::loop() {
                                (event.key.keysym.mod&KMOD_LCTRL ||
                                 event.key.keysym.mod&KMOD_RCTRL)) {
                         gpu->toggle_fullscreen();
+                    } else if (event.key.keysym.sym == SDLK_p &&
+                               (event.key.keysym.mod&KMOD_LCTRL ||
+                                event.key.keysym.mod&KMOD_RCTRL)) {
+                        profiler->toggle_overlay();
                     } else if (event.key.keysym.sym == SDLK_ESCAPE) {
                         menu();
                     } else if (event.key.keysym.sym == SDLK_RETURN) {
@@ -238,6 +357,11 @@ void Kernel::loop() {
             }
         }
 
+        // Assets carregados em segundo plano entram entre as frames
+        loader->collect(memory);
+
+        update_sampler();
+
         // Espera a gpu inicializar
         if (gpu->cycle > BOOT_CYCLES) {
             // Roda o processo no topo da lista de processos
@@ -248,18 +372,555 @@ void Kernel::loop() {
                     process->menu();
                 }
 
-                process->update(delta);
+                for (unsigned int s=0;s<steps;s++) {
+                    process->update(scheduler->delta());
+                }
             } else {
                 process->init();
             }
         }
 
-        gpu->draw();
+        update_vms();
+
+        // O overlay fica por cima de tudo e não conta como dano das
+        // janelas, senão elas seriam redesenhadas em toda passada
+        const auto damage = gpu->take_damage();
+
+        compositor->expose(profiler->draw_overlay(*gpu));
+
+        gpu->take_damage();
+        gpu->restore_damage(damage);
+
+        const bool presented = gpu->draw();
+
+        profiler->end_frame(memory, *gpu, *audio);
+
+        frame.unlock();
+
+        // O present espera o vsync; os workers usam o console enquanto isso
+        gpu->show();
+
+        scheduler->wait(presented);
+    }
+}
+
+
+// Roda a cada SAMPLER_INSTRUCTIONS instruções enquanto algum processo
+// está sendo amostrado
+static void sample_hook(lua_State *l, lua_Debug*) {
+    auto kernel = KernelSingleton.lock();
+    int32_t pid;
+
+    if (kernel && kernel->profiler->current(pid)) {
+        kernel->sampler->sample(l, pid);
+    }
+}
+
+// O hook só é trocado aqui, fora do Lua: desligar o JIT joga fora os
+// traces, e isso não pode acontecer com um deles rodando
+void Kernel::update_sampler() {
+    for (auto &folded: sampler->collect()) {
+        writer->write(folded.first, move(folded.second), false);
+    }
+
+    if (sampler->active() != sampling) {
+        sampling = sampler->active();
+
+        process->sample(sampling ? sample_hook : nullptr, SAMPLER_INSTRUCTIONS);
+
+        // As vms nos workers não são amostradas: o hook rodaria fora da
+        // thread principal
+        for (auto &vm: vms) {
+            if (!process_scheduler->has(vm.first)) {
+                vm.second->sample(sampling ? sample_hook : nullptr, SAMPLER_INSTRUCTIONS);
+            }
+        }
+    }
+}
+
+// Coleta das vms dos apps, depois de todos os updates da frame. O tempo
+// de cada uma aparece no profiler como a seção "gc" do processo. As vms
+// dos workers coletam lá, depois de cada update
+void Kernel::update_vms() {
+    const bool profiling = profiler->enabled();
+
+    {
+        lock_guard<mutex> guard(widget_garbage_lock);
+
+        for (const auto id: widget_garbage) {
+            widgets->destroy(id);
+        }
+
+        widget_garbage.clear();
+    }
+
+    for (auto &vm: vms) {
+        if (process_scheduler->has(vm.first)) {
+            continue;
+        }
+
+        if (profiling) {
+            profiler->begin(vm.first, PROFILER_GC);
+        }
+
+        vm.second->collect_garbage();
+
+        if (profiling) {
+            profiler->end();
+        }
+    }
+
+    // Processos que pararam durante a frame, talvez de dentro da
+    // própria vm. Uma vm que ainda roda num worker espera a próxima
+    // frame
+    for (auto it=stopped_vms.begin();it!=stopped_vms.end();) {
+        const auto pid = it->first;
+
+        if (process_scheduler->busy(pid)) {
+            ++it;
+            continue;
+        }
+
+        process_scheduler->remove(pid);
+
+        it->second->shutdown();
+
+        bus->close(pid);
+        it = stopped_vms.erase(it);
+    }
+}
+
+int Kernel::api_vm_new(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+    luaL_checkstring(l, 2);
+    luaL_checktype(l, 3, LUA_TTABLE);
+    const auto limit = luaL_optnumber(l, 4, 0);
+    const auto budget = luaL_optnumber(l, 5, 0);
+    // Com prioridade, o update roda nos workers (se houver algum)
+    const bool threaded = !lua_isnoneornil(l, 6) && process_scheduler->size() > 0;
+    const int priority = luaL_optinteger(l, 6, 0);
+
+    auto runtime = Path("./frameworks/vm/");
+
+    auto vm = make_unique<Process>(memory, runtime,
+                                   limit > 0 ? size_t(limit) : VM_MEMORY_LIMIT,
+                                   budget > 0 ? uint32_t(budget) : VM_GC_BUDGET);
+
+    if (!vm->ok) {
+        lua_pushnil(l);
+        lua_pushstring(l, vm->error.c_str());
+
+        return 2;
+    }
+
+    const auto it = vms.find(pid);
+
+    if (it != vms.end()) {
+        process_scheduler->cancel(pid);
+        stopped_vms.emplace_back(pid, move(it->second));
+        vms.erase(it);
+    }
+
+    // A caixa vive até a vm ser fechada
+    vm->expose("syscall", vm_syscall, pid);
+    vm->expose("receive", vm_receive, pid, bus->open(pid));
+    vm->expose("slice_begin", slice_begin, pid, vm.get());
+    vm->expose("slice_end", slice_end, pid, vm.get());
+
+    if (sampling && !threaded) {
+        vm->sample(sample_hook, SAMPLER_INSTRUCTIONS);
+    }
+
+    auto process = vm.get();
+
+    vms[pid] = move(vm);
+
+    lua_settop(l, 3);
+    lua_pushboolean(l, threaded);
+    lua_setfield(l, 3, "threaded");
+
+    // O código do app roda aqui, e já pode fazer chamadas de sistema
+    const auto caller = vm_caller;
+    vm_caller = l;
+
+    const int results = Process::call_across(process->st, l, "boot", 2, 2);
+
+    vm_caller = caller;
+
+    if (results < 0) {
+        lua_pushnil(l);
+        lua_insert(l, -2);
+
+        return 2;
+    }
+
+    if (threaded && results > 0 && lua_toboolean(l, -results)) {
+        process_scheduler->add(pid, process, priority);
+    }
+
+    lua_pushboolean(l, threaded);
+
+    return results+1;
+}
+
+int Kernel::api_vm_call(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+    luaL_checkstring(l, 2);
+
+    const auto it = vms.find(pid);
+
+    if (it == vms.end()) {
+        lua_pushstring(l, "process has no vm");
+
+        return -1;
+    }
+
+    if (process_scheduler->busy(pid)) {
+        lua_pushstring(l, "process is running on a worker");
+
+        return -1;
+    }
+
+    // A vm pode parar durante a chamada, mas só é fechada no update_vms()
+    auto process = it->second.get();
+
+    const auto caller = vm_caller;
+    vm_caller = l;
+
+    const int results = Process::call_across(process->st, l, "call", 2, lua_gettop(l)-1);
+
+    vm_caller = caller;
 
-        SDL_Delay(max<int>((1000/GPU_FRAMERATE)-(SDL_GetTicks()-last_time), 0));
+    // Um erro no meio de um draw_to deixaria os próximos processos
+    // desenhando na superfície
+    if (results < 0) {
+        gpu->reset_target();
     }
+
+    return results;
+}
+
+int Kernel::api_vm_free(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+    const auto it = vms.find(pid);
+
+    if (it != vms.end()) {
+        process_scheduler->cancel(pid);
+        stopped_vms.emplace_back(pid, move(it->second));
+        vms.erase(it);
+    }
+
+    return 0;
+}
+
+int Kernel::api_vm_stats(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+    const auto it = vms.find(pid);
+
+    if (it == vms.end()) {
+        return 0;
+    }
+
+    const auto &vm = it->second;
+
+    lua_createtable(l, 0, 5);
+
+    lua_pushnumber(l, vm->memory_used());
+    lua_setfield(l, -2, "used");
+    lua_pushnumber(l, vm->memory_peak());
+    lua_setfield(l, -2, "peak");
+    lua_pushnumber(l, vm->memory_limit());
+    lua_setfield(l, -2, "limit");
+    lua_pushnumber(l, vm->garbage_time());
+    lua_setfield(l, -2, "gc");
+    // Só o tempo nos workers; o kernel Lua soma o da thread principal
+    lua_pushnumber(l, process_scheduler->cpu_time(pid));
+    lua_setfield(l, -2, "cpu");
+
+    return 1;
+}
+
+int Kernel::api_vm_syscall(lua_State *l) {
+    // Vai para o vm_syscall(pid, nome, ...) do kernel Lua
+    lua_pushinteger(l, lua_tointeger(l, lua_upvalueindex(1)));
+    lua_insert(l, 1);
+
+    // Num worker, a vm do kernel está parada fora de qualquer chamada
+    // enquanto o console está travado
+    if (ProcessScheduler::on_worker()) {
+        if (!api_enter()) {
+            lua_pushstring(l, "process stopped");
+
+            return -1;
+        }
+
+        const int results = Process::call_across(process->st, l, "vm_syscall", 1, lua_gettop(l));
+
+        api_leave();
+
+        return results;
+    }
+
+    if (!vm_caller) {
+        lua_pushstring(l, "system call outside of a kernel call");
+
+        return -1;
+    }
+
+    return Process::call_across(vm_caller, l, "vm_syscall", 1, lua_gettop(l));
+}
+
+// Pede o próximo update no worker: true se entrou na fila, false se o
+// anterior ainda roda, nil e o erro se o anterior falhou
+int Kernel::api_vm_update(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+    const float dt = luaL_checknumber(l, 2);
+
+    string error;
+
+    const int state = process_scheduler->update(pid, dt, error);
+
+    if (state < 0) {
+        lua_pushnil(l);
+        lua_pushlstring(l, error.c_str(), error.size());
+
+        return 2;
+    }
+
+    lua_pushboolean(l, state > 0);
+
+    return 1;
+}
+
+int Kernel::api_vm_busy(lua_State *l) {
+    lua_pushboolean(l, process_scheduler->busy(luaL_checkinteger(l, 1)));
+
+    return 1;
+}
+
+int Kernel::api_vm_priority(lua_State *l) {
+    process_scheduler->set_priority(luaL_checkinteger(l, 1), luaL_checkinteger(l, 2));
+
+    return 0;
+}
+
+// Roda na vm do app, em qualquer thread: só a caixa é tocada
+int Kernel::api_vm_receive(lua_State *l) {
+    auto mailbox = (Mailbox*)lua_touserdata(l, lua_upvalueindex(2));
+
+    string message;
+
+    if (!mailbox || !mailbox->pop(message)) {
+        return 0;
+    }
+
+    Mailbox::decode(l, message);
+
+    return 1;
+}
+
+// Os finalizers rodam na coleta, que num worker acontece sem o console
+// travado: a árvore é desenhada pela thread principal ao mesmo tempo
+void Kernel::api_widget_destroy(const int32_t id) {
+    if (ProcessScheduler::on_worker()) {
+        lock_guard<mutex> guard(widget_garbage_lock);
+        widget_garbage.push_back(id);
+    } else {
+        widgets->destroy(id);
+    }
+}
+
+int Kernel::api_bus_open(lua_State *l) {
+    bus->open(luaL_checkinteger(l, 1));
+
+    return 0;
+}
+
+// A caixa de um app com vm própria só sai com a vm, que pode estar
+// lendo dela num worker (ver update_vms)
+int Kernel::api_bus_close(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+
+    bool open_vm = vms.count(pid) > 0;
+
+    for (const auto &stopped: stopped_vms) {
+        if (stopped.first == pid) {
+            open_vm = true;
+        }
+    }
+
+    if (open_vm) {
+        bus->leave(pid);
+    } else {
+        bus->close(pid);
+    }
+
+    return 0;
+}
+
+// false se o processo não existe, a caixa está cheia ou a mensagem não
+// atravessa
+int Kernel::api_bus_send(lua_State *l) {
+    const int32_t pid = luaL_checkinteger(l, 1);
+
+    string message;
+
+    lua_pushboolean(l, Mailbox::encode(l, 2, message) && bus->send(pid, move(message)));
+
+    return 1;
+}
+
+int Kernel::api_bus_receive(lua_State *l) {
+    auto mailbox = bus->find(luaL_checkinteger(l, 1));
+
+    string message;
+
+    if (!mailbox || !mailbox->pop(message)) {
+        return 0;
+    }
+
+    Mailbox::decode(l, message);
+
+    return 1;
+}
+
+int Kernel::api_bus_subscribe(lua_State *l) {
+    bus->subscribe(luaL_checkinteger(l, 1), luaL_checkstring(l, 2));
+
+    return 0;
+}
+
+int Kernel::api_bus_unsubscribe(lua_State *l) {
+    bus->unsubscribe(luaL_checkinteger(l, 1), luaL_checkstring(l, 2));
+
+    return 0;
+}
+
+// Para quantos processos a mensagem foi
+int Kernel::api_bus_publish(lua_State *l) {
+    const string topic = luaL_checkstring(l, 1);
+
+    string message;
+
+    lua_pushinteger(l, Mailbox::encode(l, 2, message) ? bus->publish(topic, message) : 0);
+
+    return 1;
+}
+
+int Kernel::api_bus_subscribers(lua_State *l) {
+    const auto pids = bus->subscribers(luaL_checkstring(l, 1));
+
+    lua_createtable(l, pids.size(), 0);
+
+    for (size_t i=0;i<pids.size();i++) {
+        lua_pushinteger(l, pids[i]);
+        lua_rawseti(l, -2, i+1);
+    }
+
+    return 1;
+}
+
+// A corrotina roda o update até ceder ou até o prazo passar; ver
+// Process::begin_slice. Retorna a fatia em microssegundos
+int Kernel::api_slice_begin(lua_State *l) {
+    auto process = (Process*)lua_touserdata(l, lua_upvalueindex(2));
+
+    luaL_checktype(l, 1, LUA_TTHREAD);
+
+    lua_pushinteger(l, process->begin_slice(lua_tothread(l, 1), max(0, int(luaL_optinteger(l, 2, 0)))));
+
+    return 1;
+}
+
+// Retorna se a corrotina foi interrompida pelo prazo
+int Kernel::api_slice_end(lua_State *l) {
+    auto process = (Process*)lua_touserdata(l, lua_upvalueindex(2));
+
+    lua_pushboolean(l, process->end_slice());
+
+    return 1;
+}
+
+// Os erros voltam como erros Lua só aqui, sem nada do C++ na pilha
+static int vm_new(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_new(l);
+}
+
+static int vm_call(lua_State *l) {
+    const int results = KernelSingleton.lock()->api_vm_call(l);
+
+    return results < 0 ? lua_error(l) : results;
+}
+
+static int vm_free(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_free(l);
+}
+
+static int vm_stats(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_stats(l);
+}
+
+static int vm_syscall(lua_State *l) {
+    const int results = KernelSingleton.lock()->api_vm_syscall(l);
+
+    return results < 0 ? lua_error(l) : results;
+}
+
+static int vm_update(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_update(l);
+}
+
+static int vm_busy(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_busy(l);
+}
+
+static int vm_priority(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_priority(l);
+}
+
+static int vm_receive(lua_State *l) {
+    return KernelSingleton.lock()->api_vm_receive(l);
+}
+
+static int bus_open(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_open(l);
+}
+
+static int bus_close(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_close(l);
+}
+
+static int bus_send(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_send(l);
+}
+
+static int bus_receive(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_receive(l);
+}
+
+static int bus_subscribe(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_subscribe(l);
+}
+
+static int bus_unsubscribe(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_unsubscribe(l);
+}
+
+static int bus_publish(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_publish(l);
 }
 
+static int bus_subscribers(lua_State *l) {
+    return KernelSingleton.lock()->api_bus_subscribers(l);
+}
+
+static int slice_begin(lua_State *l) {
+    return KernelSingleton.lock()->api_slice_begin(l);
+}
+
+static int slice_end(lua_State *l) {
+    return KernelSingleton.lock()->api_slice_end(l);
+}
 
 void Kernel::api_shutdown() {
     power = false;
@@ -302,138 +963,631 @@ void Kernel::api_use_spritesheet(const size_t source, const int w, const int h)
     gpu->source = spritesheet;
 }
 
+void Kernel::api_tilemap(const size_t map,
+                         int16_t map_w, int16_t map_h,
+                         int16_t tile_w, int16_t tile_h,
+                         int16_t scroll_x, int16_t scroll_y,
+                         int16_t x, int16_t y, int16_t w, int16_t h) {
+    if (map_w <= 0 || map_h <= 0) {
+        return;
+    }
+
+    // O mapa inteiro precisa estar na memória do console
+    const size_t size = size_t(map_w)*size_t(map_h)*TILE_CELL_SIZE;
+
+    if (map >= NIBBLE_MEM_SIZE || size > NIBBLE_MEM_SIZE-map) {
+        return;
+    }
+
+    gpu->tilemap(memory.raw+map, map_w, map_h, tile_w, tile_h, scroll_x, scroll_y, x, y, w, h);
+}
+
 tuple<size_t, int, int> Kernel::api_load_spritesheet(const string from_str) {
     auto path = Path(from_str);
 
     return mmap::read_image(memory, path);
 }
 
-void Kernel::api_save_spritesheet(const size_t ptr, const int w, const int h, const string to_str) {
+size_t Kernel::api_save_spritesheet(const size_t ptr, const int w, const int h, const string to_str) {
     auto path = Path(to_str);
 
-    mmap::write_image(memory, ptr, w, h, path);
+    // Só a cópia acontece nessa frame; codificar e escrever fica no writer
+    return writer->write(to_str, mmap::image_writer(memory, ptr, w, h, path));
 }
 
 void Kernel::api_unload_spritesheet(const size_t ptr) {
+    mmap::release_image(memory, ptr);
+}
+
+size_t Kernel::api_own_spritesheet(const size_t ptr) {
+    return mmap::own_image(memory, ptr);
+}
+
+// Retorna -1 para tamanhos inválidos
+size_t Kernel::api_new_surface(const int w, const int h) {
+    if (w <= 0 || h <= 0 || w > INT16_MAX || h > INT16_MAX) {
+        return (size_t)-1;
+    }
+
+    auto allocation = memory.allocate_with_position(size_t(w)*size_t(h), "Surface");
+
+    memset(get<0>(allocation), 0, size_t(w)*size_t(h));
+
+    return get<1>(allocation);
+}
+
+void Kernel::api_free_surface(const size_t ptr) {
+    if (ptr >= NIBBLE_MEM_SIZE) {
+        return;
+    }
+
+    if (gpu->drawing_to(memory.raw+ptr)) {
+        gpu->reset_target();
+    }
+
     memory.deallocate(ptr);
 }
 
+void Kernel::api_draw_to(const size_t ptr, const int w, const int h) {
+    if (w <= 0 || h <= 0 || w > INT16_MAX || h > INT16_MAX ||
+        ptr >= NIBBLE_MEM_SIZE || size_t(w)*size_t(h) > NIBBLE_MEM_SIZE-ptr) {
+        gpu->reset_target();
+        return;
+    }
+
+    gpu->set_target(memory.raw+ptr, w, h);
+}
+
+void Kernel::api_draw_surface(const size_t ptr, const int surface_w, const int surface_h,
+                              int16_t sx, int16_t sy,
+                              int16_t x, int16_t y, int16_t w, int16_t h,
+                              uint8_t pal) {
+    if (surface_w <= 0 || surface_h <= 0 || surface_w > INT16_MAX || surface_h > INT16_MAX ||
+        ptr >= NIBBLE_MEM_SIZE || size_t(surface_w)*size_t(surface_h) > NIBBLE_MEM_SIZE-ptr) {
+        return;
+    }
+
+    gpu->blit(memory.raw+ptr, surface_w, surface_h, sx, sy, x, y, w, h, pal);
+}
+
+tuple<size_t, size_t> Kernel::api_load_binary(const string from_str) {
+    auto path = Path(from_str);
+    auto pos = mmap::read_binary(memory, path);
+
+    if (pos == (size_t)-1) {
+        return tuple<size_t, size_t>(pos, 0);
+    }
+
+    auto meta = (mmap::BinaryMetadata*)(memory.raw+pos);
+
+    // O processo só enxerga os dados, sem o cabeçalho
+    return tuple<size_t, size_t>(pos+sizeof(mmap::BinaryMetadata), meta->length);
+}
+
+void Kernel::api_unload_binary(const size_t ptr) {
+    memory.deallocate(ptr-sizeof(mmap::BinaryMetadata));
+}
+
+size_t Kernel::api_load_async(const string path) {
+    return loader->load(path);
+}
+
+int Kernel::api_load_status(const size_t id) {
+    return loader->status(id);
+}
+
+void Kernel::api_load_wait(const size_t id) {
+    loader->wait(memory, id);
+}
+
+bool Kernel::api_load_result(const size_t id, string &data) {
+    return loader->take(id, data);
+}
+
+size_t Kernel::api_save_file(const string path, string data, const bool tracked) {
+    return writer->write(path, move(data), tracked);
+}
+
+int Kernel::api_save_status(const size_t id) {
+    return writer->status(id);
+}
+
+// Posição do registrador do profiler na memória
+size_t Kernel::api_profiler_statistics() {
+    return (uint8_t*)profiler->statistics-memory.raw;
+}
+
+bool Kernel::api_isolate_apps() {
+    return isolate_apps;
+}
+
+// A thread principal já tem o console durante a frame (o mutex é
+// recursivo). Um worker espera a frame acabar, olhando de tempos em
+// tempos se o processo dele parou
+bool Kernel::api_enter() {
+    while (!console.try_lock_for(chrono::milliseconds(SCHEDULER_LOCK_WAIT))) {
+        if (process_scheduler->cancelled()) {
+            return false;
+        }
+    }
+
+    // O cancelamento pode ter chegado enquanto a thread principal segurava
+    // o console: com ele, a vm do kernel já pode estar em outro boot
+    if (process_scheduler->cancelled()) {
+        console.unlock();
+
+        return false;
+    }
+
+    return true;
+}
+
+void Kernel::api_leave() {
+    console.unlock();
+}
+
+int Kernel::api_sample(const int32_t pid, const string name, const double seconds, const string path) {
+    // O hook de amostragem só roda na thread principal; a sessão de um
+    // app nos workers sairia vazia
+    if (process_scheduler->has(pid)) {
+        return 2;
+    }
+
+    return sampler->start(pid, name, seconds, path) ? 0 : 1;
+}
+
+size_t Kernel::api_trace_stop(const string path) {
+    string json;
+
+    if (!profiler->stop_trace(json)) {
+        return (size_t)-1;
+    }
+
+    return writer->write(path, move(json));
+}
+
 // Wrapper estático para a API
 
+// Conta a chamada no profiler
+static inline shared_ptr<Kernel> api_kernel(const ProfilerApi api) {
+    auto kernel = KernelSingleton.lock();
+
+    kernel->profiler->count(api);
+
+    return kernel;
+}
+
 size_t kernel_api_write(const size_t to, const size_t amount, const char* data) {
-    return KernelSingleton.lock()->api_write(to, amount, (uint8_t*)data);
+    return api_kernel(PROFILER_API_KERNEL)->api_write(to, amount, (uint8_t*)data);
 }
 
 size_t kernel_api_read(char* buffer, const size_t from, const size_t amount) {
-    return KernelSingleton.lock()->api_read(buffer, from, amount);
+    return api_kernel(PROFILER_API_KERNEL)->api_read(buffer, from, amount);
 }
 
 void kernel_api_load_spritesheet(const char* from, size_t* ptr, int* w, int* h) {
-    auto t = KernelSingleton.lock()->api_load_spritesheet(string(from));
+    auto t = api_kernel(PROFILER_API_KERNEL)->api_load_spritesheet(string(from));
 
     *ptr = get<0>(t);
     *w = get<1>(t);
     *h = get<2>(t);
 }
 
-void kernel_api_save_spritesheet(const size_t ptr, const int w, const int h, const char* to) {
-    KernelSingleton.lock()->api_save_spritesheet(ptr, w, h, to);
+size_t kernel_api_save_spritesheet(const size_t ptr, const int w, const int h, const char* to) {
+    return api_kernel(PROFILER_API_KERNEL)->api_save_spritesheet(ptr, w, h, to);
 }
 
 void kernel_api_use_spritesheet(const size_t source, const int w, const int h) {
-    KernelSingleton.lock()->api_use_spritesheet(source, w, h);
+    api_kernel(PROFILER_API_KERNEL)->api_use_spritesheet(source, w, h);
 }
 
 void kernel_api_unload_spritesheet(const size_t ptr) {
-    KernelSingleton.lock()->api_unload_spritesheet(ptr);
+    api_kernel(PROFILER_API_KERNEL)->api_unload_spritesheet(ptr);
+}
+
+size_t kernel_api_own_spritesheet(const size_t ptr) {
+    return api_kernel(PROFILER_API_KERNEL)->api_own_spritesheet(ptr);
+}
+
+size_t kernel_api_new_surface(const int w, const int h) {
+    return api_kernel(PROFILER_API_KERNEL)->api_new_surface(w, h);
+}
+
+void kernel_api_free_surface(const size_t ptr) {
+    api_kernel(PROFILER_API_KERNEL)->api_free_surface(ptr);
+}
+
+void kernel_api_load_binary(const char* from, size_t* ptr, size_t* length) {
+    auto t = api_kernel(PROFILER_API_KERNEL)->api_load_binary(string(from));
+
+    *ptr = get<0>(t);
+    *length = get<1>(t);
+}
+
+void kernel_api_unload_binary(const size_t ptr) {
+    api_kernel(PROFILER_API_KERNEL)->api_unload_binary(ptr);
+}
+
+size_t kernel_api_load_async(const char* path) {
+    return api_kernel(PROFILER_API_KERNEL)->api_load_async(string(path));
+}
+
+int kernel_api_load_status(const size_t id) {
+    return api_kernel(PROFILER_API_KERNEL)->api_load_status(id);
+}
+
+void kernel_api_load_wait(const size_t id) {
+    api_kernel(PROFILER_API_KERNEL)->api_load_wait(id);
+}
+
+size_t kernel_api_save_file(const char* path, const char* data, const size_t length, const int tracked) {
+    return api_kernel(PROFILER_API_KERNEL)->api_save_file(string(path), string(data, length), tracked != 0);
+}
+
+int kernel_api_save_status(const size_t id) {
+    return api_kernel(PROFILER_API_KERNEL)->api_save_status(id);
+}
+
+LuaString* kernel_api_load_result(const size_t id) {
+    string data;
+
+    if (!api_kernel(PROFILER_API_KERNEL)->api_load_result(id, data)) {
+        return nullptr;
+    }
+
+    // Liberados pelo Lua com free
+    auto result = (LuaString*)malloc(sizeof(LuaString));
+
+    result->len = data.size();
+    result->ptr = (char*)malloc(data.size());
+    memcpy(result->ptr, data.data(), data.size());
+
+    return result;
 }
 
 void kernel_api_shutdown() {
-    KernelSingleton.lock()->api_shutdown();
+    api_kernel(PROFILER_API_KERNEL)->api_shutdown();
 }
 
-void gpu_api_sprite(int16_t x, int16_t y,
-                    int16_t sx, int16_t sy,
-                    int16_t w, int16_t h,
-                    uint8_t pal) {
-    KernelSingleton.lock()->gpu->sprite(x, y, sx, sy, w, h, pal);
+int kernel_api_isolate_apps() {
+    return KernelSingleton.lock()->api_isolate_apps();
 }
 
+double kernel_api_time() {
+    return double(SDL_GetPerformanceCounter())*1000000.0/double(SDL_GetPerformanceFrequency());
+}
+
+int kernel_api_enter() {
+    return KernelSingleton.lock()->api_enter();
+}
+
+void kernel_api_leave() {
+    KernelSingleton.lock()->api_leave();
+}
+
+int kernel_api_debug() {
+#ifdef NIBBLE_DEBUG
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Conversões dos argumentos que vêm do Lua, que são sempre double
+
+// Arredonda para baixo e satura, em vez de dar a volta como no int16_t
+static inline int16_t to_coord(const double v) {
+    if (isnan(v)) {
+        return 0;
+    }
+
+    return (int16_t)max(min(floor(v), (double)INT16_MAX), (double)INT16_MIN);
+}
+
+// Cores vão de 0 a 127, como o `%128` que o Lua fazia
+static inline uint8_t to_color(const double c) {
+    return (uint8_t)(to_coord(c)&0x7F);
+}
+
+// Paletas vão de 0 a 7, inclusive para valores negativos
+static inline uint8_t to_palette(const double p) {
+    return (uint8_t)(to_coord(p)&(GPU_PALETTE_AMOUNT-1));
+}
+
+void gpu_api_sprite(double sx, double sy,
+                    double x, double y,
+                    double w, double h,
+                    double pal) {
+    api_kernel(PROFILER_API_GPU)->gpu->sprite(to_coord(sx), to_coord(sy),
+                                              to_coord(x), to_coord(y),
+                                              to_coord(w), to_coord(h),
+                                              to_palette(pal));
+}
+
+void gpu_api_spr(double x, double y, double sprx, double spry, double pal) {
+    api_kernel(PROFILER_API_GPU)->gpu->sprite(to_coord(sprx)*GPU_SPRITE_W, to_coord(spry)*GPU_SPRITE_H,
+                                              to_coord(x), to_coord(y),
+                                              GPU_SPRITE_W, GPU_SPRITE_H,
+                                              to_palette(pal));
+}
+
+void gpu_api_slice(double sx, double sy, double sw, double sh,
+                   double sl1, double sl2, double sl3, double sl4,
+                   double x, double y, double w, double h,
+                   double pal) {
+    api_kernel(PROFILER_API_GPU)->gpu->slice(to_coord(sx), to_coord(sy), to_coord(sw), to_coord(sh),
+                                             to_coord(sl1), to_coord(sl2), to_coord(sl3), to_coord(sl4),
+                                             to_coord(x), to_coord(y), to_coord(w), to_coord(h),
+                                             to_palette(pal));
+}
+
+void gpu_api_draw_to(const size_t ptr, const int w, const int h) {
+    api_kernel(PROFILER_API_GPU)->api_draw_to(ptr, w, h);
+}
+
+void gpu_api_draw_surface(const size_t ptr, const int surface_w, const int surface_h,
+                          double sx, double sy,
+                          double x, double y, double w, double h,
+                          double pal) {
+    api_kernel(PROFILER_API_GPU)->api_draw_surface(ptr, surface_w, surface_h,
+                                                   to_coord(sx), to_coord(sy),
+                                                   to_coord(x), to_coord(y), to_coord(w), to_coord(h),
+                                                   to_palette(pal));
+}
+
+void gpu_api_print(const char* str, const size_t len, double x, double y, double pal) {
+    api_kernel(PROFILER_API_GPU)->gpu->print(str, len, to_coord(x), to_coord(y), to_palette(pal));
+}
+
+void gpu_api_tilemap(const size_t map,
+                     double map_w, double map_h,
+                     double tile_w, double tile_h,
+                     double scroll_x, double scroll_y,
+                     double x, double y, double w, double h) {
+    api_kernel(PROFILER_API_GPU)->api_tilemap(map,
+                                              to_coord(map_w), to_coord(map_h),
+                                              to_coord(tile_w), to_coord(tile_h),
+                                              to_coord(scroll_x), to_coord(scroll_y),
+                                              to_coord(x), to_coord(y), to_coord(w), to_coord(h));
+}
+
+size_t gpu_api_measure(const char* str, const size_t len) {
+    return FontAtlas::length(str, len)*FONT_CHAR_W;
+}
+
+size_t gpu_api_fit(const char* str, const size_t len, double width) {
+    return FontAtlas::fit(str, len, max<int16_t>(to_coord(width), 0)/FONT_CHAR_W);
+}
+
+// Retorna quantas linhas o texto tem; só as primeiras `max_lines`
+// posições são escritas
+size_t gpu_api_wrap(const char* str, const size_t len, double width, size_t* starts, const size_t max_lines) {
+    vector<size_t> lines;
+
+    FontAtlas::wrap(str, len, max(to_coord(width)/FONT_CHAR_W, 1), lines);
+
+    copy_n(lines.begin(), min(lines.size(), max_lines), starts);
+
+    return lines.size();
+}
+
+void compositor_api_frame() {
+    auto kernel = api_kernel(PROFILER_API_COMPOSITOR);
+
+    kernel->compositor->begin_frame(kernel->gpu->take_damage());
+}
+
+int compositor_api_begin(const int32_t pid, double x, double y, double w, double h) {
+    auto kernel = api_kernel(PROFILER_API_COMPOSITOR);
+    const SDL_Rect rect = { to_coord(x), to_coord(y), to_coord(w), to_coord(h) };
+
+    return kernel->compositor->begin(pid, rect, kernel->gpu->take_damage());
+}
+
+void compositor_api_end(const int32_t pid) {
+    auto kernel = api_kernel(PROFILER_API_COMPOSITOR);
+
+    kernel->compositor->end(pid, kernel->gpu->take_damage());
+}
+
+void compositor_api_redraw(const int32_t pid) {
+    api_kernel(PROFILER_API_COMPOSITOR)->compositor->redraw(pid);
+}
+
+void compositor_api_animate(const int32_t pid, const int animating) {
+    api_kernel(PROFILER_API_COMPOSITOR)->compositor->animate(pid, animating != 0);
+}
+
+void compositor_api_remove(const int32_t pid) {
+    api_kernel(PROFILER_API_COMPOSITOR)->compositor->remove(pid);
+}
+
+size_t profiler_api_statistics() {
+    return KernelSingleton.lock()->api_profiler_statistics();
+}
+
+int profiler_api_enabled() {
+    auto kernel = KernelSingleton.lock();
+
+    // O sampler usa as seções para saber qual processo está rodando
+    return kernel->profiler->enabled() || kernel->sampler->active();
+}
+
+void profiler_api_begin(const int32_t pid, const int section) {
+    if (section >= 0 && section < PROFILER_SECTION_AMOUNT) {
+        KernelSingleton.lock()->profiler->begin(pid, (ProfilerSection)section);
+    }
+}
+
+void profiler_api_end() {
+    KernelSingleton.lock()->profiler->end();
+}
+
+void profiler_api_name(const int32_t pid, const char* name) {
+    KernelSingleton.lock()->profiler->name(pid, string(name));
+}
+
+void profiler_api_overlay(const int show) {
+    KernelSingleton.lock()->profiler->statistics->overlay = show != 0;
+}
+
+void profiler_api_trace_start() {
+    KernelSingleton.lock()->profiler->start_trace();
+}
+
+size_t profiler_api_trace_stop(const char* path) {
+    return KernelSingleton.lock()->api_trace_stop(string(path));
+}
+
+int profiler_api_sample(const int32_t pid, const char* name, const double seconds, const char* path) {
+    return KernelSingleton.lock()->api_sample(pid, string(name), seconds, string(path));
+}
+
+int32_t ui_api_create() {
+    return api_kernel(PROFILER_API_UI)->widgets->create();
+}
+
+// Chamado pelo finalizer do Lua, que pode rodar com o kernel já
+// sendo destruído
+void ui_api_destroy(const int32_t id) {
+    if (auto kernel = KernelSingleton.lock()) {
+        kernel->api_widget_destroy(id);
+    }
+}
+
+void ui_api_set_props(const int32_t id, const WidgetProps* props) {
+    api_kernel(PROFILER_API_UI)->widgets->set_props(id, *props);
+}
+
+void ui_api_set_content(const int32_t id, const char* str, const size_t len) {
+    api_kernel(PROFILER_API_UI)->widgets->set_content(id, string(str, len));
+}
+
+void ui_api_set_children(const int32_t id, const int32_t* children, const size_t count) {
+    api_kernel(PROFILER_API_UI)->widgets->set_children(id, children, count);
+}
+
+int32_t ui_api_render(const int32_t root, const int32_t resume, const int dirty,
+                      double x, double y, double w, double h) {
+    auto kernel = api_kernel(PROFILER_API_UI);
+
+    // A janela foi exposta: os nós que não mudaram também sumiram dela
+    const bool repaint = resume == WIDGET_NONE && kernel->compositor->repainting();
+
+    if (repaint) {
+        kernel->widgets->invalidate(root);
+    }
+
+    return kernel->widgets->render(*kernel->gpu, root, resume, dirty != 0 || repaint, { x, y, w, h });
+}
 
 void gpu_api_set_cursor(int16_t x, int16_t y,
                         int16_t w, int16_t h,
                         int16_t hx, int16_t hy,
                         uint8_t pal) {
-    KernelSingleton.lock()->gpu->set_cursor(x, y, w, h, hx, hy, pal);
+    api_kernel(PROFILER_API_GPU)->gpu->set_cursor(x, y, w, h, hx, hy, pal);
 }
 
-void gpu_api_clip(int16_t x, int16_t y, int16_t w, int16_t h) {
-    KernelSingleton.lock()->gpu->clip(x, y, w, h);
+void gpu_api_clip(double x, double y, double w, double h) {
+    api_kernel(PROFILER_API_GPU)->gpu->clip(to_coord(x), to_coord(y), to_coord(w), to_coord(h));
 }
 
-void gpu_api_circle_fill(int16_t x, int16_t y, int16_t r, uint8_t c) {
-    KernelSingleton.lock()->gpu->circle_fill(x, y, r, c);
+void gpu_api_circle_fill(double x, double y, double r, double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->circle_fill(to_coord(x), to_coord(y), to_coord(r), to_color(c));
 }
 
-void gpu_api_quad_fill(int16_t x1, int16_t y1,
-                       int16_t x2, int16_t y2,
-                       int16_t x3, int16_t y3,
-                       int16_t x4, int16_t y4,
-                       uint8_t c) {
-    KernelSingleton.lock()->gpu->quad_fill(x1, y1, x2, y2, x3, y3, x4, y4, c);
+// Sem paleta (negativa) a cor não é remapeada
+static inline int16_t to_optional_palette(const double p) {
+    return p < 0 ? -1 : to_palette(p);
 }
 
+void gpu_api_rounded_rect_fill(double x, double y, double w, double h, double r, double c, double pal) {
+    api_kernel(PROFILER_API_GPU)->gpu->rounded_rect_fill(to_coord(x), to_coord(y),
+                                                         to_coord(w), to_coord(h),
+                                                         to_coord(r), to_color(c),
+                                                         to_optional_palette(pal));
+}
 
-void gpu_api_tri_fill(int16_t x1, int16_t y1,
-                      int16_t x2, int16_t y2,
-                      int16_t x3, int16_t y3,
-                      uint8_t c) {
-    KernelSingleton.lock()->gpu->tri_fill(x1, y1, x2, y2, x3, y3, c);
+void gpu_api_rounded_rect(double x, double y, double w, double h, double r, double c, double pal) {
+    api_kernel(PROFILER_API_GPU)->gpu->rounded_rect(to_coord(x), to_coord(y),
+                                                    to_coord(w), to_coord(h),
+                                                    to_coord(r), to_color(c),
+                                                    to_optional_palette(pal));
 }
 
-void gpu_api_rect_fill(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t c) {
-    KernelSingleton.lock()->gpu->rect_fill(x, y, w, h, c);
+void gpu_api_quad_fill(double x1, double y1,
+                       double x2, double y2,
+                       double x3, double y3,
+                       double x4, double y4,
+                       double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->quad_fill(to_coord(x1), to_coord(y1),
+                                                 to_coord(x2), to_coord(y2),
+                                                 to_coord(x3), to_coord(y3),
+                                                 to_coord(x4), to_coord(y4),
+                                                 to_color(c));
 }
 
-void gpu_api_circle(int16_t x, int16_t y, int16_t r, uint8_t c) {
-    KernelSingleton.lock()->gpu->circle(x, y, r, c);
+
+void gpu_api_tri_fill(double x1, double y1,
+                      double x2, double y2,
+                      double x3, double y3,
+                      double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->tri_fill(to_coord(x1), to_coord(y1),
+                                                to_coord(x2), to_coord(y2),
+                                                to_coord(x3), to_coord(y3),
+                                                to_color(c));
 }
 
-void gpu_api_quad(int16_t x1, int16_t y1,
-                  int16_t x2, int16_t y2,
-                  int16_t x3, int16_t y3,
-                  int16_t x4, int16_t y4,
-                  uint8_t c) {
-    KernelSingleton.lock()->gpu->quad(x1, y1, x2, y2, x3, y3, x4, y4, c);
+void gpu_api_rect_fill(double x, double y, double w, double h, double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->rect_fill(to_coord(x), to_coord(y), to_coord(w), to_coord(h), to_color(c));
 }
 
+void gpu_api_circle(double x, double y, double r, double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->circle(to_coord(x), to_coord(y), to_coord(r), to_color(c));
+}
 
-void gpu_api_tri(int16_t x1, int16_t y1,
-                 int16_t x2, int16_t y2,
-                 int16_t x3, int16_t y3,
-                 uint8_t c) {
-    KernelSingleton.lock()->gpu->tri(x1, y1, x2, y2, x3, y3, c);
+void gpu_api_quad(double x1, double y1,
+                  double x2, double y2,
+                  double x3, double y3,
+                  double x4, double y4,
+                  double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->quad(to_coord(x1), to_coord(y1),
+                                            to_coord(x2), to_coord(y2),
+                                            to_coord(x3), to_coord(y3),
+                                            to_coord(x4), to_coord(y4),
+                                            to_color(c));
 }
 
-void gpu_api_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t c) {
-    KernelSingleton.lock()->gpu->rect(x, y, w, h, c);
+
+void gpu_api_tri(double x1, double y1,
+                 double x2, double y2,
+                 double x3, double y3,
+                 double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->tri(to_coord(x1), to_coord(y1),
+                                           to_coord(x2), to_coord(y2),
+                                           to_coord(x3), to_coord(y3),
+                                           to_color(c));
 }
 
-void gpu_api_clear(uint8_t c) {
-    KernelSingleton.lock()->gpu->clear(c);
+void gpu_api_rect(double x, double y, double w, double h, double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->rect(to_coord(x), to_coord(y), to_coord(w), to_coord(h), to_color(c));
 }
 
+void gpu_api_clear(double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->clear(to_color(c));
+}
 
-void gpu_api_line(int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint8_t c) {
-    KernelSingleton.lock()->gpu->line(x1, y1, x2, y2, c);
+
+void gpu_api_line(double x1, double y1, double x2, double y2, double c) {
+    api_kernel(PROFILER_API_GPU)->gpu->line(to_coord(x1), to_coord(y1), to_coord(x2), to_coord(y2), to_color(c));
 }
 
 int gpu_start_capturing(const char* file) {
-    return (int)KernelSingleton.lock()->gpu->start_capturing(string(file));
+    return (int)api_kernel(PROFILER_API_GPU)->gpu->start_capturing(string(file));
 }
 
 int gpu_stop_capturing() {
-    return (int)KernelSingleton.lock()->gpu->stop_capturing();
+    return (int)api_kernel(PROFILER_API_GPU)->gpu->stop_capturing();
 }
 
 LuaString* api_list_files(const char* path, size_t* length_out, int* ok_out) {
@@ -445,14 +1599,15 @@ LuaString* api_list_files(const char* path, size_t* length_out, int* ok_out) {
     *length_out = amount;
 
     if (ok && amount > 0) {
-        auto ptr_files = new LuaString[amount];
+        // Liberados pelo Lua com free
+        auto ptr_files = (LuaString*)malloc(sizeof(LuaString)*amount);
 
         for (size_t i=0;i<amount;i++) {
             auto file = files[i];
             auto o_path = file.get_original_path();
             auto length = o_path.length();
 
-            ptr_files[i].ptr = new char[length];
+            ptr_files[i].ptr = (char*)malloc(length);
 
             ptr_files[i].len = length;
             memcpy(ptr_files[i].ptr, o_path.c_str(), length);
@@ -464,6 +1619,40 @@ LuaString* api_list_files(const char* path, size_t* length_out, int* ok_out) {
     }
 }
 
+FileListing* api_list_entries(const char* path, const size_t offset, const size_t limit) {
+    vector<DirectoryEntry> entries;
+    string names;
+    bool more;
+
+    if (!fs::list_entries(Path(string(path)), offset, limit, entries, names, more)) {
+        return nullptr;
+    }
+
+    const auto count = entries.size();
+
+    auto listing = (FileListing*)malloc(sizeof(FileListing)+
+                                        sizeof(FileEntry)*count+
+                                        names.size());
+    auto file_entries = (FileEntry*)(listing+1);
+    auto arena = (char*)(file_entries+count);
+
+    memcpy(arena, names.data(), names.size());
+
+    listing->count = count;
+    listing->more = more;
+    listing->entries = file_entries;
+
+    for (size_t i=0;i<count;i++) {
+        file_entries[i].name = arena+entries[i].name_offset;
+        file_entries[i].name_length = entries[i].name_length;
+        file_entries[i].size = entries[i].size;
+        file_entries[i].mtime = entries[i].mtime;
+        file_entries[i].type = entries[i].type;
+    }
+
+    return listing;
+}
+
 API int api_create_directory(const char* strpath) {
     auto path = Path(string(strpath));
 
@@ -482,10 +1671,23 @@ API int api_touch_file(const char* strpath) {
     return (int)fs::touch_file(path);
 }
 
+API int api_file_info(const char* strpath, int64_t* mtime_out, size_t* size_out) {
+    auto path = Path(string(strpath));
+
+    if (!fs::file_exists(path)) {
+        return 0;
+    }
+
+    *mtime_out = fs::get_modification_time(path);
+    *size_out = fs::get_file_size(path);
+
+    return 1;
+}
+
 API void audio_enqueue_command(const uint64_t timestamp,
                                const uint8_t ch,
                                const uint8_t cmd,
                                const uint8_t note,
                                const uint8_t intensity) {
-    KernelSingleton.lock()->audio->enqueue_command(timestamp, ch, cmd, note, intensity);
+    api_kernel(PROFILER_API_AUDIO)->audio->enqueue_command(timestamp, ch, cmd, note, intensity);
 }
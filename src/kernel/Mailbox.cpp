@@ -0,0 +1,334 @@
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <kernel/Mailbox.hpp>
+
+// Um byte de tipo antes de cada valor; tabelas são pares chave, valor
+// até o MESSAGE_END. Uma tabela que aparece de novo (ou um ciclo) vira
+// um MESSAGE_REF com o número dela, na ordem em que as tabelas começam
+enum MessageTag {
+    MESSAGE_NIL = 0,
+    MESSAGE_FALSE,
+    MESSAGE_TRUE,
+    // Números inteiros em varint zigzag, o caso comum
+    MESSAGE_INTEGER,
+    MESSAGE_NUMBER,
+    MESSAGE_STRING,
+    MESSAGE_TABLE,
+    MESSAGE_END,
+    MESSAGE_REF
+};
+
+// Tabelas já escritas na mensagem e os números delas
+typedef struct Encoding {
+    unordered_map<const void*, uint64_t> numbers;
+    vector<const void*> order;
+} Encoding;
+
+Mailbox::Mailbox(const size_t capacity): head(0), tail(0) {
+    size_t size = 2;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    cells = unique_ptr<Cell[]>(new Cell[size]);
+    mask = size-1;
+
+    for (size_t i=0;i<size;i++) {
+        cells[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+bool Mailbox::push(string &&message) {
+    auto position = head.load(memory_order_relaxed);
+    Cell *cell;
+
+    for (;;) {
+        cell = &cells[position&mask];
+
+        const auto sequence = cell->sequence.load(memory_order_acquire);
+        const auto difference = intptr_t(sequence)-intptr_t(position);
+
+        if (difference == 0) {
+            if (head.compare_exchange_weak(position, position+1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = head.load(memory_order_relaxed);
+        }
+    }
+
+    cell->message = move(message);
+    cell->sequence.store(position+1, memory_order_release);
+
+    return true;
+}
+
+bool Mailbox::pop(string &message) {
+    auto position = tail.load(memory_order_relaxed);
+    Cell *cell;
+
+    for (;;) {
+        cell = &cells[position&mask];
+
+        const auto sequence = cell->sequence.load(memory_order_acquire);
+        const auto difference = intptr_t(sequence)-intptr_t(position+1);
+
+        if (difference == 0) {
+            if (tail.compare_exchange_weak(position, position+1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = tail.load(memory_order_relaxed);
+        }
+    }
+
+    message = move(cell->message);
+    cell->message.clear();
+    cell->sequence.store(position+mask+1, memory_order_release);
+
+    return true;
+}
+
+static void write_varint(string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char((value&0x7F)|0x80);
+        value >>= 7;
+    }
+
+    out += char(value);
+}
+
+static bool read_varint(const string &in, size_t &at, uint64_t &value) {
+    value = 0;
+
+    for (int shift=0;shift<64;shift+=7) {
+        if (at >= in.size()) {
+            return false;
+        }
+
+        const uint8_t byte = in[at++];
+
+        value |= uint64_t(byte&0x7F) << shift;
+
+        if (!(byte&0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool encode_value(lua_State *l, int index, string &out, Encoding &tables, const int depth) {
+    if (index < 0) {
+        index = lua_gettop(l)+index+1;
+    }
+
+    switch (lua_type(l, index)) {
+        case LUA_TNIL:
+            out += char(MESSAGE_NIL);
+            return true;
+        case LUA_TBOOLEAN:
+            out += char(lua_toboolean(l, index) ? MESSAGE_TRUE : MESSAGE_FALSE);
+            return true;
+        case LUA_TNUMBER: {
+            const double number = lua_tonumber(l, index);
+
+            // Inteiros que cabem num double sem perder nada
+            if (number == floor(number) && fabs(number) < 9007199254740992.0) {
+                const auto integer = int64_t(number);
+
+                out += char(MESSAGE_INTEGER);
+                write_varint(out, (uint64_t(integer) << 1)^uint64_t(integer >> 63));
+            } else {
+                char bytes[sizeof(double)];
+                memcpy(bytes, &number, sizeof(double));
+
+                out += char(MESSAGE_NUMBER);
+                out.append(bytes, sizeof(double));
+            }
+        } return true;
+        case LUA_TSTRING: {
+            size_t length;
+            const char *str = lua_tolstring(l, index, &length);
+
+            out += char(MESSAGE_STRING);
+            write_varint(out, length);
+            out.append(str, length);
+        } return true;
+        case LUA_TTABLE: {
+            const auto table = lua_topointer(l, index);
+            const auto known = tables.numbers.find(table);
+
+            if (known != tables.numbers.end()) {
+                out += char(MESSAGE_REF);
+                write_varint(out, known->second);
+
+                return true;
+            }
+
+            if (depth >= VM_COPY_DEPTH || !lua_checkstack(l, 3)) {
+                return false;
+            }
+
+            tables.numbers[table] = tables.order.size();
+            tables.order.push_back(table);
+
+            out += char(MESSAGE_TABLE);
+
+            lua_pushnil(l);
+
+            while (lua_next(l, index)) {
+                const auto size = out.size();
+                const auto count = tables.order.size();
+
+                // Pares com chave ou valor que não atravessam (ou chave
+                // NaN) somem
+                const bool nan = lua_type(l, -2) == LUA_TNUMBER && std::isnan(lua_tonumber(l, -2));
+
+                if (nan || lua_isnil(l, -1) ||
+                    !encode_value(l, -2, out, tables, depth+1) ||
+                    !encode_value(l, -1, out, tables, depth+1)) {
+                    out.resize(size);
+
+                    // As tabelas do par que sumiu não têm número no
+                    // decode
+                    for (size_t t=count;t<tables.order.size();t++) {
+                        tables.numbers.erase(tables.order[t]);
+                    }
+
+                    tables.order.resize(count);
+                }
+
+                lua_pop(l, 1);
+            }
+
+            out += char(MESSAGE_END);
+        } return true;
+        default:
+            return false;
+    }
+}
+
+bool Mailbox::encode(lua_State *l, int index, string &out) {
+    out.clear();
+
+    Encoding tables;
+
+    if (!encode_value(l, index, out, tables, 0)) {
+        out.clear();
+        return false;
+    }
+
+    return true;
+}
+
+// `tables` é uma tabela na pilha com as tabelas já lidas, pelo número
+static bool decode_value(lua_State *l, const string &in, size_t &at, const int tables) {
+    if (at >= in.size() || !lua_checkstack(l, 3)) {
+        return false;
+    }
+
+    switch (uint8_t(in[at++])) {
+        case MESSAGE_NIL:
+            lua_pushnil(l);
+            return true;
+        case MESSAGE_FALSE:
+            lua_pushboolean(l, 0);
+            return true;
+        case MESSAGE_TRUE:
+            lua_pushboolean(l, 1);
+            return true;
+        case MESSAGE_INTEGER: {
+            uint64_t value;
+
+            if (!read_varint(in, at, value)) {
+                return false;
+            }
+
+            lua_pushnumber(l, double(int64_t(value >> 1)^-int64_t(value&1)));
+        } return true;
+        case MESSAGE_NUMBER: {
+            if (in.size()-at < sizeof(double)) {
+                return false;
+            }
+
+            double number;
+            memcpy(&number, in.data()+at, sizeof(double));
+            at += sizeof(double);
+
+            lua_pushnumber(l, number);
+        } return true;
+        case MESSAGE_STRING: {
+            uint64_t length;
+
+            if (!read_varint(in, at, length) || in.size()-at < length) {
+                return false;
+            }
+
+            lua_pushlstring(l, in.data()+at, length);
+            at += length;
+        } return true;
+        case MESSAGE_TABLE: {
+            lua_newtable(l);
+
+            lua_pushvalue(l, -1);
+            lua_rawseti(l, tables, lua_objlen(l, tables)+1);
+
+            while (at < in.size() && uint8_t(in[at]) != MESSAGE_END) {
+                if (!decode_value(l, in, at, tables)) {
+                    return false;
+                }
+
+                if (!decode_value(l, in, at, tables)) {
+                    return false;
+                }
+
+                lua_rawset(l, -3);
+            }
+
+            if (at >= in.size()) {
+                return false;
+            }
+
+            at++;
+        } return true;
+        case MESSAGE_REF: {
+            uint64_t number;
+
+            if (!read_varint(in, at, number) || number >= lua_objlen(l, tables)) {
+                return false;
+            }
+
+            lua_rawgeti(l, tables, int(number)+1);
+        } return true;
+        default:
+            return false;
+    }
+}
+
+void Mailbox::decode(lua_State *l, const string &in) {
+    const int top = lua_gettop(l);
+    size_t at = 0;
+
+    lua_newtable(l);
+
+    // As mensagens só vêm do encode; isso é só para não ler fora
+    if (!decode_value(l, in, at, top+1)) {
+        lua_settop(l, top);
+        lua_pushnil(l);
+    } else {
+        lua_remove(l, top+1);
+    }
+}
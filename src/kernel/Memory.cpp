@@ -8,18 +8,34 @@
 
 #include <Specs.hpp>
 
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
 using namespace std;
 
-Memory::Area::Area(size_t pos, size_t size, function<void(AccessMode)> fn): pos(pos), size(size), trigger(fn){ }
+Memory::Area::Area(size_t pos, size_t size, Trigger fn): pos(pos), size(size), trigger(fn){ }
 
 bool Memory::Area::operator < (Area &other) {
     return size < other.size;
 }
 
-Memory::Memory(): log_memory_allocation(false) {
+Memory::Memory(): log_memory_allocation(false), trigger_calls(0) {
+#ifdef WIN32
     raw = new uint8_t[NIBBLE_MEM_SIZE];
 
     memset(raw, 0, NIBBLE_MEM_SIZE);
+#else
+    // Alinhada a página (e já zerada), para podermos mapear arquivos nela
+    raw = (uint8_t*)mmap(nullptr, NIBBLE_MEM_SIZE,
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1, 0);
+
+    if (raw == MAP_FAILED) {
+        cout << "EXITING: COULD NOT MAP MEMORY!" << endl;
+        exit(-1);
+    }
+#endif
 
     cout << "Compiled with "<< NIBBLE_MEM_SIZE/1024 << "kB of memory." << endl;
 
@@ -28,10 +44,14 @@ Memory::Memory(): log_memory_allocation(false) {
 }
 
 Memory::~Memory() {
-    delete raw;
+#ifdef WIN32
+    delete[] raw;
+#else
+    munmap(raw, NIBBLE_MEM_SIZE);
+#endif
 }
 
-tuple<uint8_t*, size_t> Memory::allocate_with_position(const size_t bytes, const string use, function<void(AccessMode)> fn) {
+tuple<uint8_t*, size_t> Memory::allocate_with_position(const size_t bytes, const string use, Trigger fn) {
     for (auto &area: free_areas) {
         if (area.second.size >= bytes) {
             // Cria as informações da nova área
@@ -48,14 +68,7 @@ tuple<uint8_t*, size_t> Memory::allocate_with_position(const size_t bytes, const
 
             used_areas.insert(make_pair(ptr, Area { pos, bytes, fn }));
 
-            if (log_memory_allocation) {
-                stringstream position;
-                position << pos << "-" << pos+bytes;
-
-                cout << setiosflags(cout.left)  << setw(24) << use << resetiosflags(cout.left);
-                cout << setiosflags(cout.right) << " [" << setw(15) << position.str() << "]";
-                cout << resetiosflags(cout.right) << endl;
-            }
+            log_allocation(use, pos, bytes);
 
             return tuple<uint8_t*, size_t> (ptr, pos);
         }
@@ -65,7 +78,53 @@ tuple<uint8_t*, size_t> Memory::allocate_with_position(const size_t bytes, const
     exit(-1);
 }
 
-uint8_t* Memory::allocate(const size_t bytes, const string use, function<void(AccessMode)> fn) {
+tuple<uint8_t*, size_t> Memory::allocate_aligned(const size_t bytes, const string use,
+                                                 const size_t alignment, const size_t offset,
+                                                 Trigger fn) {
+    for (auto &area: free_areas) {
+        const auto start = area.second.pos;
+        const auto end = start+area.second.size;
+        // Primeira posição em que pos+offset fica alinhado
+        const auto pos = ((start+offset+alignment-1)/alignment)*alignment-offset;
+
+        if (pos+bytes > end) {
+            continue;
+        }
+
+        free_areas.erase(area.first);
+
+        // O que sobra antes e depois continua livre
+        if (pos > start) {
+            free_areas.insert(make_pair(raw+start, Area { start, pos-start }));
+        }
+
+        if (pos+bytes < end) {
+            free_areas.insert(make_pair(raw+pos+bytes, Area { pos+bytes, end-pos-bytes }));
+        }
+
+        used_areas.insert(make_pair(raw+pos, Area { pos, bytes, fn }));
+
+        log_allocation(use, pos, bytes);
+
+        return tuple<uint8_t*, size_t> (raw+pos, pos);
+    }
+
+    cout << "EXITING: OUT OF MEMORY!" << endl;
+    exit(-1);
+}
+
+void Memory::log_allocation(const string &use, const size_t pos, const size_t bytes) {
+    if (log_memory_allocation) {
+        stringstream position;
+        position << pos << "-" << pos+bytes;
+
+        cout << setiosflags(cout.left)  << setw(24) << use << resetiosflags(cout.left);
+        cout << setiosflags(cout.right) << " [" << setw(15) << position.str() << "]";
+        cout << resetiosflags(cout.right) << endl;
+    }
+}
+
+uint8_t* Memory::allocate(const size_t bytes, const string use, Trigger fn) {
     return get<0>(allocate_with_position(bytes, use, fn));
 }
 
@@ -89,6 +148,8 @@ void Memory::deallocate(uint8_t *ptr) {
     try {
         auto area = used_areas.at((uint8_t*)ptr);
 
+        unmap_files(area);
+
         free_areas.insert(make_pair(ptr, area));
         used_areas.erase(ptr);
     } catch (out_of_range &o) {
@@ -100,6 +161,8 @@ void Memory::deallocate(const size_t pos) {
     try {
         auto area = used_areas.at(raw+pos);
 
+        unmap_files(area);
+
         free_areas.insert(make_pair(raw+pos, area));
         used_areas.erase(raw+pos);
     } catch (out_of_range &o) {
@@ -156,17 +219,83 @@ size_t Memory::used() {
 }
 
 void Memory::triggers(size_t start, size_t end, AccessMode mode) {
+    trigger_calls++;
+
     for (auto &area: used_areas) {
-        if ((start >= area.second.pos && start <= area.second.pos+area.second.size) ||
-            (end>= area.second.pos && end <= area.second.pos+area.second.size) ||
-            (start <= area.second.pos && end >= area.second.pos+area.second.size)) {
-            if (area.second.trigger) {
-                area.second.trigger(mode);
-            }
+        const auto area_start = area.second.pos;
+        const auto area_end = area.second.pos+area.second.size;
+
+        if (area.second.trigger && start < area_end && end > area_start) {
+            area.second.trigger(mode,
+                                max(start, area_start)-area_start,
+                                min(end, area_end)-area_start);
         }
     }
 }
 
+size_t Memory::take_trigger_calls() {
+    const auto calls = trigger_calls;
+
+    trigger_calls = 0;
+
+    return calls;
+}
+
 void Memory::set_log(bool log) {
     log_memory_allocation = log;
 }
+
+size_t Memory::page_size() {
+#ifdef WIN32
+    return 1;
+#else
+    static const size_t size = sysconf(_SC_PAGESIZE);
+
+    return size;
+#endif
+}
+
+bool Memory::map_file(uint8_t *ptr, Path &path, const size_t length, const size_t offset) {
+#ifdef WIN32
+    return false;
+#else
+    if (length == 0 || (ptr-raw)%page_size() != 0 || offset%page_size() != 0) {
+        return false;
+    }
+
+    int fd = open(path.get_path().c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    // Copy-on-write: escritas do console não vão para o arquivo
+    auto mapped = mmap(ptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        // Um MAP_FIXED que falhou pode ter removido o mapeamento anterior
+        mmap(ptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+        return false;
+    }
+
+    mapped_files[ptr] = length;
+
+    return true;
+#endif
+}
+
+void Memory::unmap_files(const Area &area) {
+#ifndef WIN32
+    auto start = raw+area.pos;
+    auto end = start+area.size;
+
+    for (auto it=mapped_files.lower_bound(start); it != mapped_files.end() && it->first < end;) {
+        mmap(it->first, it->second, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+        it = mapped_files.erase(it);
+    }
+#endif
+}
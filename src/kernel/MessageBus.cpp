@@ -0,0 +1,93 @@
+#include <kernel/MessageBus.hpp>
+
+Mailbox* MessageBus::open(const int32_t pid) {
+    auto &mailbox = mailboxes[pid];
+
+    if (!mailbox) {
+        mailbox = make_unique<Mailbox>();
+    }
+
+    return mailbox.get();
+}
+
+void MessageBus::close(const int32_t pid) {
+    leave(pid);
+
+    mailboxes.erase(pid);
+}
+
+void MessageBus::leave(const int32_t pid) {
+    for (auto it=topics.begin();it!=topics.end();) {
+        it->second.erase(pid);
+
+        if (it->second.empty()) {
+            it = topics.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void MessageBus::clear() {
+    topics.clear();
+    mailboxes.clear();
+}
+
+Mailbox* MessageBus::find(const int32_t pid) {
+    const auto it = mailboxes.find(pid);
+
+    return it == mailboxes.end() ? nullptr : it->second.get();
+}
+
+bool MessageBus::send(const int32_t pid, string &&message) {
+    auto mailbox = find(pid);
+
+    return mailbox && mailbox->push(move(message));
+}
+
+void MessageBus::subscribe(const int32_t pid, const string &topic) {
+    if (mailboxes.count(pid)) {
+        topics[topic].insert(pid);
+    }
+}
+
+void MessageBus::unsubscribe(const int32_t pid, const string &topic) {
+    const auto it = topics.find(topic);
+
+    if (it != topics.end()) {
+        it->second.erase(pid);
+
+        if (it->second.empty()) {
+            topics.erase(it);
+        }
+    }
+}
+
+size_t MessageBus::publish(const string &topic, const string &message) {
+    const auto it = topics.find(topic);
+
+    if (it == topics.end()) {
+        return 0;
+    }
+
+    size_t delivered = 0;
+
+    for (const auto pid: it->second) {
+        // Uma caixa cheia só perde essa mensagem
+        if (send(pid, string(message))) {
+            delivered++;
+        }
+    }
+
+    return delivered;
+}
+
+vector<int32_t> MessageBus::subscribers(const string &topic) const {
+    const auto it = topics.find(topic);
+
+    if (it == topics.end()) {
+        return {};
+    }
+
+    return vector<int32_t>(it->second.begin(), it->second.end());
+}
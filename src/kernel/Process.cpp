@@ -5,11 +5,35 @@
 
 #include <kernel/mmap/Image.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
+#include <SDL.h>
+
+extern "C" {
+#include <luajit.h>
+}
+
 const string Process::lua_entry_point = "main.lua";
 
-Process::Process(Memory &memory, Path &executable):
+// Onde o hook acha o processo da vm e o pcall original
+#define PROCESS_KEY     "nibble.process"
+#define PROCESS_PCALL   "nibble.pcall"
+
+// Cdigo do kernel que mexe na tabela de processos ou no console: uma
+// corrotina no cede com frames dele na pilha
+static const char *kernel_sources[] = {
+    "frameworks/kernel/main.lua",
+    "frameworks/vm/",
+};
+
+Process::Process(Memory &memory, Path &executable, const size_t limit, const uint32_t gc_budget):
+    used(0), peak(0), limit(limit),
+    gc_budget(gc_budget), gc_time(0), gc_live(0), gc_running(false),
+    sampler(nullptr), sampler_instructions(0),
+    slice_thread(nullptr), slice_deadline(0), preempted(false), stop(nullptr),
     initialized(false), ok(true), running(true), error(""),
     memory(memory), executable(executable) {
     // TODO: ideia: system rom com spritesheets acessveis de todos os processos
@@ -23,9 +47,18 @@ Process::Process(Memory &memory, Path &executable):
 	
     st = luaL_newstate();
 
+    // Conta tudo que passa pela arena dessa vm
+    alloc = lua_getallocf(st, &alloc_data);
+    lua_setallocf(st, Process::allocate, this);
+
     // Carrega libs padro lua
     luaL_openlibs(st);
 
+    lua_pushlightuserdata(st, this);
+    lua_setfield(st, LUA_REGISTRYINDEX, PROCESS_KEY);
+    lua_getglobal(st, "pcall");
+    lua_setfield(st, LUA_REGISTRYINDEX, PROCESS_PCALL);
+
     cout << "Loading lua entrypoint " << lua.get_path() << " ..." << endl;
 
     // Carrega o cdigo do app
@@ -47,9 +80,13 @@ Process::Process(Memory &memory, Path &executable):
     //this->environment["parent.pid"] = to_string(parent);
     //this->environment["name"] = executable.getName();
     //this->environment["addr"] = to_string(((uint8_t*)&layout)-memory.raw);
+
+    gc_live = used;
 }
 
 Process::~Process() {
+    // O lua_close s destri a arena com o alocador original
+    lua_setallocf(st, alloc, alloc_data);
     lua_close(st);
 
     // TODO
@@ -114,6 +151,360 @@ void Process::audio_tick() {
     }
 }
 
+void Process::sample(lua_Hook hook, const int instructions) {
+    if (hook) {
+        // Traces compilados no chamam o hook: joga fora os que
+        // existem e roda tudo no interpretador enquanto amostra
+        luaJIT_setmode(st, 0, LUAJIT_MODE_ENGINE|LUAJIT_MODE_FLUSH);
+        luaJIT_setmode(st, 0, LUAJIT_MODE_ENGINE|LUAJIT_MODE_OFF);
+    }
+
+    sampler = hook;
+    sampler_instructions = instructions;
+
+    update_hook();
+
+    if (!hook) {
+        luaJIT_setmode(st, 0, LUAJIT_MODE_ENGINE|LUAJIT_MODE_ON);
+    }
+}
+
+uint32_t Process::begin_slice(lua_State *thread, const uint32_t us) {
+    const auto slice = us > 0 ? us : SCHEDULER_SLICE;
+
+    slice_thread = thread;
+    slice_deadline = SDL_GetPerformanceCounter()+uint64_t(slice)*SDL_GetPerformanceFrequency()/1000000;
+    preempted = false;
+
+    update_hook();
+
+    return slice;
+}
+
+bool Process::end_slice() {
+    slice_thread = nullptr;
+
+    update_hook();
+
+    return preempted;
+}
+
+void Process::watch_stop(const atomic<bool> *flag) {
+    stop = flag;
+
+    update_hook();
+}
+
+// O LuaJIT tem um hook s por vm, dividido entre o sampler, as fatias e
+// o pedido de parada
+void Process::update_hook() {
+    if (slice_thread || stop) {
+        const int instructions = sampler ? min(sampler_instructions, SCHEDULER_SLICE_INSTRUCTIONS) :
+                                           SCHEDULER_SLICE_INSTRUCTIONS;
+
+        lua_sethook(st, Process::hook, LUA_MASKCOUNT, instructions);
+    } else if (sampler) {
+        lua_sethook(st, Process::hook, LUA_MASKCOUNT, sampler_instructions);
+    } else {
+        lua_sethook(st, nullptr, 0, 0);
+    }
+}
+
+void Process::hook(lua_State *l, lua_Debug *ar) {
+    lua_getfield(l, LUA_REGISTRYINDEX, PROCESS_KEY);
+    auto process = (Process*)lua_touserdata(l, -1);
+    lua_pop(l, 1);
+
+    if (!process) {
+        return;
+    }
+
+    if (process->sampler) {
+        process->sampler(l, ar);
+    }
+
+    // Um lao s de Lua no passa pelo console, onde o cancelamento 
+    // visto. Traces compilados no chamam o hook, ento nem sempre pega
+    if (process->stop && process->stop->load()) {
+        luaL_error(l, "process stopped");
+    }
+
+    if (l == process->slice_thread && !process->preempted &&
+        SDL_GetPerformanceCounter() >= process->slice_deadline && can_yield(l)) {
+        process->preempted = true;
+
+        // No retorna: a corrotina volta daqui no prximo resume
+        lua_yield(l, 0);
+    }
+}
+
+// Se a corrotina pode ceder agora. Se no puder, tenta de novo nas
+// prximas chamadas do hook
+bool Process::can_yield(lua_State *l) {
+    lua_Debug ar;
+
+    for (int level=0;lua_getstack(l, level, &ar);level++) {
+        lua_getinfo(l, "Sf", &ar);
+
+        bool safe = true;
+
+        if (strcmp(ar.what, "C") == 0) {
+            // pcall  uma funo rpida do LuaJIT, que sabe ceder
+            lua_getfield(l, LUA_REGISTRYINDEX, PROCESS_PCALL);
+            safe = lua_rawequal(l, -1, -2);
+            lua_pop(l, 1);
+        } else {
+            for (const auto source: kernel_sources) {
+                if (strstr(ar.source, source)) {
+                    safe = false;
+                }
+            }
+        }
+
+        lua_pop(l, 1);
+
+        if (!safe) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Process::expose(const char *name, lua_CFunction function, const int32_t pid, void *data) {
+    lua_pushinteger(st, pid);
+    lua_pushlightuserdata(st, data);
+    lua_pushcclosure(st, function, 2);
+    lua_setglobal(st, name);
+}
+
+void Process::shutdown() {
+    lua_getglobal(st, "shutdown");
+    if (lua_isfunction(st, -1)) {
+        if (call_with_traceback(st, 0, 0) != 0) {
+            cout << "system error: shutdown(): " << lua_tostring(st, -1) << endl;
+            lua_pop(st, 1);
+        }
+    } else {
+        lua_pop(st, 1);
+    }
+}
+
+void Process::collect_garbage() {
+    gc_time = 0;
+
+    if (gc_budget == 0) {
+        return;
+    }
+
+    // Um ciclo novo s comea depois de o heap crescer o bastante, ou
+    // perto do limite
+    const bool pressure = limit > 0 && used > limit/4*3;
+
+    if (!gc_running && !pressure && used*100 < gc_live*VM_GC_GROWTH) {
+        return;
+    }
+
+    const auto frequency = SDL_GetPerformanceFrequency();
+    const auto start = SDL_GetPerformanceCounter();
+    const auto deadline = start+uint64_t(gc_budget)*frequency/1000000;
+
+    gc_running = true;
+
+    do {
+        if (lua_gc(st, LUA_GCSTEP, VM_GC_STEP)) {
+            gc_running = false;
+            gc_live = used;
+            break;
+        }
+    } while (SDL_GetPerformanceCounter() < deadline);
+
+    gc_time = (SDL_GetPerformanceCounter()-start)*1000000/frequency;
+}
+
+size_t Process::memory_used() const {
+    return used;
+}
+
+size_t Process::memory_peak() const {
+    return peak;
+}
+
+size_t Process::memory_limit() const {
+    return limit;
+}
+
+uint32_t Process::garbage_time() const {
+    return gc_time;
+}
+
+void* Process::allocate(void *data, void *ptr, size_t old_size, size_t new_size) {
+    auto process = (Process*)data;
+
+    if (!ptr) {
+        old_size = 0;
+    }
+
+    // S crescer pode falhar; o LuaJIT levanta um erro de memria no app
+    if (new_size > old_size && process->limit > 0 &&
+        process->used-old_size+new_size > process->limit) {
+        return nullptr;
+    }
+
+    auto result = process->alloc(process->alloc_data, ptr, old_size, new_size);
+
+    // S a thread que roda a vm escreve; quem l s precisa de um valor
+    // inteiro
+    if (result || new_size == 0) {
+        const size_t used = process->used.load(memory_order_relaxed)-old_size+new_size;
+
+        process->used.store(used, memory_order_relaxed);
+
+        if (used > process->peak.load(memory_order_relaxed)) {
+            process->peak.store(used, memory_order_relaxed);
+        }
+    }
+
+    return result;
+}
+
+// Copia um valor de `from` para o topo de `to`. `memo`  uma tabela na
+// pilha de `to` com as tabelas j copiadas nessa travessia (ponteiro em
+// `from` -> cpia): uma tabela repetida ou um ciclo vira uma referncia
+//  mesma cpia, em vez de ser copiado de novo
+static void copy_value(lua_State *from, int index, lua_State *to, const int memo, const int depth) {
+    if (index < 0) {
+        index = lua_gettop(from)+index+1;
+    }
+
+    if (!lua_checkstack(to, 3) || !lua_checkstack(from, 3)) {
+        luaL_error(to, "stack overflow copying between vms");
+    }
+
+    switch (lua_type(from, index)) {
+        case LUA_TBOOLEAN:
+            lua_pushboolean(to, lua_toboolean(from, index));
+            break;
+        case LUA_TNUMBER:
+            lua_pushnumber(to, lua_tonumber(from, index));
+            break;
+        case LUA_TSTRING: {
+            size_t length;
+            const char *str = lua_tolstring(from, index, &length);
+
+            lua_pushlstring(to, str, length);
+        } break;
+        case LUA_TLIGHTUSERDATA:
+            lua_pushlightuserdata(to, lua_touserdata(from, index));
+            break;
+        case LUA_TTABLE: {
+            const auto table = (void*)lua_topointer(from, index);
+
+            lua_pushlightuserdata(to, table);
+            lua_rawget(to, memo);
+
+            if (!lua_isnil(to, -1)) {
+                break;
+            }
+
+            lua_pop(to, 1);
+
+            if (depth >= VM_COPY_DEPTH) {
+                lua_pushnil(to);
+                break;
+            }
+
+            lua_newtable(to);
+
+            lua_pushlightuserdata(to, table);
+            lua_pushvalue(to, -2);
+            lua_rawset(to, memo);
+
+            lua_pushnil(from);
+
+            while (lua_next(from, index)) {
+                copy_value(from, -2, to, memo, depth+1);
+
+                // Chaves que no atravessam (ou NaN) somem
+                if (lua_isnil(to, -1) || (lua_type(to, -1) == LUA_TNUMBER && std::isnan(lua_tonumber(to, -1)))) {
+                    lua_pop(to, 1);
+                } else {
+                    copy_value(from, -1, to, memo, depth+1);
+                    lua_rawset(to, -3);
+                }
+
+                lua_pop(from, 1);
+            }
+        } break;
+        default:
+            lua_pushnil(to);
+            break;
+    }
+}
+
+typedef struct Crossing {
+    lua_State *from;
+    const char *function;
+    int first, count;
+} Crossing;
+
+// Roda protegido em `to`: copiar pode esbarrar no limite de memria
+static int cross(lua_State *to) {
+    auto crossing = (Crossing*)lua_touserdata(to, 1);
+
+    // Tabelas copiadas, no ndice 2
+    lua_newtable(to);
+
+    lua_getglobal(to, crossing->function);
+
+    for (int i=0;i<crossing->count;i++) {
+        copy_value(crossing->from, crossing->first+i, to, 2, 0);
+    }
+
+    lua_call(to, crossing->count, LUA_MULTRET);
+
+    return lua_gettop(to)-2;
+}
+
+int Process::call_across(lua_State *to, lua_State *from, const char *function, const int first, const int count) {
+    Crossing crossing = { from, function, first, count };
+
+    const int top = lua_gettop(to);
+
+    lua_pushcfunction(to, cross);
+    lua_pushlightuserdata(to, &crossing);
+
+    if (call_with_traceback(to, 1, LUA_MULTRET) != 0) {
+        lua_pushstring(from, lua_tostring(to, -1));
+        lua_settop(to, top);
+
+        return -1;
+    }
+
+    const int results = lua_gettop(to)-top;
+
+    if (!lua_checkstack(from, results+LUA_MINSTACK)) {
+        lua_settop(to, top);
+        lua_pushstring(from, "too many results copying between vms");
+
+        return -1;
+    }
+
+    lua_newtable(from);
+
+    const int memo = lua_gettop(from);
+
+    for (int i=1;i<=results;i++) {
+        copy_value(to, top+i, from, memo, 0);
+    }
+
+    lua_remove(from, memo);
+
+    lua_settop(to, top);
+
+    return results;
+}
+
 int Process::call_with_traceback(lua_State* l, int args, int rets) {
   int handler_position = lua_gettop(l)-args;
   int status;
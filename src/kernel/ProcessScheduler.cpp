@@ -0,0 +1,320 @@
+#include <chrono>
+#include <iostream>
+
+#include <SDL.h>
+
+#include <Specs.hpp>
+#include <kernel/ProcessScheduler.hpp>
+
+// Update que a thread atual está rodando
+static thread_local bool worker_running = false;
+static thread_local const atomic<bool> *worker_cancelled = nullptr;
+
+ProcessScheduler::ProcessScheduler(const size_t worker_amount):
+    order(0), amount(worker_amount), running(true) {
+    frequency = SDL_GetPerformanceFrequency();
+
+    lock_guard<mutex> guard(lock);
+
+    for (size_t w=0;w<worker_amount;w++) {
+        spawn();
+    }
+}
+
+ProcessScheduler::~ProcessScheduler() {
+    clear();
+
+    unique_lock<mutex> guard(lock);
+    running = false;
+    wake.notify_all();
+
+    finished.wait_for(guard, chrono::milliseconds(SCHEDULER_CANCEL_WAIT), [this] {
+        for (const bool e: exited) {
+            if (!e) {
+                return false;
+            }
+        }
+
+        return true;
+    });
+
+    // Um worker preso num laço compilado nunca volta; fica solto até o
+    // fim do programa
+    for (size_t w=0;w<workers.size();w++) {
+        if (exited[w]) {
+            workers[w].join();
+        } else {
+            workers[w].detach();
+        }
+    }
+}
+
+size_t ProcessScheduler::size() const {
+    return amount;
+}
+
+void ProcessScheduler::add(const int32_t pid, Process *process, const int priority) {
+    lock_guard<mutex> guard(lock);
+
+    auto job = make_shared<Job>();
+
+    job->pid = pid;
+    job->process = process;
+    job->priority = priority;
+
+    jobs[pid] = job;
+}
+
+void ProcessScheduler::cancel(const int32_t pid) {
+    lock_guard<mutex> guard(lock);
+
+    const auto it = jobs.find(pid);
+
+    // O worker vê o pedido no hook dele ou na próxima chamada ao console
+    if (it != jobs.end()) {
+        it->second->cancelled = true;
+        it->second->queued = false;
+    }
+}
+
+void ProcessScheduler::remove(const int32_t pid) {
+    lock_guard<mutex> guard(lock);
+
+    const auto it = jobs.find(pid);
+
+    if (it != jobs.end() && !it->second->running) {
+        jobs.erase(it);
+    }
+}
+
+vector<int32_t> ProcessScheduler::clear() {
+    unique_lock<mutex> guard(lock);
+
+    for (auto &job: jobs) {
+        job.second->cancelled = true;
+        job.second->queued = false;
+    }
+
+    finished.wait_for(guard, chrono::milliseconds(SCHEDULER_CANCEL_WAIT), [this] {
+        for (const auto &job: jobs) {
+            if (job.second->running) {
+                return false;
+            }
+        }
+
+        return true;
+    });
+
+    vector<int32_t> stuck;
+
+    // Sem substituto, cada vm abandonada tiraria um worker do pool até o
+    // fim do programa
+    for (const auto &job: jobs) {
+        if (job.second->running) {
+            stuck.push_back(job.first);
+
+            retired[job.second->worker] = true;
+            spawn();
+        }
+    }
+
+    // Os workers presos seguram os jobs deles
+    jobs.clear();
+
+    return stuck;
+}
+
+int ProcessScheduler::update(const int32_t pid, const float dt, string &error) {
+    int result = 0;
+
+    {
+        lock_guard<mutex> guard(lock);
+
+        const auto it = jobs.find(pid);
+
+        if (it == jobs.end() || it->second->cancelled) {
+            return 0;
+        }
+
+        auto &job = *it->second;
+
+        if (!job.error.empty()) {
+            error = move(job.error);
+            job.error.clear();
+
+            return -1;
+        }
+
+        job.dt += dt;
+
+        if (job.queued || job.running) {
+            return 0;
+        }
+
+        job.queued = true;
+        job.order = order++;
+
+        result = 1;
+    }
+
+    wake.notify_one();
+
+    return result;
+}
+
+bool ProcessScheduler::busy(const int32_t pid) {
+    lock_guard<mutex> guard(lock);
+
+    const auto it = jobs.find(pid);
+
+    return it != jobs.end() && (it->second->queued || it->second->running);
+}
+
+bool ProcessScheduler::has(const int32_t pid) {
+    lock_guard<mutex> guard(lock);
+
+    return jobs.find(pid) != jobs.end();
+}
+
+void ProcessScheduler::set_priority(const int32_t pid, const int priority) {
+    lock_guard<mutex> guard(lock);
+
+    const auto it = jobs.find(pid);
+
+    if (it != jobs.end()) {
+        it->second->priority = priority;
+    }
+}
+
+uint64_t ProcessScheduler::cpu_time(const int32_t pid) {
+    lock_guard<mutex> guard(lock);
+
+    const auto it = jobs.find(pid);
+
+    return it == jobs.end() ? 0 : it->second->ticks*1000000/frequency;
+}
+
+bool ProcessScheduler::on_worker() {
+    return worker_running;
+}
+
+bool ProcessScheduler::cancelled() {
+    return worker_cancelled && worker_cancelled->load();
+}
+
+// Com o lock
+void ProcessScheduler::spawn() {
+    exited.push_back(false);
+    retired.push_back(false);
+
+    workers.emplace_back(&ProcessScheduler::work, this, workers.size());
+}
+
+shared_ptr<ProcessScheduler::Job> ProcessScheduler::next() {
+    shared_ptr<Job> best;
+
+    for (auto &job: jobs) {
+        const auto &j = job.second;
+
+        if (!j->queued || j->running) {
+            continue;
+        }
+
+        if (!best || j->priority > best->priority ||
+            (j->priority == best->priority && j->order < best->order)) {
+            best = j;
+        }
+    }
+
+    return best;
+}
+
+void ProcessScheduler::work(const size_t index) {
+    // O app em primeiro plano roda na thread principal e deve ganhar dos
+    // que rodam aqui
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    for (;;) {
+        shared_ptr<Job> job;
+        float dt;
+
+        {
+            unique_lock<mutex> guard(lock);
+
+            wake.wait(guard, [this] {
+                return !running || next() != nullptr;
+            });
+
+            if (!running) {
+                exited[index] = true;
+                finished.notify_all();
+
+                return;
+            }
+
+            job = next();
+
+            job->queued = false;
+            job->running = true;
+            job->worker = index;
+
+            dt = job->dt;
+            job->dt = 0;
+        }
+
+        worker_running = true;
+        worker_cancelled = &job->cancelled;
+
+        const auto start = SDL_GetPerformanceCounter();
+
+        auto st = job->process->st;
+        string error;
+
+        // O hook da vm é posto daqui, da thread que a roda
+        job->process->watch_stop(&job->cancelled);
+
+        lua_getglobal(st, "update");
+        lua_pushnumber(st, dt);
+
+        if (Process::call_with_traceback(st, 1, 0) != 0) {
+            error = lua_tostring(st, -1);
+            lua_pop(st, 1);
+        }
+
+        // Fora do update um erro do hook não teria pcall (finalizadores
+        // da coleta)
+        job->process->watch_stop(nullptr);
+
+        // A coleta da vm também fica fora da thread principal
+        job->process->collect_garbage();
+
+        const auto ticks = SDL_GetPerformanceCounter()-start;
+
+        worker_running = false;
+        worker_cancelled = nullptr;
+
+        {
+            lock_guard<mutex> guard(lock);
+
+            job->running = false;
+            job->ticks += ticks;
+
+            // Erros de um processo que parou não interessam mais
+            if (!error.empty() && !job->cancelled) {
+                cout << "process " << job->pid << " error: update(): " << error << endl;
+
+                job->error = error;
+            }
+
+            // Já foi substituído; o pool continua com o mesmo tamanho
+            if (retired[index]) {
+                exited[index] = true;
+                finished.notify_all();
+
+                return;
+            }
+        }
+
+        finished.notify_all();
+    }
+}
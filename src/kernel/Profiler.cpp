@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include <kernel/Profiler.hpp>
+
+// Cores da paleta padrão (DB16) usadas no overlay
+#define OVERLAY_BACKGROUND  0
+#define OVERLAY_BUDGET      15
+#define OVERLAY_FRAME       7
+#define OVERLAY_UNDERRUN    6
+#define OVERLAY_UPLOAD      9
+#define OVERLAY_SYNTHESIS   12
+#define OVERLAY_CALLBACK    13
+
+static const uint8_t section_colors[PROFILER_SECTION_AMOUNT] = { 14, 11, 8, 5, 2 };
+
+static const char* section_names[PROFILER_SECTION_AMOUNT] = {
+    "init", "update", "draw", "audio_tick", "gc"
+};
+
+static const char* api_names[PROFILER_API_AMOUNT] = {
+    "kernel", "gpu", "audio", "ui", "compositor"
+};
+
+static const char* primitive_names[GPU_PRIMITIVE_AMOUNT] = {
+    "line", "circle", "fill", "sprite", "tilemap", "text", "clear"
+};
+
+Profiler::Profiler(Memory &memory) {
+    frequency = SDL_GetPerformanceFrequency();
+
+    statistics = (StatisticsLayout*)memory.allocate(sizeof(StatisticsLayout), "Profiler Statistics");
+
+    reset();
+}
+
+void Profiler::reset() {
+    memset(statistics, 0, sizeof(StatisticsLayout));
+    memset(&counters, 0, sizeof(CountersLayout));
+
+    frame_start = now();
+    process_count = 0;
+    in_section = false;
+    last_underruns = 0;
+    overlay_shown = false;
+
+    tracing = false;
+    events.clear();
+    samples.clear();
+    names.clear();
+}
+
+uint64_t Profiler::now() const {
+    return SDL_GetPerformanceCounter();
+}
+
+uint32_t Profiler::to_us(const uint64_t ticks) const {
+    return min<uint64_t>(ticks*1000000/frequency, UINT32_MAX);
+}
+
+void Profiler::begin_frame() {
+    frame_start = now();
+}
+
+void Profiler::end_frame(Memory &memory, GPU &gpu, Audio &audio) {
+    const auto end = now();
+
+    counters.triggers = memory.take_trigger_calls();
+    gpu.take_counters(counters.pixels, counters.upload);
+    audio.take_counters(counters.audio_callback, counters.audio_callback_max, counters.audio_synthesis);
+
+    if (audio.statistics) {
+        counters.audio_underruns = audio.statistics->underruns-last_underruns;
+        last_underruns = audio.statistics->underruns;
+    }
+
+    statistics->frame = to_us(end-frame_start);
+    statistics->counters = counters;
+    statistics->process_count = process_count;
+    statistics->tracing = tracing;
+
+    memcpy(statistics->processes, processes, process_count*sizeof(ProcessLayout));
+
+    // O trace começa no meio de uma frame (no init() de um app): a frame
+    // e as seções que começaram antes dele ficam de fora, ou o tempo
+    // delas relativo ao início daria a volta
+    if (tracing && frame_start >= trace_start && events.size() < PROFILER_TRACE_EVENTS) {
+        events.push_back({ PROFILER_SECTION_AMOUNT, -1, frame_start, end-frame_start });
+        samples.push_back({ frame_start, counters });
+    }
+
+    memset(&counters, 0, sizeof(CountersLayout));
+    process_count = 0;
+}
+
+bool Profiler::enabled() const {
+    return statistics->enabled || statistics->overlay || tracing;
+}
+
+Profiler::ProcessLayout* Profiler::process(const int32_t pid) {
+    for (size_t i=0;i<process_count;i++) {
+        if (processes[i].pid == pid) {
+            return &processes[i];
+        }
+    }
+
+    if (process_count == PROFILER_PROCESSES) {
+        return nullptr;
+    }
+
+    auto entry = &processes[process_count++];
+
+    entry->pid = pid;
+    memset(entry->time, 0, sizeof(entry->time));
+
+    return entry;
+}
+
+void Profiler::begin(const int32_t pid, const ProfilerSection s) {
+    in_section = true;
+    section_pid = pid;
+    section = s;
+    section_start = now();
+}
+
+void Profiler::end() {
+    if (!in_section) {
+        return;
+    }
+
+    in_section = false;
+
+    const auto duration = now()-section_start;
+
+    if (auto entry = process(section_pid)) {
+        entry->time[section] += to_us(duration);
+    }
+
+    if (tracing && section_start >= trace_start && events.size() < PROFILER_TRACE_EVENTS) {
+        events.push_back({ (uint8_t)section, section_pid, section_start, duration });
+    }
+}
+
+bool Profiler::current(int32_t &pid) const {
+    pid = section_pid;
+
+    return in_section;
+}
+
+void Profiler::name(const int32_t pid, const string &process_name) {
+    names[pid] = process_name;
+}
+
+void Profiler::toggle_overlay() {
+    statistics->overlay = !statistics->overlay;
+}
+
+void Profiler::bar(GPU &gpu, int16_t &x, const int16_t y, const uint32_t us, const uint8_t color) const {
+    const int16_t limit = PROFILER_OVERLAY_BUDGET*2;
+    const int16_t width = min<uint64_t>(uint64_t(us)*PROFILER_OVERLAY_BUDGET*GPU_FRAMERATE/1000000,
+                                        limit-x);
+
+    if (width > 0) {
+        gpu.rect_fill(GPU_VIDEO_WIDTH-limit-2+x, y, width, PROFILER_OVERLAY_ROW, color);
+        x += width;
+    }
+}
+
+SDL_Rect Profiler::draw_overlay(GPU &gpu) {
+    SDL_Rect hidden = { 0, 0, 0, 0 };
+
+    if (!statistics->overlay) {
+        if (overlay_shown) {
+            hidden = overlay_rect;
+            overlay_shown = false;
+        }
+
+        return hidden;
+    }
+
+    // Frame, áudio e uma linha por processo
+    const int rows = 2+statistics->process_count;
+    const SDL_Rect rect = {
+        GPU_VIDEO_WIDTH-PROFILER_OVERLAY_BUDGET*2-4, 0,
+        PROFILER_OVERLAY_BUDGET*2+4, rows*(PROFILER_OVERLAY_ROW+1)+3
+    };
+
+    if (overlay_shown && !SDL_RectEquals(&rect, &overlay_rect)) {
+        hidden = overlay_rect;
+    }
+
+    overlay_shown = true;
+    overlay_rect = rect;
+
+    gpu.clip(rect.x, rect.y, rect.w, rect.h);
+    gpu.rect_fill(rect.x, rect.y, rect.w, rect.h, OVERLAY_BACKGROUND);
+
+    const auto &c = statistics->counters;
+    int16_t y = 2;
+
+    // Frame inteira, com o upload no começo; vermelha com underruns
+    int16_t x = 0;
+    bar(gpu, x, y, c.upload, OVERLAY_UPLOAD);
+    bar(gpu, x, y, statistics->frame-min(c.upload, statistics->frame),
+        c.audio_underruns ? OVERLAY_UNDERRUN : OVERLAY_FRAME);
+    y += PROFILER_OVERLAY_ROW+1;
+
+    // Thread de áudio e callback da placa
+    x = 0;
+    bar(gpu, x, y, c.audio_synthesis, OVERLAY_SYNTHESIS);
+    bar(gpu, x, y, c.audio_callback, OVERLAY_CALLBACK);
+    y += PROFILER_OVERLAY_ROW+1;
+
+    for (size_t i=0;i<statistics->process_count;i++) {
+        x = 0;
+
+        for (size_t s=0;s<PROFILER_SECTION_AMOUNT;s++) {
+            bar(gpu, x, y, statistics->processes[i].time[s], section_colors[s]);
+        }
+
+        y += PROFILER_OVERLAY_ROW+1;
+    }
+
+    // Fim do tempo de uma frame
+    gpu.rect_fill(GPU_VIDEO_WIDTH-PROFILER_OVERLAY_BUDGET-2, 0, 1, rect.h, OVERLAY_BUDGET);
+
+    gpu.clip(0, 0, GPU_VIDEO_WIDTH, GPU_VIDEO_HEIGHT);
+
+    return hidden;
+}
+
+void Profiler::start_trace() {
+    events.clear();
+    samples.clear();
+
+    tracing = true;
+    trace_start = now();
+}
+
+bool Profiler::stop_trace(string &json) {
+    if (!tracing) {
+        return false;
+    }
+
+    tracing = false;
+
+    ostringstream out;
+    out << fixed << setprecision(3);
+
+    const auto us = [this] (const uint64_t ticks) {
+        return double(ticks)*1000000.0/double(frequency);
+    };
+
+    // Cada processo do nibble vira um processo no trace; o kernel é o -1
+    set<int32_t> pids;
+
+    for (const auto &event: events) {
+        pids.insert(event.pid);
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+
+    const auto separator = [&out, &first] () -> ostringstream& {
+        if (!first) {
+            out << ",\n";
+        }
+
+        first = false;
+
+        return out;
+    };
+
+    for (const auto pid: pids) {
+        string process_name = pid < 0 ? "kernel" : "pid "+to_string(pid);
+
+        const auto it = names.find(pid);
+
+        if (it != names.end()) {
+            process_name += " "+it->second;
+        }
+
+        // Nomes vêm de caminhos, só aspas e barras precisam de escape
+        string escaped;
+
+        for (const auto c: process_name) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+
+            if ((uint8_t)c >= 0x20) {
+                escaped += c;
+            }
+        }
+
+        separator() << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+                    << ",\"args\":{\"name\":\"" << escaped << "\"}}";
+    }
+
+    for (const auto &event: events) {
+        const bool frame = event.section == PROFILER_SECTION_AMOUNT;
+
+        separator() << "{\"name\":\"" << (frame ? "frame" : section_names[event.section])
+                    << "\",\"cat\":\"" << (frame ? "kernel" : "process")
+                    << "\",\"ph\":\"X\",\"pid\":" << event.pid << ",\"tid\":0"
+                    << ",\"ts\":" << us(event.start-trace_start)
+                    << ",\"dur\":" << us(event.duration) << "}";
+    }
+
+    for (const auto &sample: samples) {
+        const auto &c = sample.counters;
+        const auto ts = us(sample.time-trace_start);
+
+        separator() << "{\"name\":\"calls\",\"ph\":\"C\",\"pid\":-1,\"ts\":" << ts << ",\"args\":{";
+
+        for (size_t i=0;i<PROFILER_API_AMOUNT;i++) {
+            out << (i ? "," : "") << "\"" << api_names[i] << "\":" << c.calls[i];
+        }
+
+        out << "}}";
+
+        separator() << "{\"name\":\"pixels\",\"ph\":\"C\",\"pid\":-1,\"ts\":" << ts << ",\"args\":{";
+
+        for (size_t i=0;i<GPU_PRIMITIVE_AMOUNT;i++) {
+            out << (i ? "," : "") << "\"" << primitive_names[i] << "\":" << c.pixels[i];
+        }
+
+        out << "}}";
+
+        separator() << "{\"name\":\"time (us)\",\"ph\":\"C\",\"pid\":-1,\"ts\":" << ts
+                    << ",\"args\":{\"upload\":" << c.upload
+                    << ",\"audio_callback\":" << c.audio_callback
+                    << ",\"audio_synthesis\":" << c.audio_synthesis << "}}";
+
+        separator() << "{\"name\":\"memory\",\"ph\":\"C\",\"pid\":-1,\"ts\":" << ts
+                    << ",\"args\":{\"triggers\":" << c.triggers << "}}";
+
+        separator() << "{\"name\":\"audio\",\"ph\":\"C\",\"pid\":-1,\"ts\":" << ts
+                    << ",\"args\":{\"underruns\":" << c.audio_underruns
+                    << ",\"callback_max_us\":" << c.audio_callback_max << "}}";
+    }
+
+    out << "]}\n";
+
+    json = out.str();
+
+    events.clear();
+    samples.clear();
+
+    return true;
+}
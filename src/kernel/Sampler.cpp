@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <kernel/Sampler.hpp>
+
+// Código do kernel que chama os processos; as frames dele abaixo da
+// primeira frame do app são tiradas das pilhas
+#define SAMPLER_KERNEL_SOURCE "frameworks/kernel/"
+
+Sampler::Sampler() {
+    frequency = SDL_GetPerformanceFrequency();
+}
+
+bool Sampler::start(const int32_t pid, const string &name, const double seconds, const string &path) {
+    for (const auto &session: sessions) {
+        if (session.pid == pid) {
+            return false;
+        }
+    }
+
+    const auto now = SDL_GetPerformanceCounter();
+
+    sessions.push_back({
+        pid, name, path,
+        now+uint64_t(max(seconds, 0.0)*frequency), 0,
+        {}
+    });
+
+    return true;
+}
+
+void Sampler::clear() {
+    sessions.clear();
+}
+
+bool Sampler::active() const {
+    return !sessions.empty();
+}
+
+void Sampler::sample(lua_State *l, const int32_t pid) {
+    Session *session = nullptr;
+
+    for (auto &s: sessions) {
+        if (s.pid == pid) {
+            session = &s;
+            break;
+        }
+    }
+
+    if (!session) {
+        return;
+    }
+
+    const auto now = SDL_GetPerformanceCounter();
+
+    if (now >= session->end || now-session->last_sample < SAMPLER_INTERVAL*frequency/1000000) {
+        return;
+    }
+
+    session->last_sample = now;
+
+    // Da folha para a raiz
+    vector<string> frames;
+    int app_frames = 0;
+
+    lua_Debug ar;
+
+    for (int level=0;level<SAMPLER_MAX_DEPTH && lua_getstack(l, level, &ar);level++) {
+        lua_getinfo(l, "Sn", &ar);
+
+        const bool kernel = strstr(ar.source, SAMPLER_KERNEL_SOURCE) != nullptr ||
+                            strcmp(ar.what, "C") == 0;
+
+        // Depois da última frame do app só sobra o kernel chamando o
+        // processo
+        if (!kernel) {
+            app_frames = frames.size()+1;
+        }
+
+        frames.push_back(frame(ar));
+    }
+
+    string stack = session->name;
+
+    if (app_frames == 0) {
+        stack += ";[kernel]";
+    }
+
+    for (int i=app_frames-1;i>=0;i--) {
+        stack += ';';
+        stack += frames[i];
+    }
+
+    session->stacks[stack]++;
+}
+
+vector<pair<string, string>> Sampler::collect() {
+    vector<pair<string, string>> done;
+
+    const auto now = SDL_GetPerformanceCounter();
+
+    for (auto it=sessions.begin();it!=sessions.end();) {
+        if (now < it->end) {
+            ++it;
+            continue;
+        }
+
+        ostringstream out;
+
+        for (const auto &stack: it->stacks) {
+            out << stack.first << " " << stack.second << "\n";
+        }
+
+        done.emplace_back(it->path, out.str());
+
+        it = sessions.erase(it);
+    }
+
+    return done;
+}
+
+string Sampler::frame(lua_Debug &ar) {
+    ostringstream out;
+
+    if (strcmp(ar.what, "C") == 0) {
+        out << "[C] " << (ar.name ? ar.name : "?");
+    } else if (strcmp(ar.what, "main") == 0) {
+        out << ar.short_src;
+    } else {
+        out << (ar.name ? ar.name : "?") << " (" << ar.short_src << ":" << ar.linedefined << ")";
+    }
+
+    // ';' separa as frames e a quebra de linha as pilhas
+    auto name = out.str();
+
+    replace(name.begin(), name.end(), ';', ',');
+    replace(name.begin(), name.end(), '\n', ' ');
+
+    return name;
+}
@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <kernel/WidgetTree.hpp>
+
+// As propriedades chegam como double, igual às funções de desenho do Lua
+
+static int16_t coord(const double v) {
+    if (std::isnan(v)) {
+        return 0;
+    }
+
+    return (int16_t)max(min(floor(v), (double)INT16_MAX), (double)INT16_MIN);
+}
+
+static uint8_t color(const double c) {
+    return coord(c)&0x7F;
+}
+
+static uint8_t palette(const double p) {
+    return coord(p)&(GPU_PALETTE_AMOUNT-1);
+}
+
+static double clamp(const double v, const double low, const double high) {
+    return min(max(v, low), high);
+}
+
+static void rounded_rect(GPU &gpu, const double x, const double y,
+                         const double w, const double h,
+                         const double r, const uint8_t c) {
+    gpu.rounded_rect_fill(coord(x), coord(y), coord(w), coord(h), coord(r), c, -1);
+}
+
+WidgetTree::WidgetTree(): structure_changed(false) {}
+
+int32_t WidgetTree::create() {
+    int32_t id;
+
+    if (!free_nodes.empty()) {
+        id = free_nodes.back();
+        free_nodes.pop_back();
+    } else {
+        id = nodes.size();
+        nodes.emplace_back();
+        contents.emplace_back();
+    }
+
+    auto &node = nodes[id];
+
+    memset(&node.props, 0, sizeof(WidgetProps));
+    node.parent = WIDGET_NONE;
+    node.first_child = WIDGET_NONE;
+    node.next_sibling = WIDGET_NONE;
+    node.dirty = true;
+    node.damaged = false;
+    node.has_custom = false;
+    node.alive = true;
+
+    return id;
+}
+
+void WidgetTree::destroy(const int32_t id) {
+    if (!valid(id)) {
+        return;
+    }
+
+    unlink(id);
+
+    for (auto child=nodes[id].first_child;child!=WIDGET_NONE;) {
+        const auto next = nodes[child].next_sibling;
+
+        nodes[child].parent = WIDGET_NONE;
+        nodes[child].next_sibling = WIDGET_NONE;
+
+        child = next;
+    }
+
+    nodes[id].first_child = WIDGET_NONE;
+    nodes[id].alive = false;
+    contents[id].clear();
+
+    free_nodes.push_back(id);
+    structure_changed = true;
+}
+
+void WidgetTree::clear() {
+    nodes.clear();
+    contents.clear();
+    free_nodes.clear();
+    structure_changed = false;
+}
+
+void WidgetTree::set_props(const int32_t id, const WidgetProps &props) {
+    if (!valid(id)) {
+        return;
+    }
+
+    auto &node = nodes[id];
+
+    if (node.props.custom != props.custom) {
+        structure_changed = true;
+    }
+
+    node.props = props;
+    node.props.slice_count = min<uint8_t>(props.slice_count, WIDGET_SLICE_AMOUNT);
+    node.props.cmap_count = min<uint8_t>(props.cmap_count, WIDGET_CMAP_AMOUNT);
+
+    mark_dirty(id);
+}
+
+void WidgetTree::set_content(const int32_t id, const string &content) {
+    if (!valid(id) || contents[id] == content) {
+        return;
+    }
+
+    contents[id] = content;
+
+    mark_dirty(id);
+}
+
+void WidgetTree::set_children(const int32_t id, const int32_t *children, const size_t count) {
+    if (!valid(id)) {
+        return;
+    }
+
+    // Os filhos antigos ficam soltos até alguém adotá-los
+    for (auto child=nodes[id].first_child;child!=WIDGET_NONE;) {
+        const auto next = nodes[child].next_sibling;
+
+        nodes[child].parent = WIDGET_NONE;
+        nodes[child].next_sibling = WIDGET_NONE;
+
+        child = next;
+    }
+
+    nodes[id].first_child = WIDGET_NONE;
+
+    int32_t last = WIDGET_NONE;
+
+    for (size_t i=0;i<count;i++) {
+        const auto child = children[i];
+
+        if (!valid(child) || child == id) {
+            continue;
+        }
+
+        unlink(child);
+
+        nodes[child].parent = id;
+
+        if (last == WIDGET_NONE) {
+            nodes[id].first_child = child;
+        } else {
+            nodes[last].next_sibling = child;
+        }
+
+        last = child;
+    }
+
+    structure_changed = true;
+}
+
+int32_t WidgetTree::render(GPU &gpu, const int32_t root, const int32_t resume, const bool dirty, const Box &window) {
+    if (!valid(root)) {
+        return WIDGET_NONE;
+    }
+
+    if (structure_changed) {
+        update_custom();
+    }
+
+    int32_t id;
+
+    if (resume == WIDGET_NONE) {
+        // A raiz é desenhada aqui mesmo com `draw` próprio: é o
+        // Widget.draw() chamado de dentro dele
+        auto &node = nodes[root];
+
+        if (dirty) {
+            draw(gpu, root, window);
+        }
+
+        node.dirty = false;
+        node.damaged = false;
+        id = node.first_child;
+    } else if (valid(resume)) {
+        id = after(resume, root);
+    } else {
+        return WIDGET_NONE;
+    }
+
+    while (id != WIDGET_NONE) {
+        auto &node = nodes[id];
+
+        if (node.props.custom) {
+            return id;
+        }
+
+        // Nada mudou aqui nem abaixo
+        if (!node.dirty && !node.damaged && !node.has_custom) {
+            id = after(id, root);
+            continue;
+        }
+
+        if (node.dirty) {
+            draw(gpu, id, window);
+            node.dirty = false;
+        }
+
+        node.damaged = false;
+        id = node.first_child != WIDGET_NONE ? node.first_child : after(id, root);
+    }
+
+    return WIDGET_NONE;
+}
+
+void WidgetTree::invalidate(const int32_t root) {
+    if (!valid(root)) {
+        return;
+    }
+
+    nodes[root].dirty = true;
+
+    for (auto id=nodes[root].first_child;id!=WIDGET_NONE;) {
+        nodes[id].dirty = true;
+        id = nodes[id].first_child != WIDGET_NONE ? nodes[id].first_child : after(id, root);
+    }
+}
+
+bool WidgetTree::valid(const int32_t id) const {
+    return id >= 0 && (size_t)id < nodes.size() && nodes[id].alive;
+}
+
+void WidgetTree::unlink(const int32_t id) {
+    const auto parent = nodes[id].parent;
+
+    if (parent == WIDGET_NONE) {
+        return;
+    }
+
+    if (nodes[parent].first_child == id) {
+        nodes[parent].first_child = nodes[id].next_sibling;
+    } else {
+        for (auto child=nodes[parent].first_child;child!=WIDGET_NONE;child=nodes[child].next_sibling) {
+            if (nodes[child].next_sibling == id) {
+                nodes[child].next_sibling = nodes[id].next_sibling;
+                break;
+            }
+        }
+    }
+
+    nodes[id].parent = WIDGET_NONE;
+    nodes[id].next_sibling = WIDGET_NONE;
+}
+
+void WidgetTree::mark_dirty(const int32_t id) {
+    nodes[id].dirty = true;
+
+    for (auto parent=nodes[id].parent;parent!=WIDGET_NONE;parent=nodes[parent].parent) {
+        nodes[parent].damaged = true;
+    }
+}
+
+void WidgetTree::update_custom() {
+    for (auto &node: nodes) {
+        node.has_custom = false;
+    }
+
+    for (auto &node: nodes) {
+        if (!node.alive || !node.props.custom) {
+            continue;
+        }
+
+        for (auto parent=node.parent;parent!=WIDGET_NONE && !nodes[parent].has_custom;parent=nodes[parent].parent) {
+            nodes[parent].has_custom = true;
+        }
+    }
+
+    structure_changed = false;
+}
+
+int32_t WidgetTree::after(int32_t id, const int32_t root) const {
+    while (id != root && id != WIDGET_NONE) {
+        if (nodes[id].next_sibling != WIDGET_NONE) {
+            return nodes[id].next_sibling;
+        }
+
+        id = nodes[id].parent;
+    }
+
+    return WIDGET_NONE;
+}
+
+WidgetTree::Box WidgetTree::clip_box(const int32_t id) const {
+    const auto &props = nodes[id].props;
+    const Box box = { props.x, props.y, props.w, props.h };
+
+    auto level = abs(coord(props.clip_to));
+    auto parent = id;
+
+    for (;level>0 && parent!=WIDGET_NONE;level--) {
+        parent = nodes[parent].parent;
+    }
+
+    if (parent == id || parent == WIDGET_NONE) {
+        return box;
+    }
+
+    // Recorta pela caixa do ancestral
+    const auto outer = clip_box(parent);
+
+    const auto start_x = clamp(box.x, outer.x, outer.x+outer.w);
+    const auto start_y = clamp(box.y, outer.y, outer.y+outer.h);
+    const auto end_x = clamp(box.x+box.w, outer.x, outer.x+outer.w);
+    const auto end_y = clamp(box.y+box.h, outer.y, outer.y+outer.h);
+
+    return {
+        floor(start_x), floor(start_y),
+        floor(end_x-start_x), floor(end_y-start_y)
+    };
+}
+
+void WidgetTree::clip(GPU &gpu, const Box &window, double x, double y, double w, double h) const {
+    x = max(x, window.x);
+    y = max(y, window.y);
+    w = min(w, window.x+window.w-x);
+    h = min(h, window.y+window.h-y);
+
+    gpu.clip(coord(x), coord(y), coord(w), coord(h));
+}
+
+void WidgetTree::draw(GPU &gpu, const int32_t id, const Box &window) {
+    const auto &props = nodes[id].props;
+    const auto &content = contents[id];
+
+    const auto box = clip_box(id);
+
+    clip(gpu, window, box.x, box.y, box.w, box.h);
+
+    const auto x = props.x, y = props.y;
+    const auto w = props.w, h = props.h;
+    const auto r = floor(props.radius);
+    const auto z = floor(props.z);
+
+    if (z != 0) {
+        rounded_rect(gpu, x, y+z, w, h, r, color(props.shadow_color));
+    }
+
+    rounded_rect(gpu, x, y, w, h, r, color(props.border_color));
+
+    const auto &s = props.slices;
+
+    switch (props.slice_count) {
+        case 0: {
+            const auto border = floor(props.border_size);
+
+            rounded_rect(gpu, x+border, y+border,
+                         w-border*2, h-border*2,
+                         max(r-border, 0.0), color(props.background));
+        } break;
+        case 2: {
+            gpu.sprite(coord(s[0])*GPU_SPRITE_W, coord(s[1])*GPU_SPRITE_H,
+                       coord(x), coord(y),
+                       GPU_SPRITE_W, GPU_SPRITE_H,
+                       palette(props.palette));
+        } break;
+        case 4: {
+            gpu.sprite(coord(s[0]), coord(s[1]),
+                       coord(x), coord(y),
+                       coord(s[2]), coord(s[3]),
+                       palette(props.palette));
+        } break;
+        case 6: {
+            gpu.slice(coord(s[0]), coord(s[1]), coord(s[2]), coord(s[3]),
+                      coord(s[4]), coord(s[5]), coord(s[3]), coord(s[3]),
+                      coord(x), coord(y), coord(ceil(w)), coord(h),
+                      palette(props.palette));
+        } break;
+        case 8: {
+            gpu.slice(coord(s[0]), coord(s[1]), coord(s[2]), coord(s[3]),
+                      coord(s[4]), coord(s[5]), coord(s[6]), coord(s[7]),
+                      coord(x), coord(y), coord(ceil(w)), coord(ceil(h)),
+                      palette(props.palette));
+        } break;
+    }
+
+    const auto width = FontAtlas::length(content.data(), content.size())*FONT_CHAR_W;
+    double tx = 0, ty = 0;
+
+    switch (props.text_align) {
+        case 0: tx = x+props.padding_left; break;
+        case 1: tx = x+w/2-width/2.0; break;
+        case 2: tx = x+w-width-props.padding_right; break;
+    }
+
+    switch (props.vertical_align) {
+        case 0: ty = 0; break;
+        case 1: ty = y+h/2-4; break;
+        case 2: ty = h-8; break;
+    }
+
+    for (size_t i=0;i<props.cmap_count;i++) {
+        gpu.map_color(props.cmap[i*2], props.cmap[i*2+1]);
+    }
+
+    gpu.print(content.data(), content.size(),
+              coord(tx), coord(ty+props.padding_top-props.padding_bottom),
+              palette(props.text_palette));
+
+    for (size_t i=0;i<props.cmap_count;i++) {
+        gpu.map_color(props.cmap[i*2], props.cmap[i*2]);
+    }
+}
@@ -0,0 +1,101 @@
+#include <chrono>
+
+#include <kernel/WorkerPool.hpp>
+
+WorkerPool::WorkerPool(const size_t amount):
+    generation(0), next_job(0), finished(0),
+    job_count(0), job(nullptr), context(nullptr), running(true) {
+    for (size_t w=0;w<amount;w++) {
+        workers.push_back(thread(&WorkerPool::work, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    running = false;
+
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+size_t WorkerPool::size() const {
+    return workers.size();
+}
+
+void WorkerPool::run(const size_t jobs, Job fn, void *ctx) {
+    // Sem workers, roda tudo na thread atual
+    if (workers.empty()) {
+        for (size_t i=0;i<jobs;i++) {
+            fn(ctx, i);
+        }
+
+        return;
+    }
+
+    job_count = jobs;
+    job = fn;
+    context = ctx;
+
+    next_job.store(0, memory_order_relaxed);
+    finished.store(0, memory_order_relaxed);
+
+    // Fork
+    generation.fetch_add(1, memory_order_release);
+
+    drain();
+
+    // Join: todos os workers precisam passar pela geração atual,
+    // assim nenhum continua lendo `job` quando o próximo `run` começar
+    unsigned int spins = 0;
+
+    while (finished.load(memory_order_acquire) < workers.size()) {
+        backoff(spins);
+    }
+}
+
+void WorkerPool::work() {
+    // Começa da geração 0, que nunca é rodada, para não perder
+    // um `run` que aconteça antes da thread iniciar
+    uint64_t seen = 0;
+    unsigned int spins = 0;
+
+    while (running) {
+        const auto current = generation.load(memory_order_acquire);
+
+        if (current == seen) {
+            backoff(spins);
+            continue;
+        }
+
+        seen = current;
+        spins = 0;
+
+        drain();
+
+        finished.fetch_add(1, memory_order_release);
+    }
+}
+
+void WorkerPool::drain() {
+    for (;;) {
+        const auto i = next_job.fetch_add(1, memory_order_relaxed);
+
+        if (i >= job_count) {
+            break;
+        }
+
+        job(context, i);
+    }
+}
+
+void WorkerPool::backoff(unsigned int &spins) {
+    spins++;
+
+    if (spins < 1024) {
+        // Spin
+    } else if (spins < 2048) {
+        this_thread::yield();
+    } else {
+        this_thread::sleep_for(chrono::microseconds(100));
+    }
+}
@@ -1,10 +1,14 @@
 #include <kernel/filesystem.hpp>
 #include <stack>
 #include <functional>
+#include <cerrno>
+#include <atomic>
 
 #ifdef WIN32
 #include <windows.h>
 #include <io.h>
+#include <process.h>
+#define getpid _getpid
 #else
 #define _stat stat
 #endif
@@ -312,49 +316,148 @@ bool fs::copy_file (Path _path_a, Path _path_b, bool _overwrite) {
 char* fs::get_file_data (Path _path) {
 	if (file_exists(_path)) {
 		size_t file_size = get_file_size (_path);
-		int buffer_size = 128;
 		char* data = new char [file_size+1];
-        char* buffer = new char [buffer_size];
-		int fd;
-		int nr = -1;
-        size_t rs = 0;
-
-        fd = open (_path.get_path().c_str(), O_RDONLY);
-
-        while (nr != 0) {
-            nr = read (fd,buffer,buffer_size);
-            if (nr < 0) {
-                delete[] data;
-                return NULL;
-            }
-            memcpy (data+rs, buffer, nr);
-            rs += nr;
-        }
 
-		close (fd);
+		if (!read_file_data(_path, data, file_size)) {
+			delete[] data;
+			return NULL;
+		}
 
-        delete[] buffer;
+		data[file_size] = 0;
 		return data;
 	}
 
 	return NULL;
 }
 
+bool fs::read_file_data (Path _path, char* _data, size_t _size, size_t _offset) {
+	int fd = open (_path.get_path().c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	if (_offset > 0 && lseek (fd, _offset, SEEK_SET) < 0) {
+		close (fd);
+		return false;
+	}
+
+	// Lê direto no destino, no maior pedaço que o sistema aceitar
+	size_t rs = 0;
+
+	while (rs < _size) {
+		auto nr = read (fd, _data+rs, _size-rs);
+
+		if (nr < 0) {
+			close (fd);
+			return false;
+		}
+
+		if (nr == 0)
+			break;
+
+		rs += nr;
+	}
+
+	close (fd);
+
+	return rs == _size;
+}
+
 bool fs::set_file_data (Path _path, const char* _data, size_t _size) {
+	// A crash while writing never leaves a truncated file behind. The file
+	// may also be mapped MAP_PRIVATE into console memory (binaries and
+	// sheets): truncating it in place would make the mapping fault, while
+	// the rename leaves the old inode alive under the mapping
+	Path temp = temp_path(_path);
+
+	if (!write_file_data(temp, _data, _size)) {
+		delete_file(temp);
+		return false;
+	}
+
+	return replace_file(temp, _path);
+}
+
+static bool sync_fd (int fd) {
+#ifdef WIN32
+	return _commit (fd) == 0;
+#else
+	return fsync (fd) == 0;
+#endif
+}
+
+bool fs::write_file_data (Path _path, const char* _data, size_t _size) {
 	if (!file_exists (_path))
 		if (!create_file(_path))
 			return false;
 
-	int fd, nr;
+	int fd = open (_path.get_path().c_str(), O_WRONLY | O_TRUNC);
+
+	if (fd < 0)
+		return false;
+
+	size_t nw = 0;
+
+	while (nw < _size) {
+		auto n = write (fd, _data+nw, _size-nw);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			close (fd);
+			return false;
+		}
+
+		nw += n;
+	}
+
+	bool synced = sync_fd(fd);
+
+	return close (fd) == 0 && synced;
+}
+
+bool fs::sync_file (Path _path) {
+	int fd = open (_path.get_path().c_str(), O_RDWR);
+
+	if (fd < 0)
+		return false;
+
+	bool synced = sync_fd(fd);
 
-	fd = open (_path.get_path().c_str(), O_WRONLY |  O_TRUNC);
-	nr = write (fd, _data, _size);
 	close (fd);
 
-	if ((unsigned int)nr < _size)
+	return synced;
+}
+
+Path fs::temp_path (Path _path) {
+	static atomic<uint64_t> counter (0);
+
+	// The pid keeps two consoles sharing a directory apart
+	return Path(_path.get_original_path()+"."+to_string(getpid())+"-"+
+				to_string(counter.fetch_add(1))+".tmp");
+}
+
+bool fs::replace_file (Path _path_a, Path _path_b) {
+#ifdef WIN32
+	return MoveFileEx (_path_a.get_path().c_str(), _path_b.get_path().c_str(),
+					   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (rename (_path_a.get_path().c_str(), _path_b.get_path().c_str()) < 0)
 		return false;
 
+	// Persist the rename itself
+	auto name = _path_b.get_path();
+	auto slash = name.find_last_of('/');
+	int fd = open (slash == string::npos ? "." : name.substr(0, slash+1).c_str(), O_RDONLY);
+
+	if (fd >= 0) {
+		fsync (fd);
+		close (fd);
+	}
+
 	return true;
+#endif
 }
 
 size_t fs::get_file_size (Path _path) {
@@ -383,6 +486,103 @@ size_t fs::get_file_size (Path _path) {
 	return -1;
 }
 
+bool fs::list_entries (Path _path, size_t _offset, size_t _limit,
+                       vector <DirectoryEntry> &_entries, string &_names, bool &_more) {
+	_entries.clear();
+	_names.clear();
+	_more = false;
+
+	size_t skipped = 0;
+
+	auto add = [&] (const char* name, DirectoryEntry::Type type, uint64_t size, int64_t mtime) -> bool {
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			return true;
+
+		if (skipped < _offset) {
+			skipped++;
+			return true;
+		}
+
+		if (_entries.size() == _limit) {
+			_more = true;
+			return false;
+		}
+
+		auto length = strlen(name);
+
+		_entries.push_back(DirectoryEntry { _names.size(), length, type, size, mtime });
+		_names.append(name, length);
+
+		return true;
+	};
+
+#ifdef _WIN32
+	WIN32_FIND_DATA file;
+	HANDLE found_file;
+
+	if ((found_file = FindFirstFile((_path.get_path()+"\\*").c_str(), &file)) == INVALID_HANDLE_VALUE)
+		return false;
+
+	// FindFirstFile already brings attributes, size and time
+	do {
+		auto type = file.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ?
+			DirectoryEntry::ENTRY_DIRECTORY : DirectoryEntry::ENTRY_FILE;
+		auto size = (uint64_t(file.nFileSizeHigh) << 32) | file.nFileSizeLow;
+		auto time = (uint64_t(file.ftLastWriteTime.dwHighDateTime) << 32) | file.ftLastWriteTime.dwLowDateTime;
+
+		// 100ns intervals since 1601 -> seconds since 1970
+		if (!add(file.cFileName, type, size, int64_t(time/10000000)-11644473600LL))
+			break;
+	} while (FindNextFile(found_file, &file) != 0);
+
+	FindClose(found_file);
+#else
+	DIR *d = opendir(_path.get_path().c_str());
+
+	if (!d)
+		return false;
+
+	int fd = dirfd(d);
+	struct dirent *entry;
+
+	while ((entry = readdir(d)) != NULL) {
+		struct stat info;
+
+		// Entries we will only skip don't need a stat
+		bool listed = skipped >= _offset && _entries.size() < _limit &&
+			strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+
+		if (listed && fstatat(fd, entry->d_name, &info, 0) == 0) {
+			auto type = S_ISDIR(info.st_mode) ? DirectoryEntry::ENTRY_DIRECTORY :
+				S_ISREG(info.st_mode) ? DirectoryEntry::ENTRY_FILE : DirectoryEntry::ENTRY_OTHER;
+
+			if (!add(entry->d_name, type, info.st_size, info.st_mtime))
+				break;
+		} else {
+			auto type = entry->d_type == DT_DIR ? DirectoryEntry::ENTRY_DIRECTORY :
+				entry->d_type == DT_REG ? DirectoryEntry::ENTRY_FILE : DirectoryEntry::ENTRY_OTHER;
+
+			if (!add(entry->d_name, type, 0, 0))
+				break;
+		}
+	}
+
+	closedir(d);
+#endif
+
+	return true;
+}
+
+time_t fs::get_modification_time (Path _path) {
+	struct _stat info;
+
+	if (_stat (_path.get_path().c_str(),&info) < 0) {
+		return 0;
+	}
+
+	return info.st_mtime;
+}
+
 vector <Path> fs::list_directory (Path _path, bool &_success) {
     vector <Path> dir;
     _success = true;
@@ -17,22 +17,25 @@ size_t read_binary(Memory &memory, Path &path) {
 
         auto length = fs::get_file_size(path);
 
-        auto area = memory.allocate_with_position(sizeof(BinaryMetadata)+length, "Memory Mapped Binary");
+        // Os dados começam numa página nova e ocupam páginas inteiras,
+        // assim o arquivo pode ser mapeado sem tocar nas áreas vizinhas
+        const auto page = Memory::page_size();
+        const auto mapped_length = ((length+page-1)/page)*page;
+
+        auto area = memory.allocate_aligned(sizeof(BinaryMetadata)+mapped_length,
+                                            "Memory Mapped Binary", page, sizeof(BinaryMetadata));
         auto *meta = (BinaryMetadata*)get<0>(area);
+        auto *data = get<0>(area)+sizeof(BinaryMetadata);
 
         meta->length = length;
 
-        char* file_data = fs::get_file_data(path);
-
-        if (file_data) {
-            memcpy(get<0>(area)+sizeof(BinaryMetadata), file_data, length);
-
-            delete[] file_data;
-
+        // Páginas são lidas sob demanda; sem mmap, lê tudo de uma vez
+        if (memory.map_file(data, path, length) ||
+            fs::read_file_data(path, (char*)data, length)) {
             return get<1>(area);
-        } else {
-            return -1;
         }
+
+        memory.deallocate(get<1>(area));
     }
 
     return -1;
@@ -40,7 +43,7 @@ size_t read_binary(Memory &memory, Path &path) {
 
 void write_binary(Memory &memory, size_t pos, Path &path) {
     auto ptr = memory.to_ptr(pos);
-    auto size = memory.get_size(ptr)-sizeof(BinaryMetadata);
+    auto size = ((BinaryMetadata*)ptr)->length;
     auto data_ptr = ptr+sizeof(BinaryMetadata);
 
     fs::set_file_data(path, (const char*)data_ptr, size);
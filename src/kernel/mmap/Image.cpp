@@ -3,6 +3,13 @@
  */
 
 #include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <SDL.h>
 #include <png.h>
@@ -13,6 +20,8 @@
 
 #include <kernel/mmap/Image.hpp>
 
+#include <Specs.hpp>
+
 namespace mmap {
     uint8_t color2index(const SDL_Color color) {
         return (color.r/16+color.g/16+color.b/16)/3;
@@ -29,135 +38,607 @@ namespace mmap {
     // Mapa de paletas para as spritesheets alocadas em memória
     map<size_t, png_bytep> palettes;
 
-    tuple<size_t, int16_t, int16_t> read_image(Memory &memory, Path &path) {
-        if (fs::file_exists(path) && !fs::is_dir(path)) {
-            // Carrega a imagem
-            png_image img;
-            png_bytep img_data;
+    // Imagem decodificada que pode estar em uso por vários processos
+    struct SharedImage {
+        string key;
+        int16_t w, h;
+        // Tamanho e data do arquivo quando foi decodificado
+        size_t size;
+        time_t mtime;
+        // Quantos processos usam essa imagem
+        unsigned int references;
+        // Pode ser encontrada pelo caminho (conteúdo igual ao arquivo)
+        bool cached;
+        uint64_t last_use;
+    };
+
+    // Imagens compartilhadas por posição e posições no cache por caminho
+    map<size_t, SharedImage> shared_images;
+    map<string, size_t> image_cache;
+    uint64_t use_counter = 0;
+
+    static void free_image(Memory &memory, const size_t pos) {
+        auto palette = palettes.find(pos);
+
+        if (palette != palettes.end()) {
+            delete palette->second;
+            palettes.erase(palette);
+        }
+
+        shared_images.erase(pos);
+        memory.deallocate(pos);
+    }
 
-            memset(&img, 0, sizeof(png_image));
-            img.version = PNG_IMAGE_VERSION;
+    // Remove do cache; a área continua viva enquanto tiver referências
+    static void forget_image(const string &key) {
+        auto cached = image_cache.find(key);
 
-            if (!png_image_begin_read_from_file(&img, path.get_path().c_str())) {
-                cout << "Could not load image (header): " << path.get_path() << endl;
-                return {0, 0, 0};
+        if (cached != image_cache.end()) {
+            shared_images.at(cached->second).cached = false;
+            image_cache.erase(cached);
+        }
+    }
+
+    // Libera imagens sem uso, das mais antigas, até caberem no limite
+    static void trim_cache(Memory &memory) {
+        size_t idle_size = 0;
+
+        for (auto it=shared_images.begin(); it != shared_images.end();) {
+            auto &image = it->second;
+            auto pos = it->first;
+
+            it++;
+
+            if (image.references > 0) {
+                continue;
             }
 
-            // A imagem tem uma paleta
-            if (img.format & PNG_FORMAT_FLAG_COLORMAP) {
-                img.format = PNG_FORMAT_RGBA_COLORMAP;
+            if (!image.cached) {
+                free_image(memory, pos);
+            } else {
+                idle_size += image.w*image.h;
+            }
+        }
 
-                png_bytep palette = new uint8_t[PNG_IMAGE_COLORMAP_SIZE(img)];
-                img_data = new uint8_t[PNG_IMAGE_SIZE(img)];
+        while (idle_size > IMAGE_CACHE_IDLE_SIZE) {
+            auto oldest = shared_images.end();
 
-                if (png_image_finish_read(&img, NULL, img_data, 0, palette) == 0) {
-                    cout << "Could not load image: " << path.get_path() << endl;
-                    return {0, 0, 0};
+            for (auto it=shared_images.begin(); it != shared_images.end(); it++) {
+                if (it->second.references == 0 &&
+                    (oldest == shared_images.end() || it->second.last_use < oldest->second.last_use)) {
+                    oldest = it;
                 }
+            }
 
-                // Verifica o tamanho
-                if (img.width > SPRITESHEET_W || img.height > SPRITESHEET_H) {
-                    cout << "spritesheet is too big" << endl;
-                    delete img_data;
-                    delete palette;
-                    png_image_free(&img);
-                    return {0, 0, 0};
-                }
+            idle_size -= oldest->second.w*oldest->second.h;
+
+            image_cache.erase(oldest->second.key);
+            free_image(memory, oldest->first);
+        }
+    }
 
-                auto img_mem = memory.allocate_with_position(img.width*img.height, "Memory Mapped Image");
-                auto img_mem_data = get<0>(img_mem);
-                auto img_mem_pos = get<1>(img_mem);
+    // Decodifica um PNG para índices, sem tocar na memória do console
+    static bool decode_png_pixels(Path &path, DecodedImage &image) {
+        if (!fs::file_exists(path) || fs::is_dir(path)) {
+            return false;
+        }
 
-                // Converte a imagem e escreve array data
-                for (size_t y=0;y<img.height;y++) {
-                    for (size_t x=0;x<img.width;x++) {
-                        auto p = (y*img.width+x);
-                        img_mem_data[p] = img_data[p]%16;
-                    }
-                }
+        // Carrega a imagem
+        png_image img;
+        png_bytep img_data;
 
-                // Grava a paleta para referência se precisar salvar
-                auto stored_palette = new uint8_t[256*4];
-                memcpy(stored_palette, palette, min(256*4, (int)PNG_IMAGE_COLORMAP_SIZE(img)));
-                palettes[img_mem_pos] = stored_palette;
+        memset(&img, 0, sizeof(png_image));
+        img.version = PNG_IMAGE_VERSION;
 
+        if (!png_image_begin_read_from_file(&img, path.get_path().c_str())) {
+            cout << "Could not load image (header): " << path.get_path() << endl;
+            return false;
+        }
+
+        // A imagem tem uma paleta
+        if (img.format & PNG_FORMAT_FLAG_COLORMAP) {
+            img.format = PNG_FORMAT_RGBA_COLORMAP;
+
+            png_bytep palette = new uint8_t[PNG_IMAGE_COLORMAP_SIZE(img)];
+            img_data = new uint8_t[PNG_IMAGE_SIZE(img)];
+
+            if (png_image_finish_read(&img, NULL, img_data, 0, palette) == 0) {
+                cout << "Could not load image: " << path.get_path() << endl;
+                return false;
+            }
+
+            // Verifica o tamanho
+            if (img.width > SPRITESHEET_W || img.height > SPRITESHEET_H) {
+                cout << "spritesheet is too big" << endl;
                 delete img_data;
                 delete palette;
                 png_image_free(&img);
+                return false;
+            }
 
-                return {img_mem_pos, img.width, img.height};
-            } else {
-                img.format = PNG_FORMAT_RGBA;
-
-                img_data = new uint8_t[PNG_IMAGE_SIZE(img)];
+            image.w = img.width;
+            image.h = img.height;
+            image.pixels.resize(img.width*img.height);
 
-                if (png_image_finish_read(&img, NULL, img_data, 0, NULL) == 0) {
-                    cout << "Could not load image: " << path.get_path() << endl;
-                    return {0, 0, 0};
+            // Converte a imagem e escreve array data
+            for (size_t y=0;y<img.height;y++) {
+                for (size_t x=0;x<img.width;x++) {
+                    auto p = (y*img.width+x);
+                    image.pixels[p] = img_data[p]%16;
                 }
+            }
 
-                // Verifica o tamanho
-                if (img.width > SPRITESHEET_W || img.height > SPRITESHEET_H) {
-                    cout << "spritesheet is too big" << endl;
-                    delete img_data;
-                    png_image_free(&img);
-                    return {0, 0, 0};
-                }
+            // Grava a paleta para referência se precisar salvar
+            image.palette.assign(SHEET_PALETTE_SIZE, 0);
+            memcpy(image.palette.data(), palette, min(SHEET_PALETTE_SIZE, (int)PNG_IMAGE_COLORMAP_SIZE(img)));
 
-                auto img_mem = memory.allocate_with_position(img.width*img.height, "Memory Mapped Image");
-                auto img_mem_data = get<0>(img_mem);
-                auto img_mem_pos = get<1>(img_mem);
-
-                // Converte a imagem e escreve array data
-                for (size_t y=0;y<img.height;y++) {
-                    for (size_t x=0;x<img.width;x++) {
-                        auto p = (y*img.width+x)*4;
-                        uint8_t pix = color2index(SDL_Color {
-                                                    img_data[p+0],
-                                                    img_data[p+1],
-                                                    img_data[p+2],
-                                                    img_data[p+3]
-                                                });
-
-                        img_mem_data[y*img.width+x] = pix&0x0F;
-                    }
-                }
+            delete img_data;
+            delete palette;
+            png_image_free(&img);
 
+            return true;
+        } else {
+            img.format = PNG_FORMAT_RGBA;
+
+            img_data = new uint8_t[PNG_IMAGE_SIZE(img)];
+
+            if (png_image_finish_read(&img, NULL, img_data, 0, NULL) == 0) {
+                cout << "Could not load image: " << path.get_path() << endl;
+                return false;
+            }
+
+            // Verifica o tamanho
+            if (img.width > SPRITESHEET_W || img.height > SPRITESHEET_H) {
+                cout << "spritesheet is too big" << endl;
                 delete img_data;
                 png_image_free(&img);
+                return false;
+            }
+
+            image.w = img.width;
+            image.h = img.height;
+            image.pixels.resize(img.width*img.height);
 
-                return {img_mem_pos, img.width, img.height};
+            // Converte a imagem e escreve array data
+            for (size_t y=0;y<img.height;y++) {
+                for (size_t x=0;x<img.width;x++) {
+                    auto p = (y*img.width+x)*4;
+                    uint8_t pix = color2index(SDL_Color {
+                                                img_data[p+0],
+                                                img_data[p+1],
+                                                img_data[p+2],
+                                                img_data[p+3]
+                                            });
+
+                    image.pixels[y*img.width+x] = pix&0x0F;
+                }
             }
+
+            delete img_data;
+            png_image_free(&img);
+
+            return true;
         }
+    }
+
+    // Copia uma imagem decodificada para a memória do console
+    static tuple<size_t, int16_t, int16_t> store_image(Memory &memory, DecodedImage &image, Memory::Trigger trigger) {
+        auto img_mem = memory.allocate_with_position(image.w*image.h, "Memory Mapped Image", trigger);
+        auto img_mem_pos = get<1>(img_mem);
 
-        return {0, 0, 0};
+        memcpy(get<0>(img_mem), image.pixels.data(), image.w*image.h);
+
+        if (!image.palette.empty()) {
+            auto stored_palette = new uint8_t[SHEET_PALETTE_SIZE];
+            memcpy(stored_palette, image.palette.data(), SHEET_PALETTE_SIZE);
+            palettes[img_mem_pos] = stored_palette;
+        }
+
+        return {img_mem_pos, image.w, image.h};
     }
 
-    void write_image(Memory &memory, size_t img_pos, int16_t w, int16_t h, Path &path) {
-        auto *img_ptr = memory.to_ptr(img_pos);
+    static uint8_t* palette_of(const size_t img_pos) {
+        auto palette = palettes.find(img_pos);
 
-        try {
-            auto palette = palettes.at(img_pos);
+        return palette != palettes.end() ? palette->second : nullptr;
+    }
 
-            png_image img;
-            memset(&img, 0, sizeof(png_image));
+    // Escrever direto na área compartilhada a tira do cache
+    static Memory::Trigger cache_trigger(const string &key) {
+        return [key] (Memory::AccessMode mode, size_t, size_t) {
+            if (mode == Memory::ACCESS_WRITE) {
+                forget_image(key);
+            }
+        };
+    }
 
-            img.version = PNG_IMAGE_VERSION;
-            img.width = w;
-            img.height = h;
-            img.colormap_entries = 256;
-            img.format = PNG_FORMAT_RGBA_COLORMAP;
+    // sheet.png -> sheet.nsh, no mesmo diretório
+    static Path native_path(Path &path) {
+        auto name = path.get_path();
+        auto dot = name.find_last_of('.');
+        auto slash = name.find_last_of("/\\");
+
+        if (dot != string::npos && (slash == string::npos || dot > slash)) {
+            name = name.substr(0, dot);
+        }
+
+        return Path(name+"."+SHEET_EXTENSION);
+    }
 
-            png_image_write_to_file(&img, path.get_path().c_str(), 0, img_ptr, 0, palette);
+    // A versão nativa é lida e gerada pela thread principal, pelos workers
+    // do AssetLoader e pelo FileWriter. Quem lê o cabeçalho e os dados
+    // (duas leituras) ou escreve segura o lock do caminho
+    static mutex& native_lock(Path &native) {
+        static mutex locks[IMAGE_SHEET_LOCKS];
 
-            png_image_free(&img);
-        } catch(out_of_range) {
-            png_image img;
-            memset(&img, 0, sizeof(png_image));
+        return locks[hash<string>()(native.get_path())%IMAGE_SHEET_LOCKS];
+    }
+
+    // Lê e valida o cabeçalho (e paleta) de uma sheet nativa. Se `source`
+    // for dado e existir, a sheet só é válida se foi gerada da versão
+    // atual dele.
+    static SheetHeader* read_sheet_header(Path &path, uint8_t *buffer, Path *source) {
+        if (!fs::read_file_data(path, (char*)buffer, sizeof(SheetHeader)+SHEET_PALETTE_SIZE)) {
+            return nullptr;
+        }
+
+        auto *header = (SheetHeader*)buffer;
+
+        if (memcmp(header->magic, "NSHT", 4) != 0 ||
+            header->version != SHEET_VERSION ||
+            (header->bits != 4 && header->bits != 8) ||
+            header->width == 0 || header->width > SPRITESHEET_W ||
+            header->height == 0 || header->height > SPRITESHEET_H) {
+            return nullptr;
+        }
+
+        if (source && fs::file_exists(*source) &&
+            (header->source_size != fs::get_file_size(*source) ||
+             header->source_mtime != fs::get_modification_time(*source))) {
+            return nullptr;
+        }
+
+        // A versão nativa de um PNG é sempre em 8 bits; uma em 4 bits é de
+        // antes disso e é gerada de novo
+        if (source && header->bits != 8) {
+            return nullptr;
+        }
+
+        const size_t pixels = header->width*header->height;
+        const size_t data_size = header->bits == 4 ? (pixels+1)/2 : pixels;
+
+        // Arquivo truncado: mapear além do fim daria SIGBUS
+        if (fs::get_file_size(path) < SHEET_DATA_OFFSET+data_size) {
+            return nullptr;
+        }
+
+        return header;
+    }
+
+    // Lê os índices empacotados em 4 bits
+    static bool read_packed(Path &path, uint8_t *pixels, const size_t count) {
+        const size_t data_size = (count+1)/2;
+        auto packed = new uint8_t[data_size];
+
+        if (!fs::read_file_data(path, (char*)packed, data_size, SHEET_DATA_OFFSET)) {
+            delete[] packed;
+            return false;
+        }
+
+        for (size_t p=0;p<count;p++) {
+            pixels[p] = (packed[p/2] >> ((p%2)*4))&0x0F;
+        }
+
+        delete[] packed;
+
+        return true;
+    }
+
+    // Carrega uma sheet nativa sem decodificar nada
+    static tuple<size_t, int16_t, int16_t> read_sheet(Memory &memory, Path &path, Memory::Trigger trigger, Path *source) {
+        uint8_t buffer[sizeof(SheetHeader)+SHEET_PALETTE_SIZE];
+        auto *header = read_sheet_header(path, buffer, source);
+
+        if (!header) {
+            return {0, 0, 0};
+        }
+
+        const size_t pixels = header->width*header->height;
+        size_t img_mem_pos;
+
+        if (header->bits == 8) {
+            // Índices prontos: mapeia as páginas do arquivo direto
+            const auto page = Memory::page_size();
+            auto img_mem = memory.allocate_aligned(((pixels+page-1)/page)*page, "Memory Mapped Image",
+                                                   page, 0, trigger);
+            auto img_mem_data = get<0>(img_mem);
+            img_mem_pos = get<1>(img_mem);
+
+            if (!memory.map_file(img_mem_data, path, pixels, SHEET_DATA_OFFSET) &&
+                !fs::read_file_data(path, (char*)img_mem_data, pixels, SHEET_DATA_OFFSET)) {
+                memory.deallocate(img_mem_pos);
+                return {0, 0, 0};
+            }
+        } else {
+            auto img_mem = memory.allocate_with_position(pixels, "Memory Mapped Image", trigger);
+            img_mem_pos = get<1>(img_mem);
+
+            if (!read_packed(path, get<0>(img_mem), pixels)) {
+                memory.deallocate(img_mem_pos);
+                return {0, 0, 0};
+            }
+        }
+
+        if (header->has_palette) {
+            auto stored_palette = new uint8_t[SHEET_PALETTE_SIZE];
+            memcpy(stored_palette, buffer+sizeof(SheetHeader), SHEET_PALETTE_SIZE);
+            palettes[img_mem_pos] = stored_palette;
+        }
+
+        return {img_mem_pos, header->width, header->height};
+    }
+
+    // Como read_sheet, mas para um buffer fora da memória do console
+    static bool read_sheet_pixels(Path &path, DecodedImage &image, Path *source) {
+        uint8_t buffer[sizeof(SheetHeader)+SHEET_PALETTE_SIZE];
+        auto *header = read_sheet_header(path, buffer, source);
+
+        if (!header) {
+            return false;
+        }
+
+        image.w = header->width;
+        image.h = header->height;
+        image.pixels.resize(image.w*image.h);
+
+        if (header->bits == 8) {
+            if (!fs::read_file_data(path, (char*)image.pixels.data(), image.pixels.size(), SHEET_DATA_OFFSET)) {
+                return false;
+            }
+        } else if (!read_packed(path, image.pixels.data(), image.pixels.size())) {
+            return false;
+        }
+
+        if (header->has_palette) {
+            image.palette.assign(buffer+sizeof(SheetHeader), buffer+sizeof(SheetHeader)+SHEET_PALETTE_SIZE);
+        } else {
+            image.palette.clear();
+        }
+
+        return true;
+    }
+
+    static bool write_sheet(const uint8_t *pixels, const uint8_t *palette, int16_t w, int16_t h,
+                            Path &path, Path *source) {
+        const size_t count = w*h;
 
-            img.version = PNG_IMAGE_VERSION;
-            img.width = w;
-            img.height = h;
+        // Empacota em 4 bits quando todos os índices cabem, mas só as sheets
+        // salvas pelo usuário: a versão nativa de um PNG fica em 8 bits para
+        // ser mapeada direto na memória
+        const bool packed = !source && all_of(pixels, pixels+count, [] (uint8_t index) {
+            return index < 16;
+        });
+        const size_t data_size = packed ? (count+1)/2 : count;
+
+        vector<uint8_t> file(SHEET_DATA_OFFSET+data_size, 0);
+
+        auto *header = (SheetHeader*)file.data();
+
+        memcpy(header->magic, "NSHT", 4);
+        header->version = SHEET_VERSION;
+        header->bits = packed ? 4 : 8;
+        header->width = w;
+        header->height = h;
+
+        if (source) {
+            header->source_size = fs::get_file_size(*source);
+            header->source_mtime = fs::get_modification_time(*source);
+        }
+
+        if (palette) {
+            header->has_palette = 1;
+            memcpy(file.data()+sizeof(SheetHeader), palette, SHEET_PALETTE_SIZE);
+        }
+
+        auto *data = file.data()+SHEET_DATA_OFFSET;
+
+        if (packed) {
+            for (size_t p=0;p<count;p++) {
+                data[p/2] |= pixels[p] << ((p%2)*4);
+            }
+        } else {
+            memcpy(data, pixels, count);
+        }
+
+        return fs::set_file_data(path, (const char*)file.data(), file.size());
+    }
+
+    static tuple<size_t, int16_t, int16_t> decode_image(Memory &memory, Path &path, Memory::Trigger trigger) {
+        auto native = native_path(path);
+
+        lock_guard<mutex> guard(native_lock(native));
+
+        if (path.get_extension() == SHEET_EXTENSION) {
+            return read_sheet(memory, path, trigger, nullptr);
+        }
+
+        if (fs::file_exists(native)) {
+            auto sheet = read_sheet(memory, native, trigger, &path);
+
+            if (get<0>(sheet) != 0) {
+                return sheet;
+            }
+        }
+
+        DecodedImage image;
+
+        if (!decode_png_pixels(path, image)) {
+            return {0, 0, 0};
+        }
+
+        // Gera a versão nativa para as próximas cargas
+        write_sheet(image.pixels.data(), image.palette.empty() ? nullptr : image.palette.data(),
+                    image.w, image.h, native, &path);
+
+        return store_image(memory, image, trigger);
+    }
+
+    bool decode_image_file(Path &path, DecodedImage &image) {
+        image.size = fs::get_file_size(path);
+        image.mtime = fs::get_modification_time(path);
+
+        auto native = native_path(path);
+
+        lock_guard<mutex> guard(native_lock(native));
+
+        if (path.get_extension() == SHEET_EXTENSION) {
+            return read_sheet_pixels(path, image, nullptr);
+        }
+
+        if (fs::file_exists(native) && read_sheet_pixels(native, image, &path)) {
+            return true;
+        }
+
+        if (!decode_png_pixels(path, image)) {
+            return false;
+        }
+
+        write_sheet(image.pixels.data(), image.palette.empty() ? nullptr : image.palette.data(),
+                    image.w, image.h, native, &path);
+
+        return true;
+    }
+
+    void cache_image(Memory &memory, Path &path, DecodedImage &image) {
+        const auto key = path.get_path();
+
+        auto cached = image_cache.find(key);
+
+        if (cached != image_cache.end()) {
+            auto &shared = shared_images.at(cached->second);
+
+            if (shared.size == image.size && shared.mtime == image.mtime) {
+                return;
+            }
+
+            forget_image(key);
+        }
+
+        auto stored = store_image(memory, image, cache_trigger(key));
+        const auto pos = get<0>(stored);
+
+        // Ninguém usa ainda: fica no cache até alguém carregar
+        shared_images[pos] = SharedImage {
+            key, image.w, image.h, image.size, image.mtime, 0, true, ++use_counter
+        };
+        image_cache[key] = pos;
+
+        trim_cache(memory);
+    }
+
+    tuple<size_t, int16_t, int16_t> read_image(Memory &memory, Path &path) {
+        const auto key = path.get_path();
+        const auto size = fs::get_file_size(path);
+        const auto mtime = fs::get_modification_time(path);
+
+        auto cached = image_cache.find(key);
+
+        if (cached != image_cache.end()) {
+            auto &image = shared_images.at(cached->second);
+
+            if (image.size == size && image.mtime == mtime) {
+                image.references++;
+                image.last_use = ++use_counter;
+
+                return {cached->second, image.w, image.h};
+            }
+
+            // Arquivo mudou no disco
+            forget_image(key);
+        }
+
+        auto decoded = decode_image(memory, path, cache_trigger(key));
+
+        const auto pos = get<0>(decoded);
+
+        if (pos != 0) {
+            shared_images[pos] = SharedImage {
+                key, get<1>(decoded), get<2>(decoded), size, mtime, 1, true, ++use_counter
+            };
+            image_cache[key] = pos;
+        }
+
+        trim_cache(memory);
+
+        return decoded;
+    }
+
+    void release_image(Memory &memory, size_t pos) {
+        auto shared = shared_images.find(pos);
+
+        if (shared == shared_images.end()) {
+            free_image(memory, pos);
+            return;
+        }
+
+        if (shared->second.references > 0) {
+            shared->second.references--;
+        }
+
+        // Sem referências a imagem fica no cache até trim_cache decidir
+        trim_cache(memory);
+    }
+
+    size_t own_image(Memory &memory, size_t pos) {
+        auto shared = shared_images.find(pos);
+
+        if (shared == shared_images.end()) {
+            return pos;
+        }
+
+        auto &image = shared->second;
+
+        // Único dono e fora do cache: a área já é exclusiva
+        if (image.references == 1 && !image.cached) {
+            shared_images.erase(shared);
+            return pos;
+        }
+
+        auto copy = memory.allocate_with_position(image.w*image.h, "Memory Mapped Image");
+        auto copy_pos = get<1>(copy);
+
+        memcpy(get<0>(copy), memory.to_ptr(pos), image.w*image.h);
+
+        auto palette = palettes.find(pos);
+
+        if (palette != palettes.end()) {
+            auto copy_palette = new uint8_t[256*4];
+            memcpy(copy_palette, palette->second, 256*4);
+            palettes[copy_pos] = copy_palette;
+        }
+
+        release_image(memory, pos);
+
+        return copy_pos;
+    }
+
+    // Não usa estado global: pode rodar em outra thread
+    static bool encode_png(const uint8_t *img_ptr, const uint8_t *palette, int16_t w, int16_t h, Path &path) {
+        png_image img;
+        memset(&img, 0, sizeof(png_image));
+
+        img.version = PNG_IMAGE_VERSION;
+        img.width = w;
+        img.height = h;
+
+        int ok;
+
+        if (palette) {
+            img.colormap_entries = 256;
+            img.format = PNG_FORMAT_RGBA_COLORMAP;
+
+            ok = png_image_write_to_file(&img, path.get_path().c_str(), 0, img_ptr, 0, palette);
+        } else {
             img.format = PNG_FORMAT_RGBA;
 
             auto pixels = new uint8_t[w*h*4];
@@ -176,11 +657,67 @@ namespace mmap {
                 }
             }
 
-            png_image_write_to_file(&img, path.get_path().c_str(), 0, img_ptr, 0, nullptr);
+            ok = png_image_write_to_file(&img, path.get_path().c_str(), 0, pixels, 0, nullptr);
 
-            delete pixels;
-            png_image_free(&img);
+            delete[] pixels;
         }
+
+        png_image_free(&img);
+
+        return ok != 0;
+    }
+
+    function<bool(Path&)> image_writer(Memory &memory, size_t img_pos, int16_t w, int16_t h, Path &path) {
+        auto *img_ptr = memory.to_ptr(img_pos);
+        auto *palette_ptr = palette_of(img_pos);
+
+        // Cópias: a imagem pode mudar (ou sumir) antes da escrita
+        auto pixels = make_shared<vector<uint8_t>>(img_ptr, img_ptr+w*h);
+        auto palette = palette_ptr ?
+            make_shared<vector<uint8_t>>(palette_ptr, palette_ptr+SHEET_PALETTE_SIZE) : nullptr;
+
+        const bool is_sheet = path.get_extension() == SHEET_EXTENSION;
+        auto native = native_path(path);
+
+        return [pixels, palette, w, h, is_sheet, native] (Path &target) mutable {
+            auto palette_data = palette ? palette->data() : nullptr;
+
+            if (is_sheet) {
+                return write_sheet(pixels->data(), palette_data, w, h, target, nullptr);
+            }
+
+            // O libpng não manda o arquivo para o storage
+            if (!encode_png(pixels->data(), palette_data, w, h, target) || !fs::sync_file(target)) {
+                return false;
+            }
+
+            lock_guard<mutex> guard(native_lock(native));
+
+            // Mantém a versão nativa em dia com o PNG salvo. O temporário
+            // vira o PNG com o mesmo tamanho e data.
+            write_sheet(pixels->data(), palette_data, w, h, native, &target);
+
+            return true;
+        };
+    }
+
+    void write_image(Memory &memory, size_t img_pos, int16_t w, int16_t h, Path &path) {
+        auto temp = fs::temp_path(path);
+
+        if (image_writer(memory, img_pos, w, h, path)(temp)) {
+            fs::replace_file(temp, path);
+        } else {
+            fs::delete_file(temp);
+        }
+    }
+
+    void reset_images() {
+        cleanup_palettes();
+
+        palettes.clear();
+        shared_images.clear();
+        image_cache.clear();
+        use_counter = 0;
     }
 
     void cleanup_palettes() {
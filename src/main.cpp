@@ -10,11 +10,21 @@ weak_ptr<Kernel> KernelSingleton;
 int main(int argc, char** argv) {
     char option;
 
-    bool fullscreen_startup = false;
+    Options options;
 
-    while ((option = getopt(argc, argv, "f")) > 0) {
+    while ((option = getopt(argc, argv, "fvpiw:t:")) > 0) {
         if (option == 'f') {
-            fullscreen_startup = true;
+            options.fullscreen = true;
+        } else if (option == 'v') {
+            options.vsync = true;
+        } else if (option == 'p') {
+            options.pipelined = true;
+        } else if (option == 'i') {
+            options.isolate_apps = true;
+        } else if (option == 'w') {
+            options.audio_workers = max(atoi(optarg), 0);
+        } else if (option == 't') {
+            options.process_workers = max(atoi(optarg), 0);
         }
     }
 
@@ -23,7 +33,7 @@ int main(int argc, char** argv) {
     cout << "|___|\\___| |___| |__x_/° |__x_/° |_____| \\____\\" << endl;
     cout << "v" << VERSION_STRING << endl;
 
-    auto kernel = make_shared<Kernel>(fullscreen_startup);
+    auto kernel = make_shared<Kernel>(options);
 
     KernelSingleton = kernel;
 